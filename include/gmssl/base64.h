@@ -57,6 +57,18 @@ int  base64_decode_finish(BASE64_CTX *ctx, uint8_t *out, int *outlen);
 int base64_encode_block(unsigned char *t, const unsigned char *f, int dlen);
 int base64_decode_block(unsigned char *t, const unsigned char *f, int n);
 
+/*
+ * Buffer codec. base64_encode() ends every line_len characters (a multiple
+ * of 4, 0 for a single line without newline) with '\n' and does not write a
+ * terminating zero. base64_decode() skips whitespace anywhere in the input,
+ * out needs inlen / 4 * 3 bytes.
+ * Build with BASE64_SSSE3 or BASE64_AVX2 for the vector kernels.
+ */
+size_t base64_encoded_length(size_t inlen, size_t line_len);
+int base64_encode(const uint8_t *in, size_t inlen, size_t line_len,
+    char *out, size_t *outlen);
+int base64_decode(const char *in, size_t inlen, uint8_t *out, size_t *outlen);
+
 
 #ifdef __cplusplus
 }
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <gmssl/sm4.h>
 #include <gmssl/x509.h>
 
 
@@ -141,11 +142,93 @@ int cms_signed_data_sign_to_der(const SM2_KEY *sign_keys, const X509_CERTIFICATE
 int cms_signed_data_verify_from_der(const uint8_t *signed_data, size_t signed_data_len);
 
 
+/*
+SignedData is built in three steps. The content is hashed once with SM3 in
+update, finish signs the digest for every signer through the messageDigest
+signed attribute, so N signers cost one pass over the content plus N
+signatures. cms_signed_data_to_der() then encodes the SignedData with the
+content, or without it (content = NULL) for a detached signature.
+Verification is the same: content in update, SignedData in finish.
+*/
+#define CMS_MAX_SIGNER_INFO_SIZE	1024
+
+typedef struct {
+	SM3_CTX sm3_ctx;
+	int content_type;
+} CMS_SIGNED_DATA_CTX;
+
+int cms_signed_data_sign_init(CMS_SIGNED_DATA_CTX *ctx, int content_type);
+int cms_signed_data_sign_update(CMS_SIGNED_DATA_CTX *ctx, const uint8_t *data, size_t datalen);
+int cms_signed_data_sign_finish(CMS_SIGNED_DATA_CTX *ctx,
+	const SM2_KEY *sign_keys, const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	uint8_t *signer_infos, size_t *signer_infos_len, size_t maxlen);
+int cms_signed_data_verify_init(CMS_SIGNED_DATA_CTX *ctx);
+int cms_signed_data_verify_update(CMS_SIGNED_DATA_CTX *ctx, const uint8_t *data, size_t datalen);
+int cms_signed_data_verify_finish(CMS_SIGNED_DATA_CTX *ctx,
+	const uint8_t *signed_data, size_t signed_data_len);
+
+/*
+Feed a file to a sign or verify context. Regular files are mapped and hashed
+in CMS_FILE_CHUNK_SIZE pieces with MADV_SEQUENTIAL, consumed pieces are
+dropped so memory use does not grow with the file. Other files are read.
+*/
+#define CMS_FILE_CHUNK_SIZE	(4 * 1024 * 1024)
+
+int cms_signed_data_digest_file(CMS_SIGNED_DATA_CTX *ctx, const char *file);
+
 int cms_sign(const SM2_KEY *sign_keys,
 	const X509_CERTIFICATE *sign_certs, size_t sign_count,
 	int content_type, const uint8_t *content, size_t content_len,
 	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
 	uint8_t *content_info, size_t *content_info_len);
+int cms_verify(int *content_type, const uint8_t **content, size_t *content_len,
+	const uint8_t *content_info, size_t content_info_len);
+
+// Detached signatures, eContent is omitted from the SignedData
+int cms_sign_detached(const SM2_KEY *sign_keys,
+	const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	int content_type, const uint8_t *content, size_t content_len,
+	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
+	uint8_t *content_info, size_t *content_info_len);
+int cms_sign_file(const SM2_KEY *sign_keys,
+	const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	int content_type, const char *file,
+	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
+	uint8_t *content_info, size_t *content_info_len);
+int cms_verify_detached(const uint8_t *content, size_t content_len,
+	const uint8_t *content_info, size_t content_info_len);
+int cms_verify_file(const char *file,
+	const uint8_t *content_info, size_t content_info_len);
+
+/*
+EnvelopedData for many recipients. The content key is wrapped with the SM2
+public key of every recipient certificate, in parallel from
+CMS_PARALLEL_MIN_RECIPIENTS recipients on. cms_recipient_infos_encrypt()
+returns the RecipientInfos in a buffer to be freed by the caller, it can be
+given to cms_enveloped_data_encrypt_init() for streaming.
+*/
+#define CMS_MAX_RECIPIENT_THREADS	16
+#define CMS_PARALLEL_MIN_RECIPIENTS	8
+
+int cms_recipient_infos_encrypt(const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+	const uint8_t *key, size_t keylen,
+	uint8_t **rcpt_infos, size_t *rcpt_infos_len);
+int cms_enveloped_data_encrypt_to_der(const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+	int content_type, const uint8_t *content, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	uint8_t **out, size_t *outlen);
+int cms_enveloped_data_decrypt_from_der(const SM2_KEY *sm2_key, const X509_CERTIFICATE *cert,
+	const uint8_t *enveloped_data, size_t enveloped_data_len,
+	int *content_type, uint8_t *content, size_t *content_len);
+int cms_seal(const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+	int content_type, const uint8_t *content, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	uint8_t *out, size_t *outlen);
+int cms_open(const SM2_KEY *sm2_key, const X509_CERTIFICATE *cert,
+	const uint8_t *enveloped_data, size_t enveloped_data_len,
+	int *content_type, uint8_t *content, size_t *content_len);
 
 int cms_encrypt(const uint8_t key[16], const uint8_t *in, size_t inlen,
 	uint8_t *out, size_t *outlen);
@@ -168,6 +251,91 @@ int cms_enced_content_info_from_der(int *content_type,
 	const uint8_t **shared_info2, size_t *shared_info2_len,
 	const uint8_t **in, size_t *inlen);
 
+int cms_encrypted_data_from_der(int *content_type,
+	int *enc_algor, const uint8_t **enc_iv, size_t *enc_iv_len,
+	const uint8_t **enced_content, size_t *enced_content_len,
+	const uint8_t **shared_info1, size_t *shared_info1_len,
+	const uint8_t **shared_info2, size_t *shared_info2_len,
+	const uint8_t **in, size_t *inlen);
+
+
+/*
+Streaming EncryptedData and EnvelopedData with SM4-CBC.
+
+The encoder needs the plaintext length at init: the padded ciphertext length,
+and so every DER length, is known up front. The header is written at once,
+content is encrypted chunk by chunk in update, and finish writes the padding
+block and the optional sharedInfo fields. The decoder accepts the encoding in
+pieces of any size and writes the plaintext as soon as it is known not to be
+the padding block.
+
+Output goes to a CMS_WRITE_FUNC, cms_write_to_file() writes to a FILE *.
+Content is limited to CMS_STREAM_MAX_CONTENT_SIZE by the 4-byte DER lengths.
+The number of recipients is not limited, the decoder parses RecipientInfos
+one at a time, each of them, the rest of the header and the sharedInfo
+trailer are limited to CMS_STREAM_MAX_HEADER_SIZE.
+*/
+typedef int (*CMS_WRITE_FUNC)(void *arg, const uint8_t *data, size_t datalen);
+
+int cms_write_to_file(void *fp, const uint8_t *data, size_t datalen);
+
+#define CMS_STREAM_MAX_CONTENT_SIZE	0xffff0000
+#define CMS_STREAM_MAX_HEADER_SIZE	4096
+
+typedef struct {
+	SM4_KEY sm4_key;
+	uint8_t iv[16];
+	uint8_t block[16];
+	size_t block_nbytes;
+	size_t content_len;
+	size_t content_nbytes;
+	int content_type;
+	int state;
+
+	CMS_WRITE_FUNC write;
+	void *write_arg;
+
+	// decrypting EnvelopedData: recipient's key and certificate
+	const SM2_KEY *sm2_key;
+	const X509_CERTIFICATE *cert;
+
+	// decrypting: header bytes not parsed yet, the key comes from a RecipientInfo
+	size_t header_left;
+	size_t rcpt_infos_left;
+	int have_key;
+
+	// unparsed header element (decrypt) or sharedInfo1/sharedInfo2 trailer
+	uint8_t buf[CMS_STREAM_MAX_HEADER_SIZE];
+	size_t buflen;
+	size_t trailer_len;
+} CMS_STREAM_CTX;
+
+int cms_encrypted_data_encrypt_init(CMS_STREAM_CTX *ctx,
+	const uint8_t key[16], const uint8_t iv[16],
+	int content_type, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	CMS_WRITE_FUNC write, void *write_arg);
+int cms_enveloped_data_encrypt_init(CMS_STREAM_CTX *ctx,
+	const uint8_t key[16], const uint8_t iv[16],
+	const uint8_t *rcpt_infos, size_t rcpt_infos_len,
+	int content_type, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	CMS_WRITE_FUNC write, void *write_arg);
+int cms_stream_encrypt_update(CMS_STREAM_CTX *ctx, const uint8_t *in, size_t inlen);
+int cms_stream_encrypt_finish(CMS_STREAM_CTX *ctx);
+
+int cms_encrypted_data_decrypt_init(CMS_STREAM_CTX *ctx, const uint8_t key[16],
+	CMS_WRITE_FUNC write, void *write_arg);
+int cms_enveloped_data_decrypt_init(CMS_STREAM_CTX *ctx,
+	const SM2_KEY *sm2_key, const X509_CERTIFICATE *cert,
+	CMS_WRITE_FUNC write, void *write_arg);
+int cms_stream_decrypt_update(CMS_STREAM_CTX *ctx, const uint8_t *in, size_t inlen);
+int cms_stream_decrypt_finish(CMS_STREAM_CTX *ctx, int *content_type,
+	const uint8_t **shared_info1, size_t *shared_info1_len,
+	const uint8_t **shared_info2, size_t *shared_info2_len);
+
 
 #ifdef __cplusplus
 }
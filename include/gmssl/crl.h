@@ -1,4 +1,4 @@
-﻿/* 
+﻿/*
  *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
  *
  *   Licensed under the Apache License, Version 2.0 (the "License");
@@ -19,6 +19,11 @@
 #define GMSSL_CRL_H
 
 
+#include <time.h>
+#include <stdint.h>
+#include <gmssl/sm2.h>
+#include <gmssl/x509.h>
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -39,39 +44,58 @@ typedef enum X509_CRLReason {
 	X509_cr_aACompromise,
 } CRL_REASON;
 
+const char *crl_reason_text(int reason);
+
+/*
+CertificateList ::= SEQUENCE {
+	tbsCertList		TBSCertList,
+	signatureAlgorithm	AlgorithmIdentifier,
+	signatureValue		BIT STRING }
+
+TBSCertList ::= SEQUENCE {
+	version			Version OPTIONAL, -- if present, MUST be v2
+	signature		AlgorithmIdentifier,
+	issuer			Name,
+	thisUpdate		Time,
+	nextUpdate		Time OPTIONAL,
+	revokedCertificates	SEQUENCE OF SEQUENCE {
+		userCertificate		CertificateSerialNumber,
+		revocationDate		Time,
+		crlEntryExtensions	Extensions OPTIONAL } OPTIONAL,
+	crlExtensions		[0] EXPLICIT Extensions OPTIONAL }
+
+X509_CRL keeps a copy of the DER and, built in one pass over the revoked
+entries, a hash table of the offsets of their serial numbers, so a lookup is
+O(1) whatever the size of the CRL. Offsets are from der, issuer is the whole
+Name TLV, next_update is 0 if absent. Entry extensions are not decoded.
+
+x509_crl_verify() checks the signature once, x509_crl_is_revoked() returns 1
+if the serial number is listed and 0 if not.
+*/
 typedef struct {
-	uint8_t serial_number[20];
-	size_t serial_number_len;
-	time_t revoke_date;
-	CRL_EXTENSIONS crlEntryExtensions;
-} CRL_REVOKED_CERT;
-
-typedef struct {
-	int version; // OPTIONAL, if present MUST be v2
+	uint8_t *der;
+	size_t der_len;
+	size_t tbs, tbs_len;
+	size_t issuer, issuer_len;
+	size_t sig, sig_len;
 	int signature_algor;
-	X509_NAME issuer;
 	time_t this_update;
 	time_t next_update;
-	uint8_t *revoked_certs;
-	size_t revoked_certs_count;
-	X509_EXTENSION crl_exts[32];
-	size_t crl_exts_count;
-
-	uint8_t buf[1024];
-} CRL_TBS_CERT_LIST;
-
-typedef struct {
-	X509_TBS_CERT_LIST tbs_cert_list;
-	int signature_algor;
-	uint8_t signature[128];
-	size_t signature_len;
-} CRL_CERT_LIST;
-
-
-
-
-
-
+	size_t count;
+	uint32_t *index;
+	size_t index_mask;
+	int verified;
+} X509_CRL;
+
+int x509_crl_from_der(X509_CRL *crl, const uint8_t *der, size_t derlen);
+int x509_crl_verify(X509_CRL *crl, const SM2_KEY *sign_key);
+int x509_crl_is_revoked(const X509_CRL *crl, const uint8_t *serial, size_t serial_len);
+void x509_crl_cleanup(X509_CRL *crl);
+
+int x509_crl_sign_to_der(const SM2_KEY *sign_key, const X509_NAME *issuer,
+	time_t this_update, time_t next_update,
+	const uint8_t *const *serials, const size_t *serials_lens, size_t count, time_t revoke_date,
+	uint8_t **out, size_t *outlen);
 
 
 #ifdef  __cplusplus
@@ -32,6 +32,19 @@ extern "C" {
 int pem_read(FILE *fp, const char *name, uint8_t *data, size_t *datalen);
 int pem_write(FILE *fp, const char *name, const uint8_t *data, size_t datalen);
 
+/*
+Buffer based PEM. pem_encode() writes 64 character lines, out = NULL gives the
+length. pem_decode() decodes the next "-----BEGIN name-----" block of *in,
+text before it is skipped, and moves *in past its END line. It returns 0 when
+there is no further block. Any line length and CRLF line ends are accepted.
+pem_map_file() maps a whole file for pem_decode().
+*/
+int pem_encode(const char *name, const uint8_t *data, size_t datalen, char *out, size_t *outlen);
+int pem_decode(const char *name, uint8_t *data, size_t *datalen, size_t maxlen,
+	const char **in, size_t *inlen);
+int pem_map_file(const char *file, const char **data, size_t *datalen);
+void pem_unmap_file(const char *data, size_t datalen);
+
 
 
 #ifdef __cplusplus
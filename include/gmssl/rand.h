@@ -22,7 +22,18 @@
 #include <stdlib.h>
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+rand_bytes() is served by a per-thread DRBG, the SM3 Hash_DRBG or the SM4
+CTR_DRBG with the RAND_SM4_CTR_DRBG build option. It is safe to call from any
+thread and after fork(). rand_seed_bytes() reads the OS entropy source
+(getrandom() or /dev/urandom) directly, it is for seeding.
+*/
 int rand_bytes(uint8_t *buf, size_t len);
+int rand_seed_bytes(uint8_t *buf, size_t len);
 
 
 #ifdef __cplusplus
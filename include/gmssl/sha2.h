@@ -64,6 +64,8 @@ void sha256_update(SHA256_CTX *ctx, const unsigned char* data, size_t datalen);
 void sha256_finish(SHA256_CTX *ctx, unsigned char dgst[SHA256_DIGEST_SIZE]);
 void sha256_digest(const unsigned char *data, size_t datalen,
 	unsigned char dgst[SHA256_DIGEST_SIZE]);
+void sha256_compress_blocks(uint32_t state[SHA256_STATE_WORDS],
+	const unsigned char *data, size_t blocks);
 
 
 #define SHA384_DIGEST_SIZE	48
@@ -133,6 +133,11 @@ typedef struct {
 	uint8_t ciphertext[1];
 } SM2_CIPHERTEXT;
 
+/*
+sm2_encrypt(), sm2_decrypt() and the DER ciphertext are limited to
+SM2_MAX_PLAINTEXT_SIZE bytes, larger messages use sm2_encrypt_init() and
+sm2_decrypt_init(). sm2_do_decrypt() writes `ciphertext_size` bytes to `out`.
+*/
 #define SM2_MAX_PLAINTEXT	256
 #define SM2_MAX_PLAINTEXT_SIZE	256
 
@@ -142,6 +147,21 @@ typedef struct {
 
 
 
+/* incremental KDF keystream, sm2_kdf_next() continues where the last call stopped */
+typedef struct {
+	SM3_CTX sm3_ctx;
+	uint32_t counter;
+	uint8_t keystream[SM3_LANES * SM3_DIGEST_SIZE];
+	size_t keystream_len;
+	size_t keystream_pos;
+} SM2_KDF_CTX;
+
+void sm2_kdf_init(SM2_KDF_CTX *ctx, const uint8_t *in, size_t inlen);
+void sm2_kdf_next(SM2_KDF_CTX *ctx, size_t outlen, uint8_t *out);
+
+/* KDF of GB/T 32918.4, hashes the full blocks of `in` once for all the counters */
+int sm2_kdf(const uint8_t *in, size_t inlen, size_t outlen, uint8_t *out);
+
 int sm2_ciphertext_to_der(const SM2_CIPHERTEXT *c, uint8_t **out, size_t *outlen);
 int sm2_ciphertext_from_der(SM2_CIPHERTEXT *c, const uint8_t **in, size_t *inlen);
 int sm2_ciphertext_print(FILE *fp, const SM2_CIPHERTEXT *c, int format, int indent);
@@ -152,6 +172,38 @@ int sm2_encrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *ou
 int sm2_decrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
 int sm2_print_ciphertext(FILE *fp, const uint8_t *c, size_t clen, int format, int indent);
 
+/*
+Streaming encryption of the raw ciphertext C1 || C3 || C2 or C1 || C2 || C3,
+C1 = 04 || x1 || y1. sm2_encrypt_init() outputs C1, followed by a zeroed
+placeholder for C3 with SM2_C1C3C2, sm2_encrypt_update() outputs C2 and
+sm2_encrypt_finish() outputs C3, to be appended or written over the placeholder.
+sm2_decrypt_update() outputs the plaintext before C3 is checked, it must not be
+used before sm2_decrypt_finish() returns 1.
+*/
+#define SM2_C1C3C2		0
+#define SM2_C1C2C3		1
+
+#define SM2_C1_SIZE		65
+#define SM2_C3_SIZE		SM3_DIGEST_SIZE
+
+typedef struct {
+	SM2_KEY key;
+	int format;
+	int state;
+	SM2_KDF_CTX kdf_ctx;
+	SM3_CTX sm3_ctx;
+	uint8_t y2[32];
+	uint8_t buf[SM2_C1_SIZE + SM2_C3_SIZE];
+	size_t buflen;
+} SM2_ENC_CTX;
+
+int sm2_encrypt_init(SM2_ENC_CTX *ctx, const SM2_KEY *key, int format, uint8_t *out, size_t *outlen);
+int sm2_encrypt_update(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
+int sm2_encrypt_finish(SM2_ENC_CTX *ctx, uint8_t *out, size_t *outlen);
+int sm2_decrypt_init(SM2_ENC_CTX *ctx, const SM2_KEY *key, int format);
+int sm2_decrypt_update(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
+int sm2_decrypt_finish(SM2_ENC_CTX *ctx);
+
 int sm2_ecdh(const SM2_KEY *key, const SM2_POINT *peer_public, SM2_POINT *out);
 
 
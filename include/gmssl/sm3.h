@@ -45,13 +45,38 @@ void sm3_update(SM3_CTX *ctx, const uint8_t *data, size_t datalen);
 void sm3_finish(SM3_CTX *ctx, uint8_t dgst[SM3_DIGEST_SIZE]);
 void sm3_digest(const uint8_t *data, size_t datalen, uint8_t dgst[SM3_DIGEST_SIZE]);
 
+/* compression function, sm3_compress_blocks_x4() compresses one block of each lane */
+#define SM3_LANES		4
+
+void sm3_compress_blocks(uint32_t digest[SM3_STATE_WORDS], const uint8_t *data, size_t blocks);
+void sm3_compress_blocks_x4(uint32_t digest[SM3_LANES][SM3_STATE_WORDS], const uint8_t *const data[SM3_LANES]);
+
+
+/*
+SM3_HMAC_KEY holds the SM3 states after the (key ^ ipad) and (key ^ opad)
+blocks, so a MAC under a prepared key only compresses the message blocks
+and one outer block. sm3_hmac_multi() computes the MACs of n messages under
+the same key, SM3_LANES messages at a time.
+*/
+typedef struct {
+	uint32_t ipad_digest[SM3_STATE_WORDS];
+	uint32_t opad_digest[SM3_STATE_WORDS];
+} SM3_HMAC_KEY;
+
+void sm3_hmac_key_init(SM3_HMAC_KEY *hmac_key, const uint8_t *key, size_t keylen);
+void sm3_hmac_key_cleanup(SM3_HMAC_KEY *hmac_key);
+void sm3_hmac_multi(const SM3_HMAC_KEY *hmac_key,
+	const uint8_t *const *data, const size_t *datalen, size_t n,
+	uint8_t (*mac)[SM3_HMAC_SIZE]);
+
 
 typedef struct {
 	SM3_CTX sm3_ctx;
-	unsigned char key[SM3_BLOCK_SIZE];
+	uint32_t opad_digest[SM3_STATE_WORDS];
 } SM3_HMAC_CTX;
 
 void sm3_hmac_init(SM3_HMAC_CTX *ctx, const uint8_t *key, size_t keylen);
+void sm3_hmac_init_with_key(SM3_HMAC_CTX *ctx, const SM3_HMAC_KEY *hmac_key);
 void sm3_hmac_update(SM3_HMAC_CTX *ctx, const uint8_t *data, size_t datalen);
 void sm3_hmac_finish(SM3_HMAC_CTX *ctx, uint8_t mac[SM3_HMAC_SIZE]);
 void sm3_hmac(const uint8_t *key, size_t keylen,
@@ -59,6 +84,41 @@ void sm3_hmac(const uint8_t *key, size_t keylen,
 	uint8_t mac[SM3_HMAC_SIZE]);
 
 
+/*
+Tree mode SM3, for hashing large inputs on several cores. The input is split
+into leaf_size chunks (the last one may be shorter, an empty input is one
+empty leaf) and the chunk hashes are combined into the RFC 6962 Merkle tree,
+where the left subtree of a node holds the largest power of two of leaves:
+
+	leaf = SM3(0x00 || chunk)
+	node = SM3(0x01 || left || right)
+	dgst = SM3(0x02 || uint64(leaf_size) || uint64(total_length) || root)
+
+Integers are big-endian. The digest depends on leaf_size, so it must be
+recorded with the digest, it does not depend on num_threads. With
+num_threads > 1 the context owns a pool of worker threads that hash the
+whole leaves of large sm3_tree_update() inputs in parallel.
+*/
+#define SM3_TREE_DEFAULT_LEAF_SIZE	(1024 * 1024)
+#define SM3_TREE_MAX_DEPTH		64
+
+typedef struct {
+	size_t leaf_size;
+	uint64_t nbytes;
+	uint64_t nleaves;
+	SM3_CTX leaf_ctx;
+	size_t leaf_len;
+	uint8_t stack[SM3_TREE_MAX_DEPTH][SM3_DIGEST_SIZE];
+	size_t stack_len;
+	void *pool;
+} SM3_TREE_CTX;
+
+int sm3_tree_init(SM3_TREE_CTX *ctx, size_t leaf_size, int num_threads);
+int sm3_tree_update(SM3_TREE_CTX *ctx, const uint8_t *data, size_t datalen);
+int sm3_tree_finish(SM3_TREE_CTX *ctx, uint8_t dgst[SM3_DIGEST_SIZE]);
+void sm3_tree_cleanup(SM3_TREE_CTX *ctx);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -60,6 +60,10 @@ int sm4_cbc_padding_decrypt(const SM4_KEY *key, const uint8_t iv[16],
 void sm4_ctr_encrypt(const SM4_KEY *key, uint8_t ctr[16],
 	const uint8_t *in, size_t inlen, uint8_t *out);
 
+/* only the low 32 bits of iv are incremented, caller make sure they do not wrap */
+void sm4_ctr32_encrypt_blocks(const unsigned char *in, unsigned char *out,
+	size_t blocks, const SM4_KEY *key, const unsigned char iv[16]);
+
 int sm4_gcm_encrypt(const SM4_KEY *key, const uint8_t *iv, size_t ivlen,
 	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
 	uint8_t *out, const size_t taglen, uint8_t *tag);
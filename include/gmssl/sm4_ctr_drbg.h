@@ -0,0 +1,67 @@
+﻿/* 
+ *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* NIST SP800-90A Rev.1 "Recommendation for Random Number Generation
+ * Using Deterministic Random Bit Generators", 10.2.1 CTR_DRBG with SM4 and
+ * the Block_Cipher_df derivation function */
+
+#ifndef GMSSL_SM4_CTR_DRBG_H
+#define GMSSL_SM4_CTR_DRBG_H
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <gmssl/sm4.h>
+
+
+/* keylen = outlen = 128, seedlen = keylen + outlen, table 3 of nist sp 800-90a rev.1 */
+#define SM4_CTR_DRBG_SEED_SIZE		(SM4_KEY_SIZE + SM4_BLOCK_SIZE)
+#define SM4_CTR_DRBG_RESEED_INTERVAL	((uint64_t)1 << 48)
+#define SM4_CTR_DRBG_MAX_REQUEST_SIZE	(1 << 16) /* 2^19 bits */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct {
+	SM4_KEY key;
+	uint8_t V[SM4_BLOCK_SIZE];
+	uint64_t reseed_counter;
+} SM4_CTR_DRBG;
+
+
+int sm4_ctr_drbg_init(SM4_CTR_DRBG *drbg,
+	const uint8_t *entropy, size_t entropy_len,
+	const uint8_t *nonce, size_t nonce_len,
+	const uint8_t *personalstr, size_t personalstr_len);
+
+int sm4_ctr_drbg_reseed(SM4_CTR_DRBG *drbg,
+	const uint8_t *entropy, size_t entropy_len,
+	const uint8_t *additional, size_t additional_len);
+
+/* outlen <= SM4_CTR_DRBG_MAX_REQUEST_SIZE, returns 0 when a reseed is required */
+int sm4_ctr_drbg_generate(SM4_CTR_DRBG *drbg,
+	const uint8_t *additional, size_t additional_len,
+	size_t outlen, uint8_t *out);
+
+void sm4_ctr_drbg_cleanup(SM4_CTR_DRBG *drbg);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
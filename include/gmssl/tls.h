@@ -25,6 +25,7 @@
 #include <gmssl/sm4.h>
 #include <gmssl/digest.h>
 #include <gmssl/block_cipher.h>
+#include <gmssl/x509_store.h>
 
 
 #ifdef __cplusplus
@@ -332,7 +333,31 @@ typedef enum {
 #define TLS_MAX_CERTIFICATES_SIZE	2048
 #define TLS_MAX_SERVER_CERTS_SIZE	2048
 
-#define TLS_MAX_HANDSHAKES_SIZE		4096
+
+/*
+Handshake transcript: a running SM3 state for the Finished messages, plus a
+running SM2 signing state, i.e. SM3(Z || handshakes), for CertificateVerify.
+The Z value depends on the peer's public key, so when the key is not yet known
+(server requesting client auth) the messages are buffered on the heap until
+tls_transcript_set_sm2_key() is called, then the buffer is released.
+*/
+typedef struct {
+	SM3_CTX sm3_ctx;
+	SM2_SIGN_CTX sign_ctx;
+	int sign_ctx_inited;
+	int buffering;
+	uint8_t *buf;
+	size_t buflen;
+	size_t bufsize;
+} TLS_TRANSCRIPT;
+
+int tls_transcript_init(TLS_TRANSCRIPT *ts, int buffer_for_signature);
+int tls_transcript_update(TLS_TRANSCRIPT *ts, const uint8_t *data, size_t datalen);
+int tls_transcript_set_sm2_key(TLS_TRANSCRIPT *ts, const SM2_KEY *key);
+int tls_transcript_digest(const TLS_TRANSCRIPT *ts, uint8_t dgst[32]);
+int tls_transcript_sign(const TLS_TRANSCRIPT *ts, uint8_t *sig, size_t *siglen);
+int tls_transcript_verify(const TLS_TRANSCRIPT *ts, const uint8_t *sig, size_t siglen);
+void tls_transcript_cleanup(TLS_TRANSCRIPT *ts);
 
 
 // 应该保留对方的证书
@@ -353,43 +378,78 @@ typedef struct {
 } TLS_SESSION;
 
 
+/*
+State only needed while the handshake is running. Allocated by
+tls_handshake_init() and wiped and freed when the handshake completes.
+*/
 typedef struct {
-	int sock;
-	int is_client;
-	int version;
-	int cipher_suite;
-	uint8_t session_id[32];
-	size_t session_id_len;
 	uint8_t master_secret[48];
 	uint8_t key_block[96];
-	int do_trace;
 
 	uint8_t server_certs[TLS_MAX_CERTIFICATES_SIZE];
 	size_t server_certs_len;
 
 	uint8_t client_certs[TLS_MAX_CERTIFICATES_SIZE];
 	size_t client_certs_len;
-
-	SM3_HMAC_CTX client_write_mac_ctx;
-	SM3_HMAC_CTX server_write_mac_ctx;
-	SM4_KEY client_write_enc_key;
-	SM4_KEY server_write_enc_key;
+} TLS_HANDSHAKE;
+
+/*
+An established connection keeps only the negotiated record protection state.
+TLCP and TLS 1.2 use the SM3-HMAC/SM4-CBC keys, TLS 1.3 uses the AEAD keys,
+so the two sets share storage. The record buffer is acquired with
+tls_record_buffer_acquire() only while record I/O is in progress.
+*/
+typedef struct {
+	int sock;
+	int is_client;
+	int version;
+	int cipher_suite;
+	uint8_t session_id[32];
+	size_t session_id_len;
+	int do_trace;
+	X509_STORE *ca_store; // if set, used instead of the ca_certs_fp of the connect functions
+
+	union {
+		struct {
+			SM3_HMAC_CTX client_write_mac_ctx;
+			SM3_HMAC_CTX server_write_mac_ctx;
+			SM4_KEY client_write_enc_key;
+			SM4_KEY server_write_enc_key;
+		};
+		struct {
+			BLOCK_CIPHER_KEY client_write_key;
+			BLOCK_CIPHER_KEY server_write_key;
+			uint8_t client_write_iv[12];
+			uint8_t server_write_iv[12];
+		};
+	};
 	uint8_t client_seq_num[8];
 	uint8_t server_seq_num[8];
 
-	uint8_t record[TLS_MAX_RECORD_SIZE];
-	uint8_t handshakes[TLS_MAX_HANDSHAKES_SIZE];
-	size_t handshakes_len;
-
-	uint8_t client_write_iv[12];
-	uint8_t server_write_iv[12];
+	uint8_t *record;
+	TLS_HANDSHAKE *hs;
 
+	// decrypted application data not yet returned by tls_read()
+	uint8_t *databuf;
+	const uint8_t *data;
+	size_t datalen;
+} TLS_CONNECT;
 
+/*
+Record buffers of TLS_MAX_RECORD_SIZE bytes from a per-thread pool. Connections
+only hold a buffer during the handshake or a single send/recv, so idle
+connections cost no buffer memory. Call tls_record_buffer_pool_cleanup() before
+a thread exits to free its cached buffers.
+*/
+#define TLS_RECORD_POOL_SIZE	8
 
-	BLOCK_CIPHER_KEY client_write_key;
-	BLOCK_CIPHER_KEY server_write_key;
+uint8_t *tls_record_buffer_acquire(void);
+void tls_record_buffer_release(uint8_t *record);
+void tls_record_buffer_pool_cleanup(void);
 
-} TLS_CONNECT;
+int tls_handshake_init(TLS_CONNECT *conn);
+void tls_handshake_cleanup(TLS_CONNECT *conn);
+void tls_cleanup(TLS_CONNECT *conn); // frees handshake state left by a failed connect/accept
 
 
 
@@ -416,12 +476,22 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 
 int tlcp_accept(TLS_CONNECT *conn, int port,
 	FILE *server_certs_fp, const SM2_KEY *server_sign_key, const SM2_KEY *server_enc_key,
-	FILE *client_cacerts_fp, uint8_t *client_cert_verify_buf, size_t client_cert_verify_buflen);
+	FILE *client_cacerts_fp);
 
 
 int tls_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen);
 int tls_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen);
 
+/*
+Stream style application data I/O for TLCP, TLS 1.2 and TLS 1.3 connections.
+tls_read() returns at most `size` bytes, reading a new record only when no
+decrypted data is pending, and keeps the rest of the record for later calls.
+tls_write() splits `datalen` bytes into as many records as needed.
+*/
+int tls_read(TLS_CONNECT *conn, uint8_t *buf, size_t size, size_t *readlen);
+int tls_write(TLS_CONNECT *conn, const uint8_t *data, size_t datalen);
+size_t tls_pending(const TLS_CONNECT *conn);
+
 
 
 int tls_seq_num_incr(uint8_t seq_num[8]);
@@ -462,6 +532,25 @@ int tls_record_send(const uint8_t *record, size_t recordlen, int sock);
 int tls_record_recv(uint8_t *record, size_t *recordlen, int sock);
 
 
+/*
+Handshake flight: records of one flight (e.g. ServerHello .. ServerHelloDone)
+are queued and written to the socket with a single send(). The receiver still
+sees one handshake message per record. If a record does not fit the remaining
+buffer, the queued records are flushed first.
+*/
+#define TLS_MAX_FLIGHT_SIZE		(TLS_MAX_RECORD_SIZE + 4096)
+
+typedef struct {
+	uint8_t buf[TLS_MAX_FLIGHT_SIZE];
+	size_t buflen;
+	int sock;
+} TLS_FLIGHT;
+
+int tls_flight_init(TLS_FLIGHT *flight, int sock);
+int tls_flight_add_record(TLS_FLIGHT *flight, const uint8_t *record, size_t recordlen);
+int tls_flight_flush(TLS_FLIGHT *flight);
+
+
 int tls_random_generate(uint8_t random[32]);
 int tls_random_print(FILE *fp, const uint8_t random[32], int format, int indent);
 int tls_pre_master_secret_generate(uint8_t pre_master_secret[48], int version);
@@ -514,6 +603,9 @@ int tls_certificate_get_public_keys(const uint8_t *certs, size_t certslen, SM2_K
 int tls_certificate_print(FILE *fp, const uint8_t *certs, size_t certslen, int format, int indent);
 
 int tls_certificate_chain_verify(const uint8_t *certs, size_t certslen, FILE *ca_certs_fp, int depth);
+int tls_certificate_chain_verify_ex(const uint8_t *certs, size_t certslen,
+	X509_STORE *ca_store, FILE *ca_certs_fp, int depth);
+int tls_certificate_chain_not_after(const uint8_t *certs, size_t certslen, time_t *not_after);
 
 int tls_certificate_get_first(const uint8_t *data, size_t datalen, const uint8_t **cert, size_t *certlen);
 int tls_certificate_get_second(const uint8_t *data, size_t datalen, const uint8_t **cert, size_t *certlen);
@@ -630,7 +722,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 
 int tls12_accept(TLS_CONNECT *conn, int port,
 	FILE *certs_fp, const SM2_KEY *server_sign_key,
-	FILE *client_cacerts_fp, uint8_t *handshakes_buf, size_t handshakes_buflen);
+	FILE *client_cacerts_fp);
 
 
 
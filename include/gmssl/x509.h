@@ -46,6 +46,10 @@ enum X509_Version {
 	X509_version_v3 = 2,
 };
 
+const char *x509_version_name(int version);
+int x509_version_to_der(int version, uint8_t **out, size_t *outlen);
+int x509_version_from_der(int *version, const uint8_t **in, size_t *inlen);
+
 int x509_time_to_der(time_t a, uint8_t **out, size_t *outlen);
 int x509_time_from_der(time_t *a, const uint8_t **in, size_t *inlen);
 
@@ -299,6 +303,41 @@ int x509_certificate_from_pem_by_name(X509_CERTIFICATE *cert, FILE *certs_fp, co
 
 int x509_certificate_verify_by_certificate(const X509_CERTIFICATE *cert, const X509_CERTIFICATE *cacert);
 
+/*
+X509_CERT_VIEW records where the fields of a DER Certificate are, nothing is
+copied and the DER must outlive the view. Offsets are from der, names,
+validity and SubjectPublicKeyInfo are whole TLVs, exts is the content of the
+Extensions SEQUENCE (len 0 if absent), sig is the signature value.
+Fields are decoded only when asked for.
+*/
+typedef struct {
+	const uint8_t *der;
+	uint32_t der_len;
+	uint32_t tbs, tbs_len;
+	uint32_t serial, serial_len;
+	uint32_t issuer, issuer_len;
+	uint32_t validity, validity_len;
+	uint32_t subject, subject_len;
+	uint32_t spki, spki_len;
+	uint32_t exts, exts_len;
+	uint32_t sig, sig_len;
+	int version;
+	int signature_algor;
+} X509_CERT_VIEW;
+
+int x509_cert_view_from_der(X509_CERT_VIEW *view, const uint8_t **in, size_t *inlen);
+int x509_cert_view_get_serial_number(const X509_CERT_VIEW *view, const uint8_t **serial_number, size_t *serial_number_len);
+int x509_cert_view_get_issuer(const X509_CERT_VIEW *view, X509_NAME *issuer);
+int x509_cert_view_get_subject(const X509_CERT_VIEW *view, X509_NAME *subject);
+int x509_cert_view_get_validity(const X509_CERT_VIEW *view, X509_VALIDITY *validity);
+int x509_cert_view_get_public_key(const X509_CERT_VIEW *view, SM2_KEY *sm2_key);
+int x509_cert_view_get_extension_from_oid(const X509_CERT_VIEW *view, int oid,
+	int *is_critical, const uint8_t **data, size_t *datalen);
+int x509_cert_view_issuer_equ_subject(const X509_CERT_VIEW *cert, const X509_CERT_VIEW *cacert);
+int x509_cert_view_verify_sm2(const X509_CERT_VIEW *view, const SM2_KEY *sm2_key);
+int x509_cert_view_verify_by_cert_view(const X509_CERT_VIEW *cert, const X509_CERT_VIEW *cacert);
+int x509_certificate_verify_sm2_from_der(const uint8_t *cert, size_t certlen, const SM2_KEY *sm2_key);
+
 
 
 
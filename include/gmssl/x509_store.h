@@ -0,0 +1,112 @@
+﻿/*
+ *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+
+#ifndef GMSSL_X509_STORE_H
+#define GMSSL_X509_STORE_H
+
+
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <gmssl/sm2.h>
+#include <gmssl/x509.h>
+#include <gmssl/crl.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+X509_STORE holds trusted CA certificates, parsed once when loaded and indexed
+by the DER of the subject name and by the SubjectKeyIdentifier. Names are
+matched by their DER encoding.
+
+Lookups take a read lock and may run from any number of threads. Loading
+builds a new index without the lock, then swaps it in under the write lock,
+so a reload is atomic for readers. Each load replaces the previous content.
+
+x509_store_verify() finds the issuer of cert by its AuthorityKeyIdentifier,
+or by its issuer name, and checks the signature. It returns 1 if one of the
+matching CA certificates verifies cert, 0 if no CA certificate matches and
+-1 otherwise, a revoked cert is an error.
+*/
+typedef struct {
+	pthread_rwlock_t lock;
+	void *table;
+	pthread_mutex_t cache_lock;
+	void *cache;
+	size_t cache_mask;
+	uint64_t generation;
+	X509_CRL **crls;
+	size_t crls_count;
+} X509_STORE;
+
+int x509_store_init(X509_STORE *store);
+int x509_store_load_pem(X509_STORE *store, const char *pem, size_t pemlen);
+int x509_store_load_pem_file(X509_STORE *store, const char *file);
+size_t x509_store_count(X509_STORE *store);
+int x509_store_find_by_subject(X509_STORE *store, const uint8_t *name, size_t namelen,
+	uint8_t *cert, size_t *certlen, size_t maxlen);
+int x509_store_find_by_key_id(X509_STORE *store, const uint8_t *key_id, size_t key_id_len,
+	uint8_t *cert, size_t *certlen, size_t maxlen);
+int x509_store_verify(X509_STORE *store, const X509_CERT_VIEW *cert);
+void x509_store_cleanup(X509_STORE *store);
+
+/*
+CRLs are verified once, when added, outside of the write lock.
+x509_store_add_crl() accepts a CRL signed by a CA certificate of the store.
+x509_store_add_crl_by_issuer() accepts a CRL of an intermediate CA, given its
+certificate issuer_cert, which must itself be verified by a CA of the store.
+A CRL replaces an older one from the same issuer and flushes the chain cache.
+x509_store_is_revoked() returns 1 if a CRL of the issuer lists the serial
+number and 0 otherwise, including when there is no CRL of the issuer.
+x509_store_load_crl_file() only loads CRLs of CAs of the store.
+*/
+int x509_store_add_crl(X509_STORE *store, const uint8_t *der, size_t derlen);
+int x509_store_add_crl_by_issuer(X509_STORE *store, const uint8_t *der, size_t derlen,
+	const X509_CERT_VIEW *issuer_cert);
+int x509_store_load_crl_file(X509_STORE *store, const char *file);
+int x509_store_is_revoked(X509_STORE *store, const uint8_t *issuer, size_t issuer_len,
+	const uint8_t *serial, size_t serial_len);
+int x509_store_cert_is_revoked(X509_STORE *store, const X509_CERT_VIEW *cert);
+
+/*
+Verified chain cache, disabled unless x509_store_enable_chain_cache() is
+called before the store is shared between threads. A chain is keyed by SM3 of its encoding (leaf || intermediates).
+
+x509_store_chain_cache_lookup() returns 1 if the chain was verified against
+the current store content and has not expired, else 0. It outputs the digest
+and the store generation to be given to x509_store_chain_cache_add() once the
+chain is verified, not_after is the earliest notAfter of the chain. A result
+computed while the store was reloaded or flushed is not cached.
+x509_store_chain_cache_flush() drops every cached result, call it whenever
+revocation state changes. Loading the store flushes the cache.
+*/
+#define X509_CHAIN_CACHE_WAYS	4
+
+int x509_store_enable_chain_cache(X509_STORE *store, size_t max_entries);
+int x509_store_chain_cache_lookup(X509_STORE *store, const uint8_t *chain, size_t chainlen,
+	time_t now, uint8_t dgst[32], uint64_t *generation);
+int x509_store_chain_cache_add(X509_STORE *store, const uint8_t dgst[32], uint64_t generation, time_t not_after);
+void x509_store_chain_cache_flush(X509_STORE *store);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
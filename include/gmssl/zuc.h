@@ -46,6 +46,8 @@ typedef struct ZUC_KEY_st {
 
 void zuc_set_key(ZUC_KEY *key, const uint8_t user_key[16], const uint8_t iv[16]);
 void zuc_generate_keystream(ZUC_KEY *key, size_t nwords, ZUC_UINT32 *words);
+/* out = in ^ keystream, or the keystream if `in` is NULL, `in` may equal `out` */
+void zuc_generate_keystream_xor(ZUC_KEY *key, size_t nwords, const ZUC_UINT32 *in, ZUC_UINT32 *out);
 ZUC_UINT32 zuc_generate_keyword(ZUC_KEY *key);
 
 
@@ -83,6 +85,7 @@ typedef ZUC_KEY ZUC256_KEY;
 
 void zuc256_set_key(ZUC256_KEY *key, const uint8_t user_key[32], const uint8_t iv[23]);
 #define zuc256_generate_keystream(k,n,out)	zuc_generate_keystream(k,n,out)
+#define zuc256_generate_keystream_xor(k,n,in,out)	zuc_generate_keystream_xor(k,n,in,out)
 #define zuc256_generate_keyword(k)		zuc_generate_keyword(k)
 
 
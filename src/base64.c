@@ -375,3 +375,305 @@ int base64_decode_finish(BASE64_CTX *ctx, uint8_t *out, int *outl)
     } else
         return (1);
 }
+
+/*-
+ * Buffer codec.
+ *
+ * The decoder works on whole quads: runs of 16 (SSSE3) or 32 (AVX2)
+ * base64 characters are translated and validated in one step, the rest
+ * goes through a 256 entry table four characters at a time. Whitespace
+ * is skipped wherever it is, so any line length and CRLF are accepted.
+ */
+
+#define B64_DEC_WS      0x40
+#define B64_DEC_PAD     0x41
+#define B64_DEC_ERR     0x80
+
+static const uint8_t data_ascii2dec[256] = {
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x40, 0x40, 0x80, 0x80, 0x40, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x40, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x3E, 0x80, 0x80, 0x80, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B,
+    0x3C, 0x3D, 0x80, 0x80, 0x80, 0x41, 0x80, 0x80,
+    0x80, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30,
+    0x31, 0x32, 0x33, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+};
+
+#if defined(BASE64_SSSE3) || defined(BASE64_AVX2)
+# include <immintrin.h>
+
+/* 12 bytes to 16 characters */
+static void base64_encode16_ssse3(const uint8_t *in, char *out)
+{
+    const __m128i shift_lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    uint8_t buf[16];
+    __m128i x, t0, t1, t2, t3, r, less;
+
+    memcpy(buf, in, 12);
+    x = _mm_loadu_si128((const __m128i *)buf);
+    x = _mm_shuffle_epi8(x, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm_and_si128(x, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(x, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    x = _mm_or_si128(t1, t3);
+
+    r = _mm_subs_epu8(x, _mm_set1_epi8(51));
+    less = _mm_cmpgt_epi8(_mm_set1_epi8(26), x);
+    r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+    r = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, r), x);
+    _mm_storeu_si128((__m128i *)out, r);
+}
+
+/* 16 characters to 12 bytes, returns 0 if any of them is not base64 */
+static int base64_decode16_ssse3(const char *in, uint8_t *out)
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    uint8_t buf[16];
+    __m128i x, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+    x = _mm_loadu_si128((const __m128i *)in);
+    hi_nibbles = _mm_and_si128(_mm_srli_epi32(x, 4), mask_2f);
+    lo_nibbles = _mm_and_si128(x, mask_2f);
+    hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff)
+        return 0;
+
+    roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(x, mask_2f), hi_nibbles));
+    x = _mm_add_epi8(x, roll);
+    x = _mm_maddubs_epi16(x, _mm_set1_epi32(0x01400140));
+    x = _mm_madd_epi16(x, _mm_set1_epi32(0x00011000));
+    x = _mm_shuffle_epi8(x, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i *)buf, x);
+    memcpy(out, buf, 12);
+    return 1;
+}
+#endif
+
+#ifdef BASE64_AVX2
+/* 32 characters to 24 bytes, returns 0 if any of them is not base64 */
+static int base64_decode32_avx2(const char *in, uint8_t *out)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    uint8_t buf[32];
+    __m256i x, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+    x = _mm256_loadu_si256((const __m256i *)in);
+    hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(x, 4), mask_2f);
+    lo_nibbles = _mm256_and_si256(x, mask_2f);
+    hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm256_testz_si256(lo, hi))
+        return 0;
+
+    roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(x, mask_2f), hi_nibbles));
+    x = _mm256_add_epi8(x, roll);
+    x = _mm256_maddubs_epi16(x, _mm256_set1_epi32(0x01400140));
+    x = _mm256_madd_epi16(x, _mm256_set1_epi32(0x00011000));
+    x = _mm256_shuffle_epi8(x, _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    x = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256((__m256i *)buf, x);
+    memcpy(out, buf, 24);
+    return 1;
+}
+#endif
+
+size_t base64_encoded_length(size_t inlen, size_t line_len)
+{
+    size_t len = (inlen + 2) / 3 * 4;
+
+    if (line_len && len)
+        len += (len + line_len - 1) / line_len;
+    return len;
+}
+
+int base64_encode(const uint8_t *in, size_t inlen, size_t line_len,
+    char *out, size_t *outlen)
+{
+    size_t line_bytes = line_len / 4 * 3;
+    size_t n, i;
+    unsigned long l;
+
+    if ((!in && inlen) || !out || !outlen || line_len % 4) {
+        error_print();
+        return -1;
+    }
+    *outlen = 0;
+    while (inlen) {
+        n = (line_bytes && inlen > line_bytes) ? line_bytes : inlen;
+        i = 0;
+#if defined(BASE64_SSSE3) || defined(BASE64_AVX2)
+        for (; n - i >= 12; i += 12) {
+            base64_encode16_ssse3(in + i, out);
+            out += 16;
+        }
+#endif
+        for (; n - i >= 3; i += 3) {
+            l = ((unsigned long)in[i] << 16) | ((unsigned long)in[i + 1] << 8) | in[i + 2];
+            *out++ = conv_bin2ascii(l >> 18);
+            *out++ = conv_bin2ascii(l >> 12);
+            *out++ = conv_bin2ascii(l >> 6);
+            *out++ = conv_bin2ascii(l);
+        }
+        if (n - i) {
+            l = (unsigned long)in[i] << 16;
+            if (n - i == 2)
+                l |= (unsigned long)in[i + 1] << 8;
+            *out++ = conv_bin2ascii(l >> 18);
+            *out++ = conv_bin2ascii(l >> 12);
+            *out++ = (n - i == 2) ? conv_bin2ascii(l >> 6) : '=';
+            *out++ = '=';
+        }
+        *outlen += (n + 2) / 3 * 4;
+        if (line_len) {
+            *out++ = '\n';
+            (*outlen)++;
+        }
+        in += n;
+        inlen -= n;
+    }
+    return 1;
+}
+
+int base64_decode(const char *in, size_t inlen, uint8_t *out, size_t *outlen)
+{
+    const uint8_t *p = (const uint8_t *)in;
+    const uint8_t *end = p + inlen;
+    uint8_t q[4];
+    size_t qn = 0;
+    size_t npad = 0;
+    uint8_t c;
+
+    if ((!in && inlen) || !out || !outlen) {
+        error_print();
+        return -1;
+    }
+    *outlen = 0;
+
+    while (p < end) {
+        if (qn == 0 && !npad) {
+#ifdef BASE64_AVX2
+            while (end - p >= 32 && base64_decode32_avx2((const char *)p, out)) {
+                p += 32;
+                out += 24;
+                *outlen += 24;
+            }
+#endif
+#if defined(BASE64_SSSE3) || defined(BASE64_AVX2)
+            while (end - p >= 16 && base64_decode16_ssse3((const char *)p, out)) {
+                p += 16;
+                out += 12;
+                *outlen += 12;
+            }
+#endif
+            while (end - p >= 4) {
+                uint8_t a = data_ascii2dec[p[0]];
+                uint8_t b = data_ascii2dec[p[1]];
+                uint8_t d = data_ascii2dec[p[2]];
+                uint8_t e = data_ascii2dec[p[3]];
+                unsigned long l;
+
+                if ((a | b | d | e) & 0xC0)
+                    break;
+                l = ((unsigned long)a << 18) | ((unsigned long)b << 12)
+                    | ((unsigned long)d << 6) | e;
+                *out++ = (uint8_t)(l >> 16);
+                *out++ = (uint8_t)(l >> 8);
+                *out++ = (uint8_t)l;
+                *outlen += 3;
+                p += 4;
+            }
+            if (p == end)
+                break;
+        }
+
+        c = data_ascii2dec[*p++];
+        if (c == B64_DEC_WS)
+            continue;
+        if (c == B64_DEC_ERR || (npad && c != B64_DEC_PAD)) {
+            error_print();
+            return -1;
+        }
+        if (c == B64_DEC_PAD) {
+            /* only xx== and xxx=, nothing but whitespace after the quad */
+            if (qn < 2 || qn + npad >= 4) {
+                error_print();
+                return -1;
+            }
+            npad++;
+        } else {
+            q[qn++] = c;
+        }
+        if (qn + npad == 4) {
+            unsigned long l = ((unsigned long)q[0] << 18) | ((unsigned long)q[1] << 12);
+            if (qn > 2)
+                l |= (unsigned long)q[2] << 6;
+            if (qn > 3)
+                l |= q[3];
+            *out++ = (uint8_t)(l >> 16);
+            if (qn > 2)
+                *out++ = (uint8_t)(l >> 8);
+            if (qn > 3)
+                *out++ = (uint8_t)l;
+            *outlen += qn - 1;
+            qn = 0;
+        }
+    }
+    if (qn) {
+        error_print();
+        return -1;
+    }
+    return 1;
+}
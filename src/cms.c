@@ -18,6 +18,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <gmssl/asn1.h>
 #include <gmssl/aes.h>
 #include <gmssl/sm4.h>
@@ -63,6 +70,20 @@ EncryptedContentInfo ::= SEQUENCE {
 }
 */
 
+// absent OPTIONAL fields must be skipped in the length pass too
+static int cms_shared_infos_to_der(
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	uint8_t **out, size_t *outlen)
+{
+	if ((shared_info1 && asn1_implicit_octet_string_to_der(1, shared_info1, shared_info1_len, out, outlen) != 1)
+		|| (shared_info2 && asn1_implicit_octet_string_to_der(2, shared_info2, shared_info2_len, out, outlen) != 1)) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
 int cms_enced_content_info_to_der(int enc_algor, const uint8_t *enc_iv, size_t enc_iv_len,
 	int content_type, const uint8_t *enced_content, size_t enced_content_len,
 	const uint8_t *shared_info1, size_t shared_info1_len,
@@ -73,18 +94,16 @@ int cms_enced_content_info_to_der(int enc_algor, const uint8_t *enc_iv, size_t e
 
 	if (cms_content_type_to_der(content_type, NULL, &len) != 1
 		|| x509_encryption_algor_to_der(enc_algor, enc_iv, enc_iv_len, NULL, &len) != 1
-		|| asn1_implicit_octet_string_to_der(0, enced_content, enced_content_len, NULL, &len) < 0
-		|| asn1_implicit_octet_string_to_der(1, shared_info1, shared_info1_len, NULL, &len) < 0
-		|| asn1_implicit_octet_string_to_der(2, shared_info2, shared_info2_len, NULL, &len) < 0) {
+		|| (enced_content && asn1_implicit_octet_string_to_der(0, enced_content, enced_content_len, NULL, &len) != 1)
+		|| cms_shared_infos_to_der(shared_info1, shared_info1_len, shared_info2, shared_info2_len, NULL, &len) != 1) {
 		error_print();
 		return -1;
 	}
 	if (asn1_sequence_header_to_der(len, out, outlen) != 1
 		|| cms_content_type_to_der(content_type, out, outlen) != 1
 		|| x509_encryption_algor_to_der(enc_algor, enc_iv, enc_iv_len, out, outlen) != 1
-		|| asn1_implicit_octet_string_to_der(0, enced_content, enced_content_len, out, outlen) < 0
-		|| asn1_implicit_octet_string_to_der(1, shared_info1, shared_info1_len, out, outlen) < 0
-		|| asn1_implicit_octet_string_to_der(2, shared_info2, shared_info2_len, out, outlen) < 0) {
+		|| (enced_content && asn1_implicit_octet_string_to_der(0, enced_content, enced_content_len, out, outlen) != 1)
+		|| cms_shared_infos_to_der(shared_info1, shared_info1_len, shared_info2, shared_info2_len, out, outlen) != 1) {
 		error_print();
 		return -1;
 	}
@@ -112,7 +131,7 @@ int cms_enced_content_info_from_der(int *content_type,
 		|| x509_encryption_algor_from_der(enc_algor, nodes, &nodes_count, enc_iv, enc_iv_len, &data, &datalen) != 1
 		|| asn1_implicit_octet_string_from_der(0, enced_content, enced_content_len, &data, &datalen) < 0
 		|| asn1_implicit_octet_string_from_der(1, shared_info1, shared_info1_len, &data, &datalen) < 0
-		|| asn1_implicit_octet_string_from_der(1, shared_info2, shared_info2_len, &data, &datalen) < 0
+		|| asn1_implicit_octet_string_from_der(2, shared_info2, shared_info2_len, &data, &datalen) < 0
 		|| asn1_check(datalen == 0) != 1) {
 		error_print();
 		return -1;
@@ -161,27 +180,38 @@ int cms_enced_content_info_encrypt_to_der(const SM4_KEY *sm4_key, const uint8_t
 	const uint8_t *shared_info2, size_t shared_info2_len,
 	uint8_t **out, size_t *outlen)
 {
-	uint8_t enced_content[content_len + 256];
-	size_t enced_content_len;
-
-	error_print_msg("*outlen = %zu\n", *outlen);
+	size_t enced_content_len = (content_len/16 + 1) * 16;
+	size_t len = 0;
 
-	if (sm4_cbc_padding_encrypt(sm4_key, iv, content, content_len,
-		enced_content, &enced_content_len) != 1) {
+	// the padded length is known, so the length pass does not encrypt
+	if (cms_content_type_to_der(content_type, NULL, &len) != 1
+		|| x509_encryption_algor_to_der(OID_sm4_cbc, iv, 16, NULL, &len) != 1
+		|| asn1_header_to_der(ASN1_TAG_IMPLICIT(0), enced_content_len, NULL, &len) != 1
+		|| cms_shared_infos_to_der(shared_info1, shared_info1_len, shared_info2, shared_info2_len, NULL, &len) != 1) {
 		error_print();
 		return -1;
 	}
-	error_print_msg("content_len = %zu, out = %zu\n", content_len, enced_content_len);
+	len += enced_content_len;
 
-	if (cms_enced_content_info_to_der(OID_sm4_cbc, iv, 16,
-		content_type, enced_content, enced_content_len,
-		shared_info1, shared_info1_len,
-		shared_info2, shared_info2_len,
-		out, outlen) != 1) {
+	if (asn1_sequence_header_to_der(len, out, outlen) != 1
+		|| cms_content_type_to_der(content_type, out, outlen) != 1
+		|| x509_encryption_algor_to_der(OID_sm4_cbc, iv, 16, out, outlen) != 1
+		|| asn1_header_to_der(ASN1_TAG_IMPLICIT(0), enced_content_len, out, outlen) != 1) {
+		error_print();
+		return -1;
+	}
+	if (out) {
+		if (sm4_cbc_padding_encrypt(sm4_key, iv, content, content_len, *out, &len) != 1) {
+			error_print();
+			return -1;
+		}
+		*out += enced_content_len;
+	}
+	*outlen += enced_content_len;
+	if (cms_shared_infos_to_der(shared_info1, shared_info1_len, shared_info2, shared_info2_len, out, outlen) != 1) {
 		error_print();
 		return -1;
 	}
-	error_print_msg("*outlen = %zu\n\n", *outlen);
 	return 1;
 }
 
@@ -634,8 +664,7 @@ int cms_recipient_info_from_der(X509_NAME *issuer,
 		error_print();
 		return -1;
 	}
-
-	return -1;
+	return 1;
 }
 
 int cms_recipient_info_print(FILE *fp, const uint8_t *a, size_t alen, int format, int indent)
@@ -643,20 +672,25 @@ int cms_recipient_info_print(FILE *fp, const uint8_t *a, size_t alen, int format
 	return -1;
 }
 
+// SM2 ciphertexts vary in length, every call encrypts again with a new k
 int cms_recipient_info_encrypt_to_der(const SM2_KEY *sm2_key,
 	const X509_NAME *issuer, const uint8_t *serial_number, size_t serial_number_len,
 	const uint8_t *key, size_t keylen,
 	uint8_t **out, size_t *outlen)
 {
-	size_t len = 0;
-	uint8_t buf[keylen + 256];
+	uint8_t buf[SM2_MAX_CIPHERTEXT_SIZE];
 	size_t buflen;
 
-	sm2_encrypt(sm2_key, key, keylen, buf, &buflen);
-
-	cms_recipient_info_to_der(issuer, serial_number, serial_number_len,
-		buf, buflen, out, outlen);
-
+	if (keylen > SM2_MAX_PLAINTEXT_SIZE) {
+		error_print();
+		return -1;
+	}
+	if (sm2_encrypt(sm2_key, key, keylen, buf, &buflen) != 1
+		|| cms_recipient_info_to_der(issuer, serial_number, serial_number_len,
+			buf, buflen, out, outlen) != 1) {
+		error_print();
+		return -1;
+	}
 	return 1;
 }
 
@@ -665,20 +699,228 @@ int cms_recipient_info_decrypt_from_der(const SM2_KEY *sm2_key,
 	uint8_t *key, size_t *keylen,
 	const uint8_t **in, size_t *inlen)
 {
-	/*
-	if (cms_recipient_info_from_der(issuer, serial_number, serial_number_len,
-		&enced_key, &enced_key_len, &rcpt_info, &rcpt_info_len) != 1
-		|| rcpt_info_len) {
+	int ret;
+	const uint8_t *enced_key;
+	size_t enced_key_len;
+
+	if ((ret = cms_recipient_info_from_der(issuer, serial_number, serial_number_len,
+		&enced_key, &enced_key_len, in, inlen)) != 1) {
+		if (ret < 0) error_print();
+		return ret;
+	}
+	if (sm2_decrypt(sm2_key, enced_key, enced_key_len, key, keylen) != 1) {
 		error_print();
 		return -1;
 	}
+	return 1;
+}
 
-	sm2_decrypt(sm2_key, enced_key, enced_key_len, key, keylen);
-	*/
+/*
+RecipientInfos for many recipients.
+
+Every recipient costs one SM2 encryption, two scalar multiplications, so for
+large recipient lists the work is split over up to CMS_MAX_RECIPIENT_THREADS
+threads. Each RecipientInfo is written into its own slot of one heap buffer,
+sized from the issuer and serial number of the certificate and the largest
+SM2 ciphertext, and the slots are packed in order afterwards.
+*/
+
+typedef struct {
+	const X509_CERTIFICATE *certs;
+	size_t count;
+	size_t first;
+	size_t step;
+	const uint8_t *key;
+	size_t keylen;
+	uint8_t *buf;
+	const size_t *offsets;
+	size_t *lens;
+	int ret;
+} CMS_RECIPIENT_JOB;
+
+static void *cms_recipient_infos_encrypt_job(void *arg)
+{
+	CMS_RECIPIENT_JOB *job = (CMS_RECIPIENT_JOB *)arg;
+	const X509_NAME *issuer;
+	const uint8_t *serial_number;
+	size_t serial_number_len;
+	uint8_t *p;
+	size_t i;
+
+	job->ret = -1;
+	for (i = job->first; i < job->count; i += job->step) {
+		cms_issuer_and_serial_number_from_certificate(&issuer,
+			&serial_number, &serial_number_len, &job->certs[i]);
+		p = job->buf + job->offsets[i];
+		job->lens[i] = 0;
+		if (cms_recipient_info_encrypt_to_der(
+			&job->certs[i].tbs_certificate.subject_public_key_info.sm2_key,
+			issuer, serial_number, serial_number_len,
+			job->key, job->keylen, &p, &job->lens[i]) != 1) {
+			error_print();
+			return NULL;
+		}
+	}
+	job->ret = 1;
+	return NULL;
+}
+
+int cms_recipient_infos_encrypt(const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+	const uint8_t *key, size_t keylen,
+	uint8_t **rcpt_infos, size_t *rcpt_infos_len)
+{
+	uint8_t max_enced_key[SM2_MAX_CIPHERTEXT_SIZE] = {0};
+	const X509_NAME *issuer;
+	const uint8_t *serial_number;
+	size_t serial_number_len;
+	size_t *offsets = NULL;
+	size_t *lens = NULL;
+	uint8_t *buf = NULL;
+	size_t total = 0;
+	CMS_RECIPIENT_JOB jobs[CMS_MAX_RECIPIENT_THREADS];
+	pthread_t threads[CMS_MAX_RECIPIENT_THREADS];
+	size_t nthreads = 1;
+	size_t started = 0;
+	size_t i;
+	int ret = -1;
+
+	if (!rcpt_certs || !rcpt_count || !key || !keylen || !rcpt_infos || !rcpt_infos_len) {
+		error_print();
+		return -1;
+	}
+	if (!(offsets = malloc(rcpt_count * sizeof(size_t)))
+		|| !(lens = malloc(rcpt_count * sizeof(size_t)))) {
+		error_print();
+		goto end;
+	}
+	for (i = 0; i < rcpt_count; i++) {
+		size_t len = 0;
+		cms_issuer_and_serial_number_from_certificate(&issuer,
+			&serial_number, &serial_number_len, &rcpt_certs[i]);
+		if (cms_recipient_info_to_der(issuer, serial_number, serial_number_len,
+			max_enced_key, sizeof(max_enced_key), NULL, &len) != 1) {
+			error_print();
+			goto end;
+		}
+		offsets[i] = total;
+		total += len;
+	}
+	if (!(buf = malloc(total))) {
+		error_print();
+		goto end;
+	}
+
+	if (rcpt_count >= CMS_PARALLEL_MIN_RECIPIENTS) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpus > 1 ? (size_t)ncpus : 1;
+		if (nthreads > CMS_MAX_RECIPIENT_THREADS)
+			nthreads = CMS_MAX_RECIPIENT_THREADS;
+	}
+	for (i = 0; i < nthreads; i++) {
+		jobs[i].certs = rcpt_certs;
+		jobs[i].count = rcpt_count;
+		jobs[i].first = i;
+		jobs[i].step = nthreads;
+		jobs[i].key = key;
+		jobs[i].keylen = keylen;
+		jobs[i].buf = buf;
+		jobs[i].offsets = offsets;
+		jobs[i].lens = lens;
+		jobs[i].ret = -1;
+	}
+	// the calling thread takes jobs[0]
+	for (started = 1; started < nthreads; started++) {
+		if (pthread_create(&threads[started], NULL,
+			cms_recipient_infos_encrypt_job, &jobs[started]) != 0) {
+			break;
+		}
+	}
+	// recipients of jobs that could not be started are done here
+	for (i = started; i < nthreads; i++) {
+		cms_recipient_infos_encrypt_job(&jobs[i]);
+	}
+	cms_recipient_infos_encrypt_job(&jobs[0]);
+	for (i = 1; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (jobs[i].ret != 1) {
+			error_print();
+			goto end;
+		}
+	}
+
+	*rcpt_infos_len = 0;
+	for (i = 0; i < rcpt_count; i++) {
+		memmove(buf + *rcpt_infos_len, buf + offsets[i], lens[i]);
+		*rcpt_infos_len += lens[i];
+	}
+	*rcpt_infos = buf;
+	buf = NULL;
+	ret = 1;
+end:
+	free(offsets);
+	free(lens);
+	free(buf);
+	return ret;
+}
+
+// returns 0 if the RecipientInfo is not for cert
+static int cms_recipient_info_decrypt(const SM2_KEY *sm2_key, const X509_CERTIFICATE *cert,
+	const uint8_t **in, size_t *inlen, uint8_t key[16])
+{
+	const X509_NAME *cert_issuer;
+	const uint8_t *cert_serial;
+	size_t cert_serial_len;
+	X509_NAME issuer;
+	const uint8_t *serial;
+	size_t serial_len;
+	const uint8_t *enced_key;
+	size_t enced_key_len;
+	uint8_t buf[SM2_MAX_PLAINTEXT_SIZE];
+	size_t buflen;
+
+	cms_issuer_and_serial_number_from_certificate(&cert_issuer,
+		&cert_serial, &cert_serial_len, cert);
+
+	if (cms_recipient_info_from_der(&issuer, &serial, &serial_len,
+		&enced_key, &enced_key_len, in, inlen) != 1) {
+		error_print();
+		return -1;
+	}
+	if (serial_len != cert_serial_len
+		|| memcmp(serial, cert_serial, serial_len) != 0
+		|| x509_name_equ(&issuer, cert_issuer) != 1) {
+		return 0;
+	}
+	if (sm2_decrypt(sm2_key, enced_key, enced_key_len, buf, &buflen) != 1
+		|| buflen != 16) {
+		error_print();
+		return -1;
+	}
+	memcpy(key, buf, 16);
+	memset(buf, 0, sizeof(buf));
+	return 1;
+}
+
+static int cms_recipient_infos_decrypt(const SM2_KEY *sm2_key, const X509_CERTIFICATE *cert,
+	const uint8_t *rcpt_infos, size_t rcpt_infos_len, uint8_t key[16])
+{
+	int ret;
+
+	while (rcpt_infos_len) {
+		if ((ret = cms_recipient_info_decrypt(sm2_key, cert, &rcpt_infos, &rcpt_infos_len, key)) < 0) {
+			error_print();
+			return -1;
+		}
+		if (ret == 1) {
+			return 1;
+		}
+	}
+	error_puts("no RecipientInfo for the certificate");
 	return -1;
 }
 
-													
 /*
 EnvelopedData ::= SEQUENCE {
 	version			INTEGER (1),
@@ -762,56 +1004,19 @@ int cms_enveloped_data_print(FILE *fp, const uint8_t *a, size_t alen, int format
 	return -1;
 }
 
-int cms_enveloped_data_encrypt_to_der(const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+static int cms_enveloped_data_encrypt_with_key_to_der(
+	const uint8_t *rcpt_infos, size_t rcpt_infos_len,
+	const SM4_KEY *sm4_key, const uint8_t enc_iv[16],
 	int content_type, const uint8_t *content, size_t content_len,
 	const uint8_t *shared_info1, size_t shared_info1_len,
 	const uint8_t *shared_info2, size_t shared_info2_len,
 	uint8_t **out, size_t *outlen)
 {
 	size_t len = 0;
-	SM4_KEY sm4_key;
-	uint8_t enc_key[16];
-	uint8_t enc_iv[16];
-	uint8_t enced_key[rcpt_count][256 + 16];
-	size_t enced_key_len[rcpt_count];
-	uint8_t enced_content_info[content_len + 512];
-	size_t enced_content_info_len;
-	size_t i;
-
-	const SM2_KEY *sm2_key;
-
-	size_t rcpt_infos_len = 0;
-
-	rand_bytes(enc_key, 16);
-	rand_bytes(enc_iv, 16);
-
-	for (i = 0; i < rcpt_count; i++) {
-		// = x509_certificate_get_public_key(rcpt_certs[i]);
-		sm2_encrypt(sm2_key, enc_key, 16, enced_key[i], &enced_key_len[i]);
-	}
-
-	for (i = 0; i < rcpt_count; i++) {
-		// 这个应该改为cms_recipient_info_from_x509
-		/*
-		x509_certificate_get_recipient_info(rcpt_cert,
-			&issuer,
-			&serial_number, &serial_number_len,
-			&sm2_key);
-
-		*/
-		/*
-		cms_recipient_info_encrypt_to_der(issuer,
-			serial_number, serial_number_len,
-			enced_key, enced_key_len,
-			NULL, &rcpt_infos_len);
-		*/
-	}
-
-
 
 	if (asn1_int_to_der(CMS_version, NULL, &len) != 1
-		|| asn1_set_to_der(NULL, rcpt_infos_len, NULL, &len) != 1
-		|| cms_enced_content_info_encrypt_to_der(&sm4_key, enc_iv,
+		|| asn1_set_to_der(rcpt_infos, rcpt_infos_len, NULL, &len) != 1
+		|| cms_enced_content_info_encrypt_to_der(sm4_key, enc_iv,
 			content_type, content, content_len,
 			shared_info1, shared_info1_len,
 			shared_info2, shared_info2_len,
@@ -819,112 +1024,109 @@ int cms_enveloped_data_encrypt_to_der(const X509_CERTIFICATE *rcpt_certs, size_t
 		error_print();
 		return -1;
 	}
-
 	if (asn1_sequence_header_to_der(len, out, outlen) != 1
 		|| asn1_int_to_der(CMS_version, out, outlen) != 1
-		|| asn1_set_header_to_der(rcpt_infos_len, out, outlen) != 1) {
+		|| asn1_set_to_der(rcpt_infos, rcpt_infos_len, out, outlen) != 1
+		|| cms_enced_content_info_encrypt_to_der(sm4_key, enc_iv,
+			content_type, content, content_len,
+			shared_info1, shared_info1_len,
+			shared_info2, shared_info2_len,
+			out, outlen) != 1) {
 		error_print();
 		return -1;
 	}
+	return 1;
+}
 
-	const X509_NAME *issuer;
-	const uint8_t *serial_number;
-	size_t serial_number_len;
-
-	for (i = 0; i < rcpt_count; i++) {
-		if (cms_recipient_info_encrypt_to_der(sm2_key, issuer,
-			serial_number, serial_number_len,
-			enc_key, sizeof(enc_key), out, outlen) != 1) {
-			error_print();
-			return -1;
-		}
-	}
+// Each call uses a new content encryption key, do not call with out = NULL for the length
+int cms_enveloped_data_encrypt_to_der(const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+	int content_type, const uint8_t *content, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	uint8_t **out, size_t *outlen)
+{
+	SM4_KEY sm4_key;
+	uint8_t enc_key[16];
+	uint8_t enc_iv[16];
+	uint8_t *rcpt_infos = NULL;
+	size_t rcpt_infos_len;
+	int ret = -1;
 
-	if (cms_enced_content_info_encrypt_to_der(&sm4_key, enc_iv,
-		content_type, content, content_len,
-		shared_info1, shared_info1_len,
-		shared_info2, shared_info2_len,
-		out, outlen) != 1) {
+	if (rand_bytes(enc_key, sizeof(enc_key)) != 1
+		|| rand_bytes(enc_iv, sizeof(enc_iv)) != 1) {
 		error_print();
 		return -1;
 	}
+	sm4_set_encrypt_key(&sm4_key, enc_key);
 
-	return 1;
+	if (cms_recipient_infos_encrypt(rcpt_certs, rcpt_count,
+			enc_key, sizeof(enc_key), &rcpt_infos, &rcpt_infos_len) != 1
+		|| cms_enveloped_data_encrypt_with_key_to_der(rcpt_infos, rcpt_infos_len,
+			&sm4_key, enc_iv, content_type, content, content_len,
+			shared_info1, shared_info1_len,
+			shared_info2, shared_info2_len,
+			out, outlen) != 1) {
+		error_print();
+		goto end;
+	}
+	ret = 1;
+end:
+	memset(&sm4_key, 0, sizeof(sm4_key));
+	memset(enc_key, 0, sizeof(enc_key));
+	free(rcpt_infos);
+	return ret;
 }
 
 int cms_enveloped_data_decrypt_from_der(const SM2_KEY *sm2_key, const X509_CERTIFICATE *cert,
 	const uint8_t *enveloped_data, size_t enveloped_data_len,
 	int *content_type, uint8_t *content, size_t *content_len)
 {
-/*
 	const uint8_t *rcpt_infos;
 	size_t rcpt_infos_len;
 	int enc_algor;
-	uint32_t enc_algor_nodes[32];
-	size_t enc_algor_nodes_count;
+	const uint8_t *enc_iv;
+	size_t enc_iv_len;
 	const uint8_t *enced_content;
 	size_t enced_content_len;
 	const uint8_t *shared_info1;
 	size_t shared_info1_len;
 	const uint8_t *shared_info2;
 	size_t shared_info2_len;
-	uint8_t enc_key[64];
-	size_t enc_key_len;
-
-	const uint8_t *enc_iv;
-	size_t enc_iv_len;
+	uint8_t enc_key[16];
+	SM4_KEY sm4_key;
+	int ret = -1;
 
 	if (cms_enveloped_data_from_der(&rcpt_infos, &rcpt_infos_len,
-		content_type, &enc_algor, enc_algor_nodes, &enc_algor_nodes_count,
-		&enc_iv, &enc_iv_len,
-		&enced_content, &enced_content_len, &shared_info1, &shared_info1_len,
-		&shared_info2, &shared_info2_len, &enveloped_data, &enveloped_data_len) != 1
-		|| enced_content_info_len > 0) {
+		content_type, &enc_algor, &enc_iv, &enc_iv_len,
+		&enced_content, &enced_content_len,
+		&shared_info1, &shared_info1_len,
+		&shared_info2, &shared_info2_len,
+		&enveloped_data, &enveloped_data_len) != 1
+		|| enveloped_data_len) {
 		error_print();
 		return -1;
 	}
-	if (enc_algor != OID_sm4_cbc) {
+	if (enc_algor != OID_sm4_cbc || !enc_iv || enc_iv_len != 16 || !enced_content) {
 		error_print();
 		return -1;
 	}
-	if (!enc_iv || enc_iv_len != 16) {
+	if (cms_recipient_infos_decrypt(sm2_key, cert, rcpt_infos, rcpt_infos_len, enc_key) != 1) {
 		error_print();
 		return -1;
 	}
-
-	while (rcpt_infos_len) {
-		X509_NAME issuer;
-		const uint8_t *serial_number;
-		size_t serial_number_len;
-		const uint8_t *enced_key;
-		size_t enced_key_len;
-
-		if (cms_recipient_info_from_der(&issuer, &serial_number, &serial_number_len
-			&enced_key, &enced_key_len, &rcpt_infos, &rcpt_infos_len) != 1) {
-			error_print();
-			return -1;
-		}
-		if (cms_issuer_and_serial_number_match_certificate(&issuer,
-			serial_number, serial_number_len, cert) != 1) {
-			break;
-		}
-		if (sm2_decrypt(sm2_key, enced_key, enced_key_len, enc_key, &enc_key_len) != 1) {
-			error_print();
-			return -1;
-		}
-	}
-
 	sm4_set_decrypt_key(&sm4_key, enc_key);
-	if (sm4_cbc_paddnig_decrypt(&sm4_key, enc_iv, enced_content, enced_content_len,
+	if (sm4_cbc_padding_decrypt(&sm4_key, enc_iv, enced_content, enced_content_len,
 		content, content_len) != 1) {
 		error_print();
-		return -1;
+		goto end;
 	}
-*/
-	return -1;
+	ret = 1;
+end:
+	memset(&sm4_key, 0, sizeof(sm4_key));
+	memset(enc_key, 0, sizeof(enc_key));
+	return ret;
 }
 
-
 // 注意，由于SignedData中包含ContentInfo，因此需要提前给出ContentInfo的基本编解码
 
 /*
@@ -1034,8 +1236,10 @@ int cms_content_info_from_der(int *content_type, const uint8_t **content, size_t
 		if (ret < 0) error_print();
 		return ret;
 	}
+	*content = NULL;
+	*content_len = 0;
 	if (cms_content_type_from_der(content_type, &data, &datalen) != 1
-		|| asn1_explicit_from_der(0, content, content_len, &data, &datalen) != 1
+		|| asn1_explicit_from_der(0, content, content_len, &data, &datalen) < 0
 		|| datalen > 0) {
 		error_print();
 		return -1;
@@ -1043,6 +1247,48 @@ int cms_content_info_from_der(int *content_type, const uint8_t **content, size_t
 	return 1;
 }
 
+int cms_content_info_set_data(uint8_t *content_info, size_t *content_info_len,
+	const uint8_t *data, size_t datalen)
+{
+	size_t data_len = 0;
+	size_t len = 0;
+
+	if (!content_info || !content_info_len || (!data && datalen)) {
+		error_print();
+		return -1;
+	}
+	*content_info_len = 0;
+	if (asn1_octet_string_to_der(data, datalen, NULL, &data_len) != 1
+		|| cms_content_type_to_der(CMS_data, NULL, &len) != 1
+		|| asn1_explicit_header_to_der(0, data_len, NULL, &len) != 1
+		|| asn1_sequence_header_to_der(len + data_len, &content_info, content_info_len) != 1
+		|| cms_content_type_to_der(CMS_data, &content_info, content_info_len) != 1
+		|| asn1_explicit_header_to_der(0, data_len, &content_info, content_info_len) != 1
+		|| asn1_octet_string_to_der(data, datalen, &content_info, content_info_len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int cms_content_info_get_data(const uint8_t *content_info, size_t content_info_len,
+	const uint8_t **data, size_t *datalen)
+{
+	int content_type;
+	const uint8_t *content;
+	size_t content_len;
+
+	if (cms_content_info_from_der(&content_type, &content, &content_len,
+		&content_info, &content_info_len) != 1
+		|| content_type != CMS_data
+		|| asn1_octet_string_from_der(data, datalen, &content, &content_len) != 1
+		|| content_len || content_info_len) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
 
 /*
 SignerInfo ::= SEQUENCE {
@@ -1070,10 +1316,10 @@ int cms_signer_info_to_der(
 	if (asn1_int_to_der(CMS_version, NULL, &len) != 1
 		|| cms_issuer_and_serial_number_to_der(issuer, serial_number, serial_number_len, NULL, &len) != 1
 		|| x509_digest_algor_to_der(OID_sm3, NULL, &len) != 1
-		|| asn1_implicit_set_to_der(0, authed_attrs, authed_attrs_len, NULL, &len) < 0
+		|| (authed_attrs && asn1_implicit_set_to_der(0, authed_attrs, authed_attrs_len, NULL, &len) != 1)
 		|| x509_signature_algor_to_der(OID_sm2sign_with_sm3, NULL, &len) != 1
 		|| asn1_octet_string_to_der(enced_digest, enced_digest_len, NULL, &len) != 1
-		|| asn1_implicit_set_to_der(1, unauthed_attrs, unauthed_attrs_len, NULL, &len) < 0) {
+		|| (unauthed_attrs && asn1_implicit_set_to_der(1, unauthed_attrs, unauthed_attrs_len, NULL, &len) != 1)) {
 		error_print();
 		return -1;
 	}
@@ -1259,42 +1505,115 @@ SignedData ::= SEQUENCE {
 }
 */
 
-int cms_signed_data_to_der(
-	const int *digest_algors, const size_t digest_algors_count,
-	const int content_type, const uint8_t *content, const size_t content_len,
-	const X509_CERTIFICATE *certs, size_t certs_count,
-	const uint8_t **crls, const size_t *crls_lens, const size_t crls_count,
-	const uint8_t **signer_infos, size_t *signer_infos_lens, size_t signer_infos_count,
+// content is the data itself for CMS_data, a detached SignedData has content = NULL
+static int cms_signed_content_info_to_der(int content_type,
+	const uint8_t *content, size_t content_len,
 	uint8_t **out, size_t *outlen)
 {
+	size_t content_der_len = 0;
 	size_t len = 0;
-	size_t digest_algors_len = 0;
-	size_t certs_len = 0;
-	size_t crls_len = 0;
+
+	if (content) {
+		if (content_type == CMS_data) {
+			if (asn1_octet_string_to_der(content, content_len, NULL, &content_der_len) != 1) {
+				error_print();
+				return -1;
+			}
+		} else {
+			content_der_len = content_len;
+		}
+		if (asn1_explicit_header_to_der(0, content_der_len, NULL, &len) != 1) {
+			error_print();
+			return -1;
+		}
+		len += content_der_len;
+	}
+	if (cms_content_type_to_der(content_type, NULL, &len) != 1
+		|| asn1_sequence_header_to_der(len, out, outlen) != 1
+		|| cms_content_type_to_der(content_type, out, outlen) != 1) {
+		error_print();
+		return -1;
+	}
+	if (content) {
+		if (asn1_explicit_header_to_der(0, content_der_len, out, outlen) != 1) {
+			error_print();
+			return -1;
+		}
+		if (content_type == CMS_data) {
+			if (asn1_octet_string_to_der(content, content_len, out, outlen) != 1) {
+				error_print();
+				return -1;
+			}
+		} else {
+			asn1_data_to_der(content, content_len, out, outlen);
+		}
+	}
+	return 1;
+}
+
+static int cms_signed_content_from_der(int content_type,
+	const uint8_t **data, size_t *datalen,
+	const uint8_t *content, size_t content_len)
+{
+	if (content_type != CMS_data) {
+		*data = content;
+		*datalen = content_len;
+		return 1;
+	}
+	if (asn1_octet_string_from_der(data, datalen, &content, &content_len) != 1
+		|| content_len) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int cms_signed_data_to_der(
+	const int *digest_algors, const size_t digest_algors_count,
+	const int content_type, const uint8_t *content, const size_t content_len,
+	const X509_CERTIFICATE *certs, size_t certs_count,
+	const uint8_t **crls, const size_t *crls_lens, const size_t crls_count,
+	const uint8_t **signer_infos, size_t *signer_infos_lens, size_t signer_infos_count,
+	uint8_t **out, size_t *outlen)
+{
+	size_t len = 0;
+	size_t digest_algors_len = 0;
+	size_t certs_len = 0;
+	size_t crls_len = 0;
 	size_t signer_infos_len = 0;
-	int i;
+	size_t i;
 
-	/*
-	for (i = 0; i < digest_algors_count; i++)
-		x509_digest_algor_to_der(digest_algors[i], NULL, &digest_algors_len);
-	for (i = 0; i < certs_count; i++)
-		x509_certificate_to_der(&certs[i], NULL, &certs_len);
-	for (i = 0; i < crls_count; i++)
+	for (i = 0; i < digest_algors_count; i++) {
+		if (x509_digest_algor_to_der(digest_algors[i], NULL, &digest_algors_len) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+	for (i = 0; i < certs_count; i++) {
+		if (x509_certificate_to_der(&certs[i], NULL, &certs_len) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+	for (i = 0; i < crls_count; i++) {
 		crls_len += crls_lens[i];
-	for (i = 0; i < signer_infos_count; i++)
+	}
+	for (i = 0; i < signer_infos_count; i++) {
 		signer_infos_len += signer_infos_lens[i];
+	}
 
 	if (asn1_int_to_der(CMS_version, NULL, &len) != 1
-		|| asn1_set_to_der(NULL, digest_algors_len, NULL, &len) != 1
-		|| cms_content_info_to_der(content_type, content, content_len, NULL, &len) != 1
-		|| asn1_implicit_set_to_der(0, NULL, certs_len, NULL, &len) < 0
-		|| asn1_implicit_set_to_der(1, NULL, crls_len, NULL, &len) < 0
-		|| asn1_set_to_der(NULL, signer_infos_len, NULL, &len) != 1) {
+		|| asn1_set_header_to_der(digest_algors_len, NULL, &len) != 1
+		|| cms_signed_content_info_to_der(content_type, content, content_len, NULL, &len) != 1
+		|| (certs_count && asn1_implicit_set_header_to_der(0, certs_len, NULL, &len) != 1)
+		|| (crls_count && asn1_implicit_set_header_to_der(1, crls_len, NULL, &len) != 1)
+		|| asn1_set_header_to_der(signer_infos_len, NULL, &len) != 1) {
 		error_print();
 		return -1;
 	}
+	len += digest_algors_len + certs_len + crls_len + signer_infos_len;
 
-	if (asn1_sequence_to_der(len, out, outlen) != 1
+	if (asn1_sequence_header_to_der(len, out, outlen) != 1
 		|| asn1_int_to_der(CMS_version, out, outlen) != 1
 		|| asn1_set_header_to_der(digest_algors_len, out, outlen) != 1) {
 		error_print();
@@ -1306,32 +1625,39 @@ int cms_signed_data_to_der(
 			return -1;
 		}
 	}
-	if (cms_content_info_to_der(content_type, content, content_len, out, outlen) != 1) {
+	if (cms_signed_content_info_to_der(content_type, content, content_len, out, outlen) != 1) {
 		error_print();
 		return -1;
 	}
-	if (certs) {
+	if (certs_count) {
 		if (asn1_implicit_set_header_to_der(0, certs_len, out, outlen) != 1) {
 			error_print();
 			return -1;
 		}
 		for (i = 0; i < certs_count; i++) {
+			if (x509_certificate_to_der(&certs[i], out, outlen) != 1) {
+				error_print();
+				return -1;
+			}
 		}
 	}
-	if (crls) {
+	if (crls_count) {
+		if (asn1_implicit_set_header_to_der(1, crls_len, out, outlen) != 1) {
+			error_print();
+			return -1;
+		}
 		for (i = 0; i < crls_count; i++) {
+			asn1_data_to_der(crls[i], crls_lens[i], out, outlen);
 		}
 	}
-
-
-	if (asn1_set_to_der(signer_infos_len, out, outlen) != 1) {
+	if (asn1_set_header_to_der(signer_infos_len, out, outlen) != 1) {
+		error_print();
+		return -1;
 	}
 	for (i = 0; i < signer_infos_count; i++) {
 		asn1_data_to_der(signer_infos[i], signer_infos_lens[i], out, outlen);
 	}
-
-	*/
-	return -1;
+	return 1;
 }
 
 int cms_signed_data_from_der(
@@ -1408,216 +1734,555 @@ bad:
 	return -1;
 }
 
-int cms_signed_data_sign_to_der(const SM2_KEY *sign_keys,
-	const X509_CERTIFICATE *sign_certs, size_t sign_count,
-	int content_type, const uint8_t *content, size_t content_len,
-	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
+/*
+Attribute ::= SEQUENCE {
+	attrType	OBJECT IDENTIFIER,
+	attrValues	SET OF AttributeValue
+}
+
+SignerInfos made here always carry the PKCS #9 contentType and messageDigest
+attributes. The content is hashed once with SM3, every signer only signs the
+DER encoding of its attributes, SM3(Z || SET OF Attribute).
+*/
+
+static const uint32_t OID_pkcs9_content_type[] = {1,2,840,113549,1,9,3};
+static const uint32_t OID_pkcs9_message_digest[] = {1,2,840,113549,1,9,4};
+#define OID_PKCS9_NODES_COUNT (sizeof(OID_pkcs9_content_type)/sizeof(OID_pkcs9_content_type[0]))
+
+static int cms_signed_attrs_to_der(int content_type, const uint8_t dgst[32],
 	uint8_t **out, size_t *outlen)
 {
-	uint8_t *p;
-	size_t len = 0;
-	uint8_t digest_algors[16];
-	size_t digest_algors_len = 0;
-	size_t sign_certs_len = 0;
-	size_t certs_len = 0;
-	size_t crls_len = 0;
-	size_t signer_infos_len = 0;
-	uint8_t sigs[sign_count][SM2_MAX_SIGNATURE_SIZE];
-	size_t siglens[sign_count];
-	int i;
-
-	p = digest_algors;
-	x509_digest_algor_to_der(OID_sm3, &p, &digest_algors_len);
-	for (i = 0; i < sign_count; i++) {
-		if (x509_certificate_to_der(&sign_certs[i], NULL, &sign_certs_len) != 1) {
-			error_print();
-			return -1;
-		}
-	}
-	for (i = 0; i < crls_count; i++) {
-		crls_len += crls_lens[i];
-	}
+	size_t type_len = 0;
+	size_t dgst_len = 0;
+	size_t len;
 
-	for (i = 0; i < sign_count; i++) {
-		const X509_CERTIFICATE *cert = &sign_certs[i];
-		const X509_NAME *issuer = &cert->tbs_certificate.issuer;
-		const uint8_t *serial_number = cert->tbs_certificate.serial_number;
-		size_t serial_number_len = cert->tbs_certificate.serial_number_len;
-
-		SM2_SIGN_CTX sign_ctx;
-		sm2_sign_init(&sign_ctx, &sign_keys[i], SM2_DEFAULT_ID);
-		sm2_sign_update(&sign_ctx, content, content_len);
-		sm2_sign_finish(&sign_ctx, sigs[i], &siglens[i]);
-
-		if (cms_signer_info_to_der(issuer, serial_number, serial_number_len,
-			OID_sm3, NULL, 0, sigs[i], siglens[i], NULL, 0,
-			NULL, &signer_infos_len) != 1) {
-			error_print();
-			return -1;
-		}
+	if (cms_content_type_to_der(content_type, NULL, &type_len) != 1
+		|| asn1_octet_string_to_der(dgst, 32, NULL, &dgst_len) != 1) {
+		error_print();
+		return -1;
 	}
 
-	len = 0;
-	if (asn1_int_to_der(CMS_version, NULL, &len) != 1
-		|| asn1_set_to_der(digest_algors, digest_algors_len, NULL, &len) != 1
-		|| cms_content_info_to_der(content_type, content, content_len, NULL, &len) != 1
-		|| asn1_implicit_set_to_der(0, NULL, certs_len, NULL, &len) < 0
-		|| asn1_implicit_set_to_der(1, NULL, crls_len, NULL, &len) < 0
-		|| asn1_set_to_der(NULL, signer_infos_len, NULL, &len) != 1) {
+	len = type_len;
+	if (asn1_object_identifier_to_der(OID_undef, OID_pkcs9_content_type, OID_PKCS9_NODES_COUNT, NULL, &len) != 1
+		|| asn1_set_header_to_der(type_len, NULL, &len) != 1
+		|| asn1_sequence_header_to_der(len, out, outlen) != 1
+		|| asn1_object_identifier_to_der(OID_undef, OID_pkcs9_content_type, OID_PKCS9_NODES_COUNT, out, outlen) != 1
+		|| asn1_set_header_to_der(type_len, out, outlen) != 1
+		|| cms_content_type_to_der(content_type, out, outlen) != 1) {
 		error_print();
 		return -1;
 	}
 
-
-	if (asn1_sequence_header_to_der(len, out, outlen) != 1
-		|| asn1_int_to_der(CMS_version, out, outlen) != 1
-		|| asn1_set_to_der(digest_algors, digest_algors_len, out, outlen) != 1
-		|| cms_content_info_to_der(content_type, content, content_len, out, outlen) != 1
-		|| asn1_implicit_set_header_to_der(0, certs_len, out, outlen) != 1) {
+	len = dgst_len;
+	if (asn1_object_identifier_to_der(OID_undef, OID_pkcs9_message_digest, OID_PKCS9_NODES_COUNT, NULL, &len) != 1
+		|| asn1_set_header_to_der(dgst_len, NULL, &len) != 1
+		|| asn1_sequence_header_to_der(len, out, outlen) != 1
+		|| asn1_object_identifier_to_der(OID_undef, OID_pkcs9_message_digest, OID_PKCS9_NODES_COUNT, out, outlen) != 1
+		|| asn1_set_header_to_der(dgst_len, out, outlen) != 1
+		|| asn1_octet_string_to_der(dgst, 32, out, outlen) != 1) {
 		error_print();
 		return -1;
 	}
-	for (i = 0; i < sign_count; i++) {
-		if (x509_certificate_to_der(&sign_certs[i], out, outlen) != 1) {
+	return 1;
+}
+
+static int cms_signed_attrs_check(const uint8_t *attrs, size_t attrs_len,
+	int content_type, const uint8_t dgst[32])
+{
+	int has_content_type = 0;
+	int has_message_digest = 0;
+
+	while (attrs_len) {
+		const uint8_t *attr;
+		size_t attr_len;
+		const uint8_t *values;
+		size_t values_len;
+		int oid;
+		uint32_t nodes[32];
+		size_t nodes_count;
+
+		if (asn1_sequence_from_der(&attr, &attr_len, &attrs, &attrs_len) != 1
+			|| asn1_object_identifier_from_der(&oid, nodes, &nodes_count, &attr, &attr_len) != 1
+			|| asn1_set_from_der(&values, &values_len, &attr, &attr_len) != 1
+			|| attr_len) {
 			error_print();
 			return -1;
 		}
-	}
-	if (crls) {
-		if (asn1_implicit_set_header_to_der(1, crls_len, out, outlen) != 1) {
-			error_print();
-			return -1;
+		if (nodes_count != OID_PKCS9_NODES_COUNT) {
+			continue;
 		}
-		for (i = 0; i < crls_count; i++) {
-			asn1_data_to_der(crls[i], crls_lens[i], out, outlen);
+		if (memcmp(nodes, OID_pkcs9_content_type, sizeof(OID_pkcs9_content_type)) == 0) {
+			int type;
+			if (cms_content_type_from_der(&type, &values, &values_len) != 1
+				|| values_len
+				|| type != content_type) {
+				error_print();
+				return -1;
+			}
+			has_content_type = 1;
+		} else if (memcmp(nodes, OID_pkcs9_message_digest, sizeof(OID_pkcs9_message_digest)) == 0) {
+			const uint8_t *d;
+			size_t dlen;
+			if (asn1_octet_string_from_der(&d, &dlen, &values, &values_len) != 1
+				|| values_len
+				|| dlen != 32
+				|| memcmp(d, dgst, 32) != 0) {
+				error_puts("messageDigest does not match the content");
+				return -1;
+			}
+			has_message_digest = 1;
 		}
 	}
-	asn1_set_header_to_der(signer_infos_len, out, outlen);
-	for (i = 0; i < sign_count; i++) {
-		const X509_CERTIFICATE *cert = &sign_certs[i];
-		const X509_NAME *issuer = &cert->tbs_certificate.issuer;
-		const uint8_t *serial_number = cert->tbs_certificate.serial_number;
-		size_t serial_number_len = cert->tbs_certificate.serial_number_len;
-
-		if (cms_signer_info_to_der(issuer, serial_number, serial_number_len,
-			OID_sm3, NULL, 0, sigs[i], siglens[i], NULL, 0, out, outlen) != 1) {
-			error_print();
-			return -1;
-		}
+	if (!has_content_type || !has_message_digest) {
+		error_print();
+		return -1;
 	}
-
 	return 1;
 }
 
-int cms_signed_data_verify_from_der(const uint8_t *signed_data, size_t signed_data_len)
+static int cms_signer_info_sign_attrs_to_der(const SM2_KEY *sign_key, const X509_CERTIFICATE *cert,
+	int content_type, const uint8_t dgst[32],
+	uint8_t **out, size_t *outlen)
 {
-	int version;
-	int content_type;
-	const uint8_t *digest_algors;
-	const uint8_t *content;
-	const uint8_t *certs;
-	const uint8_t *crls;
-	const uint8_t *signer_infos;
-	size_t digest_algors_len;
-	size_t content_len;
-	size_t certs_len;
-	size_t crls_len;
-	size_t signer_infos_len;
+	const X509_NAME *issuer;
+	const uint8_t *serial_number;
+	size_t serial_number_len;
+	uint8_t attrs[128];
+	size_t attrs_len = 0;
+	uint8_t header[8];
+	size_t header_len = 0;
+	uint8_t *p;
+	SM2_SIGN_CTX sign_ctx;
+	uint8_t sig[SM2_MAX_SIGNATURE_SIZE];
+	size_t siglen;
 
-	/*
-	if (asn1_sequence_from_der(&data, &datalen, &signed_data, &signed_data_len) != 1
-		|| signed_data_len > 0) {
+	cms_issuer_and_serial_number_from_certificate(&issuer, &serial_number, &serial_number_len, cert);
+
+	p = attrs;
+	if (cms_signed_attrs_to_der(content_type, dgst, &p, &attrs_len) != 1) {
 		error_print();
 		return -1;
 	}
-	if (asn1_int_from_der(&version, &data, &datalen) != 1
-		|| asn1_set_from_der(&digest_algors, &digest_algors_len, &data, &datalen) != 1
-		|| cms_content_info_from_der(&content_type, &content, &content_len, &data, &datalen) != 1
-		|| asn1_implicit_set_from_der(0, &certs, &certs_len, &data, &datalen) < 0
-		|| asn1_implicit_set_from_der(1, &crls, &crls_len, &data, &datalen) < 0
-		|| asn1_set_from_der(&signer_infos, &signer_infos_len, &data, &datalen) != 1) {
+	// signed as SET OF, not with the [0] IMPLICIT tag used in SignerInfo
+	p = header;
+	asn1_set_header_to_der(attrs_len, &p, &header_len);
+	if (sm2_sign_init(&sign_ctx, sign_key, SM2_DEFAULT_ID) != 1
+		|| sm2_sign_update(&sign_ctx, header, header_len) != 1
+		|| sm2_sign_update(&sign_ctx, attrs, attrs_len) != 1
+		|| sm2_sign_finish(&sign_ctx, sig, &siglen) != 1) {
+		memset(&sign_ctx, 0, sizeof(sign_ctx));
 		error_print();
 		return -1;
 	}
+	memset(&sign_ctx, 0, sizeof(sign_ctx));
 
-	len = signer_infos_len;
-
-	while (len > 0) {
-		cms_signer_info_from_der();
-
-
-		cms_signer_info_match();
-
-		cms_signer_info_verify();
-
+	if (cms_signer_info_to_der(issuer, serial_number, serial_number_len,
+		OID_sm3, attrs, attrs_len, sig, siglen, NULL, 0, out, outlen) != 1) {
+		error_print();
+		return -1;
 	}
-	*/
+	return 1;
+}
 
-	return -1;
+int cms_signed_data_sign_init(CMS_SIGNED_DATA_CTX *ctx, int content_type)
+{
+	if (!ctx || !cms_content_type_name(content_type)) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	sm3_init(&ctx->sm3_ctx);
+	ctx->content_type = content_type;
+	return 1;
 }
 
+int cms_signed_data_sign_update(CMS_SIGNED_DATA_CTX *ctx, const uint8_t *data, size_t datalen)
+{
+	if (!ctx || (!data && datalen)) {
+		error_print();
+		return -1;
+	}
+	sm3_update(&ctx->sm3_ctx, data, datalen);
+	return 1;
+}
 
+int cms_signed_data_sign_finish(CMS_SIGNED_DATA_CTX *ctx,
+	const SM2_KEY *sign_keys, const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	uint8_t *signer_infos, size_t *signer_infos_len, size_t maxlen)
+{
+	uint8_t dgst[32];
+	uint8_t buf[CMS_MAX_SIGNER_INFO_SIZE];
+	uint8_t *p;
+	size_t len;
+	size_t i;
 
+	if (!ctx || !sign_keys || !sign_certs || !sign_count || !signer_infos || !signer_infos_len) {
+		error_print();
+		return -1;
+	}
+	sm3_finish(&ctx->sm3_ctx, dgst);
 
-/*
+	*signer_infos_len = 0;
+	for (i = 0; i < sign_count; i++) {
+		p = buf;
+		len = 0;
+		if (cms_signer_info_sign_attrs_to_der(&sign_keys[i], &sign_certs[i],
+			ctx->content_type, dgst, &p, &len) != 1) {
+			error_print();
+			return -1;
+		}
+		if (len > maxlen - *signer_infos_len) {
+			error_print();
+			return -1;
+		}
+		memcpy(signer_infos + *signer_infos_len, buf, len);
+		*signer_infos_len += len;
+	}
+	return 1;
+}
 
+// Each call signs again and SM2 signatures vary in length, so a NULL output
+// pass does not give the length of a later call, see cms_sign().
+int cms_signed_data_sign_to_der(const SM2_KEY *sign_keys,
+	const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	int content_type, const uint8_t *content, size_t content_len,
+	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
+	uint8_t **out, size_t *outlen)
+{
+	CMS_SIGNED_DATA_CTX ctx;
+	int digest_algor = OID_sm3;
+	uint8_t *signer_infos;
+	const uint8_t *cp;
+	size_t signer_infos_len;
+	int ret = -1;
 
-SignedAndEnvelopedData ::= SEQUENCE {
-	version			INTEGER (1),
-	recipientInfos		SET OF RecipientInfo,
-	digestAlgorithms	SET OF AlgorithmIdentifier,
-	encryptedContentInfo	EncryptedContentInfo,
-	certificates		[0] IMPLICIT SET OF Certificate OPTIONAL,
-	crls			[1] IMPLICIT SET OF CertificateRevocationList OPTIONAL,
-	signerInfos		SET OF SignerInfo
+	if (!(signer_infos = malloc(sign_count * CMS_MAX_SIGNER_INFO_SIZE))) {
+		error_print();
+		return -1;
+	}
+	cp = signer_infos;
+	if (cms_signed_data_sign_init(&ctx, content_type) != 1
+		|| cms_signed_data_sign_update(&ctx, content, content_len) != 1
+		|| cms_signed_data_sign_finish(&ctx, sign_keys, sign_certs, sign_count,
+			signer_infos, &signer_infos_len, sign_count * CMS_MAX_SIGNER_INFO_SIZE) != 1
+		|| cms_signed_data_to_der(&digest_algor, 1, content_type, content, content_len,
+			sign_certs, sign_count, crls, crls_lens, crls_count,
+			&cp, &signer_infos_len, 1, out, outlen) != 1) {
+		error_print();
+		goto end;
+	}
+	ret = 1;
+end:
+	free(signer_infos);
+	return ret;
 }
- */
 
-
-int cms_signed_and_enveloped_data_to_der(void)
+// The certificates are only indexed, the signer public key is the only field decoded
+static int cms_signed_data_find_signer_public_key(SM2_KEY *pub_key,
+	const uint8_t *certs, size_t certs_len,
+	const X509_NAME *issuer, const uint8_t *serial_number, size_t serial_number_len)
 {
+	X509_CERT_VIEW view;
+	X509_NAME name;
+
+	while (certs_len) {
+		if (x509_cert_view_from_der(&view, &certs, &certs_len) != 1) {
+			error_print();
+			return -1;
+		}
+		if (view.serial_len == serial_number_len
+			&& memcmp(view.der + view.serial, serial_number, serial_number_len) == 0
+			&& x509_cert_view_get_issuer(&view, &name) == 1
+			&& x509_name_equ(&name, issuer) == 1) {
+			if (x509_cert_view_get_public_key(&view, pub_key) != 1) {
+				error_print();
+				return -1;
+			}
+			return 1;
+		}
+	}
+	error_puts("signer certificate not found");
 	return -1;
 }
 
-int cms_signed_and_enveloped_data_from_der(void)
+int cms_signed_data_verify_init(CMS_SIGNED_DATA_CTX *ctx)
 {
-	return -1;
+	if (!ctx) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	sm3_init(&ctx->sm3_ctx);
+	return 1;
 }
 
-int cms_signed_and_enveloped_data_print(void)
+int cms_signed_data_verify_update(CMS_SIGNED_DATA_CTX *ctx, const uint8_t *data, size_t datalen)
 {
-	return -1;
+	return cms_signed_data_sign_update(ctx, data, datalen);
 }
 
-int cms_signed_and_enveloped_data_sign_encrypt_to_der(
-	const int *digest_algors, const size_t digset_algors_count,
-	const X509_CERTIFICATE *sign_certs, size_t sign_count,
-	const uint8_t **crls, const size_t *crls_lens, const size_t crls_count,
-	const uint8_t **signer_infos, size_t *signer_infos_lens, size_t signer_infos_count,
-	const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
-	int content_type, const uint8_t *content, size_t content_len,
-	const uint8_t *shared_info1, size_t shared_info1_len,
-	const uint8_t *shared_info2, size_t shared_info2_len,
-	uint8_t **out, size_t *outlen)
+static int cms_signed_data_digest_fd(CMS_SIGNED_DATA_CTX *ctx, int fd)
 {
-/*
-	size_t len = 0;
-	SM4_KEY sm4_key;
-	uint8_t enc_key[16];
-	uint8_t enc_iv[16];
-	uint8_t enced_key[rcpt_count][256 + 16];
-	uint8_t enced_content_info[content_len + 512];
-	size_t enced_content_info_len;
-
-	rand_bytes(enc_key, 16);
-	rand_bytes(enc_iv, 16);
+	uint8_t *buf;
+	ssize_t n;
+	int ret = -1;
 
-	size_t i;
-	for (i = 0; i < rcpt_count; i++) {
-		const SM2_KEY *sm2_key = x509_certificate_get_public_key(rcpt_certs[i]);
-		sm2_encrypt(sm2_key, enc_key, 16, enced_key[i], enced_key_len[i]);
+	if (!(buf = malloc(CMS_FILE_CHUNK_SIZE))) {
+		error_print();
+		return -1;
 	}
-
+	for (;;) {
+		if ((n = read(fd, buf, CMS_FILE_CHUNK_SIZE)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error_print();
+			goto end;
+		}
+		if (n == 0) {
+			break;
+		}
+		sm3_update(&ctx->sm3_ctx, buf, (size_t)n);
+	}
+	ret = 1;
+end:
+	free(buf);
+	return ret;
+}
+
+int cms_signed_data_digest_file(CMS_SIGNED_DATA_CTX *ctx, const char *file)
+{
+	int fd;
+	struct stat st;
+	uint8_t *map;
+	size_t size;
+	size_t off;
+	size_t n;
+	int ret = -1;
+
+	if (!ctx || !file) {
+		error_print();
+		return -1;
+	}
+	if ((fd = open(file, O_RDONLY)) < 0) {
+		error_print();
+		return -1;
+	}
+	if (fstat(fd, &st) != 0) {
+		error_print();
+		goto end;
+	}
+	// pipes, devices and files larger than the address space are read in chunks
+	if (!S_ISREG(st.st_mode) || (uint64_t)st.st_size > SIZE_MAX) {
+		ret = cms_signed_data_digest_fd(ctx, fd);
+		goto end;
+	}
+	if ((size = (size_t)st.st_size) == 0) {
+		ret = 1;
+		goto end;
+	}
+	if ((map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		ret = cms_signed_data_digest_fd(ctx, fd);
+		goto end;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+	for (off = 0; off < size; off += n) {
+		n = size - off < CMS_FILE_CHUNK_SIZE ? size - off : CMS_FILE_CHUNK_SIZE;
+		sm3_update(&ctx->sm3_ctx, map + off, n);
+		// keep the resident set constant for large files
+		madvise(map + off, n, MADV_DONTNEED);
+	}
+	munmap(map, size);
+	ret = 1;
+end:
+	close(fd);
+	return ret;
+}
+
+int cms_signed_data_verify_finish(CMS_SIGNED_DATA_CTX *ctx,
+	const uint8_t *signed_data, size_t signed_data_len)
+{
+	const uint8_t *digest_algors;
+	size_t digest_algors_len;
+	int content_type;
+	const uint8_t *content;
+	size_t content_len;
+	const uint8_t *certs = NULL;
+	size_t certs_len = 0;
+	const uint8_t *crls = NULL;
+	size_t crls_len = 0;
+	const uint8_t *signer_infos;
+	size_t signer_infos_len;
+	uint8_t dgst[32];
+	SM2_KEY pub_key;
+
+	if (!ctx || !signed_data || !signed_data_len) {
+		error_print();
+		return -1;
+	}
+	if (cms_signed_data_from_der(&digest_algors, &digest_algors_len,
+		&content_type, &content, &content_len,
+		&certs, &certs_len, &crls, &crls_len,
+		&signer_infos, &signer_infos_len,
+		&signed_data, &signed_data_len) != 1
+		|| signed_data_len) {
+		error_print();
+		return -1;
+	}
+	if (!signer_infos_len) {
+		error_print();
+		return -1;
+	}
+	sm3_finish(&ctx->sm3_ctx, dgst);
+
+	while (signer_infos_len) {
+		X509_NAME issuer;
+		const uint8_t *serial_number;
+		size_t serial_number_len;
+		int digest_algor;
+		int sign_algor;
+		const uint8_t *authed_attrs = NULL;
+		size_t authed_attrs_len = 0;
+		const uint8_t *unauthed_attrs = NULL;
+		size_t unauthed_attrs_len = 0;
+		const uint8_t *sig;
+		size_t siglen;
+		uint8_t header[8];
+		uint8_t *p = header;
+		size_t header_len = 0;
+		SM2_SIGN_CTX verify_ctx;
+
+		if (cms_signer_info_from_der(&issuer, &serial_number, &serial_number_len,
+			&digest_algor, &authed_attrs, &authed_attrs_len,
+			&sign_algor, &sig, &siglen,
+			&unauthed_attrs, &unauthed_attrs_len,
+			&signer_infos, &signer_infos_len) != 1) {
+			error_print();
+			return -1;
+		}
+		if (digest_algor != OID_sm3 || sign_algor != OID_sm2sign_with_sm3) {
+			error_print();
+			return -1;
+		}
+		if (!authed_attrs) {
+			error_puts("SignerInfo without signed attributes");
+			return -1;
+		}
+		if (cms_signed_attrs_check(authed_attrs, authed_attrs_len, content_type, dgst) != 1
+			|| cms_signed_data_find_signer_public_key(&pub_key, certs, certs_len,
+				&issuer, serial_number, serial_number_len) != 1) {
+			error_print();
+			return -1;
+		}
+		asn1_set_header_to_der(authed_attrs_len, &p, &header_len);
+		if (sm2_verify_init(&verify_ctx, &pub_key, SM2_DEFAULT_ID) != 1
+			|| sm2_verify_update(&verify_ctx, header, header_len) != 1
+			|| sm2_verify_update(&verify_ctx, authed_attrs, authed_attrs_len) != 1
+			|| sm2_verify_finish(&verify_ctx, sig, siglen) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+	return 1;
+}
+
+int cms_signed_data_verify_from_der(const uint8_t *signed_data, size_t signed_data_len)
+{
+	CMS_SIGNED_DATA_CTX ctx;
+	const uint8_t *p = signed_data;
+	size_t len = signed_data_len;
+	const uint8_t *digest_algors, *certs, *crls, *signer_infos;
+	size_t digest_algors_len, certs_len, crls_len, signer_infos_len;
+	int content_type;
+	const uint8_t *content;
+	size_t content_len;
+	const uint8_t *data;
+	size_t datalen;
+
+	if (cms_signed_data_from_der(&digest_algors, &digest_algors_len,
+		&content_type, &content, &content_len,
+		&certs, &certs_len, &crls, &crls_len,
+		&signer_infos, &signer_infos_len,
+		&p, &len) != 1
+		|| len) {
+		error_print();
+		return -1;
+	}
+	if (!content) {
+		error_puts("detached content, use cms_signed_data_verify_init/update/finish");
+		return -1;
+	}
+	if (cms_signed_content_from_der(content_type, &data, &datalen, content, content_len) != 1
+		|| cms_signed_data_verify_init(&ctx) != 1
+		|| cms_signed_data_verify_update(&ctx, data, datalen) != 1
+		|| cms_signed_data_verify_finish(&ctx, signed_data, signed_data_len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+
+
+/*
+
+
+SignedAndEnvelopedData ::= SEQUENCE {
+	version			INTEGER (1),
+	recipientInfos		SET OF RecipientInfo,
+	digestAlgorithms	SET OF AlgorithmIdentifier,
+	encryptedContentInfo	EncryptedContentInfo,
+	certificates		[0] IMPLICIT SET OF Certificate OPTIONAL,
+	crls			[1] IMPLICIT SET OF CertificateRevocationList OPTIONAL,
+	signerInfos		SET OF SignerInfo
+}
+ */
+
+
+int cms_signed_and_enveloped_data_to_der(void)
+{
+	return -1;
+}
+
+int cms_signed_and_enveloped_data_from_der(void)
+{
+	return -1;
+}
+
+int cms_signed_and_enveloped_data_print(void)
+{
+	return -1;
+}
+
+int cms_signed_and_enveloped_data_sign_encrypt_to_der(
+	const int *digest_algors, const size_t digset_algors_count,
+	const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	const uint8_t **crls, const size_t *crls_lens, const size_t crls_count,
+	const uint8_t **signer_infos, size_t *signer_infos_lens, size_t signer_infos_count,
+	const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+	int content_type, const uint8_t *content, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	uint8_t **out, size_t *outlen)
+{
+/*
+	size_t len = 0;
+	SM4_KEY sm4_key;
+	uint8_t enc_key[16];
+	uint8_t enc_iv[16];
+	uint8_t enced_key[rcpt_count][256 + 16];
+	uint8_t enced_content_info[content_len + 512];
+	size_t enced_content_info_len;
+
+	rand_bytes(enc_key, 16);
+	rand_bytes(enc_iv, 16);
+
+	size_t i;
+	for (i = 0; i < rcpt_count; i++) {
+		const SM2_KEY *sm2_key = x509_certificate_get_public_key(rcpt_certs[i]);
+		sm2_encrypt(sm2_key, enc_key, 16, enced_key[i], enced_key_len[i]);
+	}
+
 	for (i = 0; i < rcpt_count; i++) {
 		x509_certificate_get_recipient_info(rcpt_cert,
 			&issuer,
@@ -1767,90 +2432,984 @@ int cms_seal(const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
 	const uint8_t *shared_info2, size_t shared_info2_len,
 	uint8_t *out, size_t *outlen)
 {
-	return -1;
+	SM4_KEY sm4_key;
+	uint8_t enc_key[16];
+	uint8_t enc_iv[16];
+	uint8_t *rcpt_infos = NULL;
+	size_t rcpt_infos_len;
+	size_t enveloped_data_len = 0;
+	size_t len = 0;
+	int ret = -1;
+
+	if (rand_bytes(enc_key, sizeof(enc_key)) != 1
+		|| rand_bytes(enc_iv, sizeof(enc_iv)) != 1) {
+		error_print();
+		return -1;
+	}
+	sm4_set_encrypt_key(&sm4_key, enc_key);
+
+	// wrap the key once, then encode twice
+	if (cms_recipient_infos_encrypt(rcpt_certs, rcpt_count,
+			enc_key, sizeof(enc_key), &rcpt_infos, &rcpt_infos_len) != 1
+		|| cms_enveloped_data_encrypt_with_key_to_der(rcpt_infos, rcpt_infos_len,
+			&sm4_key, enc_iv, content_type, content, content_len,
+			shared_info1, shared_info1_len, shared_info2, shared_info2_len,
+			NULL, &enveloped_data_len) != 1
+		|| cms_content_type_to_der(CMS_enveloped_data, NULL, &len) != 1
+		|| asn1_explicit_header_to_der(0, enveloped_data_len, NULL, &len) != 1) {
+		error_print();
+		goto end;
+	}
+	len += enveloped_data_len;
+	*outlen = 0;
+	if (asn1_sequence_header_to_der(len, &out, outlen) != 1
+		|| cms_content_type_to_der(CMS_enveloped_data, &out, outlen) != 1
+		|| asn1_explicit_header_to_der(0, enveloped_data_len, &out, outlen) != 1
+		|| cms_enveloped_data_encrypt_with_key_to_der(rcpt_infos, rcpt_infos_len,
+			&sm4_key, enc_iv, content_type, content, content_len,
+			shared_info1, shared_info1_len, shared_info2, shared_info2_len,
+			&out, outlen) != 1) {
+		error_print();
+		goto end;
+	}
+	ret = 1;
+end:
+	memset(&sm4_key, 0, sizeof(sm4_key));
+	memset(enc_key, 0, sizeof(enc_key));
+	free(rcpt_infos);
+	return ret;
 }
 
 int cms_open(const SM2_KEY *sm2_key, const X509_CERTIFICATE *cert,
 	const uint8_t *enveloped_data, size_t enveloped_data_len,
 	int *content_type, uint8_t *content, size_t *content_len)
 {
-	return -1;
+	int type;
+	const uint8_t *data;
+	size_t datalen;
+
+	if (cms_content_info_from_der(&type, &data, &datalen,
+		&enveloped_data, &enveloped_data_len) != 1
+		|| enveloped_data_len
+		|| type != CMS_enveloped_data
+		|| !data) {
+		error_print();
+		return -1;
+	}
+	if (cms_enveloped_data_decrypt_from_der(sm2_key, cert, data, datalen,
+		content_type, content, content_len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
 }
 
 
 // SignedData
-int cms_sign(const SM2_KEY *sign_keys,
-	const X509_CERTIFICATE *sign_certs, size_t sign_count,
-	int content_type, const uint8_t *content, size_t content_len,
+// content = NULL encodes a detached SignedData, ctx already holds the content digest
+static int cms_signed_content_info_sign_finish(CMS_SIGNED_DATA_CTX *ctx,
+	const SM2_KEY *sign_keys, const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	const uint8_t *content, size_t content_len,
 	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
 	uint8_t *content_info, size_t *content_info_len)
 {
-	size_t len = 0;
+	int digest_algor = OID_sm3;
+	uint8_t *signer_infos;
+	const uint8_t *cp;
+	size_t signer_infos_len;
 	size_t signed_data_len = 0;
+	size_t len = 0;
+	int ret = -1;
 
-	if (cms_signed_data_sign_to_der(sign_keys, sign_certs, sign_count,
-		content_type, content, content_len, crls, crls_lens, crls_count,
-		NULL, &signed_data_len) != 1) {
+	if (!(signer_infos = malloc(sign_count * CMS_MAX_SIGNER_INFO_SIZE))) {
 		error_print();
 		return -1;
 	}
+	cp = signer_infos;
+
+	// sign once, then encode twice
+	if (cms_signed_data_sign_finish(ctx, sign_keys, sign_certs, sign_count,
+			signer_infos, &signer_infos_len, sign_count * CMS_MAX_SIGNER_INFO_SIZE) != 1
+		|| cms_signed_data_to_der(&digest_algor, 1, ctx->content_type, content, content_len,
+			sign_certs, sign_count, crls, crls_lens, crls_count,
+			&cp, &signer_infos_len, 1, NULL, &signed_data_len) != 1) {
+		error_print();
+		goto end;
+	}
 	if (cms_content_type_to_der(CMS_signed_data, NULL, &len) != 1
-		|| asn1_explicit_to_der(0, NULL, signed_data_len, NULL, &len) != 1
-		|| asn1_sequence_header_to_der(len, &content_info, content_info_len) != 1
+		|| asn1_explicit_header_to_der(0, signed_data_len, NULL, &len) != 1) {
+		error_print();
+		goto end;
+	}
+	len += signed_data_len;
+	*content_info_len = 0;
+	if (asn1_sequence_header_to_der(len, &content_info, content_info_len) != 1
 		|| cms_content_type_to_der(CMS_signed_data, &content_info, content_info_len) != 1
 		|| asn1_explicit_header_to_der(0, signed_data_len, &content_info, content_info_len) != 1
-		|| cms_signed_data_sign_to_der(sign_keys, sign_certs, sign_count,
-			content_type, content, content_len, crls, crls_lens, crls_count,
-			&content_info, content_info_len) != 1) {
+		|| cms_signed_data_to_der(&digest_algor, 1, ctx->content_type, content, content_len,
+			sign_certs, sign_count, crls, crls_lens, crls_count,
+			&cp, &signer_infos_len, 1, &content_info, content_info_len) != 1) {
 		error_print();
-		return -1;
+		goto end;
 	}
-	return 1;
+	ret = 1;
+end:
+	free(signer_infos);
+	return ret;
 }
 
-int cms_verify(int *content_type, const uint8_t **content, size_t *content_len,
-	const uint8_t *content_info, size_t content_info_len)
+// SignedData
+int cms_sign(const SM2_KEY *sign_keys,
+	const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	int content_type, const uint8_t *content, size_t content_len,
+	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
+	uint8_t *content_info, size_t *content_info_len)
 {
-	return -1;
-}
-
-
-
-
-
-
-
+	CMS_SIGNED_DATA_CTX ctx;
 
+	if (cms_signed_data_sign_init(&ctx, content_type) != 1
+		|| cms_signed_data_sign_update(&ctx, content, content_len) != 1
+		|| cms_signed_content_info_sign_finish(&ctx, sign_keys, sign_certs, sign_count,
+			content, content_len, crls, crls_lens, crls_count,
+			content_info, content_info_len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
 
-// SignedAndEnvelopedData
-int cms_sign_and_seal(
-	const SM2_KEY *sign_keys, const X509_CERTIFICATE *sign_certs, size_t sign_count,
-	const uint8_t *crls, const size_t *crls_lens, const size_t crls_count,
-	const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+int cms_sign_detached(const SM2_KEY *sign_keys,
+	const X509_CERTIFICATE *sign_certs, size_t sign_count,
 	int content_type, const uint8_t *content, size_t content_len,
-	const uint8_t *shared_info1, size_t shared_info1_len,
-	const uint8_t *shared_info2, size_t shared_info2_len,
-	uint8_t *out, size_t *outlen)
+	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
+	uint8_t *content_info, size_t *content_info_len)
 {
-	return -1;
-}
+	CMS_SIGNED_DATA_CTX ctx;
 
-int cms_open_and_verify()
-{
-	return -1;
+	if (cms_signed_data_sign_init(&ctx, content_type) != 1
+		|| cms_signed_data_sign_update(&ctx, content, content_len) != 1
+		|| cms_signed_content_info_sign_finish(&ctx, sign_keys, sign_certs, sign_count,
+			NULL, 0, crls, crls_lens, crls_count,
+			content_info, content_info_len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
 }
 
+int cms_sign_file(const SM2_KEY *sign_keys,
+	const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	int content_type, const char *file,
+	const uint8_t **crls, size_t *crls_lens, size_t crls_count,
+	uint8_t *content_info, size_t *content_info_len)
+{
+	CMS_SIGNED_DATA_CTX ctx;
 
+	if (cms_signed_data_sign_init(&ctx, content_type) != 1
+		|| cms_signed_data_digest_file(&ctx, file) != 1
+		|| cms_signed_content_info_sign_finish(&ctx, sign_keys, sign_certs, sign_count,
+			NULL, 0, crls, crls_lens, crls_count,
+			content_info, content_info_len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
 
+static int cms_signed_data_from_content_info(const uint8_t **signed_data, size_t *signed_data_len,
+	const uint8_t *content_info, size_t content_info_len)
+{
+	int type;
 
+	if (cms_content_info_from_der(&type, signed_data, signed_data_len,
+		&content_info, &content_info_len) != 1
+		|| content_info_len
+		|| type != CMS_signed_data
+		|| !*signed_data) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
 
+int cms_verify(int *content_type, const uint8_t **content, size_t *content_len,
+	const uint8_t *content_info, size_t content_info_len)
+{
+	const uint8_t *signed_data;
+	size_t signed_data_len;
+	const uint8_t *p;
+	size_t len;
+	const uint8_t *digest_algors, *certs, *crls, *signer_infos;
+	size_t digest_algors_len, certs_len, crls_len, signer_infos_len;
+	const uint8_t *data;
+	size_t datalen;
+
+	if (cms_signed_data_from_content_info(&signed_data, &signed_data_len,
+		content_info, content_info_len) != 1) {
+		error_print();
+		return -1;
+	}
+	if (cms_signed_data_verify_from_der(signed_data, signed_data_len) != 1) {
+		error_print();
+		return -1;
+	}
+	p = signed_data;
+	len = signed_data_len;
+	if (cms_signed_data_from_der(&digest_algors, &digest_algors_len,
+		content_type, &data, &datalen,
+		&certs, &certs_len, &crls, &crls_len,
+		&signer_infos, &signer_infos_len,
+		&p, &len) != 1
+		|| cms_signed_content_from_der(*content_type, content, content_len, data, datalen) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int cms_verify_detached(const uint8_t *content, size_t content_len,
+	const uint8_t *content_info, size_t content_info_len)
+{
+	CMS_SIGNED_DATA_CTX ctx;
+	const uint8_t *signed_data;
+	size_t signed_data_len;
+
+	if (cms_signed_data_from_content_info(&signed_data, &signed_data_len,
+		content_info, content_info_len) != 1
+		|| cms_signed_data_verify_init(&ctx) != 1
+		|| cms_signed_data_verify_update(&ctx, content, content_len) != 1
+		|| cms_signed_data_verify_finish(&ctx, signed_data, signed_data_len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int cms_verify_file(const char *file,
+	const uint8_t *content_info, size_t content_info_len)
+{
+	CMS_SIGNED_DATA_CTX ctx;
+	const uint8_t *signed_data;
+	size_t signed_data_len;
+
+	if (cms_signed_data_from_content_info(&signed_data, &signed_data_len,
+		content_info, content_info_len) != 1
+		|| cms_signed_data_verify_init(&ctx) != 1
+		|| cms_signed_data_digest_file(&ctx, file) != 1
+		|| cms_signed_data_verify_finish(&ctx, signed_data, signed_data_len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+
+
+
+
+
+
+
+
+// SignedAndEnvelopedData
+int cms_sign_and_seal(
+	const SM2_KEY *sign_keys, const X509_CERTIFICATE *sign_certs, size_t sign_count,
+	const uint8_t *crls, const size_t *crls_lens, const size_t crls_count,
+	const X509_CERTIFICATE *rcpt_certs, size_t rcpt_count,
+	int content_type, const uint8_t *content, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	uint8_t *out, size_t *outlen)
+{
+	return -1;
+}
+
+int cms_open_and_verify()
+{
+	return -1;
+}
+
+
+/*
+Streaming EncryptedData / EnvelopedData
+
+The encrypted content is placed after everything else but
+sharedInfo1/sharedInfo2, so the encoder writes the header before the first
+content byte. The decoder buffers one header element at a time, the fields
+before RecipientInfos, each RecipientInfo, then the EncryptedContentInfo
+fields before the content, and at the end the trailer, all at most
+CMS_STREAM_MAX_HEADER_SIZE bytes.
+*/
+
+enum {
+	CMS_STREAM_header	= 0,
+	CMS_STREAM_rcpt_infos	= 1,
+	CMS_STREAM_enced_content_info = 2,
+	CMS_STREAM_content	= 3,
+	CMS_STREAM_trailer	= 4,
+	CMS_STREAM_finished	= 5,
+};
+
+#define CMS_STREAM_BUF_SIZE	4096
+
+int cms_write_to_file(void *fp, const uint8_t *data, size_t datalen)
+{
+	if (fwrite(data, 1, datalen, (FILE *)fp) != datalen) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+static int cms_stream_write(CMS_STREAM_CTX *ctx, const uint8_t *data, size_t datalen)
+{
+	if (datalen && ctx->write(ctx->write_arg, data, datalen) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+static int cms_stream_encrypt_init(CMS_STREAM_CTX *ctx,
+	const uint8_t key[16], const uint8_t iv[16],
+	int enveloped, const uint8_t *rcpt_infos, size_t rcpt_infos_len,
+	int content_type, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	CMS_WRITE_FUNC write, void *write_arg)
+{
+	uint8_t header[256];
+	uint8_t *p;
+	size_t headerlen;
+	size_t enced_content_len;
+	size_t enced_content_info_len = 0;
+	size_t len = 0;
+
+	if (!ctx || !key || !iv || (!rcpt_infos && rcpt_infos_len) || !write) {
+		error_print();
+		return -1;
+	}
+	if (content_len > CMS_STREAM_MAX_CONTENT_SIZE) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->write = write;
+	ctx->write_arg = write_arg;
+	enced_content_len = (content_len/16 + 1) * 16;
+
+	// sharedInfo1 and sharedInfo2 are written by finish
+	if (cms_shared_infos_to_der(shared_info1, shared_info1_len,
+		shared_info2, shared_info2_len, NULL, &ctx->trailer_len) != 1
+		|| ctx->trailer_len > sizeof(ctx->buf)) {
+		error_print();
+		return -1;
+	}
+	p = ctx->buf;
+	if (cms_shared_infos_to_der(shared_info1, shared_info1_len,
+		shared_info2, shared_info2_len, &p, &ctx->buflen) != 1) {
+		error_print();
+		return -1;
+	}
+
+	if (cms_content_type_to_der(content_type, NULL, &enced_content_info_len) != 1
+		|| x509_encryption_algor_to_der(OID_sm4_cbc, iv, 16, NULL, &enced_content_info_len) != 1
+		|| asn1_header_to_der(ASN1_TAG_IMPLICIT(0), enced_content_len, NULL, &enced_content_info_len) != 1) {
+		error_print();
+		return -1;
+	}
+	enced_content_info_len += enced_content_len + ctx->trailer_len;
+
+	if (asn1_int_to_der(CMS_version, NULL, &len) != 1
+		|| (enveloped && asn1_set_header_to_der(rcpt_infos_len, NULL, &len) != 1)
+		|| asn1_sequence_header_to_der(enced_content_info_len, NULL, &len) != 1) {
+		error_print();
+		return -1;
+	}
+	// the outermost length has at most 4 bytes too
+	if (rcpt_infos_len > 0xffffffff
+		|| len + enced_content_info_len > 0xffffffff - rcpt_infos_len) {
+		error_print();
+		return -1;
+	}
+	len += rcpt_infos_len + enced_content_info_len;
+
+	p = header;
+	headerlen = 0;
+	if (asn1_sequence_header_to_der(len, &p, &headerlen) != 1
+		|| asn1_int_to_der(CMS_version, &p, &headerlen) != 1
+		|| (enveloped && asn1_set_header_to_der(rcpt_infos_len, &p, &headerlen) != 1)
+		|| cms_stream_write(ctx, header, headerlen) != 1
+		|| cms_stream_write(ctx, rcpt_infos, rcpt_infos_len) != 1) {
+		error_print();
+		return -1;
+	}
+	p = header;
+	headerlen = 0;
+	if (asn1_sequence_header_to_der(enced_content_info_len, &p, &headerlen) != 1
+		|| cms_content_type_to_der(content_type, &p, &headerlen) != 1
+		|| x509_encryption_algor_to_der(OID_sm4_cbc, iv, 16, &p, &headerlen) != 1
+		|| asn1_header_to_der(ASN1_TAG_IMPLICIT(0), enced_content_len, &p, &headerlen) != 1
+		|| cms_stream_write(ctx, header, headerlen) != 1) {
+		error_print();
+		return -1;
+	}
+
+	sm4_set_encrypt_key(&ctx->sm4_key, key);
+	memcpy(ctx->iv, iv, 16);
+	ctx->content_type = content_type;
+	ctx->content_len = content_len;
+	ctx->state = CMS_STREAM_content;
+	return 1;
+}
+
+int cms_encrypted_data_encrypt_init(CMS_STREAM_CTX *ctx,
+	const uint8_t key[16], const uint8_t iv[16],
+	int content_type, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	CMS_WRITE_FUNC write, void *write_arg)
+{
+	if (cms_stream_encrypt_init(ctx, key, iv, 0, NULL, 0,
+		content_type, content_len,
+		shared_info1, shared_info1_len,
+		shared_info2, shared_info2_len,
+		write, write_arg) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int cms_enveloped_data_encrypt_init(CMS_STREAM_CTX *ctx,
+	const uint8_t key[16], const uint8_t iv[16],
+	const uint8_t *rcpt_infos, size_t rcpt_infos_len,
+	int content_type, size_t content_len,
+	const uint8_t *shared_info1, size_t shared_info1_len,
+	const uint8_t *shared_info2, size_t shared_info2_len,
+	CMS_WRITE_FUNC write, void *write_arg)
+{
+	if (cms_stream_encrypt_init(ctx, key, iv, 1, rcpt_infos, rcpt_infos_len,
+		content_type, content_len,
+		shared_info1, shared_info1_len,
+		shared_info2, shared_info2_len,
+		write, write_arg) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int cms_stream_encrypt_update(CMS_STREAM_CTX *ctx, const uint8_t *in, size_t inlen)
+{
+	uint8_t out[CMS_STREAM_BUF_SIZE];
+	size_t nblocks;
+	size_t len;
+
+	if (!ctx || (!in && inlen) || ctx->state != CMS_STREAM_content) {
+		error_print();
+		return -1;
+	}
+	if (inlen > ctx->content_len - ctx->content_nbytes) {
+		error_puts("more content than given to init");
+		return -1;
+	}
+	ctx->content_nbytes += inlen;
+
+	if (ctx->block_nbytes) {
+		len = 16 - ctx->block_nbytes;
+		if (inlen < len) {
+			memcpy(ctx->block + ctx->block_nbytes, in, inlen);
+			ctx->block_nbytes += inlen;
+			return 1;
+		}
+		memcpy(ctx->block + ctx->block_nbytes, in, len);
+		sm4_cbc_encrypt(&ctx->sm4_key, ctx->iv, ctx->block, 1, ctx->iv);
+		if (cms_stream_write(ctx, ctx->iv, 16) != 1) {
+			error_print();
+			return -1;
+		}
+		in += len;
+		inlen -= len;
+		ctx->block_nbytes = 0;
+	}
+	while (inlen >= 16) {
+		nblocks = inlen/16;
+		if (nblocks > sizeof(out)/16) {
+			nblocks = sizeof(out)/16;
+		}
+		sm4_cbc_encrypt(&ctx->sm4_key, ctx->iv, in, nblocks, out);
+		memcpy(ctx->iv, out + 16 * (nblocks - 1), 16);
+		if (cms_stream_write(ctx, out, 16 * nblocks) != 1) {
+			error_print();
+			return -1;
+		}
+		in += 16 * nblocks;
+		inlen -= 16 * nblocks;
+	}
+	if (inlen) {
+		memcpy(ctx->block, in, inlen);
+		ctx->block_nbytes = inlen;
+	}
+	return 1;
+}
+
+int cms_stream_encrypt_finish(CMS_STREAM_CTX *ctx)
+{
+	int padding;
+
+	if (!ctx || ctx->state != CMS_STREAM_content) {
+		error_print();
+		return -1;
+	}
+	if (ctx->content_nbytes != ctx->content_len) {
+		error_puts("less content than given to init");
+		return -1;
+	}
+	padding = 16 - ctx->block_nbytes;
+	memset(ctx->block + ctx->block_nbytes, padding, padding);
+	sm4_cbc_encrypt(&ctx->sm4_key, ctx->iv, ctx->block, 1, ctx->iv);
+	if (cms_stream_write(ctx, ctx->iv, 16) != 1
+		|| cms_stream_write(ctx, ctx->buf, ctx->buflen) != 1) {
+		error_print();
+		return -1;
+	}
+	memset(&ctx->sm4_key, 0, sizeof(SM4_KEY));
+	memset(ctx->block, 0, sizeof(ctx->block));
+	ctx->state = CMS_STREAM_finished;
+	return 1;
+}
+
+int cms_encrypted_data_decrypt_init(CMS_STREAM_CTX *ctx, const uint8_t key[16],
+	CMS_WRITE_FUNC write, void *write_arg)
+{
+	if (!ctx || !key || !write) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	sm4_set_decrypt_key(&ctx->sm4_key, key);
+	ctx->write = write;
+	ctx->write_arg = write_arg;
+	ctx->state = CMS_STREAM_header;
+	return 1;
+}
+
+int cms_enveloped_data_decrypt_init(CMS_STREAM_CTX *ctx,
+	const SM2_KEY *sm2_key, const X509_CERTIFICATE *cert,
+	CMS_WRITE_FUNC write, void *write_arg)
+{
+	if (!ctx || !sm2_key || !cert || !write) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->sm2_key = sm2_key;
+	ctx->cert = cert;
+	ctx->write = write;
+	ctx->write_arg = write_arg;
+	ctx->state = CMS_STREAM_header;
+	return 1;
+}
+
+// returns 0 if more input is needed
+static int cms_stream_header_from_der(int tag, size_t *len, const uint8_t **in, size_t *inlen)
+{
+	const uint8_t *p = *in;
+	size_t n = *inlen;
+	size_t nbytes;
+
+	if (n < 2) {
+		return 0;
+	}
+	if (*p != tag) {
+		error_print();
+		return -1;
+	}
+	p++;
+	n--;
+	if (*p < 128) {
+		*len = *p++;
+		n--;
+	} else {
+		nbytes = *p++ & 0x7f;
+		n--;
+		if (nbytes < 1 || nbytes > 4) {
+			error_print();
+			return -1;
+		}
+		if (n < nbytes) {
+			return 0;
+		}
+		*len = 0;
+		while (nbytes--) {
+			*len = (*len << 8) | *p++;
+			n--;
+		}
+	}
+	*in = p;
+	*inlen = n;
+	return 1;
+}
+
+static int cms_stream_tlv_from_der(int tag, const uint8_t **tlv, size_t *tlvlen,
+	const uint8_t **in, size_t *inlen)
+{
+	int ret;
+	const uint8_t *p = *in;
+	size_t n = *inlen;
+	size_t len;
+
+	if ((ret = cms_stream_header_from_der(tag, &len, &p, &n)) != 1) {
+		return ret;
+	}
+	if (n < len) {
+		return 0;
+	}
+	*tlv = *in;
+	*tlvlen = (p - *in) + len;
+	*in = p + len;
+	*inlen = n - len;
+	return 1;
+}
+
+// version and the RecipientInfos SET header, returns 0 if more input is needed
+static int cms_stream_decrypt_prefix(CMS_STREAM_CTX *ctx, const uint8_t **in, size_t *inlen)
+{
+	int ret;
+	const uint8_t *p = *in;
+	size_t n = *inlen;
+	const uint8_t *body;
+	size_t len;
+	const uint8_t *tlv;
+	size_t tlvlen;
+	int version;
+
+	if ((ret = cms_stream_header_from_der(ASN1_TAG_SEQUENCE, &len, &p, &n)) != 1) {
+		return ret;
+	}
+	body = p;
+	if ((ret = cms_stream_tlv_from_der(ASN1_TAG_INTEGER, &tlv, &tlvlen, &p, &n)) != 1) {
+		return ret;
+	}
+	if (asn1_int_from_der(&version, &tlv, &tlvlen) != 1 || version != CMS_version) {
+		error_print();
+		return -1;
+	}
+	if (ctx->sm2_key) {
+		if ((ret = cms_stream_header_from_der(ASN1_TAG_SET, &ctx->rcpt_infos_left, &p, &n)) != 1) {
+			return ret;
+		}
+	}
+	if (len < (size_t)(p - body) + ctx->rcpt_infos_left) {
+		error_print();
+		return -1;
+	}
+	ctx->header_left = len - (p - body) - ctx->rcpt_infos_left;
+	ctx->state = ctx->sm2_key ? CMS_STREAM_rcpt_infos : CMS_STREAM_enced_content_info;
+	*in = p;
+	*inlen = n;
+	return 1;
+}
+
+// one RecipientInfo, the key is taken from the first one for ctx->cert
+static int cms_stream_decrypt_rcpt_info(CMS_STREAM_CTX *ctx, const uint8_t **in, size_t *inlen)
+{
+	int ret;
+	const uint8_t *p = *in;
+	size_t n = *inlen;
+	const uint8_t *tlv;
+	size_t tlvlen;
+	uint8_t key[16];
+
+	if (!ctx->rcpt_infos_left) {
+		if (!ctx->have_key) {
+			error_puts("no RecipientInfo for the certificate");
+			return -1;
+		}
+		ctx->state = CMS_STREAM_enced_content_info;
+		return 1;
+	}
+	if ((ret = cms_stream_tlv_from_der(ASN1_TAG_SEQUENCE, &tlv, &tlvlen, &p, &n)) != 1) {
+		return ret;
+	}
+	if (tlvlen > ctx->rcpt_infos_left) {
+		error_print();
+		return -1;
+	}
+	ctx->rcpt_infos_left -= tlvlen;
+	if (!ctx->have_key) {
+		if ((ret = cms_recipient_info_decrypt(ctx->sm2_key, ctx->cert, &tlv, &tlvlen, key)) < 0) {
+			error_print();
+			return -1;
+		}
+		if (ret == 1) {
+			sm4_set_decrypt_key(&ctx->sm4_key, key);
+			memset(key, 0, sizeof(key));
+			ctx->have_key = 1;
+		}
+	}
+	*in = p;
+	*inlen = n;
+	return 1;
+}
+
+// EncryptedContentInfo up to the first content byte
+static int cms_stream_decrypt_enced_content_info(CMS_STREAM_CTX *ctx, const uint8_t **in, size_t *inlen)
+{
+	int ret;
+	const uint8_t *p = *in;
+	size_t n = *inlen;
+	const uint8_t *enced_content_info;
+	size_t enced_content_info_len;
+	const uint8_t *content_type;
+	size_t content_type_len;
+	const uint8_t *enc_algor;
+	size_t enc_algor_len;
+	size_t enced_content_len;
+	int algor;
+	uint32_t nodes[32];
+	size_t nodes_count;
+	const uint8_t *iv;
+	size_t ivlen;
 
+	if ((ret = cms_stream_header_from_der(ASN1_TAG_SEQUENCE, &enced_content_info_len, &p, &n)) != 1) {
+		return ret;
+	}
+	enced_content_info = p;
+	if ((ret = cms_stream_tlv_from_der(ASN1_TAG_OBJECT_IDENTIFIER, &content_type, &content_type_len, &p, &n)) != 1
+		|| (ret = cms_stream_tlv_from_der(ASN1_TAG_SEQUENCE, &enc_algor, &enc_algor_len, &p, &n)) != 1
+		|| (ret = cms_stream_header_from_der(ASN1_TAG_IMPLICIT(0), &enced_content_len, &p, &n)) != 1) {
+		return ret;
+	}
 
+	if (ctx->header_left != (size_t)(enced_content_info - *in) + enced_content_info_len
+		|| enced_content_info_len < (size_t)(p - enced_content_info) + enced_content_len) {
+		error_print();
+		return -1;
+	}
+	if (cms_content_type_from_der(&ctx->content_type, &content_type, &content_type_len) != 1
+		|| x509_encryption_algor_from_der(&algor, nodes, &nodes_count, &iv, &ivlen, &enc_algor, &enc_algor_len) != 1) {
+		error_print();
+		return -1;
+	}
+	if (algor != OID_sm4_cbc || !iv || ivlen != 16
+		|| enced_content_len < 16 || enced_content_len % 16) {
+		error_print();
+		return -1;
+	}
+	memcpy(ctx->iv, iv, 16);
+	ctx->content_len = enced_content_len;
+	ctx->trailer_len = enced_content_info_len - (p - enced_content_info) - enced_content_len;
+	if (ctx->trailer_len > sizeof(ctx->buf)) {
+		error_print();
+		return -1;
+	}
+	ctx->state = CMS_STREAM_content;
+	*in = p;
+	*inlen = n;
+	return 1;
+}
 
+// parsed elements are removed from ctx->buf, returns 0 if more input is needed
+static int cms_stream_decrypt_header(CMS_STREAM_CTX *ctx)
+{
+	int ret = 1;
+	const uint8_t *in = ctx->buf;
+	size_t inlen = ctx->buflen;
+
+	while (ret == 1 && ctx->state != CMS_STREAM_content) {
+		switch (ctx->state) {
+		case CMS_STREAM_header:
+			ret = cms_stream_decrypt_prefix(ctx, &in, &inlen);
+			break;
+		case CMS_STREAM_rcpt_infos:
+			ret = cms_stream_decrypt_rcpt_info(ctx, &in, &inlen);
+			break;
+		case CMS_STREAM_enced_content_info:
+			ret = cms_stream_decrypt_enced_content_info(ctx, &in, &inlen);
+			break;
+		default:
+			ret = -1;
+		}
+	}
+	if (ret < 0) {
+		error_print();
+		return -1;
+	}
+	memmove(ctx->buf, in, inlen);
+	ctx->buflen = inlen;
+	return ret;
+}
 
+// the last block is kept in ctx->block until more ciphertext or finish
+static int cms_stream_decrypt_content(CMS_STREAM_CTX *ctx, const uint8_t *in, size_t inlen)
+{
+	uint8_t out[CMS_STREAM_BUF_SIZE];
+	size_t nblocks;
+	size_t len;
 
+	while (inlen) {
+		if (ctx->block_nbytes == 16) {
+			sm4_cbc_decrypt(&ctx->sm4_key, ctx->iv, ctx->block, 1, out);
+			memcpy(ctx->iv, ctx->block, 16);
+			ctx->block_nbytes = 0;
+			if (cms_stream_write(ctx, out, 16) != 1) {
+				error_print();
+				return -1;
+			}
+		}
+		if (!ctx->block_nbytes && inlen > 16) {
+			nblocks = (inlen - 1)/16;
+			if (nblocks > sizeof(out)/16) {
+				nblocks = sizeof(out)/16;
+			}
+			sm4_cbc_decrypt(&ctx->sm4_key, ctx->iv, in, nblocks, out);
+			memcpy(ctx->iv, in + 16 * (nblocks - 1), 16);
+			if (cms_stream_write(ctx, out, 16 * nblocks) != 1) {
+				error_print();
+				return -1;
+			}
+			in += 16 * nblocks;
+			inlen -= 16 * nblocks;
+			continue;
+		}
+		len = 16 - ctx->block_nbytes;
+		if (len > inlen) {
+			len = inlen;
+		}
+		memcpy(ctx->block + ctx->block_nbytes, in, len);
+		ctx->block_nbytes += len;
+		in += len;
+		inlen -= len;
+	}
+	memset(out, 0, sizeof(out));
+	return 1;
+}
 
+int cms_stream_decrypt_update(CMS_STREAM_CTX *ctx, const uint8_t *in, size_t inlen)
+{
+	int ret;
+	size_t len;
+
+	if (!ctx || (!in && inlen)) {
+		error_print();
+		return -1;
+	}
+	while (inlen) {
+		switch (ctx->state) {
+		case CMS_STREAM_header:
+		case CMS_STREAM_rcpt_infos:
+		case CMS_STREAM_enced_content_info:
+			len = sizeof(ctx->buf) - ctx->buflen;
+			if (len > inlen) {
+				len = inlen;
+			}
+			memcpy(ctx->buf + ctx->buflen, in, len);
+			ctx->buflen += len;
+			in += len;
+			inlen -= len;
+			if ((ret = cms_stream_decrypt_header(ctx)) < 0) {
+				error_print();
+				return -1;
+			}
+			if (ret == 0) {
+				if (ctx->buflen == sizeof(ctx->buf)) {
+					error_puts("header element too long");
+					return -1;
+				}
+				break;
+			}
+			// the header ends in this input, what is left in buf is content
+			in -= ctx->buflen;
+			inlen += ctx->buflen;
+			ctx->buflen = 0;
+			break;
+
+		case CMS_STREAM_content:
+			len = ctx->content_len - ctx->content_nbytes;
+			if (len > inlen) {
+				len = inlen;
+			}
+			if (cms_stream_decrypt_content(ctx, in, len) != 1) {
+				error_print();
+				return -1;
+			}
+			ctx->content_nbytes += len;
+			in += len;
+			inlen -= len;
+			if (ctx->content_nbytes == ctx->content_len) {
+				ctx->state = CMS_STREAM_trailer;
+			}
+			break;
+
+		case CMS_STREAM_trailer:
+			if (inlen > ctx->trailer_len - ctx->buflen) {
+				error_puts("data after the end of encoding");
+				return -1;
+			}
+			memcpy(ctx->buf + ctx->buflen, in, inlen);
+			ctx->buflen += inlen;
+			inlen = 0;
+			break;
+
+		default:
+			error_print();
+			return -1;
+		}
+	}
+	return 1;
+}
+
+int cms_stream_decrypt_finish(CMS_STREAM_CTX *ctx, int *content_type,
+	const uint8_t **shared_info1, size_t *shared_info1_len,
+	const uint8_t **shared_info2, size_t *shared_info2_len)
+{
+	uint8_t block[16];
+	const uint8_t *p;
+	size_t len;
+	int padding;
+	int i;
+
+	if (!ctx || !content_type
+		|| !shared_info1 || !shared_info1_len || !shared_info2 || !shared_info2_len) {
+		error_print();
+		return -1;
+	}
+	if (ctx->state != CMS_STREAM_trailer || ctx->buflen != ctx->trailer_len) {
+		error_puts("incomplete input");
+		return -1;
+	}
+	sm4_cbc_decrypt(&ctx->sm4_key, ctx->iv, ctx->block, 1, block);
+	padding = block[15];
+	if (padding < 1 || padding > 16) {
+		error_print();
+		return -1;
+	}
+	for (i = 16 - padding; i < 16; i++) {
+		if (block[i] != padding) {
+			error_print();
+			return -1;
+		}
+	}
+	if (cms_stream_write(ctx, block, 16 - padding) != 1) {
+		error_print();
+		return -1;
+	}
+	memset(block, 0, sizeof(block));
 
-
-
-
+	*shared_info1 = *shared_info2 = NULL;
+	*shared_info1_len = *shared_info2_len = 0;
+	p = ctx->buf;
+	len = ctx->buflen;
+	if (asn1_implicit_octet_string_from_der(1, shared_info1, shared_info1_len, &p, &len) < 0
+		|| asn1_implicit_octet_string_from_der(2, shared_info2, shared_info2_len, &p, &len) < 0
+		|| len) {
+		error_print();
+		return -1;
+	}
+	*content_type = ctx->content_type;
+	memset(&ctx->sm4_key, 0, sizeof(SM4_KEY));
+	ctx->state = CMS_STREAM_finished;
+	return 1;
+}
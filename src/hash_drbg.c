@@ -182,7 +182,7 @@ static void drbg_add(uint8_t *R, const uint8_t *A, size_t seedlen)
 {
 	int temp = 0;
 	size_t i;
-	for (i = seedlen - 1; i >= 0; i--) {
+	for (i = seedlen; i-- > 0; ) {
 		temp += R[i] + A[i];
 		R[i] = temp & 0xff;
 		temp >>= 8;
@@ -193,7 +193,7 @@ static void drbg_add1(uint8_t *R, size_t seedlen)
 {
 	int temp = 1;
 	size_t i;
-	for (i = seedlen - 1; i >= 0; i--) {
+	for (i = seedlen; i-- > 0; ) {
 		temp += R[i];
 		R[i] = temp & 0xff;
 		temp >>= 8;
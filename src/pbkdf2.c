@@ -88,9 +88,224 @@
 #include <gmssl/digest.h>
 #include <gmssl/error.h>
 #include <gmssl/oid.h>
+#include <gmssl/sm3.h>
+#include <gmssl/sha2.h>
 #include "endian.h"
 #include "mem.h"
 
+/*
+Fast path for PRFs over a 64-byte block, 32-byte output hash (HMAC-SM3 and
+HMAC-SHA256). U_{i-1} and the inner hash both fit in one padded block, so
+U_i costs two compressions, from the states after (P ^ ipad) and (P ^ opad),
+without the generic HMAC_CTX. With SM3 the output blocks T_1, T_2, .. are
+computed SM3_LANES at a time by the multi-lane compression function.
+*/
+typedef void (*pbkdf2_compress_func)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+#define PBKDF2_FAST_BLOCK_SIZE	64
+#define PBKDF2_FAST_HASH_SIZE	32
+
+/* block = H || 0x80 || 0^* || bitlen(block || H), the message length is fixed */
+static void pbkdf2_fast_block_init(uint8_t block[64])
+{
+	memset(block, 0, PBKDF2_FAST_BLOCK_SIZE);
+	block[PBKDF2_FAST_HASH_SIZE] = 0x80;
+	PUTU64(block + PBKDF2_FAST_BLOCK_SIZE - 8,
+		(uint64_t)(PBKDF2_FAST_BLOCK_SIZE + PBKDF2_FAST_HASH_SIZE) * 8);
+}
+
+static void pbkdf2_fast_put_hash(uint8_t out[32], const uint32_t H[8])
+{
+	int j;
+	for (j = 0; j < 8; j++) {
+		PUTU32(out + j*4, H[j]);
+	}
+}
+
+static int pbkdf2_fast_prf_states(const DIGEST *algor, pbkdf2_compress_func compress,
+	const uint32_t iv[8], const char *pass, size_t passlen,
+	uint32_t ipad[8], uint32_t opad[8])
+{
+	uint8_t key[PBKDF2_FAST_BLOCK_SIZE] = {0};
+	size_t len;
+	int i;
+
+	if (passlen > PBKDF2_FAST_BLOCK_SIZE) {
+		if (digest(algor, (uint8_t *)pass, passlen, key, &len) != 1) {
+			error_print();
+			return -1;
+		}
+	} else {
+		memcpy(key, pass, passlen);
+	}
+	for (i = 0; i < PBKDF2_FAST_BLOCK_SIZE; i++) {
+		key[i] ^= 0x36;
+	}
+	memcpy(ipad, iv, 32);
+	compress(ipad, key, 1);
+	for (i = 0; i < PBKDF2_FAST_BLOCK_SIZE; i++) {
+		key[i] ^= 0x36 ^ 0x5c;
+	}
+	memcpy(opad, iv, 32);
+	compress(opad, key, 1);
+	memset(key, 0, sizeof(key));
+	return 1;
+}
+
+/* T = U_1 ^ .. ^ U_count, U holds U_1 */
+static void pbkdf2_fast_iterate(pbkdf2_compress_func compress,
+	const uint32_t ipad[8], const uint32_t opad[8], size_t count,
+	uint32_t U[8], uint32_t T[8])
+{
+	uint8_t block[PBKDF2_FAST_BLOCK_SIZE];
+	uint32_t state[8];
+	size_t i;
+	int j;
+
+	pbkdf2_fast_block_init(block);
+	memcpy(T, U, 32);
+	for (i = 1; i < count; i++) {
+		pbkdf2_fast_put_hash(block, U);
+		memcpy(state, ipad, sizeof(state));
+		compress(state, block, 1);
+		pbkdf2_fast_put_hash(block, state);
+		memcpy(U, opad, 32);
+		compress(U, block, 1);
+		for (j = 0; j < 8; j++) {
+			T[j] ^= U[j];
+		}
+	}
+	memset(block, 0, sizeof(block));
+	memset(state, 0, sizeof(state));
+}
+
+static void pbkdf2_fast_iterate_sm3_x4(const uint32_t ipad[8], const uint32_t opad[8],
+	size_t count, uint32_t U[SM3_LANES][8], uint32_t T[SM3_LANES][8])
+{
+	uint8_t blocks[SM3_LANES][PBKDF2_FAST_BLOCK_SIZE];
+	const uint8_t *data[SM3_LANES];
+	uint32_t state[SM3_LANES][8];
+	size_t i;
+	int l, j;
+
+	for (l = 0; l < SM3_LANES; l++) {
+		pbkdf2_fast_block_init(blocks[l]);
+		data[l] = blocks[l];
+	}
+	memcpy(T, U, sizeof(state));
+	for (i = 1; i < count; i++) {
+		for (l = 0; l < SM3_LANES; l++) {
+			pbkdf2_fast_put_hash(blocks[l], U[l]);
+			memcpy(state[l], ipad, 32);
+		}
+		sm3_compress_blocks_x4(state, data);
+		for (l = 0; l < SM3_LANES; l++) {
+			pbkdf2_fast_put_hash(blocks[l], state[l]);
+			memcpy(U[l], opad, 32);
+		}
+		sm3_compress_blocks_x4(U, data);
+		for (l = 0; l < SM3_LANES; l++) {
+			for (j = 0; j < 8; j++) {
+				T[l][j] ^= U[l][j];
+			}
+		}
+	}
+	memset(blocks, 0, sizeof(blocks));
+	memset(state, 0, sizeof(state));
+}
+
+/* returns 0 if digest has no fast path */
+static int pbkdf2_genkey_fast(const DIGEST *digest,
+	const char *pass, size_t passlen,
+	const uint8_t *salt, size_t saltlen, size_t count,
+	size_t outlen, uint8_t *out)
+{
+	pbkdf2_compress_func compress;
+	int lanes;
+	uint32_t iv[8];
+	uint32_t ipad[8], opad[8];
+	uint32_t U[SM3_LANES][8];
+	uint32_t T[SM3_LANES][8];
+	uint8_t U1[PBKDF2_FAST_HASH_SIZE];
+	uint8_t iter_be[4];
+	uint32_t iter = 1;
+	HMAC_CTX ctx_tmpl;
+	HMAC_CTX ctx;
+	size_t len;
+	int l, j;
+
+	if (digest == DIGEST_sm3()) {
+		SM3_CTX sm3_ctx;
+		sm3_init(&sm3_ctx);
+		memcpy(iv, sm3_ctx.digest, sizeof(iv));
+		compress = sm3_compress_blocks;
+		lanes = SM3_LANES;
+	} else if (digest == DIGEST_sha256()) {
+		SHA256_CTX sha256_ctx;
+		sha256_init(&sha256_ctx);
+		memcpy(iv, sha256_ctx.state, sizeof(iv));
+		compress = sha256_compress_blocks;
+		lanes = 1;
+	} else {
+		return 0;
+	}
+
+	if (pbkdf2_fast_prf_states(digest, compress, iv, pass, passlen, ipad, opad) != 1
+		|| hmac_init(&ctx_tmpl, digest, (uint8_t *)pass, passlen) != 1) {
+		error_print();
+		return -1;
+	}
+
+	while (outlen > 0) {
+
+		// a single remaining block is faster on the one-lane compression
+		if (outlen <= PBKDF2_FAST_HASH_SIZE) {
+			lanes = 1;
+		}
+
+		// U_1 = PRF(P, S || INT(i)) for the blocks of this round
+		for (l = 0; l < lanes; l++) {
+			PUTU32(iter_be, iter);
+			if (outlen > (size_t)l * PBKDF2_FAST_HASH_SIZE) {
+				iter++;
+			}
+			ctx = ctx_tmpl;
+			if (hmac_update(&ctx, salt, saltlen) != 1
+				|| hmac_update(&ctx, iter_be, sizeof(iter_be)) != 1
+				|| hmac_finish(&ctx, U1, &len) != 1) {
+				error_print();
+				return -1;
+			}
+			for (j = 0; j < 8; j++) {
+				U[l][j] = GETU32(U1 + j*4);
+			}
+		}
+
+		if (lanes == SM3_LANES) {
+			pbkdf2_fast_iterate_sm3_x4(ipad, opad, count, U, T);
+		} else {
+			pbkdf2_fast_iterate(compress, ipad, opad, count, U[0], T[0]);
+		}
+
+		for (l = 0; l < lanes && outlen > 0; l++) {
+			pbkdf2_fast_put_hash(U1, T[l]);
+			len = outlen < PBKDF2_FAST_HASH_SIZE ? outlen : PBKDF2_FAST_HASH_SIZE;
+			memcpy(out, U1, len);
+			out += len;
+			outlen -= len;
+		}
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&ctx_tmpl, 0, sizeof(ctx_tmpl));
+	memset(ipad, 0, sizeof(ipad));
+	memset(opad, 0, sizeof(opad));
+	memset(U, 0, sizeof(U));
+	memset(T, 0, sizeof(T));
+	memset(U1, 0, sizeof(U1));
+	return 1;
+}
+
 int pbkdf2_genkey(const DIGEST *digest,
 	const char *pass, size_t passlen,
 	const uint8_t *salt, size_t saltlen, size_t count,
@@ -103,6 +318,12 @@ int pbkdf2_genkey(const DIGEST *digest,
 	uint8_t tmp_block[64];
 	uint8_t key_block[64];
 	size_t len;
+	int ret;
+
+	if ((ret = pbkdf2_genkey_fast(digest, pass, passlen, salt, saltlen,
+		count, outlen, out)) != 0) {
+		return ret;
+	}
 
 	hmac_init(&ctx_tmpl, digest, (uint8_t *)pass, passlen);
 
@@ -17,68 +17,268 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <gmssl/pem.h>
 #include <gmssl/error.h>
 
 
-int pem_write(FILE *fp, const char *name, const uint8_t *data, size_t datalen)
+#define PEM_LINE_LEN	64
+
+static const char *pem_memmem(const char *s, size_t slen, const char *t, size_t tlen)
 {
-	int ret = 0;
-	BASE64_CTX ctx;
-	uint8_t b64[datalen * 2];
-	int len;
-
-	base64_encode_init(&ctx);
-	base64_encode_update(&ctx, data, (int)datalen, b64, &len);
-	base64_encode_finish(&ctx, b64 + len, &len);
-
-	ret += fprintf(fp, "-----BEGIN %s-----\n", name);
-	ret += fprintf(fp, "%s", (char *)b64);
-	ret += fprintf(fp, "-----END %s-----\n", name);
-	return ret;
+	const char *p;
+
+	while (slen >= tlen) {
+		if (!(p = memchr(s, t[0], slen - tlen + 1))) {
+			return NULL;
+		}
+		if (memcmp(p, t, tlen) == 0) {
+			return p;
+		}
+		slen -= p + 1 - s;
+		s = p + 1;
+	}
+	return NULL;
 }
 
-int pem_read(FILE *fp, const char *name, uint8_t *data, size_t *datalen)
+int pem_encode(const char *name, const uint8_t *data, size_t datalen, char *out, size_t *outlen)
+{
+	size_t namelen;
+	size_t len;
+
+	if (!name || (!data && datalen) || !outlen) {
+		error_print();
+		return -1;
+	}
+	namelen = strlen(name);
+	*outlen = sizeof("-----BEGIN -----\n") - 1 + namelen
+		+ base64_encoded_length(datalen, PEM_LINE_LEN)
+		+ sizeof("-----END -----\n") - 1 + namelen;
+	if (!out) {
+		return 1;
+	}
+	memcpy(out, "-----BEGIN ", 11); out += 11;
+	memcpy(out, name, namelen); out += namelen;
+	memcpy(out, "-----\n", 6); out += 6;
+	if (base64_encode(data, datalen, PEM_LINE_LEN, out, &len) != 1) {
+		error_print();
+		return -1;
+	}
+	out += len;
+	memcpy(out, "-----END ", 9); out += 9;
+	memcpy(out, name, namelen); out += namelen;
+	memcpy(out, "-----\n", 6);
+	return 1;
+}
+
+int pem_decode(const char *name, uint8_t *data, size_t *datalen, size_t maxlen,
+	const char **in, size_t *inlen)
 {
-	char line[80];
 	char begin_line[80];
 	char end_line[80];
-	int len;
-	BASE64_CTX ctx;
+	size_t begin_len, end_len;
+	const char *begin, *body, *end, *next;
+	size_t body_len;
+	uint8_t *buf = NULL;
+	size_t len;
 
-	snprintf(begin_line, sizeof(begin_line), "-----BEGIN %s-----\n", name);
-	snprintf(end_line, sizeof(end_line), "-----END %s-----\n", name);
+	if (!name || !data || !datalen || !in || !(*in) || !inlen) {
+		error_print();
+		return -1;
+	}
+	if (strlen(name) > sizeof(begin_line) - sizeof("-----BEGIN -----")) {
+		error_print();
+		return -1;
+	}
+	begin_len = snprintf(begin_line, sizeof(begin_line), "-----BEGIN %s-----", name);
+	end_len = snprintf(end_line, sizeof(end_line), "-----END %s-----", name);
 
-	if (!fgets(line, sizeof(line), fp)) {
-		//FIXME: feof 判断是不是文件结束了呢
+	if (!(begin = pem_memmem(*in, *inlen, begin_line, begin_len))) {
 		return 0;
 	}
+	body = begin + begin_len;
+	if (!(end = pem_memmem(body, *inlen - (body - *in), end_line, end_len))) {
+		error_print();
+		return -1;
+	}
+	body_len = end - body;
+	next = end + end_len;
+	while (next < *in + *inlen && (*next == '\r' || *next == '\n')) {
+		next++;
+	}
+
+	// the estimate counts line breaks, decode aside if it does not fit
+	if (body_len / 4 * 3 <= maxlen) {
+		if (base64_decode(body, body_len, data, datalen) != 1) {
+			error_print();
+			return -1;
+		}
+	} else {
+		if (!(buf = malloc(body_len / 4 * 3 + 3))) {
+			error_print();
+			return -1;
+		}
+		if (base64_decode(body, body_len, buf, &len) != 1
+			|| len > maxlen) {
+			free(buf);
+			error_print();
+			return -1;
+		}
+		memcpy(data, buf, len);
+		*datalen = len;
+		free(buf);
+	}
+	*inlen -= next - *in;
+	*in = next;
+	return 1;
+}
 
-	if (strcmp(line, begin_line) != 0) {
-		// FIXME: 这里是不是应该容忍一些错误呢？
+int pem_map_file(const char *file, const char **data, size_t *datalen)
+{
+	int fd;
+	struct stat st;
+	void *p;
+
+	if (!file || !data || !datalen) {
+		error_print();
+		return -1;
+	}
+	if ((fd = open(file, O_RDONLY)) < 0) {
 		error_print();
 		return -1;
 	}
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size > SIZE_MAX) {
+		close(fd);
+		error_print();
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		*data = "";
+		*datalen = 0;
+		return 1;
+	}
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		error_print();
+		return -1;
+	}
+	madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+	*data = p;
+	*datalen = (size_t)st.st_size;
+	return 1;
+}
+
+void pem_unmap_file(const char *data, size_t datalen)
+{
+	if (data && datalen) {
+		munmap((void *)data, datalen);
+	}
+}
+
+int pem_write(FILE *fp, const char *name, const uint8_t *data, size_t datalen)
+{
+	char *buf;
+	size_t len;
+
+	if (pem_encode(name, data, datalen, NULL, &len) != 1) {
+		error_print();
+		return -1;
+	}
+	if (!(buf = malloc(len))) {
+		error_print();
+		return -1;
+	}
+	if (pem_encode(name, data, datalen, buf, &len) != 1
+		|| fwrite(buf, 1, len, fp) != len) {
+		free(buf);
+		error_print();
+		return -1;
+	}
+	free(buf);
+	return (int)len;
+}
+
+static size_t pem_line_trim(const char *line, size_t len)
+{
+	while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'
+		|| line[len - 1] == ' ' || line[len - 1] == '\t')) {
+		len--;
+	}
+	return len;
+}
 
-	*datalen = 0;
+int pem_read(FILE *fp, const char *name, uint8_t *data, size_t *datalen)
+{
+	char begin_line[80];
+	char end_line[80];
+	size_t begin_len, end_len;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t n;
+	size_t len;
+	char *body = NULL;
+	size_t body_len = 0;
+	size_t body_size = 0;
+	int ret = -1;
+
+	if (strlen(name) > sizeof(begin_line) - sizeof("-----BEGIN -----")) {
+		error_print();
+		return -1;
+	}
+	begin_len = snprintf(begin_line, sizeof(begin_line), "-----BEGIN %s-----", name);
+	end_len = snprintf(end_line, sizeof(end_line), "-----END %s-----", name);
 
-	base64_decode_init(&ctx);
+	// blank lines before the block are skipped
+	do {
+		if ((n = getline(&line, &line_size, fp)) < 0) {
+			ret = 0;
+			goto end;
+		}
+		len = pem_line_trim(line, (size_t)n);
+	} while (len == 0);
+	if (len != begin_len || memcmp(line, begin_line, begin_len) != 0) {
+		error_print();
+		goto end;
+	}
 
 	for (;;) {
-		if (!fgets(line, sizeof(line), fp)) {
+		if ((n = getline(&line, &line_size, fp)) < 0) {
 			error_print();
-			return -1;
+			goto end;
 		}
-		if (strcmp(line, end_line) == 0) {
+		len = pem_line_trim(line, (size_t)n);
+		if (len == end_len && memcmp(line, end_line, end_len) == 0) {
 			break;
 		}
-
-		base64_decode_update(&ctx, (uint8_t *)line, strlen(line), data, &len);
-		data += len;
-		*datalen += len;
+		if (body_len + len > body_size) {
+			char *p;
+			size_t size = body_size ? body_size * 2 : 4096;
+			while (size < body_len + len) {
+				size *= 2;
+			}
+			if (!(p = realloc(body, size))) {
+				error_print();
+				goto end;
+			}
+			body = p;
+			body_size = size;
+		}
+		memcpy(body + body_len, line, len);
+		body_len += len;
 	}
 
-	base64_decode_finish(&ctx, data, &len);
-	*datalen += len;
-	return 1;
+	if (base64_decode(body, body_len, data, datalen) != 1) {
+		error_print();
+		goto end;
+	}
+	ret = 1;
+end:
+	free(line);
+	free(body);
+	return ret;
 }
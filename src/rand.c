@@ -18,16 +18,214 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+#include <gmssl/sm3.h>
+#include <gmssl/digest.h>
+#include <gmssl/hash_drbg.h>
+#include <gmssl/sm4_ctr_drbg.h>
 #include <gmssl/rand.h>
 #include <gmssl/error.h>
 
+/*
+Each thread has its own DRBG seeded from the OS, small requests are served
+from a buffer of DRBG output so rand_bytes() is a memcpy most of the time.
+The DRBG is reseeded after RAND_RESEED_INTERVAL output bytes, and in a child
+process after fork(), detected through a pthread_atfork() counter.
+
+The DRBG is the SM3 Hash_DRBG, or the faster SM4 CTR_DRBG when built with
+RAND_SM4_CTR_DRBG.
+*/
+#define RAND_BUF_SIZE		256
+#define RAND_RESEED_INTERVAL	(1 << 20)
+
+#ifdef RAND_SM4_CTR_DRBG
+typedef SM4_CTR_DRBG RAND_DRBG;
+#else
+typedef HASH_DRBG RAND_DRBG;
+#endif
+
+typedef struct {
+	RAND_DRBG drbg;
+	uint8_t buf[RAND_BUF_SIZE];
+	size_t buf_len;
+	uint64_t output_len;
+	unsigned int fork_count;
+	int seeded;
+} RAND_STATE;
+
+static __thread RAND_STATE rand_state;
+static volatile unsigned int rand_fork_count = 0;
+static pthread_once_t rand_once = PTHREAD_ONCE_INIT;
+
+static void rand_atfork_child(void)
+{
+	rand_fork_count++;
+}
+
+static void rand_register_atfork(void)
+{
+	pthread_atfork(NULL, NULL, rand_atfork_child);
+}
+
+int rand_seed_bytes(uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n;
+#ifdef __linux__
+		n = getrandom(buf, len, 0);
+		if (n < 0 && errno == ENOSYS)
+#else
+		n = -1;
+#endif
+		{
+			int fd;
+			if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) < 0) {
+				error_print();
+				return -1;
+			}
+			n = read(fd, buf, len);
+			close(fd);
+		}
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error_print();
+			return -1;
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+	return 1;
+}
+
+static int rand_drbg_init(RAND_DRBG *drbg, const uint8_t entropy[48],
+	const uint8_t *personalstr, size_t personalstr_len)
+{
+#ifdef RAND_SM4_CTR_DRBG
+	return sm4_ctr_drbg_init(drbg, entropy, 32, entropy + 32, 16,
+		personalstr, personalstr_len);
+#else
+	return hash_drbg_init(drbg, DIGEST_sm3(), entropy, 32, entropy + 32, 16,
+		personalstr, personalstr_len);
+#endif
+}
+
+static int rand_drbg_reseed(RAND_DRBG *drbg, const uint8_t entropy[48],
+	const uint8_t *additional, size_t additional_len)
+{
+#ifdef RAND_SM4_CTR_DRBG
+	return sm4_ctr_drbg_reseed(drbg, entropy, 48, additional, additional_len);
+#else
+	return hash_drbg_reseed(drbg, entropy, 48, additional, additional_len);
+#endif
+}
+
+static int rand_drbg_generate(RAND_DRBG *drbg, size_t outlen, uint8_t *out)
+{
+#ifdef RAND_SM4_CTR_DRBG
+	while (outlen > 0) {
+		size_t len = outlen < SM4_CTR_DRBG_MAX_REQUEST_SIZE ? outlen : SM4_CTR_DRBG_MAX_REQUEST_SIZE;
+		if (sm4_ctr_drbg_generate(drbg, NULL, 0, len, out) != 1) {
+			return -1;
+		}
+		out += len;
+		outlen -= len;
+	}
+	return 1;
+#else
+	return hash_drbg_generate(drbg, NULL, 0, outlen, out);
+#endif
+}
+
+static int rand_state_seed(RAND_STATE *st)
+{
+	uint8_t entropy[48];
+	struct {
+		pid_t pid;
+		const void *thread;
+		unsigned int fork_count;
+	} personal;
+	int ret;
+
+	if (rand_seed_bytes(entropy, sizeof(entropy)) != 1) {
+		error_print();
+		return -1;
+	}
+	memset(&personal, 0, sizeof(personal));
+	personal.pid = getpid();
+	personal.thread = st;
+	personal.fork_count = rand_fork_count;
+
+	if (st->seeded) {
+		ret = rand_drbg_reseed(&st->drbg, entropy, (uint8_t *)&personal, sizeof(personal));
+	} else {
+		ret = rand_drbg_init(&st->drbg, entropy, (uint8_t *)&personal, sizeof(personal));
+	}
+	memset(entropy, 0, sizeof(entropy));
+	if (ret != 1) {
+		error_print();
+		return -1;
+	}
+	memset(st->buf, 0, sizeof(st->buf));
+	st->buf_len = 0;
+	st->output_len = 0;
+	st->fork_count = personal.fork_count;
+	st->seeded = 1;
+	return 1;
+}
+
 int rand_bytes(uint8_t *buf, size_t len)
 {
-	FILE *fp;
-	if (!(fp = fopen("/dev/urandom", "rb"))) {
+	RAND_STATE *st = &rand_state;
+	size_t n;
+
+	if (!buf) {
 		error_print();
 		return -1;
 	}
-	fread(buf, 1, len, fp);
+	if (!st->seeded
+		|| st->fork_count != rand_fork_count
+		|| st->output_len >= RAND_RESEED_INTERVAL) {
+		pthread_once(&rand_once, rand_register_atfork);
+		if (rand_state_seed(st) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+	st->output_len += len;
+
+	// served bytes are wiped from the buffer, the buffer is consumed from its end
+	n = len < st->buf_len ? len : st->buf_len;
+	memcpy(buf, st->buf + st->buf_len - n, n);
+	memset(st->buf + st->buf_len - n, 0, n);
+	st->buf_len -= n;
+	buf += n;
+	len -= n;
+
+	if (len >= RAND_BUF_SIZE) {
+		if (rand_drbg_generate(&st->drbg, len, buf) != 1) {
+			error_print();
+			return -1;
+		}
+		return 1;
+	}
+	if (len > 0) {
+		if (rand_drbg_generate(&st->drbg, RAND_BUF_SIZE, st->buf) != 1) {
+			error_print();
+			return -1;
+		}
+		st->buf_len = RAND_BUF_SIZE;
+		memcpy(buf, st->buf + st->buf_len - len, len);
+		memset(st->buf + st->buf_len - len, 0, len);
+		st->buf_len -= len;
+	}
 	return 1;
 }
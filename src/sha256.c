@@ -45,7 +45,7 @@ static const uint32_t K[64] = {
 	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
 };
 
-static void sha256_compress_blocks(uint32_t state[8],
+void sha256_compress_blocks(uint32_t state[8],
 	const unsigned char *data, size_t blocks)
 {
 	uint32_t A;
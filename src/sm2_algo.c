@@ -1475,36 +1475,92 @@ int sm2_point_from_signature(SM2_POINT *point, const SM2_SIGNATURE *sig)
 	return -1;
 }
 
-int sm2_kdf(const uint8_t *in, size_t inlen, size_t outlen, uint8_t *out)
-{
-	SM3_CTX ctx;
-	uint8_t counter_be[4];
-	uint8_t dgst[SM3_DIGEST_SIZE];
-	uint32_t counter = 1;
-	size_t len;
+/*
+The hash input of every output block is in || counter, so the full blocks of
+`in` are compressed once and only the tail (for SM2 x2 || y2 is exactly one
+block, the tail is the padded counter) is compressed for each counter, up to
+SM3_LANES counters at a time.
+*/
+void sm2_kdf_init(SM2_KDF_CTX *ctx, const uint8_t *in, size_t inlen)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	sm3_init(&ctx->sm3_ctx);
+	sm3_update(&ctx->sm3_ctx, in, inlen);
+	ctx->counter = 1;
+}
+
+// fill ctx->keystream with the next `lanes` output blocks
+static void sm2_kdf_blocks(SM2_KDF_CTX *ctx, size_t lanes)
+{
+	uint8_t tail[SM3_LANES][SM3_BLOCK_SIZE * 2];
+	const uint8_t *data[SM3_LANES];
+	uint32_t digest[SM3_LANES][8];
+	size_t taillen = ctx->sm3_ctx.num;
+	size_t tailblocks = (taillen + 4 + 1 + 8 + SM3_BLOCK_SIZE - 1) / SM3_BLOCK_SIZE;
+	uint64_t nbits = ((uint64_t)ctx->sm3_ctx.nblocks * SM3_BLOCK_SIZE + taillen + 4) * 8;
+	size_t i, j;
+
+	// tail = in[rem] || counter || 0x80 || 0^* || bitlen(in || counter)
+	for (i = 0; i < lanes; i++) {
+		memset(tail[i], 0, sizeof(tail[i]));
+		memcpy(tail[i], ctx->sm3_ctx.block, taillen);
+		PUTU32(tail[i] + taillen, ctx->counter);
+		ctx->counter++;
+		tail[i][taillen + 4] = 0x80;
+		PUTU64(tail[i] + tailblocks * SM3_BLOCK_SIZE - 8, nbits);
+		memcpy(digest[i], ctx->sm3_ctx.digest, sizeof(digest[i]));
+	}
+
+	if (lanes > 1) {
+		for (j = 0; j < tailblocks; j++) {
+			for (i = 0; i < SM3_LANES; i++) {
+				data[i] = tail[i < lanes ? i : 0] + j * SM3_BLOCK_SIZE;
+			}
+			sm3_compress_blocks_x4(digest, data);
+		}
+	} else {
+		sm3_compress_blocks(digest[0], tail[0], tailblocks);
+	}
 
-	/*
-	size_t i; fprintf(stderr, "kdf input : ");
-	for (i = 0; i < inlen; i++) fprintf(stderr, "%02x", in[i]); fprintf(stderr, "\n");
-	*/
+	for (i = 0; i < lanes; i++) {
+		for (j = 0; j < 8; j++) {
+			PUTU32(ctx->keystream + i * SM3_DIGEST_SIZE + j * 4, digest[i][j]);
+		}
+	}
+	ctx->keystream_len = lanes * SM3_DIGEST_SIZE;
+	ctx->keystream_pos = 0;
 
-	while (outlen) {
-		PUTU32(counter_be, counter);
-		counter++;
+	memset(tail, 0, sizeof(tail));
+	memset(digest, 0, sizeof(digest));
+}
 
-		sm3_init(&ctx);
-		sm3_update(&ctx, in, inlen);
-		sm3_update(&ctx, counter_be, sizeof(counter_be));
-		sm3_finish(&ctx, dgst);
+void sm2_kdf_next(SM2_KDF_CTX *ctx, size_t outlen, uint8_t *out)
+{
+	size_t lanes, len;
 
-		len = outlen < SM3_DIGEST_SIZE ? outlen : SM3_DIGEST_SIZE;
-		memcpy(out, dgst, len);
+	while (outlen) {
+		if (ctx->keystream_pos == ctx->keystream_len) {
+			lanes = (outlen + SM3_DIGEST_SIZE - 1) / SM3_DIGEST_SIZE;
+			sm2_kdf_blocks(ctx, lanes < SM3_LANES ? lanes : SM3_LANES);
+		}
+		len = ctx->keystream_len - ctx->keystream_pos;
+		if (len > outlen) {
+			len = outlen;
+		}
+		memcpy(out, ctx->keystream + ctx->keystream_pos, len);
+		ctx->keystream_pos += len;
 		out += len;
 		outlen -= len;
 	}
+}
 
-	memset(&ctx, 0, sizeof(SM3_CTX));
-	memset(dgst, 0, sizeof(dgst));
+int sm2_kdf(const uint8_t *in, size_t inlen, size_t outlen, uint8_t *out)
+{
+	SM2_KDF_CTX ctx;
+
+	sm2_kdf_init(&ctx, in, inlen);
+	sm2_kdf_next(&ctx, outlen, out);
+	memset(&ctx, 0, sizeof(ctx));
 	return 1;
 }
 
@@ -1520,6 +1576,10 @@ int sm2_do_encrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, SM2_CIPH
 	if (!key || !in || !inlen || !out) {
 		return -1;
 	}
+	if (inlen > UINT32_MAX) {
+		error_print();
+		return -1;
+	}
 
 	// rand k in [1, n - 1]
 	do {
@@ -1614,9 +1674,240 @@ int sm2_do_decrypt(const SM2_KEY *key, const SM2_CIPHERTEXT *in, uint8_t *out, s
 		return -1;
 	}
 
+	*outlen = inlen;
+	return 1;
+}
+
+// x2y2 = x2 || y2, t = KDF(x2 || y2), C3 = Hash(x2 || M || y2)
+static void sm2_enc_ctx_start(SM2_ENC_CTX *ctx, const uint8_t x2y2[64])
+{
+	sm2_kdf_init(&ctx->kdf_ctx, x2y2, 64);
+	sm3_init(&ctx->sm3_ctx);
+	sm3_update(&ctx->sm3_ctx, x2y2, 32);
+	memcpy(ctx->y2, x2y2 + 32, 32);
+}
+
+static void sm2_enc_ctx_xor(SM2_ENC_CTX *ctx, int decrypt, const uint8_t *in, size_t inlen, uint8_t *out)
+{
+	uint8_t t[256];
+	size_t len, i;
+
+	while (inlen) {
+		len = inlen < sizeof(t) ? inlen : sizeof(t);
+		sm2_kdf_next(&ctx->kdf_ctx, len, t);
+		if (!decrypt) {
+			sm3_update(&ctx->sm3_ctx, in, len);
+		}
+		for (i = 0; i < len; i++) {
+			out[i] = in[i] ^ t[i];
+		}
+		if (decrypt) {
+			sm3_update(&ctx->sm3_ctx, out, len);
+		}
+		in += len;
+		out += len;
+		inlen -= len;
+	}
+	memset(t, 0, sizeof(t));
+}
+
+int sm2_encrypt_init(SM2_ENC_CTX *ctx, const SM2_KEY *key, int format, uint8_t *out, size_t *outlen)
+{
+	bignum_t k;
+	point_t _P, *P = &_P;
+	SM2_POINT C1;
+	uint8_t buf[64];
+
+	if (!ctx || !key || !out || !outlen
+		|| (format != SM2_C1C3C2 && format != SM2_C1C2C3)) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->format = format;
+
+	// rand k in [1, n - 1]
+	do {
+		bn_rand_range(k, SM2_N);
+	} while (bn_is_zero(k));
+
+	// C1 = k * G = (x1, y1)
+	point_mul_generator(P, k);
+	point_to_bytes(P, (uint8_t *)&C1);
+
+	// (x2, y2) = k * P
+	point_from_bytes(P, (uint8_t *)&key->public_key);
+	point_mul(P, k, P);
+	point_to_bytes(P, buf);
+	bn_clean(k);
+
+	sm2_enc_ctx_start(ctx, buf);
+	memset(buf, 0, sizeof(buf));
+
+	sm2_point_to_uncompressed_octets(&C1, out);
+	*outlen = SM2_C1_SIZE;
+	if (format == SM2_C1C3C2) {
+		memset(out + SM2_C1_SIZE, 0, SM2_C3_SIZE);
+		*outlen += SM2_C3_SIZE;
+	}
+	return 1;
+}
+
+int sm2_encrypt_update(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
+{
+	if (!ctx || (!in && inlen) || !out || !outlen) {
+		error_print();
+		return -1;
+	}
+	sm2_enc_ctx_xor(ctx, 0, in, inlen, out);
+	*outlen = inlen;
 	return 1;
 }
 
+int sm2_encrypt_finish(SM2_ENC_CTX *ctx, uint8_t *out, size_t *outlen)
+{
+	if (!ctx || !out || !outlen) {
+		error_print();
+		return -1;
+	}
+	sm3_update(&ctx->sm3_ctx, ctx->y2, 32);
+	sm3_finish(&ctx->sm3_ctx, out);
+	*outlen = SM2_C3_SIZE;
+	memset(ctx, 0, sizeof(*ctx));
+	return 1;
+}
+
+int sm2_decrypt_init(SM2_ENC_CTX *ctx, const SM2_KEY *key, int format)
+{
+	if (!ctx || !key
+		|| (format != SM2_C1C3C2 && format != SM2_C1C2C3)) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	memcpy(&ctx->key, key, sizeof(SM2_KEY));
+	ctx->format = format;
+	return 1;
+}
+
+// ctx->buf holds C1 (and C3), leaves C3 or nothing in ctx->buf
+static int sm2_decrypt_start(SM2_ENC_CTX *ctx)
+{
+	SM2_POINT C1;
+	bignum_t d;
+	point_t _P, *P = &_P;
+	uint8_t buf[64];
+
+	if (sm2_point_from_octets(&C1, ctx->buf, SM2_C1_SIZE) != 1
+		|| sm2_point_is_on_curve(&C1) != 1) {
+		error_print();
+		return -1;
+	}
+
+	// d * C1 = (x2, y2)
+	bn_from_bytes(d, ctx->key.private_key);
+	point_from_bytes(P, (uint8_t *)&C1);
+	point_mul(P, d, P);
+	bn_clean(d);
+	point_to_bytes(P, buf);
+	memset(&ctx->key, 0, sizeof(SM2_KEY));
+
+	sm2_enc_ctx_start(ctx, buf);
+	memset(buf, 0, sizeof(buf));
+
+	if (ctx->format == SM2_C1C3C2) {
+		memmove(ctx->buf, ctx->buf + SM2_C1_SIZE, SM2_C3_SIZE);
+		ctx->buflen = SM2_C3_SIZE;
+	} else {
+		ctx->buflen = 0;
+	}
+	ctx->state = 1;
+	return 1;
+}
+
+int sm2_decrypt_update(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
+{
+	size_t hdrlen, len;
+
+	if (!ctx || (!in && inlen) || !out || !outlen) {
+		error_print();
+		return -1;
+	}
+	*outlen = 0;
+
+	if (!ctx->state) {
+		hdrlen = SM2_C1_SIZE + (ctx->format == SM2_C1C3C2 ? SM2_C3_SIZE : 0);
+		len = hdrlen - ctx->buflen;
+		if (len > inlen) {
+			len = inlen;
+		}
+		memcpy(ctx->buf + ctx->buflen, in, len);
+		ctx->buflen += len;
+		in += len;
+		inlen -= len;
+		if (ctx->buflen < hdrlen) {
+			return 1;
+		}
+		if (sm2_decrypt_start(ctx) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+
+	if (ctx->format == SM2_C1C3C2) {
+		sm2_enc_ctx_xor(ctx, 1, in, inlen, out);
+		*outlen = inlen;
+		return 1;
+	}
+
+	// C1 || C2 || C3, the last SM2_C3_SIZE bytes received are held back as C3
+	if (ctx->buflen + inlen > SM2_C3_SIZE) {
+		len = ctx->buflen + inlen - SM2_C3_SIZE;
+		if (len > ctx->buflen) {
+			sm2_enc_ctx_xor(ctx, 1, ctx->buf, ctx->buflen, out);
+			sm2_enc_ctx_xor(ctx, 1, in, len - ctx->buflen, out + ctx->buflen);
+			in += len - ctx->buflen;
+			inlen -= len - ctx->buflen;
+			ctx->buflen = 0;
+		} else {
+			sm2_enc_ctx_xor(ctx, 1, ctx->buf, len, out);
+			memmove(ctx->buf, ctx->buf + len, ctx->buflen - len);
+			ctx->buflen -= len;
+		}
+		*outlen = len;
+	}
+	memcpy(ctx->buf + ctx->buflen, in, inlen);
+	ctx->buflen += inlen;
+	return 1;
+}
+
+int sm2_decrypt_finish(SM2_ENC_CTX *ctx)
+{
+	uint8_t hash[SM3_DIGEST_SIZE];
+	int ret = 1;
+
+	if (!ctx) {
+		error_print();
+		return -1;
+	}
+	if (!ctx->state || ctx->buflen != SM2_C3_SIZE) {
+		error_print();
+		ret = -1;
+		goto end;
+	}
+
+	// u = Hash(x2 || M || y2)
+	sm3_update(&ctx->sm3_ctx, ctx->y2, 32);
+	sm3_finish(&ctx->sm3_ctx, hash);
+	if (memcmp(ctx->buf, hash, SM3_DIGEST_SIZE) != 0) {
+		error_print();
+		ret = -1;
+	}
+end:
+	memset(ctx, 0, sizeof(*ctx));
+	return ret;
+}
+
 int sm2_ecdh(const SM2_KEY *key, const SM2_POINT *peer_public, SM2_POINT *out)
 {
 	bignum_t d;
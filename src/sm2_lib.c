@@ -71,12 +71,17 @@ int sm2_verify(const SM2_KEY *key, const uint8_t dgst[32], const uint8_t *der, s
 
 int sm2_encrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
 {
-	size_t clen = SM2_CIPHERTEXT_SIZE(inlen);
-	size_t cbuf[clen];
+	size_t cbuf[(SM2_CIPHERTEXT_SIZE(SM2_MAX_PLAINTEXT_SIZE) + sizeof(size_t) - 1)/sizeof(size_t)];
 	SM2_CIPHERTEXT *c = (SM2_CIPHERTEXT *)cbuf;
 
-	sm2_do_encrypt(key, in, inlen, c);
-
+	if (inlen > SM2_MAX_PLAINTEXT_SIZE) {
+		error_print();
+		return -1;
+	}
+	if (sm2_do_encrypt(key, in, inlen, c) != 1) {
+		error_print();
+		return -1;
+	}
 	*outlen = 0;
 	sm2_ciphertext_to_der(c, &out, outlen);
 	return 1;
@@ -84,11 +89,18 @@ int sm2_encrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *ou
 
 int sm2_decrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
 {
-	size_t cbuf[inlen];
+	size_t cbuf[(SM2_CIPHERTEXT_SIZE(SM2_MAX_PLAINTEXT_SIZE) + sizeof(size_t) - 1)/sizeof(size_t)];
 	SM2_CIPHERTEXT *c = (SM2_CIPHERTEXT *)cbuf;
 
-	sm2_ciphertext_from_der(c, &in, &inlen); // FIXME: 检查是否有剩余长度		
-	sm2_do_decrypt(key, c, out, outlen);
+	if (sm2_ciphertext_from_der(c, &in, &inlen) != 1
+		|| inlen > 0) {
+		error_print();
+		return -1;
+	}
+	if (sm2_do_decrypt(key, c, out, outlen) != 1) {
+		error_print();
+		return -1;
+	}
 	return 1;
 }
 
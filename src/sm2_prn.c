@@ -62,11 +62,12 @@ int sm2_print_signature(FILE *fp, const uint8_t *der, size_t derlen, int format,
 
 int sm2_print_ciphertext(FILE *fp, const uint8_t *der, size_t derlen, int format, int indent)
 {
-	uint8_t buf[512 /* derlen */] = {0}; //FIXME: add -std=c99 to CMakeList.txt
+	size_t buf[(SM2_CIPHERTEXT_SIZE(SM2_MAX_PLAINTEXT_SIZE) + sizeof(size_t) - 1)/sizeof(size_t)];
 	SM2_CIPHERTEXT *c = (SM2_CIPHERTEXT *)buf;
 	const uint8_t *p = der;
 	int i;
 
+	memset(buf, 0, sizeof(buf));
 	if (sm2_ciphertext_from_der(c, &p, &derlen) < 0) {
 		fprintf(stderr, "error: %s %d: invalid ciphertext DER encoding\n", __FILE__, __LINE__);
 	}
@@ -299,6 +299,92 @@ void sm3_compress_blocks(uint32_t digest[8], const uint8_t *data, size_t blocks)
 }
 
 
+/*
+Compress one block for each of SM3_LANES independent messages. With GCC or
+clang the lanes are the elements of a 128-bit vector, so the rounds are run
+on all messages at once with SSE2/NEON, otherwise the lanes are compressed
+one after the other.
+*/
+#if defined(__GNUC__)
+
+typedef uint32_t sm3_lanes_t __attribute__((vector_size(4 * SM3_LANES)));
+
+#define VROL32(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define VP0(x)		((x) ^ VROL32((x), 9) ^ VROL32((x),17))
+#define VP1(x)		((x) ^ VROL32((x),15) ^ VROL32((x),23))
+
+void sm3_compress_blocks_x4(uint32_t digest[SM3_LANES][8], const uint8_t *const data[SM3_LANES])
+{
+	sm3_lanes_t A, B, C, D, E, F, G, H;
+	sm3_lanes_t SS1, SS2, TT1, TT2;
+	sm3_lanes_t W[68];
+	int i, j;
+
+	for (j = 0; j < 16; j++) {
+		for (i = 0; i < SM3_LANES; i++) {
+			W[j][i] = GETU32(data[i] + j*4);
+		}
+	}
+	for (; j < 68; j++) {
+		W[j] = VP1(W[j - 16] ^ W[j - 9] ^ VROL32(W[j - 3], 15))
+			^ VROL32(W[j - 13], 7) ^ W[j - 6];
+	}
+
+	for (i = 0; i < SM3_LANES; i++) {
+		A[i] = digest[i][0];
+		B[i] = digest[i][1];
+		C[i] = digest[i][2];
+		D[i] = digest[i][3];
+		E[i] = digest[i][4];
+		F[i] = digest[i][5];
+		G[i] = digest[i][6];
+		H[i] = digest[i][7];
+	}
+
+	for (j = 0; j < 64; j++) {
+		SS1 = VROL32((VROL32(A, 12) + E + K[j]), 7);
+		SS2 = SS1 ^ VROL32(A, 12);
+		if (j < 16) {
+			TT1 = FF00(A, B, C) + D + SS2 + (W[j] ^ W[j + 4]);
+			TT2 = GG00(E, F, G) + H + SS1 + W[j];
+		} else {
+			TT1 = FF16(A, B, C) + D + SS2 + (W[j] ^ W[j + 4]);
+			TT2 = GG16(E, F, G) + H + SS1 + W[j];
+		}
+		D = C;
+		C = VROL32(B, 9);
+		B = A;
+		A = TT1;
+		H = G;
+		G = VROL32(F, 19);
+		F = E;
+		E = VP0(TT2);
+	}
+
+	for (i = 0; i < SM3_LANES; i++) {
+		digest[i][0] ^= A[i];
+		digest[i][1] ^= B[i];
+		digest[i][2] ^= C[i];
+		digest[i][3] ^= D[i];
+		digest[i][4] ^= E[i];
+		digest[i][5] ^= F[i];
+		digest[i][6] ^= G[i];
+		digest[i][7] ^= H[i];
+	}
+}
+
+#else
+
+void sm3_compress_blocks_x4(uint32_t digest[SM3_LANES][8], const uint8_t *const data[SM3_LANES])
+{
+	int i;
+	for (i = 0; i < SM3_LANES; i++) {
+		sm3_compress_blocks(digest[i], data[i], 1);
+	}
+}
+
+#endif
+
 void sm3_init(SM3_CTX *ctx)
 {
 	memset(ctx, 0, sizeof(*ctx));
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <gmssl/sm3.h>
 #include <gmssl/error.h>
+#include "endian.h"
 
 /**
  * HMAC_k(m) = H((k ^ opad) || H((k ^ ipad) || m))
@@ -40,26 +41,61 @@
 #define IPAD	0x36
 #define OPAD	0x5C
 
-void sm3_hmac_init(SM3_HMAC_CTX *ctx, const uint8_t *key, size_t key_len)
+void sm3_hmac_key_init(SM3_HMAC_KEY *hmac_key, const uint8_t *key, size_t key_len)
 {
+	SM3_CTX ctx;
+	uint8_t block[SM3_BLOCK_SIZE];
 	int i;
 
 	if (key_len <= SM3_BLOCK_SIZE) {
-		memcpy(ctx->key, key, key_len);
-		memset(ctx->key + key_len, 0, SM3_BLOCK_SIZE - key_len);
+		memcpy(block, key, key_len);
+		memset(block + key_len, 0, SM3_BLOCK_SIZE - key_len);
 	} else {
-		sm3_init(&ctx->sm3_ctx);
-		sm3_update(&ctx->sm3_ctx, key, key_len);
-		sm3_finish(&ctx->sm3_ctx, ctx->key);
-		memset(ctx->key + SM3_DIGEST_SIZE, 0,
+		sm3_init(&ctx);
+		sm3_update(&ctx, key, key_len);
+		sm3_finish(&ctx, block);
+		memset(block + SM3_DIGEST_SIZE, 0,
 			SM3_BLOCK_SIZE - SM3_DIGEST_SIZE);
 	}
+
+	for (i = 0; i < SM3_BLOCK_SIZE; i++) {
+		block[i] ^= IPAD;
+	}
+	sm3_init(&ctx);
+	sm3_compress_blocks(ctx.digest, block, 1);
+	memcpy(hmac_key->ipad_digest, ctx.digest, sizeof(ctx.digest));
+
 	for (i = 0; i < SM3_BLOCK_SIZE; i++) {
-		ctx->key[i] ^= IPAD;
+		block[i] ^= (IPAD ^ OPAD);
 	}
+	sm3_init(&ctx);
+	sm3_compress_blocks(ctx.digest, block, 1);
+	memcpy(hmac_key->opad_digest, ctx.digest, sizeof(ctx.digest));
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(block, 0, sizeof(block));
+}
+
+void sm3_hmac_key_cleanup(SM3_HMAC_KEY *hmac_key)
+{
+	memset(hmac_key, 0, sizeof(SM3_HMAC_KEY));
+}
+
+void sm3_hmac_init_with_key(SM3_HMAC_CTX *ctx, const SM3_HMAC_KEY *hmac_key)
+{
+	memset(&ctx->sm3_ctx, 0, sizeof(SM3_CTX));
+	memcpy(ctx->sm3_ctx.digest, hmac_key->ipad_digest, sizeof(ctx->sm3_ctx.digest));
+	ctx->sm3_ctx.nblocks = 1;
+	memcpy(ctx->opad_digest, hmac_key->opad_digest, sizeof(ctx->opad_digest));
+}
+
+void sm3_hmac_init(SM3_HMAC_CTX *ctx, const uint8_t *key, size_t key_len)
+{
+	SM3_HMAC_KEY hmac_key;
 
-	sm3_init(&ctx->sm3_ctx);
-	sm3_update(&ctx->sm3_ctx, ctx->key, SM3_BLOCK_SIZE);
+	sm3_hmac_key_init(&hmac_key, key, key_len);
+	sm3_hmac_init_with_key(ctx, &hmac_key);
+	sm3_hmac_key_cleanup(&hmac_key);
 }
 
 void sm3_hmac_update(SM3_HMAC_CTX *ctx, const uint8_t *data, size_t data_len)
@@ -67,22 +103,31 @@ void sm3_hmac_update(SM3_HMAC_CTX *ctx, const uint8_t *data, size_t data_len)
 	sm3_update(&ctx->sm3_ctx, data, data_len);
 }
 
+/* the outer hash input is one block after (key ^ opad): H(inner) || padding */
+static void sm3_hmac_outer_block(const uint8_t inner[SM3_DIGEST_SIZE], uint8_t block[SM3_BLOCK_SIZE])
+{
+	memcpy(block, inner, SM3_DIGEST_SIZE);
+	block[SM3_DIGEST_SIZE] = 0x80;
+	memset(block + SM3_DIGEST_SIZE + 1, 0, SM3_BLOCK_SIZE - SM3_DIGEST_SIZE - 1 - 8);
+	PUTU64(block + SM3_BLOCK_SIZE - 8, (uint64_t)(SM3_BLOCK_SIZE + SM3_DIGEST_SIZE) * 8);
+}
+
 void sm3_hmac_finish(SM3_HMAC_CTX *ctx, uint8_t mac[SM3_HMAC_SIZE])
 {
+	uint8_t block[SM3_BLOCK_SIZE];
 	int i;
-	for (i = 0; i < SM3_BLOCK_SIZE; i++) {
-		ctx->key[i] ^= (IPAD ^ OPAD);
-	}
-	sm3_finish(&ctx->sm3_ctx, mac);
-	sm3_init(&ctx->sm3_ctx);
-	sm3_update(&ctx->sm3_ctx, ctx->key, SM3_BLOCK_SIZE);
-	sm3_update(&ctx->sm3_ctx, mac, SM3_DIGEST_SIZE);
+
 	sm3_finish(&ctx->sm3_ctx, mac);
+	sm3_hmac_outer_block(mac, block);
+	sm3_compress_blocks(ctx->opad_digest, block, 1);
+	for (i = 0; i < SM3_STATE_WORDS; i++) {
+		PUTU32(mac + i*4, ctx->opad_digest[i]);
+	}
 	memset(ctx, 0, sizeof(*ctx));
 }
 
-void sm3_hmac(const uint8_t *data, size_t data_len,
-	const uint8_t *key, size_t key_len,
+void sm3_hmac(const uint8_t *key, size_t key_len,
+	const uint8_t *data, size_t data_len,
 	uint8_t mac[SM3_HMAC_SIZE])
 {
 	SM3_HMAC_CTX ctx;
@@ -90,3 +135,121 @@ void sm3_hmac(const uint8_t *data, size_t data_len,
 	sm3_hmac_update(&ctx, data, data_len);
 	sm3_hmac_finish(&ctx, mac);
 }
+
+/*
+Each lane runs one message at a time: the message blocks, then the padded
+tail blocks, then the outer block. A lane that is done takes the next
+message, so the lanes stay busy when the message lengths differ.
+*/
+typedef struct {
+	size_t index;
+	const uint8_t *data;
+	size_t nblocks;
+	uint8_t tail[2 * SM3_BLOCK_SIZE];
+	const uint8_t *tail_data;
+	size_t tail_nblocks;
+	int outer;
+	int active;
+} SM3_HMAC_LANE;
+
+static void sm3_hmac_lane_load(SM3_HMAC_LANE *lane, uint32_t digest[8], const SM3_HMAC_KEY *hmac_key,
+	size_t index, const uint8_t *data, size_t data_len)
+{
+	size_t rem = data_len % SM3_BLOCK_SIZE;
+
+	lane->index = index;
+	lane->data = data;
+	lane->nblocks = data_len / SM3_BLOCK_SIZE;
+	lane->outer = 0;
+	lane->active = 1;
+
+	// padding of (key ^ ipad) || data
+	if (rem) {
+		memcpy(lane->tail, data + data_len - rem, rem);
+	}
+	lane->tail[rem] = 0x80;
+	lane->tail_nblocks = rem < SM3_BLOCK_SIZE - 8 ? 1 : 2;
+	memset(lane->tail + rem + 1, 0, lane->tail_nblocks * SM3_BLOCK_SIZE - rem - 1 - 8);
+	PUTU64(lane->tail + lane->tail_nblocks * SM3_BLOCK_SIZE - 8,
+		((uint64_t)data_len + SM3_BLOCK_SIZE) * 8);
+	lane->tail_data = lane->tail;
+
+	memcpy(digest, hmac_key->ipad_digest, sizeof(hmac_key->ipad_digest));
+}
+
+void sm3_hmac_multi(const SM3_HMAC_KEY *hmac_key,
+	const uint8_t *const *data, const size_t *data_len, size_t n,
+	uint8_t (*mac)[SM3_HMAC_SIZE])
+{
+	static const uint8_t idle_block[SM3_BLOCK_SIZE] = {0};
+	SM3_HMAC_LANE lanes[SM3_LANES];
+	uint32_t digest[SM3_LANES][SM3_STATE_WORDS];
+	const uint8_t *blocks[SM3_LANES];
+	size_t next = 0;
+	int active;
+	int i, j;
+
+	for (i = 0; i < SM3_LANES; i++) {
+		lanes[i].active = 0;
+		if (next < n) {
+			sm3_hmac_lane_load(&lanes[i], digest[i], hmac_key, next, data[next], data_len[next]);
+			next++;
+		}
+	}
+
+	active = n > 0;
+	while (active) {
+		for (i = 0; i < SM3_LANES; i++) {
+			SM3_HMAC_LANE *lane = &lanes[i];
+
+			if (!lane->active) {
+				blocks[i] = idle_block;
+			} else if (lane->nblocks) {
+				blocks[i] = lane->data;
+				lane->data += SM3_BLOCK_SIZE;
+				lane->nblocks--;
+			} else {
+				blocks[i] = lane->tail_data;
+				lane->tail_data += SM3_BLOCK_SIZE;
+				lane->tail_nblocks--;
+			}
+		}
+
+		sm3_compress_blocks_x4(digest, blocks);
+
+		active = 0;
+		for (i = 0; i < SM3_LANES; i++) {
+			SM3_HMAC_LANE *lane = &lanes[i];
+
+			if (!lane->active || lane->nblocks || lane->tail_nblocks) {
+				active |= lane->active;
+				continue;
+			}
+			if (!lane->outer) {
+				uint8_t inner[SM3_DIGEST_SIZE];
+				for (j = 0; j < SM3_STATE_WORDS; j++) {
+					PUTU32(inner + j*4, digest[i][j]);
+				}
+				sm3_hmac_outer_block(inner, lane->tail);
+				lane->tail_data = lane->tail;
+				lane->tail_nblocks = 1;
+				lane->outer = 1;
+				memcpy(digest[i], hmac_key->opad_digest, sizeof(hmac_key->opad_digest));
+				active = 1;
+				continue;
+			}
+			for (j = 0; j < SM3_STATE_WORDS; j++) {
+				PUTU32(mac[lane->index] + j*4, digest[i][j]);
+			}
+			lane->active = 0;
+			if (next < n) {
+				sm3_hmac_lane_load(lane, digest[i], hmac_key, next, data[next], data_len[next]);
+				next++;
+				active = 1;
+			}
+		}
+	}
+
+	memset(lanes, 0, sizeof(lanes));
+	memset(digest, 0, sizeof(digest));
+}
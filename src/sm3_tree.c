@@ -0,0 +1,316 @@
+﻿/* 
+ *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <gmssl/sm3.h>
+#include <gmssl/error.h>
+#include "endian.h"
+
+
+#define SM3_TREE_LEAF_PREFIX	0x00
+#define SM3_TREE_NODE_PREFIX	0x01
+#define SM3_TREE_ROOT_PREFIX	0x02
+
+/* number of leaves handed to the pool at once, per thread */
+#define SM3_TREE_BATCH_LEAVES	8
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int num_threads;
+	int stop;
+
+	/* current batch, leaves [next, nleaves) are not yet taken */
+	const uint8_t *data;
+	size_t leaf_size;
+	size_t nleaves;
+	size_t next;
+	size_t done;
+	uint8_t (*dgsts)[SM3_DIGEST_SIZE];
+} SM3_TREE_POOL;
+
+static void sm3_tree_hash_leaf(const uint8_t *data, size_t datalen, uint8_t dgst[32])
+{
+	SM3_CTX ctx;
+	uint8_t prefix = SM3_TREE_LEAF_PREFIX;
+
+	sm3_init(&ctx);
+	sm3_update(&ctx, &prefix, 1);
+	sm3_update(&ctx, data, datalen);
+	sm3_finish(&ctx, dgst);
+}
+
+static void sm3_tree_hash_node(const uint8_t left[32], const uint8_t right[32], uint8_t dgst[32])
+{
+	SM3_CTX ctx;
+	uint8_t prefix = SM3_TREE_NODE_PREFIX;
+
+	sm3_init(&ctx);
+	sm3_update(&ctx, &prefix, 1);
+	sm3_update(&ctx, left, 32);
+	sm3_update(&ctx, right, 32);
+	sm3_finish(&ctx, dgst);
+}
+
+/* take leaves of the current batch until none is left, called with the lock held */
+static void sm3_tree_pool_work(SM3_TREE_POOL *pool)
+{
+	while (pool->next < pool->nleaves) {
+		size_t i = pool->next++;
+
+		pthread_mutex_unlock(&pool->lock);
+		sm3_tree_hash_leaf(pool->data + i * pool->leaf_size, pool->leaf_size, pool->dgsts[i]);
+		pthread_mutex_lock(&pool->lock);
+
+		if (++pool->done == pool->nleaves) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+	}
+}
+
+static void *sm3_tree_pool_thread(void *arg)
+{
+	SM3_TREE_POOL *pool = (SM3_TREE_POOL *)arg;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		if (pool->next < pool->nleaves) {
+			sm3_tree_pool_work(pool);
+		} else {
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void sm3_tree_pool_free(SM3_TREE_POOL *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->num_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->dgsts);
+	free(pool->threads);
+	free(pool);
+}
+
+/* the calling thread is one of the num_threads hashing threads */
+static SM3_TREE_POOL *sm3_tree_pool_new(int num_threads)
+{
+	SM3_TREE_POOL *pool;
+
+	if (!(pool = calloc(1, sizeof(*pool)))) {
+		error_print();
+		return NULL;
+	}
+	if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+		free(pool);
+		error_print();
+		return NULL;
+	}
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	if (!(pool->threads = calloc(num_threads - 1, sizeof(pthread_t)))
+		|| !(pool->dgsts = calloc((size_t)num_threads * SM3_TREE_BATCH_LEAVES, SM3_DIGEST_SIZE))) {
+		sm3_tree_pool_free(pool);
+		error_print();
+		return NULL;
+	}
+	for (pool->num_threads = 0; pool->num_threads < num_threads - 1; pool->num_threads++) {
+		if (pthread_create(&pool->threads[pool->num_threads], NULL,
+			sm3_tree_pool_thread, pool) != 0) {
+			sm3_tree_pool_free(pool);
+			error_print();
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+static void sm3_tree_pool_hash_leaves(SM3_TREE_POOL *pool,
+	const uint8_t *data, size_t leaf_size, size_t nleaves)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->data = data;
+	pool->leaf_size = leaf_size;
+	pool->nleaves = nleaves;
+	pool->next = 0;
+	pool->done = 0;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	sm3_tree_pool_work(pool);
+	while (pool->done < pool->nleaves) {
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	}
+	pool->nleaves = 0;
+	pool->next = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* leaf n (counting from 1) completes one subtree for every trailing zero bit of n */
+static void sm3_tree_push_leaf(SM3_TREE_CTX *ctx, const uint8_t dgst[32])
+{
+	uint64_t n;
+
+	memcpy(ctx->stack[ctx->stack_len++], dgst, SM3_DIGEST_SIZE);
+	for (n = ++ctx->nleaves; !(n & 1); n >>= 1) {
+		ctx->stack_len--;
+		sm3_tree_hash_node(ctx->stack[ctx->stack_len - 1], ctx->stack[ctx->stack_len],
+			ctx->stack[ctx->stack_len - 1]);
+	}
+}
+
+static void sm3_tree_leaf_init(SM3_TREE_CTX *ctx)
+{
+	uint8_t prefix = SM3_TREE_LEAF_PREFIX;
+
+	sm3_init(&ctx->leaf_ctx);
+	sm3_update(&ctx->leaf_ctx, &prefix, 1);
+	ctx->leaf_len = 0;
+}
+
+int sm3_tree_init(SM3_TREE_CTX *ctx, size_t leaf_size, int num_threads)
+{
+	if (!ctx || !leaf_size) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(SM3_TREE_CTX));
+	ctx->leaf_size = leaf_size;
+	sm3_tree_leaf_init(ctx);
+
+	if (num_threads > 1) {
+		if (!(ctx->pool = sm3_tree_pool_new(num_threads))) {
+			error_print();
+			return -1;
+		}
+	}
+	return 1;
+}
+
+int sm3_tree_update(SM3_TREE_CTX *ctx, const uint8_t *data, size_t datalen)
+{
+	SM3_TREE_POOL *pool = (SM3_TREE_POOL *)ctx->pool;
+	size_t len;
+
+	ctx->nbytes += datalen;
+
+	if (ctx->leaf_len) {
+		len = ctx->leaf_size - ctx->leaf_len;
+		if (len > datalen) {
+			len = datalen;
+		}
+		sm3_update(&ctx->leaf_ctx, data, len);
+		ctx->leaf_len += len;
+		data += len;
+		datalen -= len;
+
+		if (ctx->leaf_len == ctx->leaf_size) {
+			uint8_t dgst[32];
+			sm3_finish(&ctx->leaf_ctx, dgst);
+			sm3_tree_push_leaf(ctx, dgst);
+			sm3_tree_leaf_init(ctx);
+		}
+	}
+
+	if (pool) {
+		size_t max_leaves = (size_t)(pool->num_threads + 1) * SM3_TREE_BATCH_LEAVES;
+		size_t nleaves, i;
+
+		while ((nleaves = datalen / ctx->leaf_size) > 1) {
+			if (nleaves > max_leaves) {
+				nleaves = max_leaves;
+			}
+			sm3_tree_pool_hash_leaves(pool, data, ctx->leaf_size, nleaves);
+			for (i = 0; i < nleaves; i++) {
+				sm3_tree_push_leaf(ctx, pool->dgsts[i]);
+			}
+			data += nleaves * ctx->leaf_size;
+			datalen -= nleaves * ctx->leaf_size;
+		}
+	}
+
+	while (datalen >= ctx->leaf_size) {
+		uint8_t dgst[32];
+		sm3_tree_hash_leaf(data, ctx->leaf_size, dgst);
+		sm3_tree_push_leaf(ctx, dgst);
+		data += ctx->leaf_size;
+		datalen -= ctx->leaf_size;
+	}
+
+	if (datalen) {
+		sm3_update(&ctx->leaf_ctx, data, datalen);
+		ctx->leaf_len = datalen;
+	}
+	return 1;
+}
+
+int sm3_tree_finish(SM3_TREE_CTX *ctx, uint8_t dgst[SM3_DIGEST_SIZE])
+{
+	SM3_CTX sm3_ctx;
+	uint8_t prefix = SM3_TREE_ROOT_PREFIX;
+	uint8_t params[16];
+
+	if (ctx->leaf_len || !ctx->nleaves) {
+		sm3_finish(&ctx->leaf_ctx, dgst);
+		sm3_tree_push_leaf(ctx, dgst);
+	}
+	while (ctx->stack_len > 1) {
+		ctx->stack_len--;
+		sm3_tree_hash_node(ctx->stack[ctx->stack_len - 1], ctx->stack[ctx->stack_len],
+			ctx->stack[ctx->stack_len - 1]);
+	}
+
+	PUTU64(params, (uint64_t)ctx->leaf_size);
+	PUTU64(params + 8, ctx->nbytes);
+	sm3_init(&sm3_ctx);
+	sm3_update(&sm3_ctx, &prefix, 1);
+	sm3_update(&sm3_ctx, params, sizeof(params));
+	sm3_update(&sm3_ctx, ctx->stack[0], SM3_DIGEST_SIZE);
+	sm3_finish(&sm3_ctx, dgst);
+
+	/* the context can be reused for a new input */
+	ctx->nbytes = 0;
+	ctx->nleaves = 0;
+	ctx->stack_len = 0;
+	sm3_tree_leaf_init(ctx);
+	return 1;
+}
+
+void sm3_tree_cleanup(SM3_TREE_CTX *ctx)
+{
+	if (ctx) {
+		if (ctx->pool) {
+			sm3_tree_pool_free((SM3_TREE_POOL *)ctx->pool);
+		}
+		memset(ctx, 0, sizeof(SM3_TREE_CTX));
+	}
+}
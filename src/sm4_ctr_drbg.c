@@ -0,0 +1,263 @@
+﻿/* 
+ *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <gmssl/sm4.h>
+#include <gmssl/sm4_ctr_drbg.h>
+#include <gmssl/error.h>
+#include "endian.h"
+#include "mem.h"
+
+
+/* V = (V + 1) mod 2^128 */
+static void ctr_drbg_incr(uint8_t V[16])
+{
+	int i;
+	for (i = 15; i >= 0; i--) {
+		V[i]++;
+		if (V[i]) break;
+	}
+}
+
+/*
+Output Block_Encrypt(Key, V + 1) .. Block_Encrypt(Key, V + nblocks) and leave
+V = V + nblocks. The blocks are produced by the multi-block ctr32 kernel, which
+only counts in the low 32 bits, so the run is split where they wrap.
+*/
+static void ctr_drbg_keystream(const SM4_KEY *key, uint8_t V[16], size_t nblocks, uint8_t *out)
+{
+	while (nblocks > 0) {
+		uint32_t c3;
+		size_t n;
+
+		ctr_drbg_incr(V);
+		c3 = GETU32(V + 12);
+		n = nblocks;
+		if ((uint64_t)n > ((uint64_t)1 << 32) - c3) {
+			n = (size_t)(((uint64_t)1 << 32) - c3);
+		}
+		memset(out, 0, n * 16);
+		sm4_ctr32_encrypt_blocks(out, out, n, key, V);
+		PUTU32(V + 12, c3 + (uint32_t)(n - 1));
+
+		out += n * 16;
+		nblocks -= n;
+	}
+}
+
+/* CTR_DRBG_Update(provided_data, Key, V) */
+static void ctr_drbg_update(SM4_CTR_DRBG *drbg, const uint8_t provided_data[32])
+{
+	uint8_t temp[SM4_CTR_DRBG_SEED_SIZE];
+	size_t i;
+
+	ctr_drbg_keystream(&drbg->key, drbg->V, 2, temp);
+	if (provided_data) {
+		for (i = 0; i < sizeof(temp); i++) {
+			temp[i] ^= provided_data[i];
+		}
+	}
+	sm4_set_encrypt_key(&drbg->key, temp);
+	memcpy(drbg->V, temp + SM4_KEY_SIZE, SM4_BLOCK_SIZE);
+	memset(temp, 0, sizeof(temp));
+}
+
+/*
+Block_Cipher_df(in1 || in2 || in3, 256). seedlen = 2 * outlen, so the two BCC
+chains of step 9 run side by side in a single pass over the input.
+*/
+typedef struct {
+	SM4_KEY key;
+	uint8_t chain[2][16];
+	uint8_t block[16];
+	size_t num;
+} BCC_CTX;
+
+static void bcc_update(BCC_CTX *ctx, const uint8_t *data, size_t len)
+{
+	size_t n, i;
+
+	while (len > 0) {
+		n = 16 - ctx->num;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(ctx->block + ctx->num, data, n);
+		ctx->num += n;
+		data += n;
+		len -= n;
+		if (ctx->num == 16) {
+			for (i = 0; i < 2; i++) {
+				gmssl_memxor(ctx->chain[i], ctx->chain[i], ctx->block, 16);
+				sm4_encrypt(&ctx->key, ctx->chain[i], ctx->chain[i]);
+			}
+			ctx->num = 0;
+		}
+	}
+}
+
+static void block_cipher_df(const uint8_t *in1, size_t in1len,
+	const uint8_t *in2, size_t in2len,
+	const uint8_t *in3, size_t in3len,
+	uint8_t out[32])
+{
+	const uint8_t df_key[16] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	};
+	const uint8_t pad[16] = { 0x80 };
+	BCC_CTX ctx;
+	uint8_t LN[8];
+	uint8_t X[16];
+	SM4_KEY key;
+
+	/* chain_i = Block_Encrypt(K, IV_i), IV_i = i || 0^96 */
+	memset(&ctx, 0, sizeof(ctx));
+	sm4_set_encrypt_key(&ctx.key, df_key);
+	PUTU32(ctx.chain[1], 1);
+	sm4_encrypt(&ctx.key, ctx.chain[0], ctx.chain[0]);
+	sm4_encrypt(&ctx.key, ctx.chain[1], ctx.chain[1]);
+
+	/* S = L || N || input_string || 0x80 || 0^* */
+	PUTU32(LN, (uint32_t)(in1len + in2len + in3len));
+	PUTU32(LN + 4, SM4_CTR_DRBG_SEED_SIZE);
+	bcc_update(&ctx, LN, sizeof(LN));
+	bcc_update(&ctx, in1, in1len);
+	bcc_update(&ctx, in2, in2len);
+	bcc_update(&ctx, in3, in3len);
+	bcc_update(&ctx, pad, 16 - ctx.num);
+
+	/* K = leftmost(temp, keylen), X = next outlen bits of temp */
+	sm4_set_encrypt_key(&key, ctx.chain[0]);
+	memcpy(X, ctx.chain[1], 16);
+	sm4_encrypt(&key, X, out);
+	sm4_encrypt(&key, out, out + 16);
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&key, 0, sizeof(key));
+	memset(X, 0, sizeof(X));
+}
+
+int sm4_ctr_drbg_init(SM4_CTR_DRBG *drbg,
+	const uint8_t *entropy, size_t entropy_len,
+	const uint8_t *nonce, size_t nonce_len,
+	const uint8_t *personalstr, size_t personalstr_len)
+{
+	uint8_t seed_material[SM4_CTR_DRBG_SEED_SIZE];
+	const uint8_t zeros[SM4_KEY_SIZE] = {0};
+
+	if (!drbg || !entropy || !entropy_len) {
+		error_print();
+		return -1;
+	}
+
+	/* seed_material = Block_Cipher_df(entropy_input || nonce || personalization_string, seedlen) */
+	block_cipher_df(entropy, entropy_len, nonce, nonce_len,
+		personalstr, personalstr_len, seed_material);
+
+	/* Key = 0^keylen, V = 0^outlen, (Key, V) = CTR_DRBG_Update(seed_material, Key, V) */
+	memset(drbg, 0, sizeof(SM4_CTR_DRBG));
+	sm4_set_encrypt_key(&drbg->key, zeros);
+	ctr_drbg_update(drbg, seed_material);
+
+	/* reseed_counter = 1 */
+	drbg->reseed_counter = 1;
+
+	memset(seed_material, 0, sizeof(seed_material));
+	return 1;
+}
+
+int sm4_ctr_drbg_reseed(SM4_CTR_DRBG *drbg,
+	const uint8_t *entropy, size_t entropy_len,
+	const uint8_t *additional, size_t additional_len)
+{
+	uint8_t seed_material[SM4_CTR_DRBG_SEED_SIZE];
+
+	if (!drbg || !entropy || !entropy_len) {
+		error_print();
+		return -1;
+	}
+
+	/* seed_material = Block_Cipher_df(entropy_input || additional_input, seedlen) */
+	block_cipher_df(entropy, entropy_len, additional, additional_len,
+		NULL, 0, seed_material);
+
+	/* (Key, V) = CTR_DRBG_Update(seed_material, Key, V) */
+	ctr_drbg_update(drbg, seed_material);
+
+	/* reseed_counter = 1 */
+	drbg->reseed_counter = 1;
+
+	memset(seed_material, 0, sizeof(seed_material));
+	return 1;
+}
+
+int sm4_ctr_drbg_generate(SM4_CTR_DRBG *drbg,
+	const uint8_t *additional, size_t additional_len,
+	size_t outlen, uint8_t *out)
+{
+	uint8_t add[SM4_CTR_DRBG_SEED_SIZE];
+	uint8_t block[SM4_BLOCK_SIZE];
+	size_t nblocks;
+
+	if (!drbg || (!out && outlen)) {
+		error_print();
+		return -1;
+	}
+	if (outlen > SM4_CTR_DRBG_MAX_REQUEST_SIZE) {
+		error_print();
+		return -1;
+	}
+	if (drbg->reseed_counter > SM4_CTR_DRBG_RESEED_INTERVAL) {
+		return 0;
+	}
+
+	/* additional_input = Block_Cipher_df(additional_input, seedlen),
+	 * (Key, V) = CTR_DRBG_Update(additional_input, Key, V) */
+	if (additional && additional_len) {
+		block_cipher_df(additional, additional_len, NULL, 0, NULL, 0, add);
+		ctr_drbg_update(drbg, add);
+	} else {
+		additional = NULL;
+	}
+
+	/* returned_bits = leftmost(Block_Encrypt(Key, V + 1) || .., requested_number_of_bits) */
+	nblocks = outlen / SM4_BLOCK_SIZE;
+	ctr_drbg_keystream(&drbg->key, drbg->V, nblocks, out);
+	if (outlen % SM4_BLOCK_SIZE) {
+		ctr_drbg_keystream(&drbg->key, drbg->V, 1, block);
+		memcpy(out + nblocks * SM4_BLOCK_SIZE, block, outlen % SM4_BLOCK_SIZE);
+		memset(block, 0, sizeof(block));
+	}
+
+	/* (Key, V) = CTR_DRBG_Update(additional_input, Key, V) */
+	ctr_drbg_update(drbg, additional ? add : NULL);
+
+	/* reseed_counter = reseed_counter + 1 */
+	drbg->reseed_counter++;
+
+	memset(add, 0, sizeof(add));
+	return 1;
+}
+
+void sm4_ctr_drbg_cleanup(SM4_CTR_DRBG *drbg)
+{
+	if (drbg) {
+		memset(drbg, 0, sizeof(SM4_CTR_DRBG));
+	}
+}
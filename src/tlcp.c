@@ -96,35 +96,54 @@ int tlcp_record_get_handshake_server_key_exchange_pke(const uint8_t *record,
 	return 1;
 }
 
-int tlcp_certificate_chain_verify(const uint8_t *data, size_t datalen, FILE *ca_certs_fp, int depth)
+int tlcp_certificate_chain_verify(const uint8_t *data, size_t datalen,
+	X509_STORE *ca_store, FILE *ca_certs_fp, int depth)
 {
 	const uint8_t *certs;
 	size_t certslen;
 	const uint8_t *der;
 	size_t derlen;
-	X509_CERTIFICATE sign_cert;
-	X509_CERTIFICATE enc_cert;
-	X509_CERTIFICATE ca_cert;
+	X509_CERT_VIEW sign_cert;
+	X509_CERT_VIEW enc_cert;
+	X509_CERT_VIEW ca_cert;
+	X509_CERTIFICATE *anchor = NULL;
+	X509_NAME issuer;
+	SM2_KEY ca_pubkey;
+	uint8_t dgst[32];
+	uint64_t generation;
+	time_t not_after;
+	int ret;
 
 	if (tls_uint24array_from_bytes(&certs, &certslen, &data, &datalen) != 1
 		|| datalen > 0) {
 		error_print();
 		return -1;
 	}
+	if (ca_store && ca_store->cache) {
+		if ((ret = x509_store_chain_cache_lookup(ca_store, certs, certslen,
+			time(NULL), dgst, &generation)) < 0) {
+			error_print();
+			return -1;
+		} else if (ret == 1) {
+			return 1;
+		}
+	}
+	data = certs;
+	datalen = certslen;
 	if (tls_uint24array_from_bytes(&der, &derlen, &certs, &certslen) != 1
-		|| x509_certificate_from_der(&sign_cert, &der, &derlen) != 1
+		|| x509_cert_view_from_der(&sign_cert, &der, &derlen) != 1
 		|| derlen > 0) {
 		error_print();
 		return -1;
 	}
 	if (tls_uint24array_from_bytes(&der, &derlen, &certs, &certslen) != 1
-		|| x509_certificate_from_der(&enc_cert, &der, &derlen) != 1
+		|| x509_cert_view_from_der(&enc_cert, &der, &derlen) != 1
 		|| derlen > 0) {
 		error_print();
 		return -1;
 	}
-	if (x509_name_equ(&sign_cert.tbs_certificate.issuer,
-		&enc_cert.tbs_certificate.issuer) != 1) {
+	if (sign_cert.issuer_len != enc_cert.issuer_len
+		|| memcmp(sign_cert.der + sign_cert.issuer, enc_cert.der + enc_cert.issuer, sign_cert.issuer_len) != 0) {
 		error_print();
 		return -1;
 	}
@@ -133,28 +152,51 @@ int tlcp_certificate_chain_verify(const uint8_t *data, size_t datalen, FILE *ca_
 		const uint8_t *chain = certs;
 		size_t chainlen = certslen;
 		if (tls_uint24array_from_bytes(&der, &derlen, &certs, &certslen) != 1
-			|| x509_certificate_from_der(&ca_cert, &der, &derlen) != 1
+			|| x509_cert_view_from_der(&ca_cert, &der, &derlen) != 1
 			|| derlen > 0) {
 			error_print();
 			return -1;
 		}
-		if (x509_certificate_verify_by_certificate(&sign_cert, &ca_cert) != 1
-			|| x509_certificate_verify_by_certificate(&enc_cert, &ca_cert) != 1) {
+		if (x509_cert_view_verify_by_cert_view(&sign_cert, &ca_cert) != 1
+			|| x509_cert_view_verify_by_cert_view(&enc_cert, &ca_cert) != 1) {
+			error_print();
+			return -1;
+		}
+		if (ca_store && (x509_store_cert_is_revoked(ca_store, &sign_cert) != 0
+			|| x509_store_cert_is_revoked(ca_store, &enc_cert) != 0)) {
 			error_print();
 			return -1;
 		}
-		if (tls_certificate_chain_verify(chain, chainlen, ca_certs_fp, depth - 1) != 1) {
+		if (tls_certificate_chain_verify_ex(chain, chainlen, ca_store, ca_certs_fp, depth - 1) != 1) {
+			error_print();
+			return -1;
+		}
+	} else if (ca_store) {
+		if (x509_store_verify(ca_store, &sign_cert) != 1
+			|| x509_store_verify(ca_store, &enc_cert) != 1) {
 			error_print();
 			return -1;
 		}
 	} else {
-		if (x509_certificate_from_pem_by_name(&ca_cert, ca_certs_fp, &sign_cert.tbs_certificate.issuer) != 1
-			|| x509_certificate_verify_by_certificate(&sign_cert, &ca_cert) != 1) {
+		// sign and enc certs share the issuer, one trust anchor verifies both
+		if (!(anchor = malloc(sizeof(X509_CERTIFICATE)))) {
 			error_print();
 			return -1;
 		}
-		if (x509_certificate_from_pem_by_name(&ca_cert, ca_certs_fp, &enc_cert.tbs_certificate.issuer) != 1
-			|| x509_certificate_verify_by_certificate(&enc_cert, &ca_cert) != 1) {
+		if (x509_cert_view_get_issuer(&sign_cert, &issuer) != 1
+			|| x509_certificate_from_pem_by_name(anchor, ca_certs_fp, &issuer) != 1
+			|| x509_certificate_get_public_key(anchor, &ca_pubkey) != 1
+			|| x509_cert_view_verify_sm2(&sign_cert, &ca_pubkey) != 1
+			|| x509_cert_view_verify_sm2(&enc_cert, &ca_pubkey) != 1) {
+			error_print();
+			free(anchor);
+			return -1;
+		}
+		free(anchor);
+	}
+	if (ca_store && ca_store->cache) {
+		if (tls_certificate_chain_not_after(data, datalen, &not_after) != 1
+			|| x509_store_chain_cache_add(ca_store, dgst, generation, not_after) != 1) {
 			error_print();
 			return -1;
 		}
@@ -180,17 +222,16 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	SM2_KEY server_enc_key;
 	SM2_KEY server_sign_key;
 	SM2_SIGN_CTX verify_ctx; // for server_key_exchange signature verification
-	SM2_SIGN_CTX sign_ctx; // for certificate_verify signature generation
 	uint8_t sig[TLS_MAX_SIGNATURE_SIZE];
 	size_t siglen = sizeof(sig);
 	uint8_t pre_master_secret[48];
 	uint8_t enced_pre_master_secret[256];
 	size_t enced_pre_master_secret_len;
-	SM3_CTX sm3_ctx;
-	SM3_CTX tmp_sm3_ctx;
+	TLS_TRANSCRIPT transcript;
 	uint8_t sm3_hash[32];
 	uint8_t verify_data[12];
 	uint8_t local_verify_data[12];
+	TLS_FLIGHT flight;
 
 	struct sockaddr_in server;
 	server.sin_addr.s_addr = inet_addr(hostname);
@@ -206,10 +247,15 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	}
 
 	conn->is_client = 1;
+	if (tls_handshake_init(conn) != 1) {
+		error_print();
+		return -1;
+	}
+	tls_flight_init(&flight, conn->sock);
 
-	sm3_init(&sm3_ctx);
+	tls_transcript_init(&transcript, 0);
 	if (client_sign_key)
-		sm2_sign_init(&sign_ctx, client_sign_key, SM2_DEFAULT_ID);
+		tls_transcript_set_sm2_key(&transcript, client_sign_key);
 	tls_record_set_version(record, TLS_version_tlcp);
 	tls_record_set_version(finished, TLS_version_tlcp);
 
@@ -226,9 +272,7 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	tls_trace("<<<< ServerHello\n");
 	if (tls_record_recv(record, &recordlen, conn->sock) != 1
@@ -251,9 +295,7 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	tls_trace("<<<< ServerCertificate\n");
 	if (tls_record_recv(record, &recordlen, conn->sock) != 1
@@ -263,22 +305,21 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	}
 	tls_record_print(stderr, record, recordlen, 0, 0);
 	if (tls_record_get_handshake_certificate(record,
-		conn->server_certs, &conn->server_certs_len) != 1) {
+		conn->hs->server_certs, &conn->hs->server_certs_len) != 1) {
 		error_print();
 		return -1;
 	}
-	if (tlcp_certificate_chain_verify(conn->server_certs, conn->server_certs_len, ca_certs_fp, 5) != 1) {
+	if (tlcp_certificate_chain_verify(conn->hs->server_certs, conn->hs->server_certs_len,
+		conn->ca_store, ca_certs_fp, 5) != 1) {
 		error_print();
 		return -1;
 	}
-	if (tls_certificate_get_public_keys(conn->server_certs, conn->server_certs_len,
+	if (tls_certificate_get_public_keys(conn->hs->server_certs, conn->hs->server_certs_len,
 		&server_sign_key, &server_enc_key) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	tls_trace("<<<< ServerKeyExchange\n");
 	if (tls_record_recv(record, &recordlen, conn->sock) != 1
@@ -291,12 +332,10 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	tls_trace("++++ process ServerKeyExchange\n");
-	if (tls_certificate_get_second(conn->server_certs, conn->server_certs_len,
+	if (tls_certificate_get_second(conn->hs->server_certs, conn->hs->server_certs_len,
 		&server_enc_cert, &server_enc_cert_len) != 1) {
 		error_print();
 		return -1;
@@ -332,9 +371,7 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 			return -1;
 		}
 		tls_record_print(stderr, record, recordlen, 0, 0);
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		if (client_sign_key)
-			sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+		tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 		if (tls_record_recv(record, &recordlen, conn->sock) != 1
 			|| tls_record_version(record) != TLS_version_tlcp) {
@@ -342,7 +379,6 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 			return -1;
 		}
 	} else {
-		memset(&sign_ctx, 0, sizeof(SM2_SIGN_CTX));
 		client_sign_key = NULL;
 	}
 	tls_trace("<<<< ServerHelloDone\n");
@@ -351,45 +387,42 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 	if (client_sign_key) {
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
-
 		tls_trace(">>>> ClientCertificate\n");
 		if (tls_record_set_handshake_certificate_from_pem(record, &recordlen, client_certs_fp) != 1) {
 			error_print();
 			return -1;
 		}
 		tls_record_print(stderr, record, recordlen, 0, 0);
-		if (tls_record_send(record, recordlen, conn->sock) != 1) {
+		if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+		tls_transcript_update(&transcript, record + 5, recordlen - 5);
 	}
 
 	tls_trace("++++ generate secrets\n");
 	if (tls_pre_master_secret_generate(pre_master_secret, TLS_version_tlcp) != 1
 		|| tls_prf(pre_master_secret, 48, "master secret",
 			client_random, 32, server_random, 32,
-			48, conn->master_secret) != 1
-		|| tls_prf(conn->master_secret, 48, "key expansion",
+			48, conn->hs->master_secret) != 1
+		|| tls_prf(conn->hs->master_secret, 48, "key expansion",
 			server_random, 32, client_random, 32,
-			96, conn->key_block) != 1) {
+			96, conn->hs->key_block) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_hmac_init(&conn->client_write_mac_ctx, conn->key_block, 32);
-	sm3_hmac_init(&conn->server_write_mac_ctx, conn->key_block + 32, 32);
-	sm4_set_encrypt_key(&conn->client_write_enc_key, conn->key_block + 64);
-	sm4_set_decrypt_key(&conn->server_write_enc_key, conn->key_block + 80);
+	sm3_hmac_init(&conn->client_write_mac_ctx, conn->hs->key_block, 32);
+	sm3_hmac_init(&conn->server_write_mac_ctx, conn->hs->key_block + 32, 32);
+	sm4_set_encrypt_key(&conn->client_write_enc_key, conn->hs->key_block + 64);
+	sm4_set_decrypt_key(&conn->server_write_enc_key, conn->hs->key_block + 80);
 	format_bytes(stderr, 0, 0, "pre_master_secret : ", pre_master_secret, 48);
-	format_bytes(stderr, 0, 0, "master_secret : ", conn->master_secret, 48);
-	format_bytes(stderr, 0, 0, "client_write_mac_key : ", conn->key_block, 32);
-	format_bytes(stderr, 0, 0, "server_write_mac_key : ", conn->key_block + 32, 32);
-	format_bytes(stderr, 0, 0, "client_write_enc_key : ", conn->key_block + 64, 16);
-	format_bytes(stderr, 0, 0, "server_write_enc_key : ", conn->key_block + 80, 16);
+	format_bytes(stderr, 0, 0, "master_secret : ", conn->hs->master_secret, 48);
+	format_bytes(stderr, 0, 0, "client_write_mac_key : ", conn->hs->key_block, 32);
+	format_bytes(stderr, 0, 0, "server_write_mac_key : ", conn->hs->key_block + 32, 32);
+	format_bytes(stderr, 0, 0, "client_write_enc_key : ", conn->hs->key_block + 64, 16);
+	format_bytes(stderr, 0, 0, "server_write_enc_key : ", conn->hs->key_block + 80, 16);
 	format_print(stderr, 0, 0, "\n");
 
 	tls_trace(">>>> ClientKeyExchange\n");
@@ -404,27 +437,25 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, conn->cipher_suite << 8, 0);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	if (client_sign_key) {
 		tls_trace(">>>> CertificateVerify\n");
-		sm2_sign_finish(&sign_ctx, sig, &siglen);
-		if (tls_record_set_handshake_certificate_verify(record, &recordlen, sig, siglen) != 1) {
+		if (tls_transcript_sign(&transcript, sig, &siglen) != 1
+			|| tls_record_set_handshake_certificate_verify(record, &recordlen, sig, siglen) != 1) {
 			error_print();
 			return -1;
 		}
 		tls_record_print(stderr, record, recordlen, 0, 0);
-		if (tls_record_send(record, recordlen, conn->sock) != 1) {
+		if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
+		tls_transcript_update(&transcript, record + 5, recordlen - 5);
 	}
 
 	tls_trace(">>>> [ChangeCipherSpec]\n");
@@ -432,17 +463,16 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 		error_print();
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, 0, 0);
 
 	tls_trace(">>>> Finished\n");
-	memcpy(&tmp_sm3_ctx, &sm3_ctx, sizeof(sm3_ctx));
-	sm3_finish(&tmp_sm3_ctx, sm3_hash);
+	tls_transcript_digest(&transcript, sm3_hash);
 
-	if (tls_prf(conn->master_secret, 48, "client finished",
+	if (tls_prf(conn->hs->master_secret, 48, "client finished",
 		sm3_hash, 32, NULL, 0,
 		sizeof(verify_data), verify_data) != 1) {
 		error_print();
@@ -453,7 +483,7 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 	tls_record_print(stderr, finished, finishedlen, 0, 0);
-	sm3_update(&sm3_ctx, finished + 5, finishedlen - 5);
+	tls_transcript_update(&transcript, finished + 5, finishedlen - 5);
 
 	if (tls_record_encrypt(&conn->client_write_mac_ctx, &conn->client_write_enc_key,
 		conn->client_seq_num, finished, finishedlen, record, &recordlen) != 1) {
@@ -461,7 +491,8 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 	tls_seq_num_incr(conn->client_seq_num);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1
+		|| tls_flight_flush(&flight) != 1) {
 		error_print();
 		return -1;
 	}
@@ -495,8 +526,8 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_finish(&sm3_ctx, sm3_hash);
-	if (tls_prf(conn->master_secret, 48, "server finished",
+	tls_transcript_digest(&transcript, sm3_hash);
+	if (tls_prf(conn->hs->master_secret, 48, "server finished",
 		sm3_hash, 32, NULL, 0,
 		sizeof(local_verify_data), local_verify_data) != 1) {
 		error_print();
@@ -507,16 +538,16 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 
+	tls_transcript_cleanup(&transcript);
+	tls_handshake_cleanup(conn);
 	tls_trace("++++ Connection established\n");
 	return 1;
 }
 
-int tlcp_accept(TLS_CONNECT *conn, int port,
+static int tlcp_do_accept(TLS_CONNECT *conn, int port,
 	FILE *certs_fp, const SM2_KEY *server_sign_key, const SM2_KEY *server_enc_key,
-	FILE *client_cacerts_fp, uint8_t *handshakes_buf, size_t handshakes_buflen)
+	FILE *client_cacerts_fp, TLS_TRANSCRIPT *transcript)
 {
-	uint8_t *handshakes = handshakes_buf;
-	size_t handshakeslen = 0;
 	uint8_t record[TLS_MAX_RECORD_SIZE];
 	size_t recordlen;
 	uint8_t finished[256];
@@ -538,11 +569,10 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 	size_t enced_pms_len = sizeof(enced_pms);
 	uint8_t pre_master_secret[48];
 	size_t pre_master_secret_len = 48;
-	SM3_CTX sm3_ctx;
-	SM3_CTX tmp_sm3_ctx;
 	uint8_t sm3_hash[32];
 	uint8_t verify_data[12];
 	uint8_t local_verify_data[12];
+	TLS_FLIGHT flight;
 	size_t i;
 
 	int sock;
@@ -577,11 +607,14 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 	}
 
 	error_puts("connected\n");
+	if (tls_handshake_init(conn) != 1) {
+		error_print();
+		return -1;
+	}
+	tls_flight_init(&flight, conn->sock);
 
 
 
-	sm3_init(&sm3_ctx);
-
 	tls_trace("<<<< ClientHello\n");
 	if (tls_record_recv(record, &recordlen, conn->sock) != 1
 		|| tls_record_version(record) != TLS_version_tlcp) {
@@ -609,12 +642,7 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		error_puts("no common cipher_suite");
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (handshakes) {
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	tls_trace(">>>> ServerHello\n");
 	tls_random_generate(server_random);
@@ -625,16 +653,11 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, 0, 0);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (handshakes) {
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	tls_trace(">>>> ServerCertificate\n");
 	if (tls_record_set_handshake_certificate_from_pem(record, &recordlen, certs_fp) != 1) {
@@ -642,22 +665,17 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, 0, 0);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 		error_print();
 		return -1;
 	}
-	if (tls_record_get_handshake_certificate(record, conn->server_certs, &conn->server_certs_len) != 1
-		|| tls_certificate_get_second(conn->server_certs, conn->server_certs_len,
+	if (tls_record_get_handshake_certificate(record, conn->hs->server_certs, &conn->hs->server_certs_len) != 1
+		|| tls_certificate_get_second(conn->hs->server_certs, conn->hs->server_certs_len,
 			&server_enc_cert, &server_enc_certlen) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (handshakes) {
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	tls_trace(">>>> ServerKeyExchange\n");
 	if (sm2_sign_init(&sign_ctx, server_sign_key, SM2_DEFAULT_ID) != 1
@@ -673,16 +691,11 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, conn->cipher_suite << 8, 0);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (handshakes) {
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	if (client_cacerts_fp) {
 		tls_trace(">>>> CertificateRequest\n");
@@ -698,16 +711,11 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		}
 		tls_record_print(stderr, record, recordlen, 0, 0);
 
-		if (tls_record_send(record, recordlen, conn->sock) != 1) {
+		if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		if (handshakes) {
-			memcpy(handshakes, record + 5, recordlen - 5);
-			handshakes += recordlen - 5;
-			handshakeslen += recordlen - 5;
-		}
+		tls_transcript_update(transcript, record + 5, recordlen - 5);
 	}
 
 	tls_trace(">>>> ServerHelloDone\n");
@@ -716,18 +724,14 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, 0, 0);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1
+		|| tls_flight_flush(&flight) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (handshakes) {
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
-	if (handshakes) {
+	if (client_cacerts_fp) {
 		tls_trace("<<<< ClientCertificate\n");
 		if (tls_record_recv(record, &recordlen, conn->sock) != 1
 			|| tls_record_version(record) != TLS_version_tlcp) {
@@ -736,20 +740,21 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		}
 		tls_record_print(stderr, record, recordlen, 0, 0);
 		if (tls_record_get_handshake_certificate(record,
-			conn->client_certs, &conn->client_certs_len) != 1) {
+			conn->hs->client_certs, &conn->hs->client_certs_len) != 1) {
 			error_print();
 			return -1;
 		}
 		// FIXME: verify client's certificate with ca certs		
-		if (tls_certificate_get_public_keys(conn->client_certs, conn->client_certs_len,
+		if (tls_certificate_get_public_keys(conn->hs->client_certs, conn->hs->client_certs_len,
 			&client_sign_key, NULL) != 1) {
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
+		tls_transcript_update(transcript, record + 5, recordlen - 5);
+		if (tls_transcript_set_sm2_key(transcript, &client_sign_key) != 1) {
+			error_print();
+			return -1;
+		}
 	}
 
 	tls_trace("<<<< ClientKeyExchange\n");
@@ -763,19 +768,14 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (handshakes) {
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 	if (sm2_decrypt(server_enc_key, enced_pms, enced_pms_len,
 		pre_master_secret, &pre_master_secret_len) != 1) {
 		error_print();
 		return -1;
 	}
 
-	if (handshakes) {
+	if (client_cacerts_fp) {
 		tls_trace("<<<< CertificateVerify\n");
 		if (tls_record_recv(record, &recordlen, conn->sock) != 1
 			|| tls_record_version(record) != TLS_version_tlcp) {
@@ -787,38 +787,36 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		sm2_verify_init(&sign_ctx, &client_sign_key, SM2_DEFAULT_ID);
-		sm2_verify_update(&sign_ctx, handshakes_buf, handshakeslen);
-		if (sm2_verify_finish(&sign_ctx, sig, siglen) != 1) {
+		if (tls_transcript_verify(transcript, sig, siglen) != 1) {
 			error_print();
 			return -1;
 		}
+		tls_transcript_update(transcript, record + 5, recordlen - 5);
 	}
 
 	tls_trace("++++ generate secrets\n");
 	if (tls_prf(pre_master_secret, 48, "master secret",
 		client_random, 32, server_random, 32,
-		48, conn->master_secret) != 1) {
+		48, conn->hs->master_secret) != 1) {
 		error_print();
 		return -1;
 	}
-	if (tls_prf(conn->master_secret, 48, "key expansion",
+	if (tls_prf(conn->hs->master_secret, 48, "key expansion",
 		server_random, 32, client_random, 32,
-		96, conn->key_block) != 1) {
+		96, conn->hs->key_block) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_hmac_init(&conn->client_write_mac_ctx, conn->key_block, 32);
-	sm3_hmac_init(&conn->server_write_mac_ctx, conn->key_block + 32, 32);
-	sm4_set_decrypt_key(&conn->client_write_enc_key, conn->key_block + 64);
-	sm4_set_encrypt_key(&conn->server_write_enc_key, conn->key_block + 80);
+	sm3_hmac_init(&conn->client_write_mac_ctx, conn->hs->key_block, 32);
+	sm3_hmac_init(&conn->server_write_mac_ctx, conn->hs->key_block + 32, 32);
+	sm4_set_decrypt_key(&conn->client_write_enc_key, conn->hs->key_block + 64);
+	sm4_set_encrypt_key(&conn->server_write_enc_key, conn->hs->key_block + 80);
 	format_bytes(stderr, 0, 0, "pre_master_secret : ", pre_master_secret, 48);
-	format_bytes(stderr, 0, 0, "master_secret : ", conn->master_secret, 48);
-	format_bytes(stderr, 0, 0, "client_write_mac_key : ", conn->key_block, 32);
-	format_bytes(stderr, 0, 0, "server_write_mac_key : ", conn->key_block + 32, 32);
-	format_bytes(stderr, 0, 0, "client_write_enc_key : ", conn->key_block + 64, 16);
-	format_bytes(stderr, 0, 0, "server_write_enc_key : ", conn->key_block + 80, 16);
+	format_bytes(stderr, 0, 0, "master_secret : ", conn->hs->master_secret, 48);
+	format_bytes(stderr, 0, 0, "client_write_mac_key : ", conn->hs->key_block, 32);
+	format_bytes(stderr, 0, 0, "server_write_mac_key : ", conn->hs->key_block + 32, 32);
+	format_bytes(stderr, 0, 0, "client_write_enc_key : ", conn->hs->key_block + 64, 16);
+	format_bytes(stderr, 0, 0, "server_write_enc_key : ", conn->hs->key_block + 80, 16);
 	format_print(stderr, 0, 0, "\n");
 
 
@@ -851,11 +849,9 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, finished, finishedlen, 0, 0);
-	memcpy(&tmp_sm3_ctx, &sm3_ctx, sizeof(SM3_CTX));
-	sm3_update(&sm3_ctx, finished + 5, finishedlen - 5);
-
-	sm3_finish(&tmp_sm3_ctx, sm3_hash);
-	if (tls_prf(conn->master_secret, 48, "client finished", sm3_hash, 32, NULL, 0,
+	tls_transcript_digest(transcript, sm3_hash);
+	tls_transcript_update(transcript, finished + 5, finishedlen - 5);
+	if (tls_prf(conn->hs->master_secret, 48, "client finished", sm3_hash, 32, NULL, 0,
 		12, local_verify_data) != 1) {
 		error_print();
 		return -1;
@@ -871,14 +867,14 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, 0, 0);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1) {
 		error_print();
 		return -1;
 	}
 
 	tls_trace(">>>> ServerFinished\n");
-	sm3_finish(&sm3_ctx, sm3_hash);
-	if (tls_prf(conn->master_secret, 48, "server finished", sm3_hash, 32, NULL, 0,
+	tls_transcript_digest(transcript, sm3_hash);
+	if (tls_prf(conn->hs->master_secret, 48, "server finished", sm3_hash, 32, NULL, 0,
 		12, verify_data) != 1) {
 		error_print();
 		return -1;
@@ -894,7 +890,8 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_seq_num_incr(conn->server_seq_num);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, record, recordlen) != 1
+		|| tls_flight_flush(&flight) != 1) {
 		error_print();
 		return -1;
 	}
@@ -902,3 +899,19 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 	tls_trace("Connection Established!\n\n");
 	return 1;
 }
+
+int tlcp_accept(TLS_CONNECT *conn, int port,
+	FILE *certs_fp, const SM2_KEY *server_sign_key, const SM2_KEY *server_enc_key,
+	FILE *client_cacerts_fp)
+{
+	int ret;
+	TLS_TRANSCRIPT transcript;
+
+	// buffer handshakes for client's CertificateVerify until client's public key is known
+	tls_transcript_init(&transcript, client_cacerts_fp ? 1 : 0);
+	ret = tlcp_do_accept(conn, port, certs_fp, server_sign_key, server_enc_key,
+		client_cacerts_fp, &transcript);
+	tls_transcript_cleanup(&transcript);
+	tls_handshake_cleanup(conn);
+	return ret;
+}
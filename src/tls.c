@@ -592,6 +592,127 @@ int tls_verify_server_ecdh_params(const SM2_KEY *server_sign_key,
 
 
 
+// handshake transcript
+
+int tls_transcript_init(TLS_TRANSCRIPT *ts, int buffer_for_signature)
+{
+	if (!ts) {
+		error_print();
+		return -1;
+	}
+	memset(ts, 0, sizeof(TLS_TRANSCRIPT));
+	sm3_init(&ts->sm3_ctx);
+	ts->buffering = buffer_for_signature ? 1 : 0;
+	return 1;
+}
+
+int tls_transcript_update(TLS_TRANSCRIPT *ts, const uint8_t *data, size_t datalen)
+{
+	if (!ts || (!data && datalen)) {
+		error_print();
+		return -1;
+	}
+	sm3_update(&ts->sm3_ctx, data, datalen);
+	if (ts->sign_ctx_inited) {
+		sm2_sign_update(&ts->sign_ctx, data, datalen);
+	} else if (ts->buffering) {
+		if (ts->buflen + datalen > ts->bufsize) {
+			size_t bufsize = ts->bufsize ? ts->bufsize : 1024;
+			uint8_t *buf;
+			while (bufsize < ts->buflen + datalen) {
+				bufsize *= 2;
+			}
+			if (!(buf = realloc(ts->buf, bufsize))) {
+				error_print();
+				return -1;
+			}
+			ts->buf = buf;
+			ts->bufsize = bufsize;
+		}
+		memcpy(ts->buf + ts->buflen, data, datalen);
+		ts->buflen += datalen;
+	}
+	return 1;
+}
+
+int tls_transcript_set_sm2_key(TLS_TRANSCRIPT *ts, const SM2_KEY *key)
+{
+	if (!ts || !key) {
+		error_print();
+		return -1;
+	}
+	if (sm2_sign_init(&ts->sign_ctx, key, SM2_DEFAULT_ID) != 1) {
+		error_print();
+		return -1;
+	}
+	if (ts->buflen) {
+		sm2_sign_update(&ts->sign_ctx, ts->buf, ts->buflen);
+	}
+	ts->sign_ctx_inited = 1;
+	ts->buffering = 0;
+	if (ts->buf) {
+		memset(ts->buf, 0, ts->buflen);
+		free(ts->buf);
+	}
+	ts->buf = NULL;
+	ts->buflen = ts->bufsize = 0;
+	return 1;
+}
+
+int tls_transcript_digest(const TLS_TRANSCRIPT *ts, uint8_t dgst[32])
+{
+	SM3_CTX sm3_ctx;
+
+	if (!ts || !dgst) {
+		error_print();
+		return -1;
+	}
+	memcpy(&sm3_ctx, &ts->sm3_ctx, sizeof(SM3_CTX));
+	sm3_finish(&sm3_ctx, dgst);
+	return 1;
+}
+
+int tls_transcript_sign(const TLS_TRANSCRIPT *ts, uint8_t *sig, size_t *siglen)
+{
+	SM2_SIGN_CTX sign_ctx;
+
+	if (!ts || !sig || !siglen || !ts->sign_ctx_inited) {
+		error_print();
+		return -1;
+	}
+	memcpy(&sign_ctx, &ts->sign_ctx, sizeof(SM2_SIGN_CTX));
+	if (sm2_sign_finish(&sign_ctx, sig, siglen) != 1) {
+		memset(&sign_ctx, 0, sizeof(SM2_SIGN_CTX));
+		error_print();
+		return -1;
+	}
+	memset(&sign_ctx, 0, sizeof(SM2_SIGN_CTX));
+	return 1;
+}
+
+int tls_transcript_verify(const TLS_TRANSCRIPT *ts, const uint8_t *sig, size_t siglen)
+{
+	SM2_SIGN_CTX verify_ctx;
+
+	if (!ts || !sig || !siglen || !ts->sign_ctx_inited) {
+		error_print();
+		return -1;
+	}
+	memcpy(&verify_ctx, &ts->sign_ctx, sizeof(SM2_SIGN_CTX));
+	return sm2_verify_finish(&verify_ctx, sig, siglen);
+}
+
+void tls_transcript_cleanup(TLS_TRANSCRIPT *ts)
+{
+	if (ts) {
+		if (ts->buf) {
+			memset(ts->buf, 0, ts->buflen);
+			free(ts->buf);
+		}
+		memset(ts, 0, sizeof(TLS_TRANSCRIPT));
+	}
+}
+
 // handshakes
 
 int tls_record_set_handshake(uint8_t *record, size_t *recordlen,
@@ -1060,38 +1181,127 @@ int tls_certificate_get_public_keys(const uint8_t *data, size_t datalen,
 
 int tls_certificate_chain_verify(const uint8_t *certs, size_t certslen, FILE *ca_certs_fp, int depth)
 {
-	X509_CERTIFICATE cert;
-	X509_CERTIFICATE cacert;
+	return tls_certificate_chain_verify_ex(certs, certslen, NULL, ca_certs_fp, depth);
+}
+
+// Earliest notAfter of a list of uint24 length prefixed certificates
+int tls_certificate_chain_not_after(const uint8_t *certs, size_t certslen, time_t *not_after)
+{
+	X509_CERT_VIEW view;
+	X509_VALIDITY validity;
+	const uint8_t *der;
+	size_t derlen;
+	int first = 1;
+
+	while (certslen > 0) {
+		if (tls_uint24array_from_bytes(&der, &derlen, &certs, &certslen) != 1
+			|| x509_cert_view_from_der(&view, &der, &derlen) != 1
+			|| x509_cert_view_get_validity(&view, &validity) != 1) {
+			error_print();
+			return -1;
+		}
+		if (first || validity.not_after < *not_after) {
+			*not_after = validity.not_after;
+			first = 0;
+		}
+	}
+	if (first) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+/*
+The trust anchor is looked up in ca_store if given, else ca_certs_fp is scanned.
+With a store that has the chain cache enabled a chain verified before is
+accepted without verifying the signatures again.
+*/
+int tls_certificate_chain_verify_ex(const uint8_t *certs, size_t certslen,
+	X509_STORE *ca_store, FILE *ca_certs_fp, int depth)
+{
+	const uint8_t *chain = certs;
+	size_t chainlen = certslen;
+	uint8_t dgst[32];
+	uint64_t generation;
+	time_t not_after;
+	X509_CERT_VIEW views[2];
+	X509_CERT_VIEW *cert = &views[0];
+	X509_CERT_VIEW *cacert = &views[1];
+	X509_CERT_VIEW *tmp;
+	X509_CERTIFICATE *anchor = NULL;
+	X509_NAME issuer;
 	const uint8_t *der;
 	size_t derlen;
+	int ret = -1;
+
+	if (ca_store && ca_store->cache) {
+		if ((ret = x509_store_chain_cache_lookup(ca_store, chain, chainlen,
+			time(NULL), dgst, &generation)) < 0) {
+			error_print();
+			return -1;
+		} else if (ret == 1) {
+			return 1;
+		}
+		ret = -1;
+	}
+
 	if (tls_uint24array_from_bytes(&der, &derlen, &certs, &certslen) != 1) {
 		error_print();
 		return -1;
 	}
-	if (x509_certificate_from_der(&cert, &der, &derlen) != 1
+	if (x509_cert_view_from_der(cert, &der, &derlen) != 1
 		|| derlen > 0) {
 		error_print();
 		return -1;
 	}
 	while (certslen > 0) {
 		if (tls_uint24array_from_bytes(&der, &derlen, &certs, &certslen) != 1
-			|| x509_certificate_from_der(&cacert, &der, &derlen) != 1
+			|| x509_cert_view_from_der(cacert, &der, &derlen) != 1
 			|| derlen > 0) {
 			error_print();
 			return -1;
 		}
-		if (x509_certificate_verify_by_certificate(&cert, &cacert) != 1) {
+		if (x509_cert_view_verify_by_cert_view(cert, cacert) != 1) {
 			error_print();
 			return -1;
 		}
-		memcpy(&cert, &cacert, sizeof(X509_CERTIFICATE));
+		if (ca_store && x509_store_cert_is_revoked(ca_store, cert) != 0) {
+			error_print();
+			return -1;
+		}
+		tmp = cert;
+		cert = cacert;
+		cacert = tmp;
+	}
+	if (ca_store) {
+		if (x509_store_verify(ca_store, cert) != 1) {
+			error_print();
+			return -1;
+		}
+		if (ca_store->cache) {
+			if (tls_certificate_chain_not_after(chain, chainlen, &not_after) != 1
+				|| x509_store_chain_cache_add(ca_store, dgst, generation, not_after) != 1) {
+				error_print();
+				return -1;
+			}
+		}
+		return 1;
 	}
-	if (x509_certificate_from_pem_by_name(&cacert, ca_certs_fp, &cert.tbs_certificate.issuer) != 1
-		|| x509_certificate_verify_by_certificate(&cert, &cacert) != 1) {
+	if (!(anchor = malloc(sizeof(X509_CERTIFICATE)))) {
 		error_print();
 		return -1;
 	}
-	return 1;
+	if (x509_cert_view_get_issuer(cert, &issuer) != 1
+		|| x509_certificate_from_pem_by_name(anchor, ca_certs_fp, &issuer) != 1
+		|| x509_cert_view_verify_sm2(cert, &anchor->tbs_certificate.subject_public_key_info.sm2_key) != 1) {
+		error_print();
+		goto end;
+	}
+	ret = 1;
+end:
+	free(anchor);
+	return ret;
 }
 
 
@@ -1465,6 +1675,72 @@ int tls_record_recv(uint8_t *record, size_t *recordlen, int sock)
 	return 1;
 }
 
+static int tls_socket_send_all(int sock, const uint8_t *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len) {
+		if ((r = send(sock, buf, len, 0)) < 0) {
+			error_print();
+			return -1;
+		}
+		buf += r;
+		len -= r;
+	}
+	return 1;
+}
+
+int tls_flight_init(TLS_FLIGHT *flight, int sock)
+{
+	if (!flight) {
+		error_print();
+		return -1;
+	}
+	flight->buflen = 0;
+	flight->sock = sock;
+	return 1;
+}
+
+int tls_flight_add_record(TLS_FLIGHT *flight, const uint8_t *record, size_t recordlen)
+{
+	if (!flight || !record) {
+		error_print();
+		return -1;
+	}
+	if (recordlen < 5
+		|| recordlen - 5 != (((size_t)record[3] << 8) | record[4])
+		|| recordlen > TLS_MAX_RECORD_SIZE) {
+		error_print();
+		return -1;
+	}
+	if (flight->buflen + recordlen > sizeof(flight->buf)) {
+		if (tls_flight_flush(flight) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+	memcpy(flight->buf + flight->buflen, record, recordlen);
+	flight->buflen += recordlen;
+	return 1;
+}
+
+int tls_flight_flush(TLS_FLIGHT *flight)
+{
+	if (!flight) {
+		error_print();
+		return -1;
+	}
+	if (!flight->buflen) {
+		return 1;
+	}
+	if (tls_socket_send_all(flight->sock, flight->buf, flight->buflen) != 1) {
+		error_print();
+		return -1;
+	}
+	flight->buflen = 0;
+	return 1;
+}
+
 int tls_seq_num_incr(uint8_t seq_num[8])
 {
 	int i;
@@ -1490,18 +1766,111 @@ int tls_compression_methods_has_null_compression(const uint8_t *meths, size_t me
 	return -1;
 }
 
+/*
+Record buffers are cached per thread, so acquire/release never take a lock and
+the allocator is only hit while a thread's pool is warming up. A released
+buffer goes to the pool of the releasing thread; buffers beyond
+TLS_RECORD_POOL_SIZE are returned to the heap.
+*/
+static __thread uint8_t *tls_record_pool[TLS_RECORD_POOL_SIZE];
+static __thread size_t tls_record_pool_count = 0;
+
+uint8_t *tls_record_buffer_acquire(void)
+{
+	uint8_t *record;
+
+	if (tls_record_pool_count) {
+		return tls_record_pool[--tls_record_pool_count];
+	}
+	if (!(record = malloc(TLS_MAX_RECORD_SIZE))) {
+		error_print();
+		return NULL;
+	}
+	return record;
+}
+
+void tls_record_buffer_release(uint8_t *record)
+{
+	if (!record) {
+		return;
+	}
+	if (tls_record_pool_count < TLS_RECORD_POOL_SIZE) {
+		tls_record_pool[tls_record_pool_count++] = record;
+		return;
+	}
+	free(record);
+}
+
+void tls_record_buffer_pool_cleanup(void)
+{
+	while (tls_record_pool_count) {
+		free(tls_record_pool[--tls_record_pool_count]);
+	}
+}
+
+int tls_handshake_init(TLS_CONNECT *conn)
+{
+	if (!conn) {
+		error_print();
+		return -1;
+	}
+	if (!(conn->hs = calloc(1, sizeof(TLS_HANDSHAKE)))) {
+		error_print();
+		return -1;
+	}
+	if (!(conn->record = tls_record_buffer_acquire())) {
+		free(conn->hs);
+		conn->hs = NULL;
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+void tls_handshake_cleanup(TLS_CONNECT *conn)
+{
+	if (!conn) {
+		return;
+	}
+	if (conn->hs) {
+		memset(conn->hs, 0, sizeof(TLS_HANDSHAKE));
+		free(conn->hs);
+		conn->hs = NULL;
+	}
+	if (conn->record) {
+		tls_record_buffer_release(conn->record);
+		conn->record = NULL;
+	}
+}
+
+void tls_cleanup(TLS_CONNECT *conn)
+{
+	if (conn) {
+		tls_handshake_cleanup(conn);
+		if (conn->databuf) {
+			memset(conn->databuf, 0, TLS_MAX_RECORD_SIZE);
+			tls_record_buffer_release(conn->databuf);
+		}
+		memset(conn, 0, sizeof(TLS_CONNECT));
+	}
+}
+
 // FIXME: 设定支持的最大输入长度
 int tls_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen)
 {
 	const SM3_HMAC_CTX *hmac_ctx;
 	const SM4_KEY *enc_key;
 	uint8_t *seq_num;
-	uint8_t mrec[1600];
-	uint8_t crec[1600];
-	size_t mlen = sizeof(mrec);
-	size_t clen = sizeof(crec);
+	uint8_t *mrec = NULL;
+	uint8_t *crec = NULL;
+	size_t mlen;
+	size_t clen;
+	int ret = -1;
 
-	// FIXME: 检查datalen的长度
+	if (datalen > TLS_RECORD_MAX_PLAINDATA_SIZE) {
+		error_print();
+		return -1;
+	}
 
 	if (conn->is_client) {
 		hmac_ctx = &conn->client_write_mac_ctx;
@@ -1513,6 +1882,12 @@ int tls_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen)
 		seq_num = conn->server_seq_num;
 	}
 
+	if (!(mrec = tls_record_buffer_acquire())
+		|| !(crec = tls_record_buffer_acquire())) {
+		error_print();
+		goto end;
+	}
+
 	tls_trace(">>>> ApplicationData\n");
 	if (tls_record_set_version(mrec, conn->version) != 1
 		|| tls_record_set_application_data(mrec, &mlen, data, datalen) != 1
@@ -1520,10 +1895,14 @@ int tls_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen)
 		|| tls_seq_num_incr(seq_num) != 1
 		|| tls_record_send(crec, clen, conn->sock) != 1) {
 		error_print();
-		return -1;
+		goto end;
 	}
 	(void)tls_record_print(stderr, crec, clen, 0, 0);
-	return 1;
+	ret = 1;
+end:
+	tls_record_buffer_release(mrec);
+	tls_record_buffer_release(crec);
+	return ret;
 }
 
 int tls_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
@@ -1531,10 +1910,11 @@ int tls_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 	const SM3_HMAC_CTX *hmac_ctx;
 	const SM4_KEY *dec_key;
 	uint8_t *seq_num;
-	uint8_t mrec[1600];
-	uint8_t crec[1600];
-	size_t mlen = sizeof(mrec);
-	size_t clen = sizeof(crec);
+	uint8_t *mrec = NULL;
+	uint8_t *crec = NULL;
+	size_t mlen;
+	size_t clen;
+	int ret = -1;
 
 	if (conn->is_client) {
 		hmac_ctx = &conn->server_write_mac_ctx;
@@ -1546,20 +1926,115 @@ int tls_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 		seq_num = conn->client_seq_num;
 	}
 
+	if (!(mrec = tls_record_buffer_acquire())
+		|| !(crec = tls_record_buffer_acquire())) {
+		error_print();
+		goto end;
+	}
+
 	tls_trace("<<<< ApplicationData\n");
 	if (tls_record_recv(crec, &clen, conn->sock) != 1
 		// FIXME: 检查版本号
 		|| tls_record_decrypt(hmac_ctx, dec_key, seq_num, crec, clen, mrec, &mlen) != 1
 		|| tls_seq_num_incr(seq_num) != 1) {
 		error_print();
-		return -1;
+		goto end;
 	}
 	(void)tls_record_print(stderr, mrec, mlen, 0, 0);
 	memcpy(data, mrec + 5, mlen - 5);
 	*datalen = mlen - 5;
+	ret = 1;
+end:
+	tls_record_buffer_release(mrec);
+	tls_record_buffer_release(crec);
+	return ret;
+}
+
+static int tls_recv_record_data(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
+{
+	if (conn->version == TLS_version_tls13) {
+		return tls13_recv(conn, data, datalen);
+	}
+	return tls_recv(conn, data, datalen);
+}
+
+int tls_read(TLS_CONNECT *conn, uint8_t *buf, size_t size, size_t *readlen)
+{
+	size_t len;
+
+	if (!conn || (!buf && size) || !readlen) {
+		error_print();
+		return -1;
+	}
+
+	if (!conn->datalen) {
+		// caller's buffer can hold any record, no need to buffer
+		if (size >= TLS_RECORD_MAX_DATA_SIZE) {
+			if (tls_recv_record_data(conn, buf, readlen) != 1) {
+				error_print();
+				return -1;
+			}
+			return 1;
+		}
+		if (!conn->databuf && !(conn->databuf = tls_record_buffer_acquire())) {
+			error_print();
+			return -1;
+		}
+		if (tls_recv_record_data(conn, conn->databuf, &conn->datalen) != 1) {
+			error_print();
+			return -1;
+		}
+		conn->data = conn->databuf;
+	}
+
+	len = size < conn->datalen ? size : conn->datalen;
+	memcpy(buf, conn->data, len);
+	conn->data += len;
+	conn->datalen -= len;
+	*readlen = len;
+
+	// give the buffer back once drained, idle connections hold no buffer
+	if (!conn->datalen && conn->databuf) {
+		memset(conn->databuf, 0, conn->data - conn->databuf);
+		tls_record_buffer_release(conn->databuf);
+		conn->databuf = NULL;
+		conn->data = NULL;
+	}
 	return 1;
 }
 
+int tls_write(TLS_CONNECT *conn, const uint8_t *data, size_t datalen)
+{
+	size_t len;
+
+	if (!conn || (!data && datalen)) {
+		error_print();
+		return -1;
+	}
+	while (datalen) {
+		len = datalen < TLS_RECORD_MAX_PLAINDATA_SIZE ? datalen : TLS_RECORD_MAX_PLAINDATA_SIZE;
+		if (conn->version == TLS_version_tls13) {
+			if (tls13_send(conn, data, len, 0) != 1) {
+				error_print();
+				return -1;
+			}
+		} else {
+			if (tls_send(conn, data, len) != 1) {
+				error_print();
+				return -1;
+			}
+		}
+		data += len;
+		datalen -= len;
+	}
+	return 1;
+}
+
+size_t tls_pending(const TLS_CONNECT *conn)
+{
+	return conn ? conn->datalen : 0;
+}
+
 //FIXME: any difference in TLS 1.2 and TLS 1.3?
 int tls_shutdown(TLS_CONNECT *conn)
 {
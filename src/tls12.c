@@ -191,7 +191,7 @@ int tls12_record_recv(uint8_t *record, size_t *recordlen, int sock)
 int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	FILE *ca_certs_fp, FILE *client_certs_fp, const SM2_KEY *client_sign_key)
 {
-	uint8_t *record = conn->record;
+	uint8_t *record;
 	size_t recordlen;
 	uint8_t finished[256];
 	size_t finishedlen;
@@ -207,7 +207,6 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 
 	SM2_KEY server_sign_key;
 	SM2_SIGN_CTX verify_ctx;
-	SM2_SIGN_CTX sign_ctx;   // for certificate_verify signature generation
 	uint8_t sig[TLS_MAX_SIGNATURE_SIZE];
 	size_t siglen = sizeof(sig);
 
@@ -218,8 +217,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 
 	uint8_t pre_master_secret[64];
 
-	SM3_CTX sm3_ctx;
-	SM3_CTX tmp_sm3_ctx;
+	TLS_TRANSCRIPT transcript;
 	uint8_t sm3_hash[32];
 	uint8_t verify_data[12];
 	uint8_t local_verify_data[12];
@@ -230,10 +228,9 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	server.sin_port = htons(port);
 
 
-	sm3_init(&sm3_ctx);
+	tls_transcript_init(&transcript, 0);
 	if (client_sign_key)
-		sm2_sign_init(&sign_ctx, client_sign_key, SM2_DEFAULT_ID);
-	tls_record_set_version(record, TLS_version_tls1);
+		tls_transcript_set_sm2_key(&transcript, client_sign_key);
 	tls_record_set_version(finished, TLS_version_tls12);
 
 
@@ -250,6 +247,12 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	}
 
 	conn->is_client = 1;
+	if (tls_handshake_init(conn) != 1) {
+		error_print();
+		return -1;
+	}
+	record = conn->record;
+	tls_record_set_version(record, TLS_version_tls1);
 
 
 	tls_trace(">>>> ClientHello\n");
@@ -265,9 +268,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	tls_trace("<<<< ServerHello\n");
 	if (tls12_record_recv(record, &recordlen, conn->sock) != 1) {
@@ -290,9 +291,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 	// FIXME: check extensions			
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	tls_trace("<<<< ServerCertificate\n");
 	if (tls12_record_recv(record, &recordlen, conn->sock) != 1) {
@@ -300,26 +299,25 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, 0, 0);
-	if (tls_record_get_handshake_certificate(record, conn->server_certs, &conn->server_certs_len) != 1) {
+	if (tls_record_get_handshake_certificate(record, conn->hs->server_certs, &conn->hs->server_certs_len) != 1) {
 		error_print();
 		return -1;
 	}
 
 	/*
 	// FIXME: review cert chain verification		
-	if (tls_certificate_chain_verify(conn->server_certs, conn->server_certs_len, ca_certs_fp, 5) != 1) {
+	if (tls_certificate_chain_verify_ex(conn->hs->server_certs, conn->hs->server_certs_len,
+		conn->ca_store, ca_certs_fp, 5) != 1) {
 		error_print();
 		return -1;
 	}
 	*/
-	if (tls_certificate_get_public_keys(conn->server_certs, conn->server_certs_len,
+	if (tls_certificate_get_public_keys(conn->hs->server_certs, conn->hs->server_certs_len,
 		&server_sign_key, NULL) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	tls_trace("<<<< ServerKeyExchange\n");
 	if (tls12_record_recv(record, &recordlen, conn->sock) != 1) {
@@ -327,9 +325,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 	tls_record_print(stderr, record, recordlen, conn->cipher_suite << 8, 0);
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	if (tls_record_get_handshake_server_key_exchange_ecdhe(record, &curve, &server_ecdh_public, sig, &siglen) != 1) {
 		error_print();
@@ -354,17 +350,17 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	tls_prf(pre_master_secret, 32, "master secret",
 		client_random, 32,
 		server_random, 32,
-		48, conn->master_secret);
-	tls_prf(conn->master_secret, 48, "key expansion",
+		48, conn->hs->master_secret);
+	tls_prf(conn->hs->master_secret, 48, "key expansion",
 		server_random, 32,
 		client_random, 32,
-		96, conn->key_block);
-	sm3_hmac_init(&conn->client_write_mac_ctx, conn->key_block, 32);
-	sm3_hmac_init(&conn->server_write_mac_ctx, conn->key_block + 32, 32);
-	sm4_set_encrypt_key(&conn->client_write_enc_key, conn->key_block + 64);
-	sm4_set_decrypt_key(&conn->server_write_enc_key, conn->key_block + 80);
+		96, conn->hs->key_block);
+	sm3_hmac_init(&conn->client_write_mac_ctx, conn->hs->key_block, 32);
+	sm3_hmac_init(&conn->server_write_mac_ctx, conn->hs->key_block + 32, 32);
+	sm4_set_encrypt_key(&conn->client_write_enc_key, conn->hs->key_block + 64);
+	sm4_set_decrypt_key(&conn->server_write_enc_key, conn->hs->key_block + 80);
 	tls_secrets_print(stderr, pre_master_secret, 32, client_random, server_random,
-		conn->master_secret, conn->key_block, 96, 0, 0);
+		conn->hs->master_secret, conn->hs->key_block, 96, 0, 0);
 
 
 	if (tls12_record_recv(record, &recordlen, conn->sock) != 1) {
@@ -388,16 +384,13 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		if (client_sign_key)
-			sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+		tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 		if (tls_record_recv(record, &recordlen, conn->sock) != 1) {
 			error_print();
 			return -1;
 		}
 	} else {
-		memset(&sign_ctx, 0, sizeof(SM2_SIGN_CTX));
 		client_sign_key = NULL;
 	}
 	tls_trace("<<<< ServerHelloDone\n");
@@ -406,12 +399,10 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 
 	if (client_sign_key) {
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
-
 		tls_trace(">>>> ClientCertificate\n");
 		if (tls_record_set_handshake_certificate_from_pem(record, &recordlen, client_certs_fp) != 1) {
 			error_print();
@@ -422,8 +413,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+		tls_transcript_update(&transcript, record + 5, recordlen - 5);
 	}
 
 
@@ -441,14 +431,12 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (client_sign_key)
-		sm2_sign_update(&sign_ctx, record + 5, recordlen - 5);
+	tls_transcript_update(&transcript, record + 5, recordlen - 5);
 
 	if (client_sign_key) {
 		tls_trace(">>>> CertificateVerify\n");
-		sm2_sign_finish(&sign_ctx, sig, &siglen);
-		if (tls_record_set_handshake_certificate_verify(record, &recordlen, sig, siglen) != 1) {
+		if (tls_transcript_sign(&transcript, sig, &siglen) != 1
+			|| tls_record_set_handshake_certificate_verify(record, &recordlen, sig, siglen) != 1) {
 			error_print();
 			return -1;
 		}
@@ -457,7 +445,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
+		tls_transcript_update(&transcript, record + 5, recordlen - 5);
 	}
 
 	tls_trace(">>>> [ChangeCipherSpec]\n");
@@ -472,10 +460,9 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	tls_record_print(stderr, record, recordlen, 0, 0);
 
 	tls_trace(">>>> Finished\n");
-	memcpy(&tmp_sm3_ctx, &sm3_ctx, sizeof(sm3_ctx));
-	sm3_finish(&tmp_sm3_ctx, sm3_hash);
+	tls_transcript_digest(&transcript, sm3_hash);
 
-	tls_prf(conn->master_secret, 48, "client finished",
+	tls_prf(conn->hs->master_secret, 48, "client finished",
 		sm3_hash, 32, NULL, 0,
 		sizeof(verify_data), verify_data);
 	if (tls_record_set_handshake_finished(finished, &finishedlen, verify_data) != 1) {
@@ -483,7 +470,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 	tls_record_print(stderr, finished, finishedlen, 0, 0);
-	sm3_update(&sm3_ctx, finished + 5, finishedlen - 5);
+	tls_transcript_update(&transcript, finished + 5, finishedlen - 5);
 
 	if (tls_record_encrypt(&conn->client_write_mac_ctx, &conn->client_write_enc_key,
 		conn->client_seq_num, finished, finishedlen, record, &recordlen) != 1) {
@@ -523,8 +510,8 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_finish(&sm3_ctx, sm3_hash);
-	tls_prf(conn->master_secret, 48, "server finished",
+	tls_transcript_digest(&transcript, sm3_hash);
+	tls_prf(conn->hs->master_secret, 48, "server finished",
 		sm3_hash, 32, NULL, 0,
 		12, local_verify_data);
 	if (memcmp(local_verify_data, verify_data, 12) != 0) {
@@ -532,6 +519,8 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		return -1;
 	}
 
+	tls_transcript_cleanup(&transcript);
+	tls_handshake_cleanup(conn);
 	tls_trace("++++ Connection established\n");
 	return 1;
 }
@@ -541,13 +530,11 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 // 还有就是server端需要一个握手buffer
 
 
-int tls12_accept(TLS_CONNECT *conn, int port,
+static int tls12_do_accept(TLS_CONNECT *conn, int port,
 	FILE *server_certs_fp, const SM2_KEY *server_sign_key,
-	FILE *client_cacerts_fp, uint8_t *handshakes_buf, size_t handshakes_buflen)
+	FILE *client_cacerts_fp, TLS_TRANSCRIPT *transcript)
 {
-	uint8_t *handshakes = handshakes_buf;
-	size_t handshakeslen = 0;
-	uint8_t *record = conn->record;
+	uint8_t *record;
 	size_t recordlen;
 	uint8_t finished[256];
 	size_t finishedlen = sizeof(finished);
@@ -564,12 +551,9 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 	SM2_KEY client_sign_key;
 	SM2_KEY server_ecdh;
 	SM2_POINT client_ecdh_public;
-	SM2_SIGN_CTX sign_ctx;
 	uint8_t sig[TLS_MAX_SIGNATURE_SIZE];
 	size_t siglen = sizeof(sig);
 	uint8_t pre_master_secret[64];
-	SM3_CTX sm3_ctx;
-	SM3_CTX tmp_sm3_ctx;
 	uint8_t sm3_hash[32];
 	uint8_t verify_data[12];
 	uint8_t local_verify_data[12];
@@ -607,12 +591,15 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 	}
 
 	error_puts("connected\n");
+	if (tls_handshake_init(conn) != 1) {
+		error_print();
+		return -1;
+	}
+	record = conn->record;
 
 
 
 
-	sm3_init(&sm3_ctx);
-
 	tls_trace("<<<< ClientHello\n");
 	if (tls_record_recv(record, &recordlen, conn->sock) != 1) {
 		error_print();
@@ -644,15 +631,7 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		error_puts("no common cipher_suite");
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	tls_array_to_bytes(record + 5, recordlen - 5, &handshakes, &handshakeslen);
-	if (handshakes) {
-		/*
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-		*/
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	tls_trace(">>>> ServerHello\n");
 	tls_random_generate(server_random);
@@ -668,12 +647,7 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	if (handshakes) {
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	tls_trace(">>>> ServerCertificate\n");
 	if (tls_record_set_handshake_certificate_from_pem(record, &recordlen, server_certs_fp) != 1) {
@@ -685,19 +659,11 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	if (tls_record_get_handshake_certificate(record, conn->server_certs, &conn->server_certs_len) != 1) {
+	if (tls_record_get_handshake_certificate(record, conn->hs->server_certs, &conn->hs->server_certs_len) != 1) {
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	tls_array_to_bytes(record + 5, recordlen - 5, &handshakes, &handshakeslen);
-	if (handshakes) {
-		/*
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-		*/
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	tls_trace(">>>> ServerKeyExchange\n");
 	sm2_keygen(&server_ecdh);
@@ -717,15 +683,7 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	tls_array_to_bytes(record + 5, recordlen - 5, &handshakes, &handshakeslen);
-	if (handshakes) {
-		/*
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-		*/
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	if (client_cacerts_fp) {
 		tls_trace(">>>> CertificateRequest\n");
@@ -744,15 +702,7 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		tls_array_to_bytes(record + 5, recordlen - 5, &handshakes, &handshakeslen);
-		if (handshakes) {
-			/*
-			memcpy(handshakes, record + 5, recordlen - 5);
-			handshakes += recordlen - 5;
-			handshakeslen += recordlen - 5;
-			*/
-		}
+		tls_transcript_update(transcript, record + 5, recordlen - 5);
 	}
 
 	tls_trace(">>>> ServerHelloDone\n");
@@ -765,17 +715,9 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	tls_array_to_bytes(record + 5, recordlen - 5, &handshakes, &handshakeslen);
-	if (handshakes) {
-		/*
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-		*/
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
-	if (handshakes) {
+	if (client_cacerts_fp) {
 		tls_trace("<<<< ClientCertificate\n");
 		if (tls12_record_recv(record, &recordlen, conn->sock) != 1) {
 			error_print();
@@ -787,23 +729,21 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 			return -1;
 		}
 		if (tls_record_get_handshake_certificate(record,
-			conn->client_certs, &conn->client_certs_len) != 1) {
+			conn->hs->client_certs, &conn->hs->client_certs_len) != 1) {
 			error_print();
 			return -1;
 		}
 		// FIXME: verify client's certificate with ca certs		
-		if (tls_certificate_get_public_keys(conn->client_certs, conn->client_certs_len,
+		if (tls_certificate_get_public_keys(conn->hs->client_certs, conn->hs->client_certs_len,
 			&client_sign_key, NULL) != 1) {
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		tls_array_to_bytes(record + 5, recordlen - 5, &handshakes, &handshakeslen);
-		/*
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-		*/
+		tls_transcript_update(transcript, record + 5, recordlen - 5);
+		if (tls_transcript_set_sm2_key(transcript, &client_sign_key) != 1) {
+			error_print();
+			return -1;
+		}
 	}
 
 	tls_trace("<<<< ClientKeyExchange\n");
@@ -816,33 +756,25 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-	tls_array_to_bytes(record + 5, recordlen - 5, &handshakes, &handshakeslen);
-	if (handshakes) {
-		/*
-		memcpy(handshakes, record + 5, recordlen - 5);
-		handshakes += recordlen - 5;
-		handshakeslen += recordlen - 5;
-		*/
-	}
+	tls_transcript_update(transcript, record + 5, recordlen - 5);
 
 	tls_trace("++++ generate secrets\n");
 	sm2_ecdh(&server_ecdh, &client_ecdh_public, (SM2_POINT *)pre_master_secret);
 	tls_prf(pre_master_secret, 32, "master secret",
 		client_random, 32, server_random, 32,
-		48, conn->master_secret);
-	tls_prf(conn->master_secret, 48, "key expansion",
+		48, conn->hs->master_secret);
+	tls_prf(conn->hs->master_secret, 48, "key expansion",
 		server_random, 32, client_random, 32,
-		96, conn->key_block);
-	sm3_hmac_init(&conn->client_write_mac_ctx, conn->key_block, 32);
-	sm3_hmac_init(&conn->server_write_mac_ctx, conn->key_block + 32, 32);
-	sm4_set_decrypt_key(&conn->client_write_enc_key, conn->key_block + 64);
-	sm4_set_encrypt_key(&conn->server_write_enc_key, conn->key_block + 80);
+		96, conn->hs->key_block);
+	sm3_hmac_init(&conn->client_write_mac_ctx, conn->hs->key_block, 32);
+	sm3_hmac_init(&conn->server_write_mac_ctx, conn->hs->key_block + 32, 32);
+	sm4_set_decrypt_key(&conn->client_write_enc_key, conn->hs->key_block + 64);
+	sm4_set_encrypt_key(&conn->server_write_enc_key, conn->hs->key_block + 80);
 	tls_secrets_print(stderr, pre_master_secret, 32, client_random, server_random,
-		conn->master_secret, conn->key_block, 96, 0, 0);
+		conn->hs->master_secret, conn->hs->key_block, 96, 0, 0);
 
 
-	if (handshakes) {
+	if (client_cacerts_fp) {
 		tls_trace("<<<< CertificateVerify\n");
 		if (tls_record_recv(record, &recordlen, conn->sock) != 1
 			|| tls_record_version(record) != TLS_version_tls12) {
@@ -854,13 +786,11 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 			error_print();
 			return -1;
 		}
-		sm3_update(&sm3_ctx, record + 5, recordlen - 5);
-		sm2_verify_init(&sign_ctx, &client_sign_key, SM2_DEFAULT_ID);
-		sm2_verify_update(&sign_ctx, handshakes_buf, handshakeslen);
-		if (sm2_verify_finish(&sign_ctx, sig, siglen) != 1) {
+		if (tls_transcript_verify(transcript, sig, siglen) != 1) {
 			error_print();
 			return -1;
 		}
+		tls_transcript_update(transcript, record + 5, recordlen - 5);
 	}
 
 	tls_trace("<<<< [ChangeCipherSpec]\n");
@@ -890,11 +820,9 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, finished, finishedlen, 0, 0);
-	memcpy(&tmp_sm3_ctx, &sm3_ctx, sizeof(SM3_CTX));
-	sm3_update(&sm3_ctx, finished + 5, finishedlen - 5);
-
-	sm3_finish(&tmp_sm3_ctx, sm3_hash);
-	tls_prf(conn->master_secret, 48, "client finished",
+	tls_transcript_digest(transcript, sm3_hash);
+	tls_transcript_update(transcript, finished + 5, finishedlen - 5);
+	tls_prf(conn->hs->master_secret, 48, "client finished",
 		sm3_hash, 32, NULL, 0,
 		12, local_verify_data);
 	if (memcmp(local_verify_data, verify_data, 12) != 0) {
@@ -914,8 +842,8 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 	}
 
 	tls_trace(">>>> ServerFinished\n");
-	sm3_finish(&sm3_ctx, sm3_hash);
-	tls_prf(conn->master_secret, 48, "server finished",
+	tls_transcript_digest(transcript, sm3_hash);
+	tls_prf(conn->hs->master_secret, 48, "server finished",
 		sm3_hash, 32, NULL, 0,
 		12, verify_data);
 	if (tls_record_set_handshake_finished(finished, &finishedlen, verify_data) != 1) {
@@ -937,3 +865,19 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 	tls_trace("Connection Established!\n\n");
 	return 1;
 }
+
+int tls12_accept(TLS_CONNECT *conn, int port,
+	FILE *server_certs_fp, const SM2_KEY *server_sign_key,
+	FILE *client_cacerts_fp)
+{
+	int ret;
+	TLS_TRANSCRIPT transcript;
+
+	// buffer handshakes for client's CertificateVerify until client's public key is known
+	tls_transcript_init(&transcript, client_cacerts_fp ? 1 : 0);
+	ret = tls12_do_accept(conn, port, server_certs_fp, server_sign_key,
+		client_cacerts_fp, &transcript);
+	tls_transcript_cleanup(&transcript);
+	tls_handshake_cleanup(conn);
+	return ret;
+}
@@ -62,7 +62,6 @@ int tls13_gcm_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	uint8_t nonce[12];
 	uint8_t aad[5];
 	uint8_t *gmac;
-	uint8_t *mbuf = malloc(inlen + 256); // FIXME: update gcm_encrypt API		
 	size_t mlen, clen;
 
 	// nonce = (zeros|seq_num) xor (iv)
@@ -70,10 +69,10 @@ int tls13_gcm_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	memcpy(nonce + 3, seq_num, 8);
 	gmssl_memxor(nonce, nonce, iv, 12);
 
-	// TLSInnerPlaintext
-	memcpy(mbuf, in, inlen);
-	mbuf[inlen] = record_type;
-	memset(mbuf + inlen + 1, 0, padding_len);
+	// TLSInnerPlaintext, built in the output buffer and encrypted in place
+	memmove(out, in, inlen);
+	out[inlen] = record_type;
+	memset(out + inlen + 1, 0, padding_len);
 	mlen = inlen + 1 + padding_len;
 	clen = mlen + GHASH_SIZE;
 
@@ -85,10 +84,11 @@ int tls13_gcm_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	aad[4] = clen;
 
 	gmac = out + mlen;
-	if (gcm_encrypt(key, nonce, sizeof(nonce), aad, sizeof(aad), mbuf, mlen, out, 16, gmac) != 1) {
+	if (gcm_encrypt(key, nonce, sizeof(nonce), aad, sizeof(aad), out, mlen, out, 16, gmac) != 1) {
 		error_print();
 		return -1;
 	}
+	*outlen = clen;
 	return 1;
 }
 
@@ -189,7 +189,7 @@ int tls13_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen, size_t pa
 	const BLOCK_CIPHER_KEY *key;
 	const uint8_t *iv;
 	uint8_t *seq_num;
-	uint8_t *record = conn->record;
+	uint8_t *record;
 	size_t recordlen;
 
 	tls_trace("<<<< [ApplicationData]\n");
@@ -204,9 +204,14 @@ int tls13_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen, size_t pa
 		seq_num = conn->server_seq_num;
 	}
 
+	if (!(record = tls_record_buffer_acquire())) {
+		error_print();
+		return -1;
+	}
 	if (tls13_gcm_encrypt(key, iv,
 		seq_num, TLS_record_application_data, data, datalen, padding_len,
 		record + 5, &recordlen) != 1) {
+		tls_record_buffer_release(record);
 		error_print();
 		return -1;
 	}
@@ -221,13 +226,14 @@ int tls13_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen, size_t pa
 	tls_record_send(record, recordlen, conn->sock);
 	tls_seq_num_incr(seq_num);
 
+	tls_record_buffer_release(record);
 	return 1;
 }
 
 int tls13_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 {
 	int record_type;
-	uint8_t *record = conn->record;
+	uint8_t *record;
 	size_t recordlen;
 	const BLOCK_CIPHER_KEY *key;
 	const uint8_t *iv;
@@ -246,11 +252,17 @@ int tls13_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 		seq_num = conn->server_seq_num;
 	}
 
+	if (!(record = tls_record_buffer_acquire())) {
+		error_print();
+		return -1;
+	}
 	if (tls12_record_recv(record, &recordlen, conn->sock) != 1) {
+		tls_record_buffer_release(record);
 		error_print();
 		return -1;
 	}
 	if (record[0] != TLS_record_application_data) {
+		tls_record_buffer_release(record);
 		error_print();
 		return -1;
 	}
@@ -258,9 +270,11 @@ int tls13_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 	if (tls13_gcm_decrypt(key, iv,
 		seq_num, record + 5, recordlen - 5,
 		&record_type, data, datalen) != 1) {
+		tls_record_buffer_release(record);
 		error_print();
 		return -1;
 	}
+	tls_record_buffer_release(record);
 	tls_seq_num_incr(seq_num);
 
 	if (record_type != TLS_record_application_data) {
@@ -1202,7 +1216,7 @@ Auth | {CertificateVerify*}
 int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *server_cacerts_fp,
 	FILE *client_certs_fp, const SM2_KEY *client_sign_key)
 {
-	uint8_t *record = conn->record;
+	uint8_t *record;
 	size_t recordlen;
 
 	uint8_t enced_record[256];
@@ -1249,6 +1263,7 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 	uint8_t server_application_traffic_secret[32];
 	uint8_t client_write_key[16];
 	uint8_t server_write_key[16];
+	TLS_FLIGHT flight;
 
 	struct sockaddr_in server;
 	server.sin_addr.s_addr = inet_addr(hostname);
@@ -1269,6 +1284,12 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 	}
 
 	conn->is_client = 1;
+	if (tls_handshake_init(conn) != 1) {
+		error_print();
+		return -1;
+	}
+	record = conn->record;
+	tls_flight_init(&flight, conn->sock);
 	tls_record_set_version(enced_record, TLS_version_tls12);
 
 
@@ -1430,11 +1451,11 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 
 	tls_trace(">>>> Server Certificate\n");
 	tls_record_print(stderr, record, recordlen, 0, 0);
-	if (tls13_record_get_handshake_certificate(record, conn->server_certs, &conn->server_certs_len) != 1) {
+	if (tls13_record_get_handshake_certificate(record, conn->hs->server_certs, &conn->hs->server_certs_len) != 1) {
 		error_print();
 		return -1;
 	}
-	if (tls_certificate_get_public_keys(conn->server_certs, conn->server_certs_len,
+	if (tls_certificate_get_public_keys(conn->hs->server_certs, conn->hs->server_certs_len,
 		&server_sign_key, NULL) != 1) {
 		error_print();
 		return -1;
@@ -1533,7 +1554,7 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 			return -1;
 		}
 		tls_seq_num_incr(conn->client_seq_num);
-		if (tls_record_send(enced_record, enced_recordlen, conn->sock) != 1) {
+		if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1) {
 			error_print();
 			return -1;
 		}
@@ -1558,7 +1579,7 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 			return -1;
 		}
 		tls_seq_num_incr(conn->client_seq_num);
-		if (tls_record_send(enced_record, enced_recordlen, conn->sock) != 1) {
+		if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1) {
 			error_print();
 			return -1;
 		}
@@ -1587,7 +1608,8 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 		return -1;
 	}
 	tls_seq_num_incr(conn->client_seq_num);
-	if (tls_record_send(enced_record, enced_recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1
+		|| tls_flight_flush(&flight) != 1) {
 		error_print();
 		return -1;
 	}
@@ -1600,6 +1622,8 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 	block_cipher_set_encrypt_key(&conn->client_write_key, cipher, client_write_key);
 	tls13_hkdf_expand_label(digest, client_application_traffic_secret, "iv", NULL, 0, 12, conn->client_write_iv);
 
+	conn->version = TLS_version_tls13;
+	tls_handshake_cleanup(conn);
 	tls_trace("++++ Connection established\n");
 	return 1;
 }
@@ -1608,7 +1632,7 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 	FILE *server_certs_fp, const SM2_KEY *server_sign_key,
 	FILE *client_cacerts_fp)
 {
-	uint8_t *record = conn->record;
+	uint8_t *record;
 	size_t recordlen;
 	uint8_t enced_record[25600];
 	size_t enced_recordlen = sizeof(enced_record);
@@ -1657,6 +1681,7 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 	uint8_t client_application_traffic_secret[32];
 	uint8_t server_application_traffic_secret[32];
 	uint8_t master_secret[32];
+	TLS_FLIGHT flight;
 
 
 	int sock;
@@ -1691,6 +1716,12 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 	}
 
 	error_puts("connected\n");
+	if (tls_handshake_init(conn) != 1) {
+		error_print();
+		return -1;
+	}
+	record = conn->record;
+	tls_flight_init(&flight, conn->sock);
 
 
 	// 1. Recv ClientHello
@@ -1751,8 +1782,8 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 	}
 	tls_record_print(stderr, enced_record, enced_recordlen, 0, 0);
 
-	digest_update(&dgst_ctx, record + 5, recordlen - 5);
-	if (tls_record_send(record, recordlen, conn->sock) != 1) {
+	digest_update(&dgst_ctx, enced_record + 5, enced_recordlen - 5);
+	if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1) {
 		error_print();
 		return -1;
 	}
@@ -1797,7 +1828,7 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 
-	if (tls_record_send(enced_record, enced_recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1) {
 		error_print();
 		return -1;
 	}
@@ -1829,7 +1860,7 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 			error_print();
 			return -1;
 		}
-		if (tls_record_send(enced_record, enced_recordlen, conn->sock) != 1) {
+		if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1) {
 			error_print();
 			return -1;
 		}
@@ -1854,14 +1885,14 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 
-	if (tls_record_send(enced_record, enced_recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1) {
 		error_print();
 		return -1;
 	}
 	tls_seq_num_incr(conn->server_seq_num);
 
 
-	if (tls_record_get_handshake_certificate(record, conn->server_certs, &conn->server_certs_len) != 1) {
+	if (tls_record_get_handshake_certificate(record, conn->hs->server_certs, &conn->hs->server_certs_len) != 1) {
 		error_print();
 		return -1;
 	}
@@ -1889,7 +1920,7 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 
-	if (tls_record_send(enced_record, enced_recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1) {
 		error_print();
 		return -1;
 	}
@@ -1919,7 +1950,8 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 
-	if (tls_record_send(enced_record, enced_recordlen, conn->sock) != 1) {
+	if (tls_flight_add_record(&flight, enced_record, enced_recordlen) != 1
+		|| tls_flight_flush(&flight) != 1) {
 		error_print();
 		return -1;
 	}
@@ -1954,12 +1986,12 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 		tls_record_print(stderr, record, recordlen, 0, 0);
 
 		if (tls13_record_get_handshake_certificate(record,
-			conn->client_certs, &conn->client_certs_len) != 1) {
+			conn->hs->client_certs, &conn->hs->client_certs_len) != 1) {
 			error_print();
 			return -1;
 		}
 		// FIXME: verify client's certificate with ca certs		
-		if (tls_certificate_get_public_keys(conn->client_certs, conn->client_certs_len,
+		if (tls_certificate_get_public_keys(conn->hs->client_certs, conn->hs->client_certs_len,
 			&client_sign_key, NULL) != 1) {
 			error_print();
 			return -1;
@@ -2028,6 +2060,8 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 
+	conn->version = TLS_version_tls13;
+	tls_handshake_cleanup(conn);
 	tls_trace("Connection Established!\n\n");
 	return 1;
 }
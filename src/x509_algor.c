@@ -58,7 +58,7 @@ const char *x509_digest_algor_name(int oid)
 
 int x509_digest_algor_to_der(int oid, uint8_t **out, size_t *outlen)
 {
-	size_t len;
+	size_t len = 0;
 
 	if (oid != OID_sm3) {
 		error_print();
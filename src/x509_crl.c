@@ -1,4 +1,4 @@
-﻿/* 
+﻿/*
  *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
  *
  *   Licensed under the Apache License, Version 2.0 (the "License");
@@ -17,415 +17,386 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <gmssl/sm2.h>
+#include <gmssl/oid.h>
+#include <gmssl/asn1.h>
+#include <gmssl/x509.h>
 #include <gmssl/crl.h>
+#include <gmssl/error.h>
 
 
 const char *crl_reason_text(int reason)
 {
 	switch (reason) {
 	case X509_cr_unspecified: return "unspecified";
-	case X509_cr_key_compromise: return "keyCompromise";
-	case X509_cr_ca_compromise: return "cACompromise";
-	case X509_cr_affiliation_changed: return "affiliationChanged";
+	case X509_cr_keyCompromise: return "keyCompromise";
+	case X509_cr_cACompromise: return "cACompromise";
+	case X509_cr_affiliationChanged: return "affiliationChanged";
 	case X509_cr_superseded: return "superseded";
-	case X509_cr_cessation_of_operation: return "cessationOfOperation";
-	case X509_cr_certificate_hold: return "certificateHold";
-	case X509_cr_remove_from_crl: return "removeFromCRL";
-	case X509_cr_privilege_withdrawn: return "privilegeWithdrawn";
-	case X509_cr_aa_compromise: return "aACompromise";
+	case X509_cr_cessationOfOperation: return "cessationOfOperation";
+	case X509_cr_certificateHold: return "certificateHold";
+	case X509_cr_removeFromCRL: return "removeFromCRL";
+	case X509_cr_privilegeWithdrawn: return "privilegeWithdrawn";
+	case X509_cr_aACompromise: return "aACompromise";
 	}
 	return NULL;
 }
 
- 84 typedef struct {
- 85         uint8_t serial_number[20];
- 86         size_t serial_number_len;
- 87         time_t revoke_date;
- 88         CRL_EXTENSIONS crlEntryExtensions;
- 89 } CRL_REVOKED_CERT;
-
-
-int crl_revoked_cert_to_der(const CRL_REVOKED_CERT *a, uint8_t **out, size_t *outlen)
+static uint32_t x509_crl_hash(const uint8_t *serial, size_t serial_len)
 {
-	size_t len = 0;
-	if (asn1_integer_to_der(a->serial_number, a->serial_number_len, NULL, &len) != 1
-		|| x509_time_to_der(a->revoke_date, NULL, &len) != 1
-		|| x509_extension_to_der(a->exts, NULL, &len) != 1
-		|| asn1_sequence_header_to_der(len, out, outlen) != 1
-		|| asn1_integer_to_der(a->serial_number, a->serial_number_len, out, outlen) != 1
-		|| x509_time_to_der(a->revoke_date, out, outlen) != 1
-		|| x509_extension_to_der(a->exts, out, outlen) != 1) {
-		error_print();
-		return -1;
+	uint32_t h = 0x811c9dc5;
+	while (serial_len--) {
+		h ^= *serial++;
+		h *= 0x01000193;
 	}
-	return 1;
+	return h;
 }
 
-int crl_revoked_cert_from_der(CRL_REVOKED_CERT *a, const uint8_t **in, size_t *inlen)
+// The index holds the offset of the userCertificate INTEGER of each entry
+static int x509_crl_index_serial(const X509_CRL *crl, uint32_t off, const uint8_t **serial, size_t *serial_len)
 {
-	int ret;
-	const uint8_t *data;
-	size_t datalen;
+	const uint8_t *p = crl->der + off;
+	size_t len = crl->der_len - off;
+	return asn1_integer_from_der(serial, serial_len, &p, &len);
+}
 
-	if ((ret = asn1_sequence_from_der(&data, &datalen, in, inlen)) != 1) {
-		if (ret < 0) error_print();
-		return ret;
-	}
-	if (asn1_integer_from_der(a->serial_number, &a->serial_number_len, &data, &datalen) != 1
-		|| x509_time_from_der(&a->revoke_date, &data, &datalen) != 1
-		|| x509_extensions_from_der(&a->exts, &data, &datalen) != 1
-		|| datalen) {
+static int x509_crl_index_build(X509_CRL *crl, const uint8_t *revoked, size_t revoked_len)
+{
+	const uint8_t *entries = revoked;
+	size_t entries_len = revoked_len;
+	size_t buckets = 16;
+	size_t count = 0;
+
+	// first pass counts the entries so the table is allocated once
+	while (entries_len) {
+		const uint8_t *entry;
+		size_t entry_len;
+		if (asn1_sequence_from_der(&entry, &entry_len, &entries, &entries_len) != 1) {
+			error_print();
+			return -1;
+		}
+		count++;
+	}
+	if (count > UINT32_MAX / 2 || crl->der_len > UINT32_MAX) {
 		error_print();
 		return -1;
 	}
-	return 1;
-}
-
-int crl_revoked_cert_print(FILE *fp, const CRL_REVOKED_CERT *a, int format, int indent)
-{
-
-	return 1;
-}
-
-int crl_tbs_cert_list_to_der(const CRL_TBS_CERT_LIST *a, uint8_t **out, size_t *outlen)
-{
-	size_t len = 0;
-	if (asn1_int_to_der(a->version, NULL, &len) != 1
-		|| x509_algorithm_id_to_der(a->signature_algor, NULL, &len) != 1
-		|| x509_name_to_der(&a->issuer, NULL, &len) != 1
-		|| x509_time_to_der(a->this_update, NULL, &len) != 1
-		|| x509_time_to_der(a->next_update, NULL, &len) != 1
-		|| asn1_sequence_header_to_der(len, out, outlen) != 1
-		|| asn1_int_to_der(a->version, out, outlen) != 1
-		|| x509_algorithm_id_to_der(a->signature_algor, out, outlen) != 1
-		|| x509_name_to_der(&a->issuer, out, outlen) != 1
-		|| x509_time_to_der(a->next_update, out, outlen) != 1) {
+	while (buckets < count * 2) {
+		buckets <<= 1;
+	}
+	if (!(crl->index = calloc(buckets, sizeof(uint32_t)))) {
 		error_print();
 		return -1;
 	}
+	crl->index_mask = buckets - 1;
+
+	entries = revoked;
+	entries_len = revoked_len;
+	while (entries_len) {
+		const uint8_t *entry;
+		size_t entry_len;
+		const uint8_t *serial_tlv;
+		const uint8_t *serial;
+		size_t serial_len;
+		const uint8_t *date;
+		size_t date_len;
+		size_t pos;
+
+		if (asn1_sequence_from_der(&entry, &entry_len, &entries, &entries_len) != 1) {
+			error_print();
+			return -1;
+		}
+		serial_tlv = entry;
+		if (asn1_integer_from_der(&serial, &serial_len, &entry, &entry_len) != 1
+			|| asn1_any_from_der(&date, &date_len, &entry, &entry_len) != 1) {
+			error_print();
+			return -1;
+		}
+		pos = x509_crl_hash(serial, serial_len) & crl->index_mask;
+		while (crl->index[pos]) {
+			pos = (pos + 1) & crl->index_mask;
+		}
+		crl->index[pos] = (uint32_t)(serial_tlv - crl->der);
+	}
+	crl->count = count;
 	return 1;
 }
 
-int crl_tbs_cert_list_from_der(CRL_TBS_CERT_LIST *a, const uint8_t **in, size_t *inlen)
+int x509_crl_from_der(X509_CRL *crl, const uint8_t *der, size_t derlen)
 {
-	int ret;
+	const uint8_t *in;
+	size_t inlen;
+	const uint8_t *cert_list;
+	size_t cert_list_len;
+	const uint8_t *tbs;
+	size_t tbs_len;
 	const uint8_t *data;
 	size_t datalen;
+	const uint8_t *revoked = NULL;
+	size_t revoked_len = 0;
+	const uint8_t *sig;
+	size_t sig_nbits;
+	int version;
+	int tbs_algor;
+	uint32_t nodes[32];
+	size_t nodes_count;
+	int ret;
 
-	if ((ret = asn1_sequence_from_der(&data, &datalen, in, inlen)) != 1) {
-		if (ret < 0) error_print();
-		return ret;
-	}
-	if (asn1_int_from_der(&a->version, &data, &datalen) != 1
-		|| x509_algorithm_id_from_der(&a->signature_algor, &data, &datalen) != 1
-		|| x509_name_from_der(&a->issuer, &data, &datalen) != 1
-		|| x509_time_from_der(&a->this_update, &data, &datalen) != 1
-		|| x509_time_from_der(&a->next_update, &data, &datalen) != 1) {
+	if (!crl || !der || !derlen) {
 		error_print();
 		return -1;
 	}
-}
-
-int x509_cert_list_to_der(const X509_CERT_LIST *a, uint8_t **out, size_t *outlen)
-{
-	size_t len = 0;
-	if (x509_tbs_cert_list_to_der(&a->tbs_cert_list, NULL, &len) != 1
-		|| x509_signature_algor_to_der(a->signature_algor, NULL, &len) != 1
-		|| asn1_bit_string_to_der(a->signature, a->signature_len, NULL, &len) != 1
-		|| asn1_sequence_header_to_der(len, out, outlen) != 1
-		|| x509_tbs_cert_list_to_der(&a->tbs_cert_list, out, outlen) != 1
-		|| x509_signature_algor_to_der(a->signature_algor, out, outlen) != 1
-		|| asn1_bit_string_to_der(a->signature, a->signature_len, out, outlen) != 1) {
+	memset(crl, 0, sizeof(X509_CRL));
+	if (!(crl->der = malloc(derlen))) {
 		error_print();
 		return -1;
 	}
-	return 1;
-}
-
-int x509_cert_list_from_der(X509_CERT_LIST *a, const uint8_t **in, size_t *inlen)
-{
-	int ret;
-	const uint8_t *data;
-	size_t datalen;
-	const uint8_t *sig;
+	memcpy(crl->der, der, derlen);
+	crl->der_len = derlen;
+	in = crl->der;
+	inlen = derlen;
 
-	if ((ret = asn1_sequence_from_der(&data, &datalen, in, inlen)) != 1) {
-		if (ret < 0)
-			error_print();
-		return ret;
+	if (asn1_sequence_from_der(&cert_list, &cert_list_len, &in, &inlen) != 1
+		|| inlen > 0) {
+		error_print();
+		goto err;
 	}
-	if (x509_tbs_cert_list_from_der(&a->tbs_cert_list, in, inlen) != 1
-		|| x509_signature_algor_from_der(&a->signature_algor, in, inlen) != 1
-		|| asn1_bit_string_from_der(&sig, &a->signature_len, in, inlen) != 1
-		|| a->signature_len <= 0
-		|| a->signature_len >= X509_MAX_SIGNATURE_SIZE) {
+	crl->tbs = cert_list - crl->der;
+	if (asn1_sequence_from_der(&tbs, &tbs_len, &cert_list, &cert_list_len) != 1) {
 		error_print();
-		return -1;
+		goto err;
 	}
+	crl->tbs_len = (cert_list - crl->der) - crl->tbs;
 
-	memcpy(a->signature, sig, a->signature_len);
-	return 1;
-}
-
-
-static const int X509_CRLExtensionOIDs[7] = {
-	OID_id_ce_authorityKeyIdentifier,
-	OID_id_ce_issuerAltName,
-	OID_id_ce_cRLNumber,
-	OID_id_ce_deltaCRLIndicator,
-	OID_id_ce_issuingDistributionPoint,
-	OID_id_ce_freshestCRL,
-	OID_pe_authorityInfoAccess,
-};
-
-
-
-void X509_CRLExtensionValue_to_der(const X509_CRLExtensionValue *a, int type, uint8_t **out, size_t *outlen)
-{
-	switch (type) {
-	case OID_id_ce_authorityKeyIdentifier: AuthorityKeyIdentifier_to_der(&a->u.authorityKeyIdentifier, out, outlen); break;
-	case OID_id_ce_issuerAltName: X509_GeneralNames_to_der(&a->u.issuerAltName, out, outlen); break;
-	case OID_id_ce_cRLNumber: ASN1_INTEGER_to_der(&a->u.cRLNumber, out, outlen); break;
-	case OID_id_ce_deltaCRLIndicator: ASN1_INTEGER_to_der(&a->u.deltaCRLIndicator, out, outlen);
-	case OID_id_ce_issuingDistributionPoint: X509_IssuingDistributionPoint_to_der(&a->u.issuingDistributionPoint, out, outlen);
-	case OID_id_ce_freshestCRL: X509_CRLDistributionPoints_to_der(&a->u.freshestCRL, out, outlen);
-	case OID_pe_authorityInfoAccess: X509_AuthorityInfoAccessSyntax_to_der(&a->u.authorityInfoAccess, out, outlen);
+	if ((ret = asn1_int_from_der(&version, &tbs, &tbs_len)) < 0
+		|| (ret == 1 && version != 1)
+		|| x509_signature_algor_from_der(&tbs_algor, nodes, &nodes_count, &tbs, &tbs_len) != 1) {
+		error_print();
+		goto err;
 	}
-}
-
-int X509_CRLExtensionValue_from_der(X509_CRLExtensionValue *a, int type, const uint8_t **in, size_t *inlen)
-{
-	switch (type) {
-	case OID_id_ce_authorityKeyIdentifier: return AuthorityKeyIdentifier_from_der(&a->u.authorityKeyIdentifier, in, inlen);
-	case OID_id_ce_issuerAltName: return X509_GeneralNames_from_der(&a->u.issuerAltName, in, inlen);
-	case OID_id_ce_cRLNumber: return ASN1_INTEGER_from_der(&a->u.cRLNumber, in, inlen);
-	case OID_id_ce_deltaCRLIndicator: return ASN1_INTEGER_from_der(&a->u.deltaCRLIndicator, in, inlen);
-	case OID_id_ce_issuingDistributionPoint: return X509_IssuingDistributionPoint_from_der(&a->u.issuingDistributionPoint, in, inlen);
-	case OID_id_ce_freshestCRL: return X509_CRLDistributionPoints_from_der(&a->u.freshestCRL, in, inlen);
-	case OID_pe_authorityInfoAccess: return X509_AuthorityInfoAccessSyntax_from_der(&a->u.authorityInfoAccess, in, inlen);
+	crl->issuer = tbs - crl->der;
+	if (asn1_sequence_from_der(&data, &datalen, &tbs, &tbs_len) != 1) {
+		error_print();
+		goto err;
 	}
-}
+	crl->issuer_len = (tbs - crl->der) - crl->issuer;
 
+	if (x509_time_from_der(&crl->this_update, &tbs, &tbs_len) != 1
+		|| x509_time_from_der(&crl->next_update, &tbs, &tbs_len) < 0
+		|| asn1_sequence_from_der(&revoked, &revoked_len, &tbs, &tbs_len) < 0
+		|| asn1_explicit_from_der(0, &data, &datalen, &tbs, &tbs_len) < 0
+		|| tbs_len > 0) {
+		error_print();
+		goto err;
+	}
 
+	if (x509_signature_algor_from_der(&crl->signature_algor, nodes, &nodes_count, &cert_list, &cert_list_len) != 1
+		|| asn1_bit_string_from_der(&sig, &sig_nbits, &cert_list, &cert_list_len) != 1
+		|| cert_list_len > 0
+		|| crl->signature_algor != tbs_algor) {
+		error_print();
+		goto err;
+	}
+	crl->sig = sig - crl->der;
+	crl->sig_len = (sig_nbits + 7) / 8;
 
-void X509_CRLExtension_to_der(const X509_CRLExtension *a, uint8_t **out, size_t *outlen)
-{
-	ASN1_SEQUENCE_tag_length_to_der((ASN1_SEQUENCE *)a, out, outlen);
-	ASN1_OBJECT_IDENTIFIER_to_der(&a->extnID, out, outlen);
-	ASN1_BOOLEAN_to_der(&a->critical, out, outlen);
-	ASN1_OCTET_STRING_tag_length_to_der(&a->extnValue, out, outlen);
-	X509_CRLExtensionValue_to_der(&a->extnValue_data, out, outlen);
+	if (x509_crl_index_build(crl, revoked, revoked_len) != 1) {
+		error_print();
+		goto err;
+	}
+	return 1;
+err:
+	x509_crl_cleanup(crl);
+	return -1;
 }
 
-int X509_CRLExtension_from_der(X509_CRLExtension *a, const uint8_t **in, size_t *inlen)
+int x509_crl_verify(X509_CRL *crl, const SM2_KEY *sign_key)
 {
+	SM2_SIGN_CTX ctx;
 	int ret;
-	const uint8_t *data;
-	size_t length;
 
-	if ((ret = ASN1_SEQUENCE_from_der((ASN1_SEQUENCE *)a, in, inlen)) <= 0) {
-		return ret;
-	}
-	data = ((ASN1_SEQUENCE *)a)->data;
-	length = ((ASN1_SEQUENCE *)a)->length;
-	if (ASN1_OBJECT_IDENTIFIER_from_der(&a->extnID, &data, &length) <= 0
-		|| ASN1_BOOLEAN_from_der(&a->critical, &data, &length) < 0
-		|| ASN1_OCTET_STRING_from_der(&a->extnValue, &data, &length) <= 0
-		|| length > 0) {
+	if (!crl || !crl->der || !sign_key) {
+		error_print();
 		return -1;
 	}
-	data = a->extnValue.data;
-	length = a->extnValue.length;
-	if (X509_CRLExtensionValue_from_der(&a->extnValue_data, &data, &length) < 0
-		|| length > 0) {
+	if (crl->signature_algor != OID_sm2sign_with_sm3) {
+		error_print();
 		return -1;
 	}
-
+	if (sm2_verify_init(&ctx, sign_key, SM2_DEFAULT_ID) != 1
+		|| sm2_verify_update(&ctx, crl->der + crl->tbs, crl->tbs_len) != 1) {
+		error_print();
+		return -1;
+	}
+	ret = sm2_verify_finish(&ctx, crl->der + crl->sig, crl->sig_len);
+	memset(&ctx, 0, sizeof(ctx));
+	if (ret != 1) {
+		error_print();
+		return -1;
+	}
+	crl->verified = 1;
 	return 1;
 }
 
-
-
-
-
-void X509_CRLExtensions_add(X509_CRLExtensions *a, const X509_CRLExtension *value)
+int x509_crl_is_revoked(const X509_CRL *crl, const uint8_t *serial, size_t serial_len)
 {
-	size_t length = ((ASN1_SEQUENCE *)a)->length;
-	assert(a->count < 16);
-	X509_CRLExtension_copy(&a->values[a->count], value);
-	X509_CRLExtension_to_der(&a->values[a->count], NULL, &length);
-	ASN1_SEQUENCE_set((ASN1_SEQUENCE *)a, NULL, length);
-	a->count++;
-}
+	size_t pos;
 
-void X509_CRLExtensions_to_der(const X509_CRLExtensions *a, uint8_t **out, size_t *outlen)
-{
-	int i;
-	ASN1_SEQUENCE_tag_length_to_der((ASN1_SEQUENCE *)a, out, outlen);
-	for (i = 0; i < a->count; i++) {
-		X509_CRLExtension_to_der(&a->value[i], out, outlen);
+	if (!crl || !crl->index || !serial) {
+		error_print();
+		return -1;
 	}
-}
-
-int X509_CRLExtensions_from_der(X509_CRLExtensions *a, const uint8_t **in, size_t *inlen)
-{
-	int ret;
-	const uint8_t *data;
-	size_t length;
-
-	if ((ret = ASN1_SEQUENCE_from_der((ASN1_SEQUENCE *)a, in, inlen)) <= 0) {
-		return ret;
-	}
-	data = ((ASN1_SEQUENCE *)a)->data;
-	length = ((ASN1_SEQUENCE *)a)->length;
-	while (length > 0) {
-		if (a->count >= 16
-			|| X509_CRLExtension_from_der(&a->values[a->count], &data, &length) <= 0) {
+	pos = x509_crl_hash(serial, serial_len) & crl->index_mask;
+	while (crl->index[pos]) {
+		const uint8_t *p;
+		size_t len;
+		if (x509_crl_index_serial(crl, crl->index[pos], &p, &len) != 1) {
+			error_print();
 			return -1;
 		}
+		if (len == serial_len && memcmp(p, serial, len) == 0) {
+			return 1;
+		}
+		pos = (pos + 1) & crl->index_mask;
 	}
-	return 1;
+	return 0;
 }
 
-
-
-
-// 5.2.5.  Issuing Distribution Point
-/*
--- issuing distribution point extension OID and syntax
-
-id-ce-issuingDistributionPoint OBJECT IDENTIFIER ::= { id-ce 28 }
-
-IssuingDistributionPoint ::= SEQUENCE {
-     distributionPoint          [0] IMPLICIT DistributionPointName OPTIONAL,
-     onlyContainsUserCerts      [1] IMPLICIT BOOLEAN DEFAULT FALSE,
-     onlyContainsCACerts        [2] IMPLICIT BOOLEAN DEFAULT FALSE,
-     onlySomeReasons            [3] IMPLICIT ReasonFlags OPTIONAL,
-     indirectCRL                [4] IMPLICIT BOOLEAN DEFAULT FALSE,
-     onlyContainsAttributeCerts [5] IMPLICIT BOOLEAN DEFAULT FALSE }
-     -- at most one of onlyContainsUserCerts, onlyContainsCACerts,
-     -- and onlyContainsAttributeCerts may be set to TRUE.
-*/
-
-
-
-
-
-
-
-
-
-
-void X509_CRLEntryExtension_to_der(const X509_CRLEntryExtension *a, uint8_t **out, size_t *outlen)
+void x509_crl_cleanup(X509_CRL *crl)
 {
-	ASN1_SEQUENCE_tag_length_to_der((ASN1_SEQUENCE *)a, out, outlen);
-	ASN1_OBJECT_IDENTIFIER_to_der(&a->extnID, out, outlen);
-	ASN1_BOOLEAN_to_der(&a->critical, out, outlen);
-	ASN1_OCTET_STRING_tag_length_to_der(&a->extnValue, out, outlen);
-	X509_CRLEntryExtensionValue_to_der(&a->extnValue_data, out, outlen);
+	if (crl) {
+		free(crl->der);
+		free(crl->index);
+		memset(crl, 0, sizeof(X509_CRL));
+	}
 }
 
-int X509_CRLEntryExtension_from_der(X509_CRLEntryExtension *a, const uint8_t **in, size_t *inlen)
+static int x509_crl_revoked_to_der(const uint8_t *const *serials, const size_t *serials_lens, size_t count,
+	time_t revoke_date, uint8_t **out, size_t *outlen)
 {
-	int ret;
-	const uint8_t *data;
-	size_t length;
-
-	if ((ret = ASN1_SEQUENCE_from_der((ASN1_SEQUENCE *)a, in, inlen)) <= 0) {
-		return ret;
-	}
-	data = ((ASN1_SEQUENCE *)a)->data;
-	length = ((ASN1_SEQUENCE *)a)->length;
-	if (ASN1_OBJECT_IDENTIFIER_from_der(&a->extnID, &data, &length) <= 0
-		|| ASN1_BOOLEAN_from_der(&a->critical, &data, &length) < 0
-		|| ASN1_OCTET_STRING_from_der(&a->extnValue, &data, &length) <= 0
-		|| length > 0) {
-		return -1;
+	size_t entries_len = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		size_t len = 0;
+		if (asn1_integer_to_der(serials[i], serials_lens[i], NULL, &len) != 1
+			|| x509_time_to_der(revoke_date, NULL, &len) != 1
+			|| asn1_sequence_header_to_der(len, NULL, &entries_len) != 1) {
+			error_print();
+			return -1;
+		}
+		entries_len += len;
 	}
-	data = a->extnValue.data;
-	length = a->extnValue.length;
-	if (X509_CRLEntryExtensionValue_from_der(&a->extnValue_data, &data, &length) < 0
-		|| length > 0) {
+	if (asn1_sequence_header_to_der(entries_len, out, outlen) != 1) {
+		error_print();
 		return -1;
 	}
-
+	for (i = 0; i < count; i++) {
+		size_t len = 0;
+		if (asn1_integer_to_der(serials[i], serials_lens[i], NULL, &len) != 1
+			|| x509_time_to_der(revoke_date, NULL, &len) != 1
+			|| asn1_sequence_header_to_der(len, out, outlen) != 1
+			|| asn1_integer_to_der(serials[i], serials_lens[i], out, outlen) != 1
+			|| x509_time_to_der(revoke_date, out, outlen) != 1) {
+			error_print();
+			return -1;
+		}
+	}
 	return 1;
 }
 
-
-	
-
-// CRL Entry Extensions
-//***********************************************************************************************************
-
-static const int X509_CRLEntryExtensionOIDs[3] = {
-	OID_id_ce_cRLReasons,
-	OID_id_ce_invalidityDate,
-	OID_id_ce_certificateIssuer,
-};
-
-
-
-void X509_CRLEntryExtensionValue_to_der(const X509_CRLEntryExtensionValue *a, int type, uint8_t **out, size_t *outlen)
+static int x509_tbs_cert_list_to_der(const X509_NAME *issuer, time_t this_update, time_t next_update,
+	const uint8_t *const *serials, const size_t *serials_lens, size_t count, time_t revoke_date,
+	uint8_t **out, size_t *outlen)
 {
-	switch (type) {
-	case OID_id_ce_cRLReasons: ASN1_ENUMERATED_to_der(&a->u.reasonCode, out, outlen); break;
-	case OID_id_ce_invalidityDate: X509_GeneralizedTime_to_der(&a->u.invalidityDate, out, outlen); break;
-	case OID_id_ce_certificateIssuer: X509_GeneralNames_to_der(&a->u.certificateIssuer, out, outlen); break;
-	}
-}
+	size_t len = 0;
 
-int X509_CRLEntryExtensionValue_from_der(X509_CRLEntryExtensionValue *a, int type, const uint8_t **in, size_t *inlen)
-{
-	switch (type) {
-	case OID_id_ce_cRLReasons: return ASN1_ENUMERATED_to_der(&a->u.reasonCode, in, inlen);
-	case OID_id_ce_invalidityDate: return X509_GeneralizedTime_to_der(&a->u.invalidityDate, in, inlen);
-	case OID_id_ce_certificateIssuer: return X509_GeneralNames_to_der(&a->u.certificateIssuer, in, inlen);
+	if (asn1_int_to_der(1, NULL, &len) != 1
+		|| x509_signature_algor_to_der(OID_sm2sign_with_sm3, NULL, &len) != 1
+		|| x509_name_to_der(issuer, NULL, &len) != 1
+		|| x509_time_to_der(this_update, NULL, &len) != 1
+		|| (next_update && x509_time_to_der(next_update, NULL, &len) != 1)
+		|| (count && x509_crl_revoked_to_der(serials, serials_lens, count, revoke_date, NULL, &len) != 1)
+		|| asn1_sequence_header_to_der(len, out, outlen) != 1
+		|| asn1_int_to_der(1, out, outlen) != 1
+		|| x509_signature_algor_to_der(OID_sm2sign_with_sm3, out, outlen) != 1
+		|| x509_name_to_der(issuer, out, outlen) != 1
+		|| x509_time_to_der(this_update, out, outlen) != 1
+		|| (next_update && x509_time_to_der(next_update, out, outlen) != 1)
+		|| (count && x509_crl_revoked_to_der(serials, serials_lens, count, revoke_date, out, outlen) != 1)) {
+		error_print();
+		return -1;
 	}
+	return 1;
 }
 
-void X509_CRLEntryExtensions_add(X509_CRLEntryExtensions *a, const X509_CRLEntryExtension *value)
-{
-	size_t length = ((ASN1_SEQUENCE *)a)->length;
-	assert(a->count < 16);
-	X509_CRLEntryExtension_copy(&a->values[a->count], value);
-	X509_CRLEntryExtension_to_der(&a->values[a->count], NULL, &length);
-	ASN1_SEQUENCE_set((ASN1_SEQUENCE *)a, NULL, length);
-	a->count++;
-}
-
-void X509_CRLEntryExtensions_to_der(const X509_CRLEntryExtensions *a, uint8_t **out, size_t *outlen)
+// With out == NULL the maximum length is returned
+int x509_crl_sign_to_der(const SM2_KEY *sign_key, const X509_NAME *issuer,
+	time_t this_update, time_t next_update,
+	const uint8_t *const *serials, const size_t *serials_lens, size_t count, time_t revoke_date,
+	uint8_t **out, size_t *outlen)
 {
-	int i;
-	ASN1_SEQUENCE_tag_length_to_der((ASN1_SEQUENCE *)a, out, outlen);
-	for (i = 0; i < a->count; i++) {
-		X509_CRLEntryExtension_to_der(&a->value[i], out, outlen);
+	uint8_t *tbs = NULL;
+	uint8_t *p;
+	size_t tbs_len = 0;
+	uint8_t sig[SM2_MAX_SIGNATURE_SIZE];
+	size_t siglen = sizeof(sig);
+	SM2_SIGN_CTX ctx;
+	size_t len;
+	int ret = -1;
+
+	if (!sign_key || !issuer || (count && (!serials || !serials_lens)) || !outlen) {
+		error_print();
+		return -1;
 	}
-}
-
-int X509_CRLEntryExtensions_from_der(X509_CRLExtensions *a, const uint8_t **in, size_t *inlen)
-{
-	int ret;
-	const uint8_t *data;
-	size_t length;
-
-	if ((ret = ASN1_SEQUENCE_from_der((ASN1_SEQUENCE *)a, in, inlen)) <= 0) {
-		return ret;
-	}
-	data = ((ASN1_SEQUENCE *)a)->data;
-	length = ((ASN1_SEQUENCE *)a)->length;
-	while (length > 0) {
-		if (a->count >= 16
-			|| X509_CRLEntryExtension_from_der(&a->values[a->count], &data, &length) <= 0) {
+	if (x509_tbs_cert_list_to_der(issuer, this_update, next_update,
+		serials, serials_lens, count, revoke_date, NULL, &tbs_len) != 1) {
+		error_print();
+		return -1;
+	}
+	if (!out || !*out) {
+		len = tbs_len;
+		if (x509_signature_algor_to_der(OID_sm2sign_with_sm3, NULL, &len) != 1
+			|| asn1_bit_string_to_der(sig, sizeof(sig) * 8, NULL, &len) != 1
+			|| asn1_sequence_header_to_der(len, NULL, outlen) != 1) {
+			error_print();
 			return -1;
 		}
+		*outlen += len;
+		return 1;
 	}
-	return 1;
-}
-
-
-
-
-
-
 
+	if (!(tbs = malloc(tbs_len))) {
+		error_print();
+		return -1;
+	}
+	p = tbs;
+	tbs_len = 0;
+	if (x509_tbs_cert_list_to_der(issuer, this_update, next_update,
+			serials, serials_lens, count, revoke_date, &p, &tbs_len) != 1
+		|| sm2_sign_init(&ctx, sign_key, SM2_DEFAULT_ID) != 1
+		|| sm2_sign_update(&ctx, tbs, tbs_len) != 1
+		|| sm2_sign_finish(&ctx, sig, &siglen) != 1) {
+		error_print();
+		goto end;
+	}
+	len = tbs_len;
+	if (x509_signature_algor_to_der(OID_sm2sign_with_sm3, NULL, &len) != 1
+		|| asn1_bit_string_to_der(sig, siglen * 8, NULL, &len) != 1
+		|| asn1_sequence_header_to_der(len, out, outlen) != 1) {
+		error_print();
+		goto end;
+	}
+	asn1_data_to_der(tbs, tbs_len, out, outlen);
+	if (x509_signature_algor_to_der(OID_sm2sign_with_sm3, out, outlen) != 1
+		|| asn1_bit_string_to_der(sig, siglen * 8, out, outlen) != 1) {
+		error_print();
+		goto end;
+	}
+	ret = 1;
+end:
+	memset(&ctx, 0, sizeof(ctx));
+	free(tbs);
+	return ret;
+}
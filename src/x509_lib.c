@@ -129,40 +129,73 @@ int x509_certificate_set_subject_unique_id_from_public_key_sm2(X509_CERTIFICATE
 int x509_certificate_sign_sm2(X509_CERTIFICATE *cert, const SM2_KEY *key)
 {
 	SM2_SIGN_CTX ctx;
-	uint8_t buf[1024];
-	uint8_t *p = buf;
+	uint8_t *buf;
+	uint8_t *p;
 	size_t len = 0;
+	int ret = -1;
 
 	cert->signature_algor = OID_sm2sign_with_sm3;
-	x509_tbs_certificate_to_der(&cert->tbs_certificate, &p, &len);
-	if (sm2_sign_init(&ctx, key, SM2_DEFAULT_ID) != 1
+	if (x509_tbs_certificate_to_der(&cert->tbs_certificate, NULL, &len) != 1
+		|| !(buf = malloc(len))) {
+		error_print();
+		return -1;
+	}
+	p = buf;
+	len = 0;
+	if (x509_tbs_certificate_to_der(&cert->tbs_certificate, &p, &len) != 1
+		|| sm2_sign_init(&ctx, key, SM2_DEFAULT_ID) != 1
 		|| sm2_sign_update(&ctx, buf, len) != 1
 		|| sm2_sign_finish(&ctx, cert->signature, &cert->signature_len) != 1) {
 		error_print();
-		return -1;
+		goto end;
 	}
-
+	ret = 1;
+end:
 	memset(&ctx, 0, sizeof(ctx));
-	return 1;
+	free(buf);
+	return ret;
 }
 
 // 这个公钥应该是根据issuer name从签名的CA证书中取得的
 int x509_certificate_verify_sm2(const X509_CERTIFICATE *cert, const SM2_KEY *sm2_key)
 {
 	SM2_SIGN_CTX ctx;
-	uint8_t buf[1024];
-	uint8_t *p = buf;
+	uint8_t *buf;
+	uint8_t *p;
 	size_t len = 0;
+	int ret = -1;
 
-	x509_tbs_certificate_to_der(&cert->tbs_certificate, &p, &len);
-	if (sm2_verify_init(&ctx, sm2_key, SM2_DEFAULT_ID) != 1
+	if (x509_tbs_certificate_to_der(&cert->tbs_certificate, NULL, &len) != 1
+		|| !(buf = malloc(len))) {
+		error_print();
+		return -1;
+	}
+	p = buf;
+	len = 0;
+	if (x509_tbs_certificate_to_der(&cert->tbs_certificate, &p, &len) != 1
+		|| sm2_verify_init(&ctx, sm2_key, SM2_DEFAULT_ID) != 1
 		|| sm2_verify_update(&ctx, buf, len) != 1
 		|| sm2_verify_finish(&ctx, cert->signature, cert->signature_len) != 1) {
-		return -1;
+		goto end;
 	}
-
+	ret = 1;
+end:
 	memset(&ctx, 0, sizeof(ctx));
-	return 1;
+	free(buf);
+	return ret;
+}
+
+// Verify over the tbsCertificate bytes as received, nothing is re-encoded
+int x509_certificate_verify_sm2_from_der(const uint8_t *cert, size_t certlen, const SM2_KEY *sm2_key)
+{
+	X509_CERT_VIEW view;
+
+	if (x509_cert_view_from_der(&view, &cert, &certlen) != 1
+		|| certlen > 0) {
+		error_print();
+		return -1;
+	}
+	return x509_cert_view_verify_sm2(&view, sm2_key);
 }
 
 int x509_certificate_get_public_key_sm2(const X509_CERTIFICATE *cert, SM2_KEY *sm2_key)
@@ -206,3 +239,260 @@ int x509_certificate_from_pem_by_name(X509_CERTIFICATE *cert, FILE *fp, const X5
 	}
 	return 0;
 }
+
+
+int x509_cert_view_from_der(X509_CERT_VIEW *view, const uint8_t **in, size_t *inlen)
+{
+	int ret;
+	const uint8_t *cert;
+	size_t certlen;
+	const uint8_t *tbs;
+	size_t tbslen;
+	const uint8_t *start;
+	const uint8_t *data;
+	size_t datalen;
+	const uint8_t *serial;
+	const uint8_t *uid;
+	size_t uid_nbits;
+	const uint8_t *exts;
+	size_t extslen;
+	const uint8_t *sig;
+	size_t sig_nbits;
+	int tbs_algor;
+	uint32_t nodes[32];
+	size_t nodes_count;
+
+	if (!view || !in || !(*in) || !inlen) {
+		error_print();
+		return -1;
+	}
+	start = *in;
+	if ((ret = asn1_sequence_from_der(&cert, &certlen, in, inlen)) != 1) {
+		if (ret < 0) error_print();
+		return ret;
+	}
+	if ((size_t)(*in - start) > UINT32_MAX) {
+		error_print();
+		return -1;
+	}
+	memset(view, 0, sizeof(X509_CERT_VIEW));
+	view->der = start;
+	view->der_len = (uint32_t)(*in - start);
+
+#define X509_VIEW_OFFSET(p)	((uint32_t)((p) - start))
+
+	view->tbs = X509_VIEW_OFFSET(cert);
+	if (asn1_sequence_from_der(&tbs, &tbslen, &cert, &certlen) != 1) {
+		error_print();
+		return -1;
+	}
+	view->tbs_len = X509_VIEW_OFFSET(cert) - view->tbs;
+
+	if (x509_version_from_der(&view->version, &tbs, &tbslen) != 1
+		|| asn1_integer_from_der(&serial, &datalen, &tbs, &tbslen) != 1
+		|| x509_signature_algor_from_der(&tbs_algor, nodes, &nodes_count, &tbs, &tbslen) != 1) {
+		error_print();
+		return -1;
+	}
+	view->serial = X509_VIEW_OFFSET(serial);
+	view->serial_len = (uint32_t)datalen;
+
+	view->issuer = X509_VIEW_OFFSET(tbs);
+	if (asn1_sequence_from_der(&data, &datalen, &tbs, &tbslen) != 1) {
+		error_print();
+		return -1;
+	}
+	view->issuer_len = X509_VIEW_OFFSET(tbs) - view->issuer;
+
+	view->validity = X509_VIEW_OFFSET(tbs);
+	if (asn1_sequence_from_der(&data, &datalen, &tbs, &tbslen) != 1) {
+		error_print();
+		return -1;
+	}
+	view->validity_len = X509_VIEW_OFFSET(tbs) - view->validity;
+
+	view->subject = X509_VIEW_OFFSET(tbs);
+	if (asn1_sequence_from_der(&data, &datalen, &tbs, &tbslen) != 1) {
+		error_print();
+		return -1;
+	}
+	view->subject_len = X509_VIEW_OFFSET(tbs) - view->subject;
+
+	view->spki = X509_VIEW_OFFSET(tbs);
+	if (asn1_sequence_from_der(&data, &datalen, &tbs, &tbslen) != 1) {
+		error_print();
+		return -1;
+	}
+	view->spki_len = X509_VIEW_OFFSET(tbs) - view->spki;
+
+	if (asn1_implicit_bit_string_from_der(1, &uid, &uid_nbits, &tbs, &tbslen) < 0
+		|| asn1_implicit_bit_string_from_der(2, &uid, &uid_nbits, &tbs, &tbslen) < 0
+		|| (ret = asn1_explicit_from_der(3, &exts, &extslen, &tbs, &tbslen)) < 0
+		|| tbslen > 0) {
+		error_print();
+		return -1;
+	}
+	if (ret == 1) {
+		if (asn1_sequence_from_der(&data, &datalen, &exts, &extslen) != 1
+			|| extslen > 0) {
+			error_print();
+			return -1;
+		}
+		view->exts = X509_VIEW_OFFSET(data);
+		view->exts_len = (uint32_t)datalen;
+	}
+
+	if (x509_signature_algor_from_der(&view->signature_algor, nodes, &nodes_count, &cert, &certlen) != 1
+		|| asn1_bit_string_from_der(&sig, &sig_nbits, &cert, &certlen) != 1
+		|| certlen > 0) {
+		error_print();
+		return -1;
+	}
+	if (view->signature_algor != tbs_algor) {
+		error_print();
+		return -1;
+	}
+	view->sig = X509_VIEW_OFFSET(sig);
+	view->sig_len = (uint32_t)((sig_nbits + 7) / 8);
+
+#undef X509_VIEW_OFFSET
+	return 1;
+}
+
+int x509_cert_view_get_serial_number(const X509_CERT_VIEW *view,
+	const uint8_t **serial_number, size_t *serial_number_len)
+{
+	*serial_number = view->der + view->serial;
+	*serial_number_len = view->serial_len;
+	return 1;
+}
+
+int x509_cert_view_get_issuer(const X509_CERT_VIEW *view, X509_NAME *issuer)
+{
+	const uint8_t *p = view->der + view->issuer;
+	size_t len = view->issuer_len;
+
+	if (x509_name_from_der(issuer, &p, &len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int x509_cert_view_get_subject(const X509_CERT_VIEW *view, X509_NAME *subject)
+{
+	const uint8_t *p = view->der + view->subject;
+	size_t len = view->subject_len;
+
+	if (x509_name_from_der(subject, &p, &len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int x509_cert_view_get_validity(const X509_CERT_VIEW *view, X509_VALIDITY *validity)
+{
+	const uint8_t *p = view->der + view->validity;
+	size_t len = view->validity_len;
+
+	if (x509_validity_from_der(validity, &p, &len) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int x509_cert_view_get_public_key(const X509_CERT_VIEW *view, SM2_KEY *sm2_key)
+{
+	const uint8_t *p = view->der + view->spki;
+	size_t len = view->spki_len;
+
+	if (sm2_public_key_info_from_der(sm2_key, &p, &len) != 1
+		|| len > 0) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+int x509_cert_view_get_extension_from_oid(const X509_CERT_VIEW *view, int oid,
+	int *is_critical, const uint8_t **data, size_t *datalen)
+{
+	const uint8_t *p = view->der + view->exts;
+	size_t len = view->exts_len;
+	int ext_oid;
+	uint32_t nodes[32];
+	size_t nodes_count;
+	int critical;
+	const uint8_t *d;
+	size_t dlen;
+
+	while (len) {
+		if (x509_extension_from_der(&ext_oid, nodes, &nodes_count,
+			&critical, &d, &dlen, &p, &len) != 1) {
+			error_print();
+			return -1;
+		}
+		if (ext_oid == oid) {
+			if (is_critical) *is_critical = critical;
+			if (data) *data = d;
+			if (datalen) *datalen = dlen;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Equal DER is a match, otherwise the names are decoded and compared
+int x509_cert_view_issuer_equ_subject(const X509_CERT_VIEW *cert, const X509_CERT_VIEW *cacert)
+{
+	X509_NAME issuer;
+	X509_NAME subject;
+
+	if (cert->issuer_len == cacert->subject_len
+		&& memcmp(cert->der + cert->issuer, cacert->der + cacert->subject, cert->issuer_len) == 0) {
+		return 1;
+	}
+	if (x509_cert_view_get_issuer(cert, &issuer) != 1
+		|| x509_cert_view_get_subject(cacert, &subject) != 1) {
+		error_print();
+		return -1;
+	}
+	return x509_name_equ(&issuer, &subject) == 1 ? 1 : 0;
+}
+
+int x509_cert_view_verify_sm2(const X509_CERT_VIEW *view, const SM2_KEY *sm2_key)
+{
+	SM2_SIGN_CTX ctx;
+	int ret;
+
+	if (view->signature_algor != OID_sm2sign_with_sm3) {
+		error_print();
+		return -1;
+	}
+	if (sm2_verify_init(&ctx, sm2_key, SM2_DEFAULT_ID) != 1
+		|| sm2_verify_update(&ctx, view->der + view->tbs, view->tbs_len) != 1) {
+		error_print();
+		return -1;
+	}
+	ret = sm2_verify_finish(&ctx, view->der + view->sig, view->sig_len);
+	memset(&ctx, 0, sizeof(ctx));
+	return ret == 1 ? 1 : -1;
+}
+
+int x509_cert_view_verify_by_cert_view(const X509_CERT_VIEW *cert, const X509_CERT_VIEW *cacert)
+{
+	SM2_KEY ca_pubkey;
+
+	if (x509_cert_view_issuer_equ_subject(cert, cacert) != 1) {
+		error_print();
+		return -1;
+	}
+	if (x509_cert_view_get_public_key(cacert, &ca_pubkey) != 1
+		|| x509_cert_view_verify_sm2(cert, &ca_pubkey) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
@@ -0,0 +1,728 @@
+﻿/*
+ *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <gmssl/sm2.h>
+#include <gmssl/sm3.h>
+#include <gmssl/oid.h>
+#include <gmssl/asn1.h>
+#include <gmssl/pem.h>
+#include <gmssl/x509.h>
+#include <gmssl/crl.h>
+#include <gmssl/x509_store.h>
+#include <gmssl/error.h>
+
+
+typedef struct {
+	X509_CERT_VIEW view;
+	SM2_KEY public_key;
+	const uint8_t *key_id;
+	size_t key_id_len;
+} X509_STORE_ENTRY;
+
+// by_subject and by_key_id are open addressing tables of entry index + 1
+typedef struct {
+	uint8_t *der;
+	X509_STORE_ENTRY *entries;
+	size_t count;
+	uint32_t *by_subject;
+	uint32_t *by_key_id;
+	size_t mask;
+} X509_STORE_TABLE;
+
+typedef struct {
+	uint8_t dgst[32];
+	uint64_t generation;
+	time_t not_after;
+} X509_CHAIN_CACHE_ENTRY;
+
+
+static uint32_t x509_store_hash(const uint8_t *data, size_t datalen)
+{
+	uint32_t h = 0x811c9dc5;
+	while (datalen--) {
+		h ^= *data++;
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static void x509_store_index_add(uint32_t *index, size_t mask, uint32_t hash, size_t i)
+{
+	size_t pos = hash & mask;
+	while (index[pos]) {
+		pos = (pos + 1) & mask;
+	}
+	index[pos] = (uint32_t)(i + 1);
+}
+
+static void x509_store_table_free(X509_STORE_TABLE *table)
+{
+	if (table) {
+		free(table->der);
+		free(table->entries);
+		free(table->by_subject);
+		free(table->by_key_id);
+		free(table);
+	}
+}
+
+static int x509_store_table_new(X509_STORE_TABLE **out, const char *pem, size_t pemlen)
+{
+	X509_STORE_TABLE *table;
+	size_t der_maxlen = pemlen;
+	size_t der_len = 0;
+	size_t maxcount = 0;
+	size_t buckets = 16;
+	size_t i;
+	int ret;
+
+	if (!(table = calloc(1, sizeof(X509_STORE_TABLE)))
+		|| !(table->der = malloc(der_maxlen ? der_maxlen : 1))) {
+		error_print();
+		goto err;
+	}
+	for (;;) {
+		X509_STORE_ENTRY *entry;
+		const uint8_t *cp;
+		size_t len;
+		int critical;
+
+		if ((ret = pem_decode("CERTIFICATE", table->der + der_len, &len, der_maxlen - der_len,
+			&pem, &pemlen)) < 0) {
+			error_print();
+			goto err;
+		} else if (ret == 0) {
+			break;
+		}
+		if (table->count == maxcount) {
+			X509_STORE_ENTRY *entries;
+			maxcount = maxcount ? maxcount * 2 : 64;
+			if (!(entries = realloc(table->entries, sizeof(X509_STORE_ENTRY) * maxcount))) {
+				error_print();
+				goto err;
+			}
+			table->entries = entries;
+		}
+		entry = &table->entries[table->count];
+		cp = table->der + der_len;
+		if (x509_cert_view_from_der(&entry->view, &cp, &len) != 1
+			|| len > 0
+			|| x509_cert_view_get_public_key(&entry->view, &entry->public_key) != 1
+			|| (ret = x509_cert_view_get_extension_from_oid(&entry->view, OID_ce_subjectKeyIdentifier,
+				&critical, &cp, &len)) < 0) {
+			error_print();
+			goto err;
+		}
+		entry->key_id = NULL;
+		entry->key_id_len = 0;
+		if (ret == 1
+			&& (asn1_octet_string_from_der(&entry->key_id, &entry->key_id_len, &cp, &len) != 1
+				|| len > 0)) {
+			error_print();
+			goto err;
+		}
+		der_len += entry->view.der_len;
+		table->count++;
+	}
+
+	while (buckets < table->count * 2) {
+		buckets <<= 1;
+	}
+	table->mask = buckets - 1;
+	if (!(table->by_subject = calloc(buckets, sizeof(uint32_t)))
+		|| !(table->by_key_id = calloc(buckets, sizeof(uint32_t)))) {
+		error_print();
+		goto err;
+	}
+	for (i = 0; i < table->count; i++) {
+		const X509_STORE_ENTRY *entry = &table->entries[i];
+		x509_store_index_add(table->by_subject, table->mask,
+			x509_store_hash(entry->view.der + entry->view.subject, entry->view.subject_len), i);
+		if (entry->key_id) {
+			x509_store_index_add(table->by_key_id, table->mask,
+				x509_store_hash(entry->key_id, entry->key_id_len), i);
+		}
+	}
+	*out = table;
+	return 1;
+err:
+	x509_store_table_free(table);
+	return -1;
+}
+
+// Walks the entries with the given subject (by_key_id == 0) or key id, *pos is the probe position
+static const X509_STORE_ENTRY *x509_store_table_next(const X509_STORE_TABLE *table,
+	int by_key_id, const uint8_t *key, size_t keylen, size_t *pos)
+{
+	const uint32_t *index = by_key_id ? table->by_key_id : table->by_subject;
+
+	while (index[*pos]) {
+		const X509_STORE_ENTRY *entry = &table->entries[index[*pos] - 1];
+		*pos = (*pos + 1) & table->mask;
+
+		if (by_key_id) {
+			if (entry->key_id_len == keylen && memcmp(entry->key_id, key, keylen) == 0) {
+				return entry;
+			}
+		} else {
+			if (entry->view.subject_len == keylen
+				&& memcmp(entry->view.der + entry->view.subject, key, keylen) == 0) {
+				return entry;
+			}
+		}
+	}
+	return NULL;
+}
+
+int x509_store_init(X509_STORE *store)
+{
+	if (!store) {
+		error_print();
+		return -1;
+	}
+	memset(store, 0, sizeof(X509_STORE));
+	if (pthread_rwlock_init(&store->lock, NULL) != 0) {
+		error_print();
+		return -1;
+	}
+	if (pthread_mutex_init(&store->cache_lock, NULL) != 0) {
+		pthread_rwlock_destroy(&store->lock);
+		error_print();
+		return -1;
+	}
+	// generation 0 marks an empty cache slot
+	store->generation = 1;
+	return 1;
+}
+
+int x509_store_load_pem(X509_STORE *store, const char *pem, size_t pemlen)
+{
+	X509_STORE_TABLE *table;
+	X509_STORE_TABLE *old;
+
+	if (!store || !pem) {
+		error_print();
+		return -1;
+	}
+	if (x509_store_table_new(&table, pem, pemlen) != 1) {
+		error_print();
+		return -1;
+	}
+	pthread_rwlock_wrlock(&store->lock);
+	old = store->table;
+	store->table = table;
+	pthread_rwlock_unlock(&store->lock);
+	x509_store_chain_cache_flush(store);
+
+	x509_store_table_free(old);
+	return 1;
+}
+
+int x509_store_load_pem_file(X509_STORE *store, const char *file)
+{
+	const char *pem;
+	size_t pemlen;
+	int ret;
+
+	if (pem_map_file(file, &pem, &pemlen) != 1) {
+		error_print();
+		return -1;
+	}
+	ret = x509_store_load_pem(store, pem, pemlen);
+	pem_unmap_file(pem, pemlen);
+	return ret;
+}
+
+size_t x509_store_count(X509_STORE *store)
+{
+	size_t count = 0;
+
+	pthread_rwlock_rdlock(&store->lock);
+	if (store->table) {
+		count = ((X509_STORE_TABLE *)store->table)->count;
+	}
+	pthread_rwlock_unlock(&store->lock);
+	return count;
+}
+
+static int x509_store_find(X509_STORE *store, int by_key_id, const uint8_t *key, size_t keylen,
+	uint8_t *cert, size_t *certlen, size_t maxlen)
+{
+	const X509_STORE_TABLE *table;
+	const X509_STORE_ENTRY *entry = NULL;
+	size_t pos;
+	int ret = 0;
+
+	if (!store || !key || !cert || !certlen) {
+		error_print();
+		return -1;
+	}
+	pthread_rwlock_rdlock(&store->lock);
+	if ((table = store->table) != NULL) {
+		pos = x509_store_hash(key, keylen) & table->mask;
+		entry = x509_store_table_next(table, by_key_id, key, keylen, &pos);
+	}
+	if (entry) {
+		if (entry->view.der_len > maxlen) {
+			error_print();
+			ret = -1;
+		} else {
+			memcpy(cert, entry->view.der, entry->view.der_len);
+			*certlen = entry->view.der_len;
+			ret = 1;
+		}
+	}
+	pthread_rwlock_unlock(&store->lock);
+	return ret;
+}
+
+int x509_store_find_by_subject(X509_STORE *store, const uint8_t *name, size_t namelen,
+	uint8_t *cert, size_t *certlen, size_t maxlen)
+{
+	return x509_store_find(store, 0, name, namelen, cert, certlen, maxlen);
+}
+
+int x509_store_find_by_key_id(X509_STORE *store, const uint8_t *key_id, size_t key_id_len,
+	uint8_t *cert, size_t *certlen, size_t maxlen)
+{
+	return x509_store_find(store, 1, key_id, key_id_len, cert, certlen, maxlen);
+}
+
+static int x509_cert_view_get_authority_key_id(const X509_CERT_VIEW *cert,
+	const uint8_t **key_id, size_t *key_id_len)
+{
+	const uint8_t *data;
+	size_t datalen;
+	const uint8_t *aki;
+	size_t akilen;
+	int critical;
+	int ret;
+
+	if ((ret = x509_cert_view_get_extension_from_oid(cert, OID_ce_authorityKeyIdentifier,
+		&critical, &data, &datalen)) != 1) {
+		if (ret < 0) error_print();
+		return ret;
+	}
+	if (asn1_sequence_from_der(&aki, &akilen, &data, &datalen) != 1
+		|| datalen > 0
+		|| (ret = asn1_implicit_octet_string_from_der(0, key_id, key_id_len, &aki, &akilen)) < 0) {
+		error_print();
+		return -1;
+	}
+	return ret;
+}
+
+// Caller holds the lock
+static int x509_store_crls_is_revoked(const X509_STORE *store, const uint8_t *issuer, size_t issuer_len,
+	const uint8_t *serial, size_t serial_len)
+{
+	size_t i;
+
+	for (i = 0; i < store->crls_count; i++) {
+		const X509_CRL *crl = store->crls[i];
+		if (crl->issuer_len == issuer_len
+			&& memcmp(crl->der + crl->issuer, issuer, issuer_len) == 0) {
+			return x509_crl_is_revoked(crl, serial, serial_len);
+		}
+	}
+	return 0;
+}
+
+int x509_store_verify(X509_STORE *store, const X509_CERT_VIEW *cert)
+{
+	const X509_STORE_TABLE *table;
+	const X509_STORE_ENTRY *entry;
+	const uint8_t *key_id = NULL;
+	size_t key_id_len = 0;
+	const uint8_t *issuer;
+	size_t pos;
+	int found = 0;
+	int ret = 0;
+
+	if (!store || !cert) {
+		error_print();
+		return -1;
+	}
+	if (x509_cert_view_get_authority_key_id(cert, &key_id, &key_id_len) < 0) {
+		error_print();
+		return -1;
+	}
+	issuer = cert->der + cert->issuer;
+
+	pthread_rwlock_rdlock(&store->lock);
+	if ((table = store->table) != NULL) {
+		if (key_id) {
+			pos = x509_store_hash(key_id, key_id_len) & table->mask;
+			while (ret != 1 && (entry = x509_store_table_next(table, 1, key_id, key_id_len, &pos)) != NULL) {
+				found = 1;
+				ret = x509_cert_view_verify_sm2(cert, &entry->public_key);
+			}
+		}
+		pos = x509_store_hash(issuer, cert->issuer_len) & table->mask;
+		while (ret != 1 && (entry = x509_store_table_next(table, 0, issuer, cert->issuer_len, &pos)) != NULL) {
+			found = 1;
+			ret = x509_cert_view_verify_sm2(cert, &entry->public_key);
+		}
+	}
+	if (ret == 1 && x509_store_crls_is_revoked(store, issuer, cert->issuer_len,
+		cert->der + cert->serial, cert->serial_len) != 0) {
+		error_puts("certificate revoked");
+		ret = -1;
+	}
+	pthread_rwlock_unlock(&store->lock);
+
+	if (ret == 1) {
+		return 1;
+	}
+	if (found) {
+		error_print();
+		return -1;
+	}
+	return 0;
+}
+
+void x509_store_cleanup(X509_STORE *store)
+{
+	if (store) {
+		size_t i;
+		x509_store_table_free(store->table);
+		free(store->cache);
+		for (i = 0; i < store->crls_count; i++) {
+			x509_crl_cleanup(store->crls[i]);
+			free(store->crls[i]);
+		}
+		free(store->crls);
+		pthread_rwlock_destroy(&store->lock);
+		pthread_mutex_destroy(&store->cache_lock);
+		memset(store, 0, sizeof(X509_STORE));
+	}
+}
+
+int x509_store_enable_chain_cache(X509_STORE *store, size_t max_entries)
+{
+	X509_CHAIN_CACHE_ENTRY *cache;
+	X509_CHAIN_CACHE_ENTRY *old;
+	size_t sets = 1;
+
+	if (!store || !max_entries) {
+		error_print();
+		return -1;
+	}
+	while (sets * X509_CHAIN_CACHE_WAYS < max_entries) {
+		sets <<= 1;
+	}
+	if (!(cache = calloc(sets * X509_CHAIN_CACHE_WAYS, sizeof(X509_CHAIN_CACHE_ENTRY)))) {
+		error_print();
+		return -1;
+	}
+	pthread_mutex_lock(&store->cache_lock);
+	old = store->cache;
+	store->cache = cache;
+	store->cache_mask = sets - 1;
+	store->generation++;
+	pthread_mutex_unlock(&store->cache_lock);
+	free(old);
+	return 1;
+}
+
+static X509_CHAIN_CACHE_ENTRY *x509_store_chain_cache_set(X509_STORE *store, const uint8_t dgst[32])
+{
+	size_t set = ((size_t)dgst[0] | (size_t)dgst[1] << 8 | (size_t)dgst[2] << 16 | (size_t)dgst[3] << 24)
+		& store->cache_mask;
+	return (X509_CHAIN_CACHE_ENTRY *)store->cache + set * X509_CHAIN_CACHE_WAYS;
+}
+
+int x509_store_chain_cache_lookup(X509_STORE *store, const uint8_t *chain, size_t chainlen,
+	time_t now, uint8_t dgst[32], uint64_t *generation)
+{
+	X509_CHAIN_CACHE_ENTRY *set;
+	int ret = 0;
+	int i;
+
+	if (!store || !chain || !dgst || !generation) {
+		error_print();
+		return -1;
+	}
+	sm3_digest(chain, chainlen, dgst);
+
+	pthread_mutex_lock(&store->cache_lock);
+	*generation = store->generation;
+	if (store->cache) {
+		set = x509_store_chain_cache_set(store, dgst);
+		for (i = 0; i < X509_CHAIN_CACHE_WAYS; i++) {
+			if (set[i].generation == store->generation
+				&& set[i].not_after >= now
+				&& memcmp(set[i].dgst, dgst, 32) == 0) {
+				ret = 1;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&store->cache_lock);
+	return ret;
+}
+
+int x509_store_chain_cache_add(X509_STORE *store, const uint8_t dgst[32], uint64_t generation, time_t not_after)
+{
+	X509_CHAIN_CACHE_ENTRY *set;
+	X509_CHAIN_CACHE_ENTRY *entry;
+	int i;
+
+	if (!store || !dgst) {
+		error_print();
+		return -1;
+	}
+	pthread_mutex_lock(&store->cache_lock);
+	if (store->cache && generation == store->generation) {
+		set = x509_store_chain_cache_set(store, dgst);
+		// the slot of the same chain, else a stale one, else the one picked by the digest
+		entry = NULL;
+		for (i = 0; i < X509_CHAIN_CACHE_WAYS; i++) {
+			if (set[i].generation == store->generation
+				&& memcmp(set[i].dgst, dgst, 32) == 0) {
+				entry = &set[i];
+				break;
+			}
+			if (!entry && set[i].generation != store->generation) {
+				entry = &set[i];
+			}
+		}
+		if (!entry) {
+			entry = &set[dgst[4] % X509_CHAIN_CACHE_WAYS];
+		}
+		memcpy(entry->dgst, dgst, 32);
+		entry->generation = generation;
+		entry->not_after = not_after;
+	}
+	pthread_mutex_unlock(&store->cache_lock);
+	return 1;
+}
+
+void x509_store_chain_cache_flush(X509_STORE *store)
+{
+	pthread_mutex_lock(&store->cache_lock);
+	store->generation++;
+	pthread_mutex_unlock(&store->cache_lock);
+}
+
+static X509_CRL *x509_store_crl_new(const uint8_t *der, size_t derlen)
+{
+	X509_CRL *crl;
+
+	if (!(crl = malloc(sizeof(X509_CRL)))) {
+		error_print();
+		return NULL;
+	}
+	if (x509_crl_from_der(crl, der, derlen) != 1) {
+		error_print();
+		free(crl);
+		return NULL;
+	}
+	return crl;
+}
+
+static void x509_store_crl_free(X509_CRL *crl)
+{
+	x509_crl_cleanup(crl);
+	free(crl);
+}
+
+// Takes ownership of a verified crl
+static int x509_store_insert_crl(X509_STORE *store, X509_CRL *crl)
+{
+	X509_CRL *old = NULL;
+	const uint8_t *issuer = crl->der + crl->issuer;
+	size_t i;
+
+	pthread_rwlock_wrlock(&store->lock);
+	for (i = 0; i < store->crls_count; i++) {
+		if (store->crls[i]->issuer_len == crl->issuer_len
+			&& memcmp(store->crls[i]->der + store->crls[i]->issuer, issuer, crl->issuer_len) == 0) {
+			break;
+		}
+	}
+	if (i < store->crls_count) {
+		if (store->crls[i]->this_update > crl->this_update) {
+			// keep the newer one
+			old = crl;
+		} else {
+			old = store->crls[i];
+			store->crls[i] = crl;
+		}
+	} else {
+		X509_CRL **crls;
+		if (!(crls = realloc(store->crls, sizeof(X509_CRL *) * (store->crls_count + 1)))) {
+			pthread_rwlock_unlock(&store->lock);
+			error_print();
+			x509_store_crl_free(crl);
+			return -1;
+		}
+		store->crls = crls;
+		store->crls[store->crls_count++] = crl;
+	}
+	pthread_rwlock_unlock(&store->lock);
+	x509_store_chain_cache_flush(store);
+
+	if (old) {
+		x509_store_crl_free(old);
+	}
+	return 1;
+}
+
+int x509_store_add_crl(X509_STORE *store, const uint8_t *der, size_t derlen)
+{
+	X509_CRL *crl;
+	const X509_STORE_TABLE *table;
+	const X509_STORE_ENTRY *entry;
+	const uint8_t *issuer;
+	size_t pos;
+
+	if (!store || !der || !derlen) {
+		error_print();
+		return -1;
+	}
+	if (!(crl = x509_store_crl_new(der, derlen))) {
+		error_print();
+		return -1;
+	}
+	issuer = crl->der + crl->issuer;
+
+	// the crl is not shared yet, verifying it only reads the table
+	pthread_rwlock_rdlock(&store->lock);
+	if ((table = store->table) != NULL) {
+		pos = x509_store_hash(issuer, crl->issuer_len) & table->mask;
+		while (!crl->verified
+			&& (entry = x509_store_table_next(table, 0, issuer, crl->issuer_len, &pos)) != NULL) {
+			x509_crl_verify(crl, &entry->public_key);
+		}
+	}
+	pthread_rwlock_unlock(&store->lock);
+
+	if (!crl->verified) {
+		error_puts("CRL not signed by a CA of the store");
+		x509_store_crl_free(crl);
+		return -1;
+	}
+	return x509_store_insert_crl(store, crl);
+}
+
+int x509_store_add_crl_by_issuer(X509_STORE *store, const uint8_t *der, size_t derlen,
+	const X509_CERT_VIEW *issuer_cert)
+{
+	X509_CRL *crl;
+	SM2_KEY public_key;
+
+	if (!store || !der || !derlen || !issuer_cert) {
+		error_print();
+		return -1;
+	}
+	if (x509_store_verify(store, issuer_cert) != 1) {
+		error_puts("CRL issuer not verified by the store");
+		return -1;
+	}
+	if (x509_cert_view_get_public_key(issuer_cert, &public_key) != 1) {
+		error_print();
+		return -1;
+	}
+	if (!(crl = x509_store_crl_new(der, derlen))) {
+		error_print();
+		return -1;
+	}
+	if (crl->issuer_len != issuer_cert->subject_len
+		|| memcmp(crl->der + crl->issuer, issuer_cert->der + issuer_cert->subject, crl->issuer_len) != 0
+		|| x509_crl_verify(crl, &public_key) != 1) {
+		error_puts("CRL not signed by the issuer certificate");
+		x509_store_crl_free(crl);
+		return -1;
+	}
+	return x509_store_insert_crl(store, crl);
+}
+
+// Either DER or one or more PEM "X509 CRL" blocks
+int x509_store_load_crl_file(X509_STORE *store, const char *file)
+{
+	const char *data;
+	size_t datalen;
+	const char *in;
+	size_t inlen;
+	uint8_t *der = NULL;
+	size_t derlen;
+	int ret;
+
+	if (pem_map_file(file, &data, &datalen) != 1) {
+		error_print();
+		return -1;
+	}
+	if (datalen && (uint8_t)data[0] == ASN1_TAG_SEQUENCE) {
+		ret = x509_store_add_crl(store, (const uint8_t *)data, datalen);
+		goto end;
+	}
+	ret = -1;
+	if (!(der = malloc(datalen ? datalen : 1))) {
+		error_print();
+		goto end;
+	}
+	in = data;
+	inlen = datalen;
+	for (;;) {
+		int rv;
+		if ((rv = pem_decode("X509 CRL", der, &derlen, datalen, &in, &inlen)) < 0) {
+			error_print();
+			goto end;
+		} else if (rv == 0) {
+			break;
+		}
+		if (x509_store_add_crl(store, der, derlen) != 1) {
+			error_print();
+			goto end;
+		}
+		ret = 1;
+	}
+	if (ret != 1) {
+		error_puts("no CRL found");
+	}
+end:
+	free(der);
+	pem_unmap_file(data, datalen);
+	return ret;
+}
+
+int x509_store_is_revoked(X509_STORE *store, const uint8_t *issuer, size_t issuer_len,
+	const uint8_t *serial, size_t serial_len)
+{
+	int ret;
+
+	if (!store || !issuer || !serial) {
+		error_print();
+		return -1;
+	}
+	pthread_rwlock_rdlock(&store->lock);
+	ret = x509_store_crls_is_revoked(store, issuer, issuer_len, serial, serial_len);
+	pthread_rwlock_unlock(&store->lock);
+	return ret;
+}
+
+int x509_store_cert_is_revoked(X509_STORE *store, const X509_CERT_VIEW *cert)
+{
+	return x509_store_is_revoked(store, cert->der + cert->issuer, cert->issuer_len,
+		cert->der + cert->serial, cert->serial_len);
+}
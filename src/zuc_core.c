@@ -198,25 +198,154 @@ uint32_t zuc_generate_keyword(ZUC_KEY *key)
 	return Z;
 }
 
-void zuc_generate_keystream(ZUC_KEY *key, size_t nwords, uint32_t *keystream)
+/*
+Instead of shifting the LFSR, 16 steps are unrolled and step i sees s_k in
+S[(i + k) % 16], the new s_16 overwrites s_0 and after 16 steps the naming is
+back where it started.
+*/
+#define ZUC_S(i,k)	S[((i) + (k)) & 15]
+
+#define ZUC_ROUND(i)								\
+	X0 = ((ZUC_S(i,15) & 0x7FFF8000) << 1) | (ZUC_S(i,14) & 0xFFFF);	\
+	X1 = ((ZUC_S(i,11) & 0xFFFF) << 16) | (ZUC_S(i,9) >> 15);		\
+	X2 = ((ZUC_S(i,7) & 0xFFFF) << 16) | (ZUC_S(i,5) >> 15);		\
+	X3 = ((ZUC_S(i,2) & 0xFFFF) << 16) | (ZUC_S(i,0) >> 15);		\
+	Z = X3 ^ ((X0 ^ R1) + R2);						\
+	F_(X1, X2);								\
+	out[i] = in ? (in[i] ^ Z) : Z;						\
+	a = ZUC_S(i,0);								\
+	a += ((uint64_t)ZUC_S(i,0)) << 8;					\
+	a += ((uint64_t)ZUC_S(i,4)) << 20;					\
+	a += ((uint64_t)ZUC_S(i,10)) << 21;					\
+	a += ((uint64_t)ZUC_S(i,13)) << 17;					\
+	a += ((uint64_t)ZUC_S(i,15)) << 15;					\
+	a = (a & 0x7fffffff) + (a >> 31);					\
+	ZUC_S(i,0) = (uint32_t)((a & 0x7fffffff) + (a >> 31))
+
+void zuc_generate_keystream_xor(ZUC_KEY *key, size_t nwords, const uint32_t *in, uint32_t *out)
 {
-	ZUC_UINT31 *LFSR = key->LFSR;
+	uint32_t S[16];
+	ZUC_UINT31 *LFSR = S;
 	uint32_t R1 = key->R1;
 	uint32_t R2 = key->R2;
 	uint32_t X0, X1, X2, X3;
 	uint32_t W1, W2, U, V;
+	uint32_t Z;
+	uint64_t a;
 	size_t i;
 
-	for (i = 0; i < nwords; i ++) {
+	memcpy(S, key->LFSR, sizeof(S));
+
+	while (nwords >= 16) {
+		ZUC_ROUND(0);
+		ZUC_ROUND(1);
+		ZUC_ROUND(2);
+		ZUC_ROUND(3);
+		ZUC_ROUND(4);
+		ZUC_ROUND(5);
+		ZUC_ROUND(6);
+		ZUC_ROUND(7);
+		ZUC_ROUND(8);
+		ZUC_ROUND(9);
+		ZUC_ROUND(10);
+		ZUC_ROUND(11);
+		ZUC_ROUND(12);
+		ZUC_ROUND(13);
+		ZUC_ROUND(14);
+		ZUC_ROUND(15);
+		if (in) {
+			in += 16;
+		}
+		out += 16;
+		nwords -= 16;
+	}
+
+	for (i = 0; i < nwords; i++) {
 		BitReconstruction4(X0, X1, X2, X3);
-		keystream[i] = X3 ^ F(X0, X1, X2);
+		Z = X3 ^ ((X0 ^ R1) + R2);
+		F_(X1, X2);
+		out[i] = in ? (in[i] ^ Z) : Z;
 		LFSRWithWorkMode();
 	}
 
+	memcpy(key->LFSR, S, sizeof(S));
+	memset(S, 0, sizeof(S));
 	key->R1 = R1;
 	key->R2 = R2;
 }
 
+void zuc_generate_keystream(ZUC_KEY *key, size_t nwords, uint32_t *keystream)
+{
+	zuc_generate_keystream_xor(key, nwords, NULL, keystream);
+}
+
+/*
+EIA3 adds the 32-bit keystream window at bit i for every set bit i of the
+message. For a message word M and keystream words K0, K1 the sum is bits 63..32
+of the carry-less product of K0 || K1 and the bit-reversed M, computed with
+PCLMULQDQ (ZUC_PCLMUL) or from a table of the 4-bit multiples of K0 || K1.
+*/
+#ifdef ZUC_PCLMUL
+#include <wmmintrin.h>
+
+static ZUC_UINT32 zuc_mac_word(ZUC_UINT32 K0, ZUC_UINT32 K1, ZUC_UINT32 M)
+{
+	__m128i W, R;
+
+	M = ((M >> 1) & 0x55555555) | ((M & 0x55555555) << 1);
+	M = ((M >> 2) & 0x33333333) | ((M & 0x33333333) << 2);
+	M = ((M >> 4) & 0x0f0f0f0f) | ((M & 0x0f0f0f0f) << 4);
+	M = ((M >> 8) & 0x00ff00ff) | ((M & 0x00ff00ff) << 8);
+	M = (M >> 16) | (M << 16);
+
+	W = _mm_cvtsi64_si128((long long)(((uint64_t)K0 << 32) | K1));
+	R = _mm_clmulepi64_si128(W, _mm_cvtsi32_si128((int)M), 0x00);
+	return (ZUC_UINT32)((uint64_t)_mm_cvtsi128_si64(R) >> 32);
+}
+#else
+static ZUC_UINT32 zuc_mac_word(ZUC_UINT32 K0, ZUC_UINT32 K1, ZUC_UINT32 M)
+{
+	uint64_t W = ((uint64_t)K0 << 32) | K1;
+	uint64_t tab[16];
+	uint64_t T = 0;
+	int i;
+
+	// MSB first, tab[v] = sum of (W << j) for the set bits 3 - j of v
+	tab[0] = 0;
+	tab[1] = W << 3;
+	tab[2] = W << 2;
+	tab[3] = tab[2] ^ tab[1];
+	tab[4] = W << 1;
+	tab[5] = tab[4] ^ tab[1];
+	tab[6] = tab[4] ^ tab[2];
+	tab[7] = tab[4] ^ tab[3];
+	for (i = 0; i < 8; i++) {
+		tab[8 + i] = W ^ tab[i];
+	}
+
+	for (i = 0; i < 8; i++) {
+		T ^= tab[(M >> (28 - 4*i)) & 0xf] << (4*i);
+	}
+	return (ZUC_UINT32)(T >> 32);
+}
+#endif
+
+// ZUC-256 MAC over the n-word tag T, K0[0..n-1] || K1 is the keystream window
+static void zuc256_mac_word(ZUC_UINT32 *T, ZUC_UINT32 *K0, size_t n, ZUC_UINT32 K1, ZUC_UINT32 M)
+{
+	size_t j;
+
+	for (j = 0; j < n - 1; j++) {
+		T[j] ^= zuc_mac_word(K0[j], K0[j + 1], M);
+	}
+	T[j] ^= zuc_mac_word(K0[j], K1, M);
+
+	for (j = 0; j < n - 1; j++) {
+		K0[j] = K0[j + 1];
+	}
+	K0[j] = K1;
+}
+
 void zuc_mac_init(ZUC_MAC_CTX *ctx, const unsigned char key[16], const unsigned char iv[16])
 {
 	memset(ctx, 0, sizeof(*ctx));
@@ -234,7 +363,6 @@ void zuc_mac_update(ZUC_MAC_CTX *ctx, const unsigned char *data, size_t len)
 	ZUC_UINT32 R2 = ctx->R2;
 	ZUC_UINT32 X0, X1, X2, X3;
 	ZUC_UINT32 W1, W2, U, V;
-	size_t i;
 
 	if (!data || !len) {
 		return;
@@ -256,14 +384,8 @@ void zuc_mac_update(ZUC_MAC_CTX *ctx, const unsigned char *data, size_t len)
 		K1 = X3 ^ F(X0, X1, X2);
 		LFSRWithWorkMode();
 
-		for (i = 0; i < 32; i++) {
-			if (M & 0x80000000) {
-				T ^= K0;
-			}
-			M <<= 1;
-			K0 = (K0 << 1) | (K1 >> 31);
-			K1 <<= 1;
-		}
+		T ^= zuc_mac_word(K0, K1, M);
+		K0 = K1;
 
 		data += num;
 		len -= num;
@@ -276,14 +398,8 @@ void zuc_mac_update(ZUC_MAC_CTX *ctx, const unsigned char *data, size_t len)
 		K1 = X3 ^ F(X0, X1, X2);
 		LFSRWithWorkMode();
 
-		for (i = 0; i < 32; i++) {
-			if (M & 0x80000000) {
-				T ^= K0;
-			}
-			M <<= 1;
-			K0 = (K0 << 1) | (K1 >> 31);
-			K1 <<= 1;
-		}
+		T ^= zuc_mac_word(K0, K1, M);
+		K0 = K1;
 
 		data += 4;
 		len -= 4;
@@ -459,7 +575,6 @@ void zuc256_mac_update(ZUC256_MAC_CTX *ctx, const unsigned char *data, size_t le
 {
 	ZUC_UINT32 K1, M;
 	size_t n = ctx->macbits / 32;
-	size_t i, j;
 
 	if (!data || !len) {
 		return;
@@ -479,19 +594,7 @@ void zuc256_mac_update(ZUC256_MAC_CTX *ctx, const unsigned char *data, size_t le
 
 		K1 = zuc256_generate_keyword((ZUC256_KEY *)ctx);
 
-		for (i = 0; i < 32; i++) {
-			if (M & 0x80000000) {
-				for (j = 0; j < n; j++) {
-					ctx->T[j] ^= ctx->K0[j];
-				}
-			}
-			M <<= 1;
-			for (j = 0; j < n - 1; j++) {
-				ctx->K0[j] = (ctx->K0[j] << 1) | (ctx->K0[j + 1] >> 31);
-			}
-			ctx->K0[j] = (ctx->K0[j] << 1) | (K1 >> 31);
-			K1 <<= 1;
-		}
+		zuc256_mac_word(ctx->T, ctx->K0, n, K1, M);
 
 		data += num;
 		len -= num;
@@ -501,19 +604,7 @@ void zuc256_mac_update(ZUC256_MAC_CTX *ctx, const unsigned char *data, size_t le
 		M = GETU32(data);
 		K1 = zuc256_generate_keyword((ZUC256_KEY *)ctx);
 
-		for (i = 0; i < 32; i++) {
-			if (M & 0x80000000) {
-				for (j = 0; j < n; j++) {
-					ctx->T[j] ^= ctx->K0[j];
-				}
-			}
-			M <<= 1;
-			for (j = 0; j < n - 1; j++) {
-				ctx->K0[j] = (ctx->K0[j] << 1) | (ctx->K0[j + 1] >> 31);
-			}
-			ctx->K0[j] = (ctx->K0[j] << 1) | (K1 >> 31);
-			K1 <<= 1;
-		}
+		zuc256_mac_word(ctx->T, ctx->K0, n, K1, M);
 
 		data += 4;
 		len -= 4;
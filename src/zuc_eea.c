@@ -35,13 +35,9 @@ void zuc_eea_encrypt(const ZUC_UINT32 *in, ZUC_UINT32 *out, size_t nbits,
 {
 	ZUC_KEY zuc_key;
 	size_t nwords = (nbits + 31)/32;
-	size_t i;
 
 	zuc_set_eea_key(&zuc_key, key, count, bearer, direction);
-	zuc_generate_keystream(&zuc_key, nwords, out);
-	for (i = 0; i < nwords; i++) {
-		out[i] ^= in[i];
-	}
+	zuc_generate_keystream_xor(&zuc_key, nwords, in, out);
 
 	if (nbits % 32 != 0) {
 		out[nwords - 1] |= (0xffffffff << (32 - (nbits%32)));
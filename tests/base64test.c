@@ -62,9 +62,73 @@ int test_base64(void)
 	return err;
 }
 
+static int test_base64_buffer(void)
+{
+	uint8_t bin[1000];
+	char b64[2000];
+	char crlf[2000];
+	uint8_t dec[1000];
+	size_t b64len, crlflen, declen;
+	size_t lens[] = { 0, 1, 2, 3, 11, 12, 13, 47, 48, 49, 100, 1000 };
+	size_t line_lens[] = { 0, 4, 64, 76 };
+	size_t i, j, k;
+
+	for (i = 0; i < sizeof(bin); i++) {
+		bin[i] = (uint8_t)(i * 31 + 7);
+	}
+	for (i = 0; i < sizeof(lens)/sizeof(lens[0]); i++) {
+		for (j = 0; j < sizeof(line_lens)/sizeof(line_lens[0]); j++) {
+			if (base64_encode(bin, lens[i], line_lens[j], b64, &b64len) != 1
+				|| b64len != base64_encoded_length(lens[i], line_lens[j])
+				|| base64_decode(b64, b64len, dec, &declen) != 1
+				|| declen != lens[i]
+				|| memcmp(dec, bin, declen) != 0) {
+				error_print();
+				return -1;
+			}
+			// CRLF line ends
+			for (k = 0, crlflen = 0; k < b64len; k++) {
+				if (b64[k] == '\n') crlf[crlflen++] = '\r';
+				crlf[crlflen++] = b64[k];
+			}
+			if (base64_decode(crlf, crlflen, dec, &declen) != 1
+				|| declen != lens[i]
+				|| memcmp(dec, bin, declen) != 0) {
+				error_print();
+				return -1;
+			}
+		}
+	}
+
+	// known answer, and errors
+	if (base64_decode("Zm9v YmE=", 9, dec, &declen) != 1
+		|| declen != 5 || memcmp(dec, "fooba", 5) != 0
+		|| base64_decode("Zm9vYmFyZm9vYmFyZm9vYmFy!m9v", 28, dec, &declen) == 1
+		|| base64_decode("Zm9=vYmE", 8, dec, &declen) == 1
+		|| base64_decode("Zm9vY", 5, dec, &declen) == 1
+		|| base64_decode("QQ== \n", 6, dec, &declen) != 1
+		|| declen != 1 || dec[0] != 'A'
+		|| base64_decode("QQ===", 5, dec, &declen) == 1
+		|| base64_decode("QQ====", 6, dec, &declen) == 1
+		|| base64_decode("QQ== =", 6, dec, &declen) == 1
+		|| base64_decode("QQ==QQ==", 8, dec, &declen) == 1
+		|| base64_decode("Q===", 4, dec, &declen) == 1
+		|| base64_decode("====", 4, dec, &declen) == 1) {
+		error_print();
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
 int main(void)
 {
 	test_base64();
+	if (test_base64_buffer() != 1) {
+		error_print();
+		return 1;
+	}
 	return 0;
 }
 
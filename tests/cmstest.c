@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <gmssl/oid.h>
 #include <gmssl/x509.h>
 #include <gmssl/rand.h>
@@ -141,10 +142,483 @@ static int test_cms_encrypt(void)
 	return 1;
 }
 
+typedef struct {
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+} MEM_WRITER;
+
+static int mem_write(void *arg, const uint8_t *data, size_t datalen)
+{
+	MEM_WRITER *w = (MEM_WRITER *)arg;
+	if (datalen > w->size - w->len) {
+		error_print();
+		return -1;
+	}
+	memcpy(w->buf + w->len, data, datalen);
+	w->len += datalen;
+	return 1;
+}
+
+static int test_cms_encrypt_stream(void)
+{
+	static uint8_t msg[100003];
+	static uint8_t cbuf[sizeof(msg) + 1024];
+	static uint8_t mbuf[sizeof(msg)];
+	MEM_WRITER cw = { cbuf, 0, sizeof(cbuf) };
+	MEM_WRITER mw = { mbuf, 0, sizeof(mbuf) };
+	CMS_STREAM_CTX ctx;
+	uint8_t key[16];
+	uint8_t iv[16];
+	uint8_t info[] = "shared info";
+	int content_type;
+	const uint8_t *cp;
+	size_t clen;
+	int enc_algor;
+	const uint8_t *enc_iv, *enced_content, *shared_info1, *shared_info2;
+	size_t enc_iv_len, enced_content_len, shared_info1_len, shared_info2_len;
+	size_t i, len;
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(iv, sizeof(iv));
+	rand_bytes(msg, sizeof(msg));
+
+	if (cms_encrypted_data_encrypt_init(&ctx, key, iv, CMS_data, sizeof(msg),
+		info, sizeof(info), NULL, 0, mem_write, &cw) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < sizeof(msg); i += len) {
+		len = (i % 37) + 1;
+		if (len > sizeof(msg) - i) len = sizeof(msg) - i;
+		if (cms_stream_encrypt_update(&ctx, msg + i, len) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+	if (cms_stream_encrypt_finish(&ctx) != 1) {
+		error_print();
+		return -1;
+	}
+
+	// output is plain DER EncryptedData
+	cp = cbuf;
+	clen = cw.len;
+	if (cms_encrypted_data_from_der(&content_type, &enc_algor, &enc_iv, &enc_iv_len,
+		&enced_content, &enced_content_len,
+		&shared_info1, &shared_info1_len,
+		&shared_info2, &shared_info2_len,
+		&cp, &clen) != 1
+		|| clen
+		|| enced_content_len != (sizeof(msg)/16 + 1) * 16) {
+		error_print();
+		return -1;
+	}
+
+	if (cms_encrypted_data_decrypt_init(&ctx, key, mem_write, &mw) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < cw.len; i += len) {
+		len = (i % 4099) + 1;
+		if (len > cw.len - i) len = cw.len - i;
+		if (cms_stream_decrypt_update(&ctx, cbuf + i, len) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+	if (cms_stream_decrypt_finish(&ctx, &content_type,
+		&shared_info1, &shared_info1_len,
+		&shared_info2, &shared_info2_len) != 1) {
+		error_print();
+		return -1;
+	}
+	if (content_type != CMS_data
+		|| mw.len != sizeof(msg) || memcmp(mbuf, msg, sizeof(msg)) != 0
+		|| shared_info1_len != sizeof(info) || memcmp(shared_info1, info, sizeof(info)) != 0
+		|| shared_info2) {
+		error_print();
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+static int test_cms_gen_signer(SM2_KEY *key, X509_CERTIFICATE *cert, const char *cn)
+{
+	X509_NAME name;
+	uint8_t serial[12];
+	time_t not_before;
+
+	memset(&name, 0, sizeof(name));
+	memset(cert, 0, sizeof(*cert));
+	time(&not_before);
+	rand_bytes(serial, sizeof(serial));
+	serial[0] &= 0x7f;
+
+	if (sm2_keygen(key) != 1
+		|| x509_name_set_country(&name, "CN") != 1
+		|| x509_name_set_common_name(&name, cn) != 1
+		|| x509_certificate_set_version(cert, X509_version_v3) != 1
+		|| x509_certificate_set_serial_number(cert, serial, sizeof(serial)) != 1
+		|| x509_certificate_set_signature_algor(cert, OID_sm2sign_with_sm3) != 1
+		|| x509_certificate_set_issuer(cert, &name) != 1
+		|| x509_certificate_set_subject(cert, &name) != 1
+		|| x509_certificate_set_validity(cert, not_before, 365) != 1
+		|| x509_certificate_set_subject_public_key_info_sm2(cert, key) != 1
+		|| x509_certificate_sign_sm2(cert, key) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+static int test_cms_signed_data_multi(void)
+{
+	SM2_KEY keys[2];
+	X509_CERTIFICATE *certs = NULL;
+	uint8_t *msg = NULL;
+	size_t msglen = 5000;
+	uint8_t *buf = NULL;
+	size_t buflen = 16384;
+	size_t len;
+	int content_type;
+	const uint8_t *content;
+	size_t content_len;
+	CMS_SIGNED_DATA_CTX ctx;
+	uint8_t signer_infos[2 * CMS_MAX_SIGNER_INFO_SIZE];
+	size_t signer_infos_len;
+	const uint8_t *cp = signer_infos;
+	int digest_algor = OID_sm3;
+	uint8_t *p;
+	size_t i;
+	int ret = -1;
+
+	if (!(certs = malloc(2 * sizeof(X509_CERTIFICATE)))
+		|| !(msg = malloc(msglen))
+		|| !(buf = malloc(buflen))) {
+		error_print();
+		goto end;
+	}
+	for (i = 0; i < msglen; i++) {
+		msg[i] = (uint8_t)i;
+	}
+	if (test_cms_gen_signer(&keys[0], &certs[0], "signer0") != 1
+		|| test_cms_gen_signer(&keys[1], &certs[1], "signer1") != 1) {
+		error_print();
+		goto end;
+	}
+
+	// attached, two signers
+	if (cms_sign(keys, certs, 2, CMS_data, msg, msglen, NULL, NULL, 0, buf, &len) != 1
+		|| len > buflen) {
+		error_print();
+		goto end;
+	}
+	if (cms_verify(&content_type, &content, &content_len, buf, len) != 1
+		|| content_type != CMS_data
+		|| content_len != msglen
+		|| memcmp(content, msg, msglen) != 0) {
+		error_print();
+		goto end;
+	}
+
+	// detached, content hashed in chunks
+	if (cms_signed_data_sign_init(&ctx, CMS_data) != 1) {
+		error_print();
+		goto end;
+	}
+	for (i = 0; i < msglen; i += 777) {
+		size_t n = msglen - i < 777 ? msglen - i : 777;
+		if (cms_signed_data_sign_update(&ctx, msg + i, n) != 1) {
+			error_print();
+			goto end;
+		}
+	}
+	p = buf;
+	len = 0;
+	if (cms_signed_data_sign_finish(&ctx, keys, certs, 2,
+			signer_infos, &signer_infos_len, sizeof(signer_infos)) != 1
+		|| cms_signed_data_to_der(&digest_algor, 1, CMS_data, NULL, 0,
+			certs, 2, NULL, NULL, 0, &cp, &signer_infos_len, 1, &p, &len) != 1) {
+		error_print();
+		goto end;
+	}
+	if (cms_signed_data_verify_init(&ctx) != 1
+		|| cms_signed_data_verify_update(&ctx, msg, msglen) != 1
+		|| cms_signed_data_verify_finish(&ctx, buf, len) != 1) {
+		error_print();
+		goto end;
+	}
+
+	// modified content must be rejected
+	msg[100] ^= 1;
+	if (cms_signed_data_verify_init(&ctx) != 1
+		|| cms_signed_data_verify_update(&ctx, msg, msglen) != 1
+		|| cms_signed_data_verify_finish(&ctx, buf, len) == 1) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	ret = 1;
+end:
+	free(certs);
+	free(msg);
+	free(buf);
+	return ret;
+}
+
+static int test_cms_sign_file(void)
+{
+	const char *file = "cmstest_sign_file.tmp";
+	SM2_KEY key;
+	X509_CERTIFICATE *cert = NULL;
+	uint8_t *msg = NULL;
+	size_t msglen = 300000;
+	uint8_t buf[4096];
+	size_t len;
+	FILE *fp;
+	size_t i;
+	int ret = -1;
+
+	if (!(cert = malloc(sizeof(X509_CERTIFICATE)))
+		|| !(msg = malloc(msglen))) {
+		error_print();
+		goto end;
+	}
+	for (i = 0; i < msglen; i++) {
+		msg[i] = (uint8_t)(i * 7);
+	}
+	if (!(fp = fopen(file, "wb"))) {
+		error_print();
+		goto end;
+	}
+	if (fwrite(msg, 1, msglen, fp) != msglen) {
+		fclose(fp);
+		error_print();
+		goto end;
+	}
+	fclose(fp);
+
+	if (test_cms_gen_signer(&key, cert, "signer") != 1) {
+		error_print();
+		goto end;
+	}
+	if (cms_sign_file(&key, cert, 1, CMS_data, file, NULL, NULL, 0, buf, &len) != 1
+		|| cms_verify_detached(msg, msglen, buf, len) != 1) {
+		error_print();
+		goto end;
+	}
+	if (cms_sign_detached(&key, cert, 1, CMS_data, msg, msglen, NULL, NULL, 0, buf, &len) != 1
+		|| cms_verify_file(file, buf, len) != 1) {
+		error_print();
+		goto end;
+	}
+	msg[msglen - 1] ^= 1;
+	if (cms_verify_detached(msg, msglen, buf, len) == 1) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	ret = 1;
+end:
+	remove(file);
+	free(cert);
+	free(msg);
+	return ret;
+}
+
+static int test_cms_seal(void)
+{
+	size_t rcpt_count = 20;
+	SM2_KEY *keys = NULL;
+	X509_CERTIFICATE *certs = NULL;
+	uint8_t msg[1000];
+	uint8_t buf[20 * 512 + 2048];
+	size_t len;
+	uint8_t content[sizeof(msg) + 16];
+	size_t content_len;
+	int content_type;
+	size_t i;
+	int ret = -1;
+
+	if (!(keys = malloc(rcpt_count * sizeof(SM2_KEY)))
+		|| !(certs = malloc(rcpt_count * sizeof(X509_CERTIFICATE)))) {
+		error_print();
+		goto end;
+	}
+	for (i = 0; i < rcpt_count; i++) {
+		if (test_cms_gen_signer(&keys[i], &certs[i], "recipient") != 1) {
+			error_print();
+			goto end;
+		}
+	}
+	rand_bytes(msg, sizeof(msg));
+
+	if (cms_seal(certs, rcpt_count, CMS_data, msg, sizeof(msg),
+		NULL, 0, NULL, 0, buf, &len) != 1
+		|| len > sizeof(buf)) {
+		error_print();
+		goto end;
+	}
+	for (i = 0; i < rcpt_count; i += 7) {
+		content_len = 0;
+		if (cms_open(&keys[i], &certs[i], buf, len,
+			&content_type, content, &content_len) != 1
+			|| content_type != CMS_data
+			|| content_len != sizeof(msg)
+			|| memcmp(content, msg, sizeof(msg)) != 0) {
+			error_print();
+			goto end;
+		}
+	}
+	// key of one recipient with the certificate of another
+	if (cms_open(&keys[0], &certs[1], buf, len,
+		&content_type, content, &content_len) == 1) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	ret = 1;
+end:
+	free(keys);
+	free(certs);
+	return ret;
+}
+
+// RecipientInfos much larger than the decoder buffer
+static int test_cms_seal_stream(void)
+{
+	size_t rcpt_count = 300;
+	SM2_KEY *keys = NULL;
+	X509_CERTIFICATE *certs = NULL;
+	uint8_t msg[5000];
+	MEM_WRITER cw = { NULL, 0, 0 };
+	uint8_t mbuf[sizeof(msg)];
+	MEM_WRITER mw;
+	CMS_STREAM_CTX ctx;
+	uint8_t key[16];
+	uint8_t iv[16];
+	uint8_t *rcpt_infos = NULL;
+	size_t rcpt_infos_len;
+	int content_type;
+	const uint8_t *shared_info1, *shared_info2;
+	size_t shared_info1_len, shared_info2_len;
+	size_t rcpts[3];
+	size_t i, j, k, len;
+	int ret = -1;
+
+	if (!(keys = malloc(rcpt_count * sizeof(SM2_KEY)))
+		|| !(certs = malloc(rcpt_count * sizeof(X509_CERTIFICATE)))) {
+		error_print();
+		goto end;
+	}
+	for (i = 0; i < rcpt_count; i++) {
+		if (test_cms_gen_signer(&keys[i], &certs[i], "recipient") != 1) {
+			error_print();
+			goto end;
+		}
+	}
+	rand_bytes(key, sizeof(key));
+	rand_bytes(iv, sizeof(iv));
+	rand_bytes(msg, sizeof(msg));
+
+	if (cms_recipient_infos_encrypt(certs, rcpt_count, key, sizeof(key),
+		&rcpt_infos, &rcpt_infos_len) != 1
+		|| rcpt_infos_len <= CMS_STREAM_MAX_HEADER_SIZE) {
+		error_print();
+		goto end;
+	}
+	cw.size = rcpt_infos_len + sizeof(msg) + 1024;
+	if (!(cw.buf = malloc(cw.size))) {
+		error_print();
+		goto end;
+	}
+	if (cms_enveloped_data_encrypt_init(&ctx, key, iv, rcpt_infos, rcpt_infos_len,
+		CMS_data, sizeof(msg), NULL, 0, NULL, 0, mem_write, &cw) != 1
+		|| cms_stream_encrypt_update(&ctx, msg, sizeof(msg)) != 1
+		|| cms_stream_encrypt_finish(&ctx) != 1) {
+		error_print();
+		goto end;
+	}
+
+	// first, middle and last recipient
+	rcpts[0] = 0;
+	rcpts[1] = rcpt_count/2;
+	rcpts[2] = rcpt_count - 1;
+	for (k = 0; k < sizeof(rcpts)/sizeof(rcpts[0]); k++) {
+		i = rcpts[k];
+		mw.buf = mbuf;
+		mw.len = 0;
+		mw.size = sizeof(mbuf);
+		if (cms_enveloped_data_decrypt_init(&ctx, &keys[i], &certs[i], mem_write, &mw) != 1) {
+			error_print();
+			goto end;
+		}
+		for (j = 0; j < cw.len; j += len) {
+			len = ((j + i) % 4099) + 1;
+			if (len > cw.len - j) len = cw.len - j;
+			if (cms_stream_decrypt_update(&ctx, cw.buf + j, len) != 1) {
+				error_print();
+				goto end;
+			}
+		}
+		if (cms_stream_decrypt_finish(&ctx, &content_type,
+			&shared_info1, &shared_info1_len,
+			&shared_info2, &shared_info2_len) != 1
+			|| content_type != CMS_data
+			|| mw.len != sizeof(msg)
+			|| memcmp(mbuf, msg, sizeof(msg)) != 0) {
+			error_print();
+			goto end;
+		}
+	}
+	// key of one recipient with the certificate of another
+	mw.len = 0;
+	if (cms_enveloped_data_decrypt_init(&ctx, &keys[0], &certs[1], mem_write, &mw) != 1
+		|| cms_stream_decrypt_update(&ctx, cw.buf, cw.len) == 1) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok, %zu recipients, %zu bytes\n", __FUNCTION__, rcpt_count, rcpt_infos_len);
+	ret = 1;
+end:
+	free(keys);
+	free(certs);
+	free(rcpt_infos);
+	free(cw.buf);
+	return ret;
+}
+
 int main(void)
 {
 	// 很可能x509_algor.c中有错误！
 	test_cms_enced_content_info();
+	if (test_cms_encrypt_stream() != 1) {
+		error_print();
+		return 1;
+	}
+	if (test_cms_signed_data_multi() != 1) {
+		error_print();
+		return 1;
+	}
+	if (test_cms_sign_file() != 1) {
+		error_print();
+		return 1;
+	}
+	if (test_cms_seal() != 1) {
+		error_print();
+		return 1;
+	}
+	if (test_cms_seal_stream() != 1) {
+		error_print();
+		return 1;
+	}
 	//test_cms_encrypt();
 	//test_cms_data();
 	//test_cms_sign();
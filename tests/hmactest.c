@@ -18,6 +18,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <gmssl/hex.h>
+#include <gmssl/sm3.h>
 #include <gmssl/hmac.h>
 
 
@@ -112,6 +113,75 @@ int test_hmac(const DIGEST *digest, const char *key_hex, const char *data_hex, c
 	return 1;
 }
 
+static int test_sm3_hmac(void)
+{
+	const char *mac_hex = "b91bb9ff1543e8e08c7dd4c0a33b2e1345a0bca226fb2d002a26a52ebd336bde";
+	size_t keylens[] = { 1, 32, 64, 65, 100 };
+	size_t datalens[] = { 0, 1, 55, 56, 63, 64, 119, 120, 200, 1000, 3, 64 };
+	const uint8_t *datas[sizeof(datalens)/sizeof(datalens[0])];
+	uint8_t macs[sizeof(datalens)/sizeof(datalens[0])][32];
+	uint8_t key[100];
+	uint8_t data[1000 + 16];
+	uint8_t mac[32];
+	uint8_t buf[64];
+	SM3_HMAC_KEY hmac_key;
+	SM3_HMAC_CTX ctx;
+	size_t len, i, j, n;
+
+	for (i = 0; i < sizeof(key); i++) {
+		key[i] = (uint8_t)(i + 1);
+	}
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = "abcd"[i % 4];
+	}
+
+	hex2bin(mac_hex, strlen(mac_hex), mac);
+	sm3_hmac(key, 32, data, 192, buf);
+	if (memcmp(buf, mac, 32) != 0) {
+		printf("%s() failed\n", __FUNCTION__);
+		return -1;
+	}
+
+	for (i = 0; i < sizeof(keylens)/sizeof(keylens[0]); i++) {
+		sm3_hmac_key_init(&hmac_key, key, keylens[i]);
+
+		for (j = 0; j < sizeof(datalens)/sizeof(datalens[0]); j++) {
+			hmac(DIGEST_sm3(), key, keylens[i], data, datalens[j], mac, &len);
+
+			sm3_hmac_init_with_key(&ctx, &hmac_key);
+			sm3_hmac_update(&ctx, data, datalens[j] / 2);
+			sm3_hmac_update(&ctx, data + datalens[j] / 2, datalens[j] - datalens[j] / 2);
+			sm3_hmac_finish(&ctx, buf);
+			if (memcmp(buf, mac, 32) != 0) {
+				printf("%s() failed\n", __FUNCTION__);
+				return -1;
+			}
+			sm3_hmac(key, keylens[i], data, datalens[j], buf);
+			if (memcmp(buf, mac, 32) != 0) {
+				printf("%s() failed\n", __FUNCTION__);
+				return -1;
+			}
+			datas[j] = data + j;
+		}
+
+		// messages of different lengths, more than the lanes, some lanes left idle
+		for (n = 0; n <= sizeof(datalens)/sizeof(datalens[0]); n += 3) {
+			memset(macs, 0, sizeof(macs));
+			sm3_hmac_multi(&hmac_key, datas, datalens, n, macs);
+			for (j = 0; j < n; j++) {
+				hmac(DIGEST_sm3(), key, keylens[i], datas[j], datalens[j], mac, &len);
+				if (memcmp(macs[j], mac, 32) != 0) {
+					printf("%s() failed\n", __FUNCTION__);
+					return -1;
+				}
+			}
+		}
+		sm3_hmac_key_cleanup(&hmac_key);
+	}
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
 int main(void)
 {
 	int i;
@@ -121,6 +191,8 @@ int main(void)
 		test_hmac(DIGEST_sha384(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha384);
 		test_hmac(DIGEST_sha512(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha512);
 	};
-
+	if (test_sm3_hmac() != 1) {
+		return 1;
+	}
 	return 0;
 };
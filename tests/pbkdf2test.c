@@ -69,6 +69,96 @@ struct {
 	},
 };
 
+// pbkdf2-hmac-sm3 and pbkdf2-hmac-sha256 vectors, generated by python hashlib.pbkdf2_hmac()
+struct {
+	char *digest;
+	char *pass;
+	char *salt;
+	int iter;
+	int dklen;
+	char *dk;
+} pbkdf2_hmac_sm3_sha256_tests[] = {
+	{
+		"sha256",
+		"passwd",
+		"salt",
+		1,
+		64,
+		"55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+		"49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783",
+	},
+	{
+		"sha256",
+		"Password",
+		"NaCl",
+		80000,
+		64,
+		"4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+		"a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d",
+	},
+	{
+		"sm3",
+		"password",
+		"salt",
+		1,
+		32,
+		"4612f922a1fdcefaf4312fc6f8f3322b489cbf24f2ea361b44c2bd8fa2c6dcb0",
+	},
+	{
+		"sm3",
+		"password",
+		"salt",
+		4096,
+		16,
+		"b6e8f2074c87432b78f62e5ced980fdf",
+	},
+	{
+		"sm3",
+		"passwordPASSWORDpassword",
+		"saltSALTsaltSALTsaltSALTsaltSALTsalt",
+		4096,
+		100,
+		"3b6282ac8519f059e465abff0ea37b0dbfe6c672a76e6b805312d53900db6307"
+		"32ccc1a88fa5512a6e8bbd7e48d336632a254dd72a4ced777cd6fa094665db77"
+		"f64dcc35208fc0950b9745e424a665f6b12b954d7a2139b05781cbebe95c3420"
+		"ca3305cc",
+	},
+	{
+		"sm3",
+		"pppppppppppppppppppppppppppppppppppppppppppppppppp"
+		"pppppppppppppppppppppppppppppppppppppppppppppppppp",
+		"salt",
+		1000,
+		40,
+		"5cfc56a1ca5d1262d833b318c5aa18e451794d2809227d103cbedcab44e0c5bf"
+		"23e18f715d3017c2",
+	},
+};
+
+int test_pbkdf2_hmac_sm3_sha256(void)
+{
+	uint8_t key[128];
+	uint8_t buf[128];
+	int i;
+
+	for (i = 0; i < sizeof(pbkdf2_hmac_sm3_sha256_tests)/sizeof(pbkdf2_hmac_sm3_sha256_tests[0]); i++) {
+		const DIGEST *digest = strcmp(pbkdf2_hmac_sm3_sha256_tests[i].digest, "sm3") == 0
+			? DIGEST_sm3() : DIGEST_sha256();
+
+		hex2bin(pbkdf2_hmac_sm3_sha256_tests[i].dk, strlen(pbkdf2_hmac_sm3_sha256_tests[i].dk), buf);
+
+		if (pbkdf2_genkey(digest,
+			pbkdf2_hmac_sm3_sha256_tests[i].pass, strlen(pbkdf2_hmac_sm3_sha256_tests[i].pass),
+			(uint8_t *)pbkdf2_hmac_sm3_sha256_tests[i].salt, strlen(pbkdf2_hmac_sm3_sha256_tests[i].salt),
+			pbkdf2_hmac_sm3_sha256_tests[i].iter, pbkdf2_hmac_sm3_sha256_tests[i].dklen, key) != 1
+			|| memcmp(key, buf, pbkdf2_hmac_sm3_sha256_tests[i].dklen) != 0) {
+			printf("%s test %d failed\n", __FUNCTION__, i);
+			return -1;
+		}
+	}
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
 
 void test(void)
 {
@@ -124,5 +214,8 @@ int main(void)
 		}
 	}
 
+	if (test_pbkdf2_hmac_sm3_sha256() != 1) {
+		return -1;
+	}
 	return 1;
 }
@@ -0,0 +1,138 @@
+﻿/* 
+ *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <gmssl/rand.h>
+#include <gmssl/error.h>
+
+
+static int test_rand_bytes(void)
+{
+	uint8_t buf1[1000];
+	uint8_t buf2[1000];
+	uint8_t zeros[1000] = {0};
+	size_t lens[] = { 1, 7, 32, 255, 256, 257, 1000 };
+	size_t i;
+
+	for (i = 0; i < sizeof(lens)/sizeof(lens[0]); i++) {
+		memset(buf1, 0, sizeof(buf1));
+		memset(buf2, 0, sizeof(buf2));
+		if (rand_bytes(buf1, lens[i]) != 1
+			|| rand_bytes(buf2, lens[i]) != 1) {
+			error_print();
+			return -1;
+		}
+		if (lens[i] >= 8
+			&& (memcmp(buf1, zeros, lens[i]) == 0
+				|| memcmp(buf1, buf2, lens[i]) == 0)) {
+			error_print();
+			return -1;
+		}
+	}
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+// the child must not repeat the output of the parent
+static int test_rand_bytes_fork(void)
+{
+	uint8_t parent[32];
+	uint8_t child[32];
+	int fds[2];
+	pid_t pid;
+	int status;
+
+	rand_bytes(parent, 1);
+	if (pipe(fds) != 0 || (pid = fork()) < 0) {
+		error_print();
+		return -1;
+	}
+	if (pid == 0) {
+		rand_bytes(child, sizeof(child));
+		if (write(fds[1], child, sizeof(child)) != sizeof(child)) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	rand_bytes(parent, sizeof(parent));
+	if (read(fds[0], child, sizeof(child)) != sizeof(child)
+		|| waitpid(pid, &status, 0) != pid
+		|| memcmp(parent, child, sizeof(child)) == 0) {
+		error_print();
+		return -1;
+	}
+	close(fds[0]);
+	close(fds[1]);
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+static void *rand_thread(void *arg)
+{
+	uint8_t *out = arg;
+	size_t i;
+	for (i = 0; i < 1000; i++) {
+		if (rand_bytes(out, 32) != 1) {
+			return NULL;
+		}
+	}
+	return out;
+}
+
+static int test_rand_bytes_threads(void)
+{
+	pthread_t threads[4];
+	uint8_t outs[4][32];
+	size_t i;
+
+	for (i = 0; i < 4; i++) {
+		if (pthread_create(&threads[i], NULL, rand_thread, outs[i]) != 0) {
+			error_print();
+			return -1;
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		void *ret;
+		if (pthread_join(threads[i], &ret) != 0 || ret != outs[i]) {
+			error_print();
+			return -1;
+		}
+	}
+	for (i = 1; i < 4; i++) {
+		if (memcmp(outs[0], outs[i], 32) == 0) {
+			error_print();
+			return -1;
+		}
+	}
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+int main(void)
+{
+	int err = 0;
+	if (test_rand_bytes() != 1) err++;
+	if (test_rand_bytes_fork() != 1) err++;
+	if (test_rand_bytes_threads() != 1) err++;
+	return err;
+}
@@ -18,6 +18,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <gmssl/sm2.h>
+#include <gmssl/hex.h>
+#include <gmssl/error.h>
 
 
 // SM2还需要大量的测试覆盖
@@ -91,6 +93,205 @@ static int test_sm2_do_encrypt(void)
 	return r;
 }
 
+// reference values from SM3(in || counter) with python hashlib
+static int test_sm2_kdf(void)
+{
+	struct {
+		size_t inlen;
+		size_t outlen;
+		char *out;
+	} tests[] = {
+		{ 64, 19, "c3e5cfe48b9da30523c65df3b189227188a89a" },
+		{ 64, 100,
+			"c3e5cfe48b9da30523c65df3b189227188a89ac9057b739bb779f028e4afe606"
+			"e9df98cf02023b778579bdf48e7002306ba21850d002971e209d2e785d3518c9"
+			"113608e38a6d10f539425e5352d8577e6b424cd7efa6c65d9491a5c71b1432d4"
+			"ce17d411" },
+		{ 60, 70,
+			"5e70edc982ef65f804c16b184492cb4eb6bcfc935cd1e35b413d20933a3f713e"
+			"ffd5fb1f99a22374af6dae044bbcd2023d2386ee5e46adba7bb12844bb32e266"
+			"41f04cf5d3bc" },
+		{ 130, 40,
+			"12d71b4afbb5de8bb5b905ac3d32a70f822b2f68b7c17b47ac3c7ed43d469c98"
+			"c49ae1831621939a" },
+	};
+	uint8_t in[130];
+	uint8_t out[200];
+	uint8_t buf[200];
+	size_t len;
+	size_t i;
+
+	for (i = 0; i < sizeof(in); i++) {
+		in[i] = (uint8_t)i;
+	}
+	for (i = 0; i < sizeof(tests)/sizeof(tests[0]); i++) {
+		hex_to_bytes(tests[i].out, strlen(tests[i].out), buf, &len);
+		if (sm2_kdf(in, tests[i].inlen, tests[i].outlen, out) != 1
+			|| len != tests[i].outlen
+			|| memcmp(out, buf, len) != 0) {
+			error_print();
+			return -1;
+		}
+	}
+
+	// the last block of a 200-byte output is the 7th counter
+	hex_to_bytes("f7fec34b286c74f541a23dc002b181707452c47065916ac15ad53a3a7d6c0e4f", 64, buf, &len);
+	if (sm2_kdf(in, 64, 200, out) != 1
+		|| memcmp(out + 200 - 32, buf, 32) != 0) {
+		error_print();
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+// plaintext longer than SM2_MAX_PLAINTEXT_SIZE
+static int test_sm2_encrypt_long(void)
+{
+	SM2_KEY key;
+	uint8_t plaintext[3000];
+	size_t cbuf[SM2_CIPHERTEXT_SIZE(3000)/sizeof(size_t) + 1];
+	SM2_CIPHERTEXT *c = (SM2_CIPHERTEXT *)cbuf;
+	uint8_t der[3200];
+	uint8_t *p = der;
+	uint8_t decrypted[SM2_MAX_PLAINTEXT_SIZE + 16];
+	uint8_t guard[sizeof(decrypted)];
+	size_t clen = 0, mlen;
+	size_t i;
+
+	for (i = 0; i < sizeof(plaintext); i++) {
+		plaintext[i] = (uint8_t)(i * 7);
+	}
+	sm2_keygen(&key);
+
+	// the raw API has no length limit
+	if (sm2_do_encrypt(&key, plaintext, sizeof(plaintext), c) != 1
+		|| sm2_do_decrypt(&key, c, der, &mlen) != 1
+		|| mlen != sizeof(plaintext)
+		|| memcmp(der, plaintext, mlen) != 0) {
+		error_print();
+		return -1;
+	}
+
+	// the DER API rejects it, also a forged DER ciphertext must not overflow `out`
+	if (sm2_encrypt(&key, plaintext, sizeof(plaintext), der, &clen) == 1) {
+		error_print();
+		return -1;
+	}
+	clen = 0;
+	sm2_ciphertext_to_der(c, &p, &clen);
+	memset(decrypted, 0xa5, sizeof(decrypted));
+	memset(guard, 0xa5, sizeof(guard));
+	if (sm2_decrypt(&key, der, clen, decrypted, &mlen) == 1
+		|| memcmp(decrypted, guard, sizeof(guard)) != 0) {
+		error_print();
+		return -1;
+	}
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+static int test_sm2_encrypt_stream(void)
+{
+	SM2_KEY key;
+	SM2_ENC_CTX ctx;
+	int formats[] = { SM2_C1C3C2, SM2_C1C2C3 };
+	size_t chunks[] = { 1, 31, 100, 33, 500, 335 };
+	uint8_t msg[1000];
+	uint8_t cbuf[SM2_C1_SIZE + SM2_C3_SIZE + sizeof(msg)];
+	size_t mbuf[SM2_CIPHERTEXT_SIZE(sizeof(msg))/sizeof(size_t) + 1];
+	SM2_CIPHERTEXT *c = (SM2_CIPHERTEXT *)mbuf;
+	uint8_t buf[sizeof(cbuf)];
+	uint8_t *C2;
+	size_t clen, len, mlen;
+	size_t i, j, off;
+
+	for (i = 0; i < sizeof(msg); i++) {
+		msg[i] = (uint8_t)i;
+	}
+	sm2_keygen(&key);
+
+	for (i = 0; i < sizeof(formats)/sizeof(formats[0]); i++) {
+
+		if (sm2_encrypt_init(&ctx, &key, formats[i], cbuf, &clen) != 1) {
+			error_print();
+			return -1;
+		}
+		for (j = 0, off = 0; j < sizeof(chunks)/sizeof(chunks[0]); j++) {
+			if (sm2_encrypt_update(&ctx, msg + off, chunks[j], cbuf + clen, &len) != 1) {
+				error_print();
+				return -1;
+			}
+			off += chunks[j];
+			clen += len;
+		}
+		if (formats[i] == SM2_C1C3C2) {
+			C2 = cbuf + SM2_C1_SIZE + SM2_C3_SIZE;
+			if (sm2_encrypt_finish(&ctx, cbuf + SM2_C1_SIZE, &len) != 1) {
+				error_print();
+				return -1;
+			}
+		} else {
+			C2 = cbuf + SM2_C1_SIZE;
+			if (sm2_encrypt_finish(&ctx, cbuf + clen, &len) != 1) {
+				error_print();
+				return -1;
+			}
+			clen += len;
+		}
+		if (off != sizeof(msg) || clen != sizeof(cbuf)) {
+			error_print();
+			return -1;
+		}
+
+		// same ciphertext as sm2_do_encrypt()
+		memcpy(&c->point, cbuf + 1, 64);
+		memcpy(c->hash, formats[i] == SM2_C1C3C2 ? cbuf + SM2_C1_SIZE : cbuf + clen - SM2_C3_SIZE, 32);
+		memcpy(c->ciphertext, C2, sizeof(msg));
+		c->ciphertext_size = sizeof(msg);
+		if (sm2_do_decrypt(&key, c, buf, &mlen) != 1
+			|| mlen != sizeof(msg)
+			|| memcmp(buf, msg, mlen) != 0) {
+			error_print();
+			return -1;
+		}
+
+		// decrypt in 7-byte pieces
+		if (sm2_decrypt_init(&ctx, &key, formats[i]) != 1) {
+			error_print();
+			return -1;
+		}
+		for (off = 0, mlen = 0; off < clen; off += len) {
+			size_t outlen;
+			len = clen - off < 7 ? clen - off : 7;
+			if (sm2_decrypt_update(&ctx, cbuf + off, len, buf + mlen, &outlen) != 1) {
+				error_print();
+				return -1;
+			}
+			mlen += outlen;
+		}
+		if (sm2_decrypt_finish(&ctx) != 1
+			|| mlen != sizeof(msg)
+			|| memcmp(buf, msg, mlen) != 0) {
+			error_print();
+			return -1;
+		}
+
+		// modified C2 must be rejected
+		C2[10] ^= 1;
+		if (sm2_decrypt_init(&ctx, &key, formats[i]) != 1
+			|| sm2_decrypt_update(&ctx, cbuf, clen, buf, &mlen) != 1
+			|| sm2_decrypt_finish(&ctx) == 1) {
+			error_print();
+			return -1;
+		}
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
 static int test_sm2_sign(void)
 {
 	SM2_KEY key;
@@ -126,6 +327,9 @@ int main(void)
 	//test_sm2_point();
 	//test_sm2_sign();
 	test_sm2_do_encrypt();
+	if (test_sm2_kdf() != 1) return 1;
+	if (test_sm2_encrypt_long() != 1) return 1;
+	if (test_sm2_encrypt_stream() != 1) return 1;
 
 	return 0;
 }
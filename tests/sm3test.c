@@ -142,11 +142,104 @@ static char *dgsthex[] = {
 	"C3B02E500A8B60B77DEDCF6F4C11BEF8D56E5CDE708C72065654FD7B2167915A",
 };
 
+static void sm3_tree_reference(const uint8_t *data, size_t datalen, size_t leaf_size, uint8_t dgst[32])
+{
+	SM3_CTX ctx;
+	uint8_t prefix;
+	uint8_t left[32], right[32];
+	size_t nleaves = datalen ? (datalen + leaf_size - 1) / leaf_size : 1;
+	size_t k;
+
+	if (nleaves == 1) {
+		prefix = 0x00;
+		sm3_init(&ctx);
+		sm3_update(&ctx, &prefix, 1);
+		sm3_update(&ctx, data, datalen);
+		sm3_finish(&ctx, dgst);
+		return;
+	}
+	for (k = 1; k * 2 < nleaves; k *= 2) {
+	}
+	sm3_tree_reference(data, k * leaf_size, leaf_size, left);
+	sm3_tree_reference(data + k * leaf_size, datalen - k * leaf_size, leaf_size, right);
+	prefix = 0x01;
+	sm3_init(&ctx);
+	sm3_update(&ctx, &prefix, 1);
+	sm3_update(&ctx, left, 32);
+	sm3_update(&ctx, right, 32);
+	sm3_finish(&ctx, dgst);
+}
+
+static int test_sm3_tree(void)
+{
+	size_t leaf_size = 1024;
+	size_t lens[] = { 0, 1, 1023, 1024, 1025, 3 * 1024, 5 * 1024 + 7, 64 * 1024, 100 * 1024 + 512 };
+	int threads[] = { 1, 4 };
+	uint8_t *data;
+	uint8_t params[16];
+	uint8_t root[32], dgst[32], tree_dgst[32];
+	SM3_TREE_CTX tree_ctx;
+	SM3_CTX ctx;
+	size_t i, j, k;
+
+	if (!(data = malloc(100 * 1024 + 512))) {
+		return -1;
+	}
+	for (i = 0; i < 100 * 1024 + 512; i++) {
+		data[i] = (uint8_t)(i * 31 + (i >> 8));
+	}
+
+	for (i = 0; i < sizeof(lens)/sizeof(lens[0]); i++) {
+		sm3_tree_reference(data, lens[i], leaf_size, root);
+		memset(params, 0, sizeof(params));
+		for (k = 0; k < 8; k++) {
+			params[7 - k] = (uint8_t)(leaf_size >> (8 * k));
+			params[15 - k] = (uint8_t)((uint64_t)lens[i] >> (8 * k));
+		}
+		sm3_init(&ctx);
+		sm3_update(&ctx, (uint8_t *)"\x02", 1);
+		sm3_update(&ctx, params, sizeof(params));
+		sm3_update(&ctx, root, sizeof(root));
+		sm3_finish(&ctx, dgst);
+
+		for (j = 0; j < sizeof(threads)/sizeof(threads[0]); j++) {
+			size_t off, step;
+
+			// one update, then updates not aligned to the leaves
+			if (sm3_tree_init(&tree_ctx, leaf_size, threads[j]) != 1
+				|| sm3_tree_update(&tree_ctx, data, lens[i]) != 1
+				|| sm3_tree_finish(&tree_ctx, tree_dgst) != 1
+				|| memcmp(tree_dgst, dgst, 32) != 0) {
+				printf("%s() error on length %zu, %d threads\n", __FUNCTION__, lens[i], threads[j]);
+				sm3_tree_cleanup(&tree_ctx);
+				free(data);
+				return -1;
+			}
+			for (off = 0, step = 1; off < lens[i]; off += step, step = step * 3 + 100) {
+				if (step > lens[i] - off) {
+					step = lens[i] - off;
+				}
+				sm3_tree_update(&tree_ctx, data + off, step);
+			}
+			sm3_tree_finish(&tree_ctx, tree_dgst);
+			sm3_tree_cleanup(&tree_ctx);
+			if (memcmp(tree_dgst, dgst, 32) != 0) {
+				printf("%s() error on split length %zu, %d threads\n", __FUNCTION__, lens[i], threads[j]);
+				free(data);
+				return -1;
+			}
+		}
+	}
+	free(data);
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
 int main(int argc, char **argv)
 {
 	int err = 0;
 	char *p;
-	uint8_t testbuf[sizeof(testhex)/2];
+	uint8_t testbuf[1024];
 	uint8_t dgstbuf[32];
 	size_t testbuflen, dgstbuflen;
 	uint8_t dgst[32];
@@ -173,5 +266,6 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (test_sm3_tree() != 1) err++;
 	return err;
 }
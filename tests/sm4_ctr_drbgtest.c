@@ -0,0 +1,206 @@
+﻿/* 
+ *   Copyright 2014-2021 The GmSSL Project Authors. All Rights Reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <gmssl/hex.h>
+#include <gmssl/sm4_ctr_drbg.h>
+#include <gmssl/error.h>
+
+
+struct {
+	char *entropy;
+	char *nonce;
+	char *personalstr;
+	char *entropy_reseed;
+	char *additional1;
+	char *additional2;
+	char *K;
+	char *V;
+	char *out;
+} sm4_ctr_drbg_tests[] = {
+	{
+		"0f65da13dca407999d4773c2b4a11d85",
+		"5209e5b4ed82a234",
+		"",
+		"1dea0a12c52bf64339dd291c80d8ca89",
+		"",
+		"",
+		"40ef052e0dffc441fd644f6dce7430c0",
+		"3dee0b770815026b88a86a1637c4c9f6",
+		"c946bea334b3818d698f404944118785baf3f67cfb76b2f7fd816c39c06c00de"
+		"33331e816193b2ff832dfa0a7224a37a4bb3819fa2261802eed144ac59ce41f8",
+	},
+	{
+		"8a1f7b05ea3d5b6a1c3e3f0ab6c1a2e4",
+		"9c4f2d1e7a6b5c3d",
+		"4d6f79a0e1c2d3b4a59687786950413200112233445566778899aabbccddeeff",
+		"",
+		"b1e2d3c4a5968778695a4b3c2d1e0f1021324354657687980a1b2c3d4e5f6071",
+		"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef",
+		"082e266f049604e1e0ce547955782968",
+		"d54f9e996eb2c24621398cf92b47bdc0",
+		"f661965f0af21a6acf2870ac61e993fff861f5c1f72c973326b7871a51e1f2c8"
+		"b55a0b382d7a64dfd8c221b04c48cf0dbb635d38236d6c570a2e4bc01fbb1cc3",
+	},
+};
+
+static int test_sm4_ctr_drbg(void)
+{
+	SM4_CTR_DRBG drbg;
+	SM4_KEY key;
+	uint8_t entropy[32], nonce[16], personalstr[32], entropy_reseed[32];
+	uint8_t additional1[32], additional2[32];
+	uint8_t K[16], V[16], out[64], buf[64];
+	size_t entropy_len, nonce_len, personalstr_len, entropy_reseed_len;
+	size_t additional1_len, additional2_len, len;
+	size_t i;
+
+	for (i = 0; i < sizeof(sm4_ctr_drbg_tests)/sizeof(sm4_ctr_drbg_tests[0]); i++) {
+		hex_to_bytes(sm4_ctr_drbg_tests[i].entropy, strlen(sm4_ctr_drbg_tests[i].entropy), entropy, &entropy_len);
+		hex_to_bytes(sm4_ctr_drbg_tests[i].nonce, strlen(sm4_ctr_drbg_tests[i].nonce), nonce, &nonce_len);
+		hex_to_bytes(sm4_ctr_drbg_tests[i].personalstr, strlen(sm4_ctr_drbg_tests[i].personalstr), personalstr, &personalstr_len);
+		hex_to_bytes(sm4_ctr_drbg_tests[i].entropy_reseed, strlen(sm4_ctr_drbg_tests[i].entropy_reseed), entropy_reseed, &entropy_reseed_len);
+		hex_to_bytes(sm4_ctr_drbg_tests[i].additional1, strlen(sm4_ctr_drbg_tests[i].additional1), additional1, &additional1_len);
+		hex_to_bytes(sm4_ctr_drbg_tests[i].additional2, strlen(sm4_ctr_drbg_tests[i].additional2), additional2, &additional2_len);
+		hex_to_bytes(sm4_ctr_drbg_tests[i].K, strlen(sm4_ctr_drbg_tests[i].K), K, &len);
+		hex_to_bytes(sm4_ctr_drbg_tests[i].V, strlen(sm4_ctr_drbg_tests[i].V), V, &len);
+		hex_to_bytes(sm4_ctr_drbg_tests[i].out, strlen(sm4_ctr_drbg_tests[i].out), out, &len);
+
+		if (sm4_ctr_drbg_init(&drbg, entropy, entropy_len, nonce, nonce_len,
+			personalstr, personalstr_len) != 1) {
+			error_print();
+			return -1;
+		}
+		sm4_set_encrypt_key(&key, K);
+		if (memcmp(drbg.key.rk, key.rk, sizeof(key.rk)) != 0
+			|| memcmp(drbg.V, V, sizeof(V)) != 0
+			|| drbg.reseed_counter != 1) {
+			error_print();
+			return -1;
+		}
+		if (entropy_reseed_len) {
+			if (sm4_ctr_drbg_reseed(&drbg, entropy_reseed, entropy_reseed_len, NULL, 0) != 1) {
+				error_print();
+				return -1;
+			}
+		}
+		if (sm4_ctr_drbg_generate(&drbg, additional1, additional1_len, sizeof(buf), buf) != 1
+			|| sm4_ctr_drbg_generate(&drbg, additional2, additional2_len, sizeof(buf), buf) != 1) {
+			error_print();
+			return -1;
+		}
+		if (memcmp(buf, out, sizeof(out)) != 0) {
+			error_print();
+			return -1;
+		}
+	}
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+/* the counter crosses the 32-bit boundary of the ctr32 kernel and wraps mod 2^128 */
+static int test_sm4_ctr_drbg_counter_wrap(void)
+{
+	SM4_CTR_DRBG drbg;
+	SM4_KEY key;
+	uint8_t entropy[16], nonce[8];
+	uint8_t K[16], V[16], out[64], buf[64];
+	size_t len;
+
+	hex_to_bytes("8a1f7b05ea3d5b6a1c3e3f0ab6c1a2e4", 32, entropy, &len);
+	hex_to_bytes("9c4f2d1e7a6b5c3d", 16, nonce, &len);
+	hex_to_bytes("5dc2a6825d78639a12e8762224cae421", 32, K, &len);
+	hex_to_bytes("ed51ab101703f2621985381213f142f3", 32, V, &len);
+	hex_to_bytes(
+		"59300324ec3d0fef02694eae613126b9f714c382f06cce295c2b19c4fcb71029"
+		"91bf6b0a1d767eb41ae55faf61c39c0f44ae6f7faaab491a1732407fb09be612", 128, out, &len);
+
+	if (sm4_ctr_drbg_init(&drbg, entropy, sizeof(entropy), nonce, sizeof(nonce), NULL, 0) != 1) {
+		error_print();
+		return -1;
+	}
+	memset(drbg.V, 0xff, sizeof(drbg.V));
+	drbg.V[15] = 0xfe;
+	if (sm4_ctr_drbg_generate(&drbg, NULL, 0, sizeof(buf), buf) != 1) {
+		error_print();
+		return -1;
+	}
+	sm4_set_encrypt_key(&key, K);
+	if (memcmp(buf, out, sizeof(out)) != 0
+		|| memcmp(drbg.key.rk, key.rk, sizeof(key.rk)) != 0
+		|| memcmp(drbg.V, V, sizeof(V)) != 0) {
+		error_print();
+		return -1;
+	}
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+/* a request is one keystream, splitting it must not change the output */
+static int test_sm4_ctr_drbg_lengths(void)
+{
+	SM4_CTR_DRBG drbg;
+	uint8_t entropy[32] = {1};
+	uint8_t buf[1000];
+	uint8_t blocks[1008];
+	SM4_KEY key;
+	uint8_t V[16];
+	size_t lens[] = { 0, 1, 15, 16, 17, 1000 };
+	size_t i, j;
+	int k;
+
+	for (i = 0; i < sizeof(lens)/sizeof(lens[0]); i++) {
+		sm4_ctr_drbg_init(&drbg, entropy, sizeof(entropy), NULL, 0, NULL, 0);
+		key = drbg.key;
+		memcpy(V, drbg.V, sizeof(V));
+		for (j = 0; j < sizeof(blocks); j += 16) {
+			for (k = 15; k >= 0; k--) {
+				if (++V[k]) break;
+			}
+			sm4_encrypt(&key, V, blocks + j);
+		}
+		memset(buf, 0, sizeof(buf));
+		if (sm4_ctr_drbg_generate(&drbg, NULL, 0, lens[i], buf) != 1
+			|| memcmp(buf, blocks, lens[i]) != 0) {
+			error_print();
+			return -1;
+		}
+	}
+	if (sm4_ctr_drbg_generate(&drbg, NULL, 0, SM4_CTR_DRBG_MAX_REQUEST_SIZE + 1, buf) != -1) {
+		error_print();
+		return -1;
+	}
+	drbg.reseed_counter = SM4_CTR_DRBG_RESEED_INTERVAL + 1;
+	if (sm4_ctr_drbg_generate(&drbg, NULL, 0, 16, buf) != 0) {
+		error_print();
+		return -1;
+	}
+	sm4_ctr_drbg_cleanup(&drbg);
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+int main(void)
+{
+	int err = 0;
+	if (test_sm4_ctr_drbg() != 1) err++;
+	if (test_sm4_ctr_drbg_counter_wrap() != 1) err++;
+	if (test_sm4_ctr_drbg_lengths() != 1) err++;
+	return err;
+}
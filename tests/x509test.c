@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <gmssl/oid.h>
 #include <gmssl/x509.h>
+#include <gmssl/x509_store.h>
+#include <gmssl/pem.h>
 #include <gmssl/rand.h>
 #include <gmssl/error.h>
 
@@ -283,6 +285,524 @@ end:
 }
 
 
+static int test_x509_cert_view(void)
+{
+	X509_CERTIFICATE *cert;
+	X509_NAME ca_name;
+	X509_NAME name;
+	SM2_KEY ca_key;
+	SM2_KEY key;
+	SM2_KEY pub;
+	uint8_t sn[12];
+	time_t not_before;
+	uint8_t ca_der[1024];
+	uint8_t der[1024];
+	uint8_t *p;
+	const uint8_t *cp;
+	size_t ca_len = 0, len = 0;
+	X509_CERT_VIEW ca_view, view;
+	const uint8_t *serial;
+	size_t serial_len;
+	int ret = -1;
+
+	if (!(cert = malloc(sizeof(X509_CERTIFICATE)))) {
+		error_print();
+		return -1;
+	}
+	time(&not_before);
+	rand_bytes(sn, sizeof(sn));
+	sn[0] &= 0x7f;
+	sm2_keygen(&ca_key);
+	sm2_keygen(&key);
+	memset(&ca_name, 0, sizeof(X509_NAME));
+	x509_name_add_rdn(&ca_name, OID_at_countryName, ASN1_TAG_PrintableString, "CN");
+	x509_name_add_rdn(&ca_name, OID_at_commonName, ASN1_TAG_PrintableString, "CA");
+	memset(&name, 0, sizeof(X509_NAME));
+	x509_name_add_rdn(&name, OID_at_countryName, ASN1_TAG_PrintableString, "CN");
+	x509_name_add_rdn(&name, OID_at_commonName, ASN1_TAG_PrintableString, "infosec");
+
+	memset(cert, 0, sizeof(X509_CERTIFICATE));
+	x509_certificate_set_version(cert, X509_version_v3);
+	x509_certificate_set_serial_number(cert, sn, sizeof(sn));
+	x509_certificate_set_signature_algor(cert, OID_sm2sign_with_sm3);
+	x509_certificate_set_issuer(cert, &ca_name);
+	x509_certificate_set_subject(cert, &ca_name);
+	x509_certificate_set_validity(cert, not_before, 365);
+	x509_certificate_set_subject_public_key_info_sm2(cert, &ca_key);
+	x509_certificate_sign_sm2(cert, &ca_key);
+	p = ca_der;
+	if (x509_certificate_to_der(cert, &p, &ca_len) != 1) {
+		error_print();
+		goto end;
+	}
+
+	memset(cert, 0, sizeof(X509_CERTIFICATE));
+	x509_certificate_set_version(cert, X509_version_v3);
+	x509_certificate_set_serial_number(cert, sn, sizeof(sn));
+	x509_certificate_set_signature_algor(cert, OID_sm2sign_with_sm3);
+	x509_certificate_set_issuer(cert, &ca_name);
+	x509_certificate_set_subject(cert, &name);
+	x509_certificate_set_validity(cert, not_before, 365);
+	x509_certificate_set_subject_public_key_info_sm2(cert, &key);
+	x509_certificate_generate_subject_key_identifier(cert, 1);
+	x509_certificate_sign_sm2(cert, &ca_key);
+	p = der;
+	if (x509_certificate_to_der(cert, &p, &len) != 1) {
+		error_print();
+		goto end;
+	}
+
+	cp = ca_der;
+	if (x509_cert_view_from_der(&ca_view, &cp, &ca_len) != 1 || ca_len) {
+		error_print();
+		goto end;
+	}
+	cp = der;
+	if (x509_cert_view_from_der(&view, &cp, &len) != 1 || len) {
+		error_print();
+		goto end;
+	}
+	if (x509_cert_view_verify_by_cert_view(&view, &ca_view) != 1
+		|| x509_cert_view_verify_by_cert_view(&ca_view, &ca_view) != 1
+		|| x509_cert_view_issuer_equ_subject(&ca_view, &view) != 0) {
+		error_print();
+		goto end;
+	}
+	if (x509_cert_view_get_serial_number(&view, &serial, &serial_len) != 1
+		|| serial_len != sizeof(sn) || memcmp(serial, sn, sizeof(sn)) != 0
+		|| x509_cert_view_get_public_key(&view, &pub) != 1
+		|| memcmp(&pub.public_key, &key.public_key, sizeof(SM2_POINT)) != 0
+		|| x509_cert_view_get_extension_from_oid(&view, OID_ce_subjectKeyIdentifier, NULL, NULL, NULL) != 1) {
+		error_print();
+		goto end;
+	}
+
+	// one bit of the subject changed
+	der[view.subject + view.subject_len - 1] ^= 1;
+	if (x509_cert_view_verify_by_cert_view(&view, &ca_view) == 1) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok, sizeof(X509_CERT_VIEW) = %zu\n", __FUNCTION__, sizeof(X509_CERT_VIEW));
+	ret = 1;
+end:
+	free(cert);
+	return ret;
+}
+
+// tbsCertificate larger than 1 KB, verified from the struct and from the DER
+static int test_x509_certificate_large(void)
+{
+	X509_CERTIFICATE *cert;
+	X509_NAME name;
+	SM2_KEY key;
+	uint8_t sn[12];
+	uint8_t data[1500];
+	time_t not_before;
+	uint8_t *der = NULL;
+	uint8_t *p;
+	size_t len = 0;
+	int ret = -1;
+
+	if (!(cert = malloc(sizeof(X509_CERTIFICATE)))
+		|| !(der = malloc(4096))) {
+		error_print();
+		goto end;
+	}
+	time(&not_before);
+	rand_bytes(sn, sizeof(sn));
+	sn[0] &= 0x7f;
+	memset(data, 'A', sizeof(data));
+	sm2_keygen(&key);
+	memset(&name, 0, sizeof(X509_NAME));
+	x509_name_add_rdn(&name, OID_at_countryName, ASN1_TAG_PrintableString, "CN");
+	x509_name_add_rdn(&name, OID_at_commonName, ASN1_TAG_PrintableString, "large");
+
+	memset(cert, 0, sizeof(X509_CERTIFICATE));
+	x509_certificate_set_version(cert, X509_version_v3);
+	x509_certificate_set_serial_number(cert, sn, sizeof(sn));
+	x509_certificate_set_signature_algor(cert, OID_sm2sign_with_sm3);
+	x509_certificate_set_issuer(cert, &name);
+	x509_certificate_set_subject(cert, &name);
+	x509_certificate_set_validity(cert, not_before, 365);
+	x509_certificate_set_subject_public_key_info_sm2(cert, &key);
+	if (x509_certificate_add_extension(cert, OID_ce_subjectKeyIdentifier, 0, data, sizeof(data)) != 1
+		|| x509_certificate_sign_sm2(cert, &key) != 1) {
+		error_print();
+		goto end;
+	}
+	p = der;
+	if (x509_certificate_to_der(cert, &p, &len) != 1
+		|| len <= 1024) {
+		error_print();
+		goto end;
+	}
+	if (x509_certificate_verify_sm2(cert, &key) != 1
+		|| x509_certificate_verify_sm2_from_der(der, len, &key) != 1) {
+		error_print();
+		goto end;
+	}
+	der[len - 1] ^= 1;
+	if (x509_certificate_verify_sm2_from_der(der, len, &key) == 1) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok, %zu bytes\n", __FUNCTION__, len);
+	ret = 1;
+end:
+	free(cert);
+	free(der);
+	return ret;
+}
+
+static int gen_cert(const char *subject, const SM2_KEY *key,
+	const char *issuer, const SM2_KEY *issuer_key, uint8_t *der, size_t *derlen)
+{
+	X509_CERTIFICATE *cert;
+	X509_NAME name;
+	uint8_t sn[12];
+	time_t not_before;
+	uint8_t *p = der;
+	int ret = -1;
+
+	if (!(cert = malloc(sizeof(X509_CERTIFICATE)))) {
+		error_print();
+		return -1;
+	}
+	time(&not_before);
+	rand_bytes(sn, sizeof(sn));
+	sn[0] &= 0x7f;
+
+	memset(cert, 0, sizeof(X509_CERTIFICATE));
+	x509_certificate_set_version(cert, X509_version_v3);
+	x509_certificate_set_serial_number(cert, sn, sizeof(sn));
+	x509_certificate_set_signature_algor(cert, OID_sm2sign_with_sm3);
+	memset(&name, 0, sizeof(X509_NAME));
+	x509_name_add_rdn(&name, OID_at_commonName, ASN1_TAG_PrintableString, issuer);
+	x509_certificate_set_issuer(cert, &name);
+	memset(&name, 0, sizeof(X509_NAME));
+	x509_name_add_rdn(&name, OID_at_commonName, ASN1_TAG_PrintableString, subject);
+	x509_certificate_set_subject(cert, &name);
+	x509_certificate_set_validity(cert, not_before, 365);
+	x509_certificate_set_subject_public_key_info_sm2(cert, key);
+	x509_certificate_generate_subject_key_identifier(cert, 0);
+	*derlen = 0;
+	if (x509_certificate_sign_sm2(cert, issuer_key) != 1
+		|| x509_certificate_to_der(cert, &p, derlen) != 1) {
+		error_print();
+		goto end;
+	}
+	ret = 1;
+end:
+	free(cert);
+	return ret;
+}
+
+static int test_x509_store(void)
+{
+	X509_STORE store;
+	SM2_KEY ca1_key, ca2_key, key;
+	uint8_t der[1024];
+	size_t derlen;
+	char pem[4096];
+	size_t pemlen = 0;
+	size_t len;
+	uint8_t leaf1[1024], leaf2[1024];
+	size_t leaf1_len, leaf2_len;
+	const uint8_t *cp;
+	size_t cplen;
+	X509_CERT_VIEW view1, view2;
+	int ret = -1;
+
+	sm2_keygen(&ca1_key);
+	sm2_keygen(&ca2_key);
+	sm2_keygen(&key);
+	if (gen_cert("CA1", &ca1_key, "CA1", &ca1_key, der, &derlen) != 1
+		|| pem_encode("CERTIFICATE", der, derlen, pem, &len) != 1) {
+		error_print();
+		return -1;
+	}
+	pemlen = len;
+	if (gen_cert("CA2", &ca2_key, "CA2", &ca2_key, der, &derlen) != 1
+		|| pem_encode("CERTIFICATE", der, derlen, pem + pemlen, &len) != 1
+		|| gen_cert("leaf1", &key, "CA1", &ca1_key, leaf1, &leaf1_len) != 1
+		|| gen_cert("leaf2", &key, "CA2", &ca2_key, leaf2, &leaf2_len) != 1) {
+		error_print();
+		return -1;
+	}
+	cp = leaf1;
+	cplen = leaf1_len;
+	if (x509_cert_view_from_der(&view1, &cp, &cplen) != 1) {
+		error_print();
+		return -1;
+	}
+	cp = leaf2;
+	cplen = leaf2_len;
+	if (x509_cert_view_from_der(&view2, &cp, &cplen) != 1) {
+		error_print();
+		return -1;
+	}
+
+	x509_store_init(&store);
+	if (x509_store_verify(&store, &view1) != 0) {
+		error_print();
+		goto end;
+	}
+	// only CA1
+	if (x509_store_load_pem(&store, pem, pemlen) != 1
+		|| x509_store_count(&store) != 1
+		|| x509_store_verify(&store, &view1) != 1
+		|| x509_store_verify(&store, &view2) != 0) {
+		error_print();
+		goto end;
+	}
+	// reload with CA1 and CA2
+	if (x509_store_load_pem(&store, pem, pemlen + len) != 1
+		|| x509_store_count(&store) != 2
+		|| x509_store_verify(&store, &view1) != 1
+		|| x509_store_verify(&store, &view2) != 1
+		|| x509_store_find_by_subject(&store, view2.der + view2.issuer, view2.issuer_len,
+			der, &derlen, sizeof(der)) != 1) {
+		error_print();
+		goto end;
+	}
+	// issuer found, wrong signature
+	leaf1[view1.sig + view1.sig_len - 1] ^= 1;
+	if (x509_store_verify(&store, &view1) != -1) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	ret = 1;
+end:
+	x509_store_cleanup(&store);
+	return ret;
+}
+
+static int test_x509_store_chain_cache(void)
+{
+	X509_STORE store;
+	SM2_KEY key;
+	uint8_t der[1024];
+	size_t derlen;
+	char pem[2048];
+	size_t pemlen;
+	uint8_t dgst[32];
+	uint64_t generation, old_generation;
+	time_t now = time(NULL);
+	int ret = -1;
+
+	sm2_keygen(&key);
+	if (gen_cert("CA", &key, "CA", &key, der, &derlen) != 1
+		|| pem_encode("CERTIFICATE", der, derlen, pem, &pemlen) != 1) {
+		error_print();
+		return -1;
+	}
+	x509_store_init(&store);
+	if (x509_store_load_pem(&store, pem, pemlen) != 1
+		|| x509_store_enable_chain_cache(&store, 100) != 1) {
+		error_print();
+		goto end;
+	}
+
+	if (x509_store_chain_cache_lookup(&store, der, derlen, now, dgst, &generation) != 0
+		|| x509_store_chain_cache_add(&store, dgst, generation, now + 60) != 1
+		|| x509_store_chain_cache_lookup(&store, der, derlen, now, dgst, &generation) != 1
+		|| x509_store_chain_cache_lookup(&store, der, derlen - 1, now, dgst, &generation) != 0) {
+		error_print();
+		goto end;
+	}
+	// expired
+	if (x509_store_chain_cache_lookup(&store, der, derlen, now + 61, dgst, &generation) != 0) {
+		error_print();
+		goto end;
+	}
+	// flushed, and a result computed before the flush is not cached
+	x509_store_chain_cache_lookup(&store, der, derlen, now, dgst, &old_generation);
+	x509_store_chain_cache_flush(&store);
+	if (x509_store_chain_cache_lookup(&store, der, derlen, now, dgst, &generation) != 0
+		|| x509_store_chain_cache_add(&store, dgst, old_generation, now + 60) != 1
+		|| x509_store_chain_cache_lookup(&store, der, derlen, now, dgst, &generation) != 0) {
+		error_print();
+		goto end;
+	}
+	// reloaded
+	if (x509_store_chain_cache_add(&store, dgst, generation, now + 60) != 1
+		|| x509_store_chain_cache_lookup(&store, der, derlen, now, dgst, &generation) != 1
+		|| x509_store_load_pem(&store, pem, pemlen) != 1
+		|| x509_store_chain_cache_lookup(&store, der, derlen, now, dgst, &generation) != 0) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	ret = 1;
+end:
+	x509_store_cleanup(&store);
+	return ret;
+}
+
+static int test_x509_crl(void)
+{
+	size_t count = 100000;
+	SM2_KEY ca_key, sub_key, key;
+	X509_NAME ca_name;
+	uint8_t ca_der[1024], der1[1024], der2[1024], sub_der[1024], der3[1024];
+	size_t ca_len, len1, len2, sub_len, len3;
+	X509_CERT_VIEW view1, view2, sub_view, view3;
+	uint8_t sub_crl[1024];
+	size_t sub_crl_len = 0;
+	const uint8_t *serial3;
+	size_t serial3_len;
+	char pem[2048];
+	size_t pemlen;
+	uint8_t (*serials)[8] = NULL;
+	const uint8_t **serials_ptrs = NULL;
+	size_t *serials_lens = NULL;
+	uint8_t *crl_der = NULL;
+	uint8_t *p;
+	size_t crl_len = 0;
+	const uint8_t *cp;
+	size_t cplen;
+	X509_CRL crl;
+	X509_STORE store;
+	time_t now = time(NULL);
+	size_t i;
+	int ret = -1;
+
+	memset(&crl, 0, sizeof(crl));
+	x509_store_init(&store);
+	sm2_keygen(&ca_key);
+	sm2_keygen(&sub_key);
+	sm2_keygen(&key);
+	if (gen_cert("CA", &ca_key, "CA", &ca_key, ca_der, &ca_len) != 1
+		|| gen_cert("leaf1", &key, "CA", &ca_key, der1, &len1) != 1
+		|| gen_cert("leaf2", &key, "CA", &ca_key, der2, &len2) != 1
+		|| gen_cert("SubCA", &sub_key, "CA", &ca_key, sub_der, &sub_len) != 1
+		|| gen_cert("leaf3", &key, "SubCA", &sub_key, der3, &len3) != 1) {
+		error_print();
+		goto end;
+	}
+	cp = der1;
+	cplen = len1;
+	if (x509_cert_view_from_der(&view1, &cp, &cplen) != 1) {
+		error_print();
+		goto end;
+	}
+	cp = der2;
+	cplen = len2;
+	if (x509_cert_view_from_der(&view2, &cp, &cplen) != 1) {
+		error_print();
+		goto end;
+	}
+	cp = sub_der;
+	cplen = sub_len;
+	if (x509_cert_view_from_der(&sub_view, &cp, &cplen) != 1) {
+		error_print();
+		goto end;
+	}
+	cp = der3;
+	cplen = len3;
+	if (x509_cert_view_from_der(&view3, &cp, &cplen) != 1) {
+		error_print();
+		goto end;
+	}
+
+	// leaf1 and count - 1 random serial numbers
+	if (!(serials = malloc(sizeof(*serials) * count))
+		|| !(serials_ptrs = malloc(sizeof(uint8_t *) * count))
+		|| !(serials_lens = malloc(sizeof(size_t) * count))) {
+		error_print();
+		goto end;
+	}
+	rand_bytes((uint8_t *)serials, sizeof(*serials) * count);
+	for (i = 0; i < count; i++) {
+		serials[i][0] = (serials[i][0] & 0x7f) | 0x01;
+		serials_ptrs[i] = serials[i];
+		serials_lens[i] = sizeof(serials[i]);
+	}
+	serials_ptrs[count / 2] = view1.der + view1.serial;
+	serials_lens[count / 2] = view1.serial_len;
+
+	memset(&ca_name, 0, sizeof(X509_NAME));
+	x509_name_add_rdn(&ca_name, OID_at_commonName, ASN1_TAG_PrintableString, "CA");
+	if (x509_crl_sign_to_der(&ca_key, &ca_name, now, now + 86400,
+		serials_ptrs, serials_lens, count, now, NULL, &crl_len) != 1
+		|| !(crl_der = malloc(crl_len))) {
+		error_print();
+		goto end;
+	}
+	p = crl_der;
+	crl_len = 0;
+	if (x509_crl_sign_to_der(&ca_key, &ca_name, now, now + 86400,
+		serials_ptrs, serials_lens, count, now, &p, &crl_len) != 1) {
+		error_print();
+		goto end;
+	}
+
+	if (x509_crl_from_der(&crl, crl_der, crl_len) != 1
+		|| crl.count != count
+		|| x509_crl_verify(&crl, &ca_key) != 1
+		|| x509_crl_is_revoked(&crl, serials[1], sizeof(serials[1])) != 1
+		|| x509_crl_is_revoked(&crl, view1.der + view1.serial, view1.serial_len) != 1
+		|| x509_crl_is_revoked(&crl, view2.der + view2.serial, view2.serial_len) != 0) {
+		error_print();
+		goto end;
+	}
+
+	if (pem_encode("CERTIFICATE", ca_der, ca_len, pem, &pemlen) != 1
+		|| x509_store_load_pem(&store, pem, pemlen) != 1
+		|| x509_store_verify(&store, &view1) != 1
+		|| x509_store_add_crl(&store, crl_der, crl_len) != 1
+		|| x509_store_verify(&store, &view1) != -1
+		|| x509_store_verify(&store, &view2) != 1
+		|| x509_store_cert_is_revoked(&store, &view1) != 1) {
+		error_print();
+		goto end;
+	}
+	// not signed by the CA
+	crl_der[crl_len - 1] ^= 1;
+	if (x509_store_add_crl(&store, crl_der, crl_len) == 1) {
+		error_print();
+		goto end;
+	}
+
+	// CRL of an intermediate CA, accepted only with a verified issuer certificate
+	memset(&ca_name, 0, sizeof(X509_NAME));
+	x509_name_add_rdn(&ca_name, OID_at_commonName, ASN1_TAG_PrintableString, "SubCA");
+	serial3 = view3.der + view3.serial;
+	serial3_len = view3.serial_len;
+	p = sub_crl;
+	if (x509_crl_sign_to_der(&sub_key, &ca_name, now, now + 86400,
+		&serial3, &serial3_len, 1, now, &p, &sub_crl_len) != 1) {
+		error_print();
+		goto end;
+	}
+	if (x509_store_add_crl(&store, sub_crl, sub_crl_len) == 1
+		|| x509_store_add_crl_by_issuer(&store, sub_crl, sub_crl_len, &view2) == 1
+		|| x509_store_cert_is_revoked(&store, &view3) != 0
+		|| x509_store_add_crl_by_issuer(&store, sub_crl, sub_crl_len, &sub_view) != 1
+		|| x509_store_cert_is_revoked(&store, &view3) != 1
+		|| x509_store_verify(&store, &sub_view) != 1) {
+		error_print();
+		goto end;
+	}
+
+	printf("%s() ok, %zu entries, %zu bytes\n", __FUNCTION__, count, crl_len);
+	ret = 1;
+end:
+	x509_crl_cleanup(&crl);
+	x509_store_cleanup(&store);
+	free(serials);
+	free(serials_ptrs);
+	free(serials_lens);
+	free(crl_der);
+	return ret;
+}
+
 int main(void)
 {
 	int err = 0;
@@ -292,6 +812,11 @@ int main(void)
 	err += test_x509_name();
 	err += test_x509_public_key_info();
 	err += test_x509_certificate();
+	if (test_x509_cert_view() != 1) err++;
+	if (test_x509_certificate_large() != 1) err++;
+	if (test_x509_store() != 1) err++;
+	if (test_x509_store_chain_cache() != 1) err++;
+	if (test_x509_crl() != 1) err++;
 	err += test_x509_cert_request();
 	//test_x509_extensions();
 	return 1;
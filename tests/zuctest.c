@@ -477,6 +477,95 @@ int zuc256_mac_test(void)
 	return err;
 }
 
+// keystream split over several calls must equal a single call
+static int zuc_keystream_split_test(void)
+{
+	unsigned char key[16] = {1, 2, 3};
+	unsigned char iv[16] = {4, 5, 6};
+	size_t nwords[] = {5, 20, 16, 1, 33};
+	ZUC_UINT32 ks1[75], ks2[75], buf[75];
+	ZUC_KEY zuc_key;
+	size_t i, off;
+
+	zuc_set_key(&zuc_key, key, iv);
+	zuc_generate_keystream(&zuc_key, 75, ks1);
+
+	zuc_set_key(&zuc_key, key, iv);
+	for (i = 0, off = 0; i < sizeof(nwords)/sizeof(nwords[0]); i++) {
+		zuc_generate_keystream(&zuc_key, nwords[i], ks2 + off);
+		off += nwords[i];
+	}
+	if (off != 75 || memcmp(ks1, ks2, sizeof(ks1)) != 0) {
+		printf("zuc keystream split test failed\n");
+		return 1;
+	}
+
+	// in place xor
+	for (i = 0; i < 75; i++) {
+		buf[i] = (ZUC_UINT32)i;
+	}
+	zuc_set_key(&zuc_key, key, iv);
+	zuc_generate_keystream_xor(&zuc_key, 75, buf, buf);
+	for (i = 0; i < 75; i++) {
+		if (buf[i] != (ks1[i] ^ (ZUC_UINT32)i)) {
+			printf("zuc keystream xor test failed\n");
+			return 1;
+		}
+	}
+	printf("zuc keystream split test ok\n");
+	return 0;
+}
+
+// MAC over uneven update() pieces must equal the single update() MAC
+static int zuc_mac_update_test(void)
+{
+	unsigned char key[32] = {1, 2, 3};
+	unsigned char iv[23] = {4, 5, 6};
+	unsigned char msg[301];
+	size_t chunks[] = {1, 2, 5, 4, 100, 3, 185};
+	unsigned char mac1[16], mac2[16];
+	int macbits[] = {32, 64, 128};
+	ZUC_MAC_CTX ctx;
+	ZUC256_MAC_CTX ctx256;
+	size_t i, j, off;
+
+	for (i = 0; i < sizeof(msg); i++) {
+		msg[i] = (unsigned char)(i * 31);
+	}
+
+	zuc_mac_init(&ctx, key, iv);
+	zuc_mac_update(&ctx, msg, 300);
+	zuc_mac_finish(&ctx, msg + 300, 5, mac1);
+	zuc_mac_init(&ctx, key, iv);
+	for (j = 0, off = 0; j < sizeof(chunks)/sizeof(chunks[0]); j++) {
+		zuc_mac_update(&ctx, msg + off, chunks[j]);
+		off += chunks[j];
+	}
+	zuc_mac_finish(&ctx, msg + off, 5, mac2);
+	if (off != 300 || memcmp(mac1, mac2, 4) != 0) {
+		printf("zuc mac update test failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(macbits)/sizeof(macbits[0]); i++) {
+		zuc256_mac_init(&ctx256, key, iv, macbits[i]);
+		zuc256_mac_update(&ctx256, msg, 300);
+		zuc256_mac_finish(&ctx256, msg + 300, 5, mac1);
+		zuc256_mac_init(&ctx256, key, iv, macbits[i]);
+		for (j = 0, off = 0; j < sizeof(chunks)/sizeof(chunks[0]); j++) {
+			zuc256_mac_update(&ctx256, msg + off, chunks[j]);
+			off += chunks[j];
+		}
+		zuc256_mac_finish(&ctx256, msg + off, 5, mac2);
+		if (memcmp(mac1, mac2, macbits[i]/8) != 0) {
+			printf("zuc256 mac update test %d-bit failed\n", macbits[i]);
+			return 1;
+		}
+	}
+	printf("zuc mac update test ok\n");
+	return 0;
+}
+
 int main(void)
 {
 	int err = 0;
@@ -485,5 +574,7 @@ int main(void)
 	err += zuc_eia_test();
 	err += zuc256_test();
 	err += zuc256_mac_test();
+	err += zuc_mac_update_test();
+	err += zuc_keystream_split_test();
 	return err;
 }
@@ -17,11 +17,111 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <gmssl/sm3.h>
 #include <gmssl/digest.h>
 
 #define FORMAT_HEX	1
 #define FORMAT_BIN	2
 
+/* regular files are mapped and hashed a window at a time, others are read */
+#define MMAP_WINDOW_SIZE	(64 * 1024 * 1024)
+#define READ_BUF_SIZE		(1024 * 1024)
+
+typedef struct {
+	int tree;
+	DIGEST_CTX digest_ctx;
+	SM3_TREE_CTX tree_ctx;
+} HASH_CTX;
+
+static int hash_update(HASH_CTX *ctx, const uint8_t *data, size_t len)
+{
+	if (ctx->tree) {
+		return sm3_tree_update(&ctx->tree_ctx, data, len);
+	}
+	return digest_update(&ctx->digest_ctx, data, len);
+}
+
+static int hash_fd(HASH_CTX *ctx, int fd, uint8_t *buf, size_t buflen)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		off_t off;
+		for (off = 0; off < st.st_size; off += MMAP_WINDOW_SIZE) {
+			size_t len = st.st_size - off < MMAP_WINDOW_SIZE ? (size_t)(st.st_size - off) : MMAP_WINDOW_SIZE;
+			uint8_t *p;
+
+			if ((p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, off)) == MAP_FAILED) {
+				// fall back to read() from where the mapping failed
+				if (lseek(fd, off, SEEK_SET) != off) {
+					return -1;
+				}
+				break;
+			}
+			madvise(p, len, MADV_SEQUENTIAL);
+			if (hash_update(ctx, p, len) != 1) {
+				munmap(p, len);
+				return -1;
+			}
+			munmap(p, len);
+		}
+		if (off >= st.st_size) {
+			return 1;
+		}
+	}
+
+	for (;;) {
+		size_t len = 0;
+		ssize_t n;
+
+		// fill the buffer so that the tree mode gets many leaves per update
+		while (len < buflen) {
+			if ((n = read(fd, buf + len, buflen - len)) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			if (n == 0) {
+				break;
+			}
+			len += n;
+		}
+		if (len == 0) {
+			break;
+		}
+		if (hash_update(ctx, buf, len) != 1) {
+			return -1;
+		}
+		if (len < buflen) {
+			break;
+		}
+	}
+	return 1;
+}
+
+static int hash_init(HASH_CTX *ctx, const DIGEST *digest)
+{
+	if (ctx->tree) {
+		return 1;
+	}
+	return digest_init(&ctx->digest_ctx, digest);
+}
+
+static int hash_finish(HASH_CTX *ctx, uint8_t *dgst, size_t *dgstlen)
+{
+	if (ctx->tree) {
+		*dgstlen = SM3_DIGEST_SIZE;
+		return sm3_tree_finish(&ctx->tree_ctx, dgst);
+	}
+	return digest_finish(&ctx->digest_ctx, dgst, dgstlen);
+}
+
 
 void print_usage(FILE *out, const char *prog)
 {
@@ -39,6 +139,12 @@ void print_usage(FILE *out, const char *prog)
 	fprintf(out, "  -hex		generate hex output\n");
 	fprintf(out, "  -binary		generate binary output\n");
 	fprintf(out, "  -out file	set output filename\n");
+	fprintf(out, "  -tree		tree mode SM3, hash leaf_size chunks in parallel\n");
+	fprintf(out, "  -leaf_size num	tree mode leaf size in bytes, default %d\n", SM3_TREE_DEFAULT_LEAF_SIZE);
+	fprintf(out, "  -threads num	tree mode hashing threads, default is the number of cpus\n");
+	fprintf(out, "\n");
+	fprintf(out, "The tree mode hex output is tagged with the leaf size, as\n");
+	fprintf(out, "  SM3-TREE-<leaf_size> (file) = digest\n");
 }
 
 int main(int argc, char **argv)
@@ -50,15 +156,20 @@ int main(int argc, char **argv)
 	int format = FORMAT_HEX;
 	char *infile = NULL;
 	char *outfile = NULL;
-	FILE *in = stdin;
 	FILE *out = stdout;
+	int fd;
+	size_t leaf_size = SM3_TREE_DEFAULT_LEAF_SIZE;
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
 
-	DIGEST_CTX ctx;
+	HASH_CTX ctx;
 	unsigned char dgst[64];
-	unsigned char buf[4096];
+	unsigned char *buf = NULL;
+	size_t buflen = READ_BUF_SIZE;
 	size_t len;
 	size_t dgstlen, i;
 
+	memset(&ctx, 0, sizeof(ctx));
+
 	argc--;
 	argv++;
 	while (argc >= 1) {
@@ -103,6 +214,18 @@ int main(int argc, char **argv)
 		} else if (!strcmp(*argv, "-out")) {
 			if (--argc < 1) goto bad;
 			outfile = *(++argv);
+
+		} else if (!strcmp(*argv, "-tree")) {
+			ctx.tree = 1;
+
+		} else if (!strcmp(*argv, "-leaf_size")) {
+			if (--argc < 1) goto bad;
+			leaf_size = strtoul(*(++argv), NULL, 0);
+
+		} else if (!strcmp(*argv, "-threads")) {
+			if (--argc < 1) goto bad;
+			num_threads = atoi(*(++argv));
+
 		} else {
 			break;
 		}
@@ -117,6 +240,23 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (ctx.tree) {
+		if (digest != DIGEST_sm3()) {
+			fprintf(stderr, "%s: -tree is only supported with -sm3\n", prog);
+			return 1;
+		}
+		if (leaf_size < SM3_BLOCK_SIZE) {
+			fprintf(stderr, "%s: invalid leaf size\n", prog);
+			return 1;
+		}
+		if (num_threads < 1) {
+			num_threads = 1;
+		}
+		if (leaf_size * num_threads * 2 > buflen) {
+			buflen = leaf_size * num_threads * 2;
+		}
+	}
+
 	if (outfile) {
 		if (!(out = fopen(outfile, "wb"))) {
 			fprintf(stderr, "%s: can not open %s\n", prog, outfile);
@@ -124,24 +264,30 @@ int main(int argc, char **argv)
 		}
 	}
 
-	digest_ctx_init(&ctx);
-
-	if (!argc) {
-		if (!digest_init(&ctx, digest)) {
+	digest_ctx_init(&ctx.digest_ctx);
+	if (ctx.tree) {
+		if (sm3_tree_init(&ctx.tree_ctx, leaf_size, (int)num_threads) != 1) {
 			goto end;
 		}
-		while ((len = fread(buf, 1, sizeof(buf), stdin)) > 0) {
-			if (!digest_update(&ctx, buf, len)) {
-				goto end;
-			}
-		}
-		if (!digest_finish(&ctx, dgst, &len)) {
+	}
+	if (!(buf = malloc(buflen))) {
+		fprintf(stderr, "%s: malloc failure\n", prog);
+		goto end;
+	}
+
+	if (!argc) {
+		if (hash_init(&ctx, digest) != 1
+			|| hash_fd(&ctx, STDIN_FILENO, buf, buflen) != 1
+			|| hash_finish(&ctx, dgst, &len) != 1) {
 			goto end;
 		}
 
 		if (format == FORMAT_BIN) {
 			fwrite(dgst, 1, len, out);
 		} else {
+			if (ctx.tree) {
+				printf("SM3-TREE-%zu (-) = ", leaf_size);
+			}
 			for (i = 0; i < len; i++) {
 				printf("%02x", dgst[i]);
 			}
@@ -156,28 +302,34 @@ int main(int argc, char **argv)
 
 	while (argc > 0) {
 		infile = *argv++;
-		if (!(in = fopen(infile, "rb"))) {
+		if ((fd = open(infile, O_RDONLY)) < 0) {
 			fprintf(stderr, "%s: can not open input file %s\n", prog, infile);
 			goto end;
 		}
 
-		if (!digest_init(&ctx, digest)) {
+		if (hash_init(&ctx, digest) != 1
+			|| hash_fd(&ctx, fd, buf, buflen) != 1) {
+			fprintf(stderr, "%s: read error on %s\n", prog, infile);
+			close(fd);
 			goto end;
 		}
-		while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
-			if (!digest_update(&ctx, buf, len)) {
-				goto end;
-			}
-		}
-		fclose(in);
-		if (!digest_finish(&ctx, dgst, &dgstlen)) {
+		close(fd);
+		if (hash_finish(&ctx, dgst, &dgstlen) != 1) {
 			goto end;
 		}
 
-		for (i = 0; i < dgstlen; i++) {
-			printf("%02x", dgst[i]);
+		if (ctx.tree) {
+			printf("SM3-TREE-%zu (%s) = ", leaf_size, infile);
+			for (i = 0; i < dgstlen; i++) {
+				printf("%02x", dgst[i]);
+			}
+			printf("\n");
+		} else {
+			for (i = 0; i < dgstlen; i++) {
+				printf("%02x", dgst[i]);
+			}
+			printf("    %s\n", infile);
 		}
-		printf("    %s\n", infile);
 		argc--;
 	}
 	ret = 0;
@@ -186,7 +338,11 @@ int main(int argc, char **argv)
 bad:
 	fprintf(stderr, "%s: commands should not be used together\n", prog);
 end:
-	digest_ctx_cleanup(&ctx);
+	digest_ctx_cleanup(&ctx.digest_ctx);
+	if (ctx.tree) {
+		sm3_tree_cleanup(&ctx.tree_ctx);
+	}
+	free(buf);
 	fclose(out);
 	return ret;
 }
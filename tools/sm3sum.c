@@ -17,33 +17,658 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <gmssl/sm3.h>
+#include <gmssl/hex.h>
 
 
-int main(int argc, char **argv)
-{
-	char *prog = argv[0];
-	SM3_CTX ctx;
+/* files larger than READ_BUF_SIZE are mapped and hashed a window at a time */
+#define MMAP_WINDOW_SIZE	(64 * 1024 * 1024)
+#define READ_BUF_SIZE		(1024 * 1024)
+
+/* files queued per worker, results are printed in the input order */
+#define JOBS_PER_WORKER		16
+
+enum {
+	JOB_EMPTY = 0,
+	JOB_PENDING,
+	JOB_BUSY,
+	JOB_DONE,
+};
+
+typedef struct {
+	char *path;
+	int state;
+	int error;
+	size_t leaf_size; /* tree mode if not 0 */
+	uint8_t expected[32];
 	uint8_t dgst[32];
-	uint8_t buf[4096];
+} JOB;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	JOB *jobs;
+	size_t num_jobs;
+	size_t head; /* next job to print */
+	size_t next; /* next job to hash */
+	size_t tail; /* next job to fill */
+	int stop;
+	int tree_threads;
+} QUEUE;
+
+typedef struct {
+	int check;
+	int list;
+	char **args;
+	int argc;
+	FILE *fp;
+	char *line;
+	size_t linecap;
+	size_t num_unopened;
+} SOURCE;
+
+typedef struct {
+	int tree;
+	SM3_CTX sm3_ctx;
+	SM3_TREE_CTX tree_ctx;
+} HASH_CTX;
+
+static const char *prog;
+
+static void hash_update(HASH_CTX *ctx, const uint8_t *data, size_t len)
+{
+	if (ctx->tree) {
+		sm3_tree_update(&ctx->tree_ctx, data, len);
+	} else {
+		sm3_update(&ctx->sm3_ctx, data, len);
+	}
+}
+
+static int hash_fd(HASH_CTX *ctx, int fd, uint8_t *buf, size_t buflen)
+{
+	struct stat st;
+
+	// small files are cheaper to read() than to map
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > READ_BUF_SIZE) {
+		off_t off;
+		for (off = 0; off < st.st_size; off += MMAP_WINDOW_SIZE) {
+			size_t len = st.st_size - off < MMAP_WINDOW_SIZE ? (size_t)(st.st_size - off) : MMAP_WINDOW_SIZE;
+			uint8_t *p;
+
+			if ((p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, off)) == MAP_FAILED) {
+				// fall back to read() from where the mapping failed
+				if (lseek(fd, off, SEEK_SET) != off) {
+					return -1;
+				}
+				break;
+			}
+			madvise(p, len, MADV_SEQUENTIAL);
+			hash_update(ctx, p, len);
+			munmap(p, len);
+		}
+		if (off >= st.st_size) {
+			return 1;
+		}
+	}
+
+	for (;;) {
+		size_t len = 0;
+		ssize_t n;
+
+		// fill the buffer so that the tree mode gets many leaves per update
+		while (len < buflen) {
+			if ((n = read(fd, buf + len, buflen - len)) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			if (n == 0) {
+				break;
+			}
+			len += n;
+		}
+		if (len == 0) {
+			break;
+		}
+		hash_update(ctx, buf, len);
+		if (len < buflen) {
+			break;
+		}
+	}
+	return 1;
+}
+
+static int hash_file(const char *path, size_t leaf_size, int tree_threads,
+	uint8_t **buf, size_t *buflen, uint8_t dgst[32])
+{
+	HASH_CTX ctx;
+	size_t len = READ_BUF_SIZE;
+	int fd = STDIN_FILENO;
+	int ret = -1;
+
+	ctx.tree = leaf_size ? 1 : 0;
+	if (ctx.tree) {
+		if (sm3_tree_init(&ctx.tree_ctx, leaf_size, tree_threads) != 1) {
+			return -1;
+		}
+		if (leaf_size * tree_threads * 2 > len) {
+			len = leaf_size * tree_threads * 2;
+		}
+	} else {
+		sm3_init(&ctx.sm3_ctx);
+	}
+	if (*buflen < len) {
+		free(*buf);
+		if (!(*buf = malloc(len))) {
+			*buflen = 0;
+			goto end;
+		}
+		*buflen = len;
+	}
+
+	if (strcmp(path, "-") != 0 && (fd = open(path, O_RDONLY)) < 0) {
+		goto end;
+	}
+	if (hash_fd(&ctx, fd, *buf, *buflen) != 1) {
+		goto end;
+	}
+	if (ctx.tree) {
+		sm3_tree_finish(&ctx.tree_ctx, dgst);
+	} else {
+		sm3_finish(&ctx.sm3_ctx, dgst);
+	}
+	ret = 1;
+end:
+	if (fd >= 0 && fd != STDIN_FILENO) {
+		close(fd);
+	}
+	if (ctx.tree) {
+		sm3_tree_cleanup(&ctx.tree_ctx);
+	}
+	return ret;
+}
+
+static void job_run(QUEUE *queue, JOB *job, uint8_t **buf, size_t *buflen)
+{
+	job->error = 0;
+	if (hash_file(job->path, job->leaf_size, queue->tree_threads, buf, buflen, job->dgst) != 1) {
+		job->error = errno ? errno : EIO;
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	QUEUE *queue = (QUEUE *)arg;
+	uint8_t *buf = NULL;
+	size_t buflen = 0;
+
+	pthread_mutex_lock(&queue->lock);
+	for (;;) {
+		JOB *job;
+
+		while (!queue->stop && queue->next == queue->tail) {
+			pthread_cond_wait(&queue->work_cond, &queue->lock);
+		}
+		if (queue->next == queue->tail) {
+			break;
+		}
+		job = &queue->jobs[queue->next++ % queue->num_jobs];
+		job->state = JOB_BUSY;
+		pthread_mutex_unlock(&queue->lock);
+
+		job_run(queue, job, &buf, &buflen);
+
+		pthread_mutex_lock(&queue->lock);
+		job->state = JOB_DONE;
+		pthread_cond_signal(&queue->done_cond);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	free(buf);
+	return NULL;
+}
+
+/* the next line of the current list or check file, or the next argument */
+static char *source_next(SOURCE *src)
+{
 	ssize_t len;
+
+	for (;;) {
+		if (src->fp) {
+			if ((len = getline(&src->line, &src->linecap, src->fp)) > 0) {
+				if (src->line[len - 1] == '\n') {
+					src->line[--len] = 0;
+				}
+				if (len > 0 && src->line[len - 1] == '\r') {
+					src->line[--len] = 0;
+				}
+				return src->line;
+			}
+			if (src->fp != stdin) {
+				fclose(src->fp);
+			}
+			src->fp = NULL;
+		}
+		if (src->argc <= 0) {
+			return NULL;
+		}
+		src->argc--;
+		if (!src->check && !src->list) {
+			return *src->args++;
+		}
+		if (!strcmp(*src->args, "-")) {
+			src->fp = stdin;
+		} else if (!(src->fp = fopen(*src->args, "r"))) {
+			fprintf(stderr, "%s: %s: %s\n", prog, *src->args, strerror(errno));
+			src->num_unopened++;
+		}
+		src->args++;
+	}
+}
+
+/* sha256sum escapes names holding a backslash or a newline */
+static int name_unescape(char *name)
+{
+	char *p = name;
+
+	while (*name) {
+		if (*name == '\\') {
+			name++;
+			if (*name == 'n') {
+				*p++ = '\n';
+			} else if (*name == '\\') {
+				*p++ = '\\';
+			} else {
+				return -1;
+			}
+			name++;
+		} else {
+			*p++ = *name++;
+		}
+	}
+	*p = 0;
+	return 1;
+}
+
+static void print_escape(const char *name)
+{
+	if (strchr(name, '\n') || strchr(name, '\\')) {
+		putchar('\\');
+	}
+}
+
+static void print_name(const char *name)
+{
+	for (; *name; name++) {
+		if (*name == '\n') {
+			fputs("\\n", stdout);
+		} else if (*name == '\\') {
+			fputs("\\\\", stdout);
+		} else {
+			putchar(*name);
+		}
+	}
+}
+
+/*
+Parse a checksum line, either "digest  name" (a '*' instead of the second
+space marks binary mode) or a tagged "SM3 (name) = digest" or
+"SM3-TREE-<leaf_size> (name) = digest" line.
+*/
+static int parse_check_line(char *line, JOB *job, char **pname)
+{
+	int escaped = 0;
+	char *hex;
+	char *name;
+	size_t len;
+
+	if (*line == '\\') {
+		escaped = 1;
+		line++;
+	}
+	job->leaf_size = 0;
+
+	if (!strncmp(line, "SM3 (", 5) || !strncmp(line, "SM3-TREE-", 9)) {
+		char *end;
+		if (line[3] == '-') {
+			job->leaf_size = strtoul(line + 9, &end, 10);
+			if (job->leaf_size < SM3_BLOCK_SIZE || strncmp(end, " (", 2) != 0) {
+				return -1;
+			}
+			name = end + 2;
+		} else {
+			name = line + 5;
+		}
+		len = strlen(line);
+		if (len < 64 + 4 || strncmp(line + len - 64 - 4, ") = ", 4) != 0) {
+			return -1;
+		}
+		hex = line + len - 64;
+		line[len - 64 - 4] = 0;
+	} else {
+		hex = line;
+		if (strlen(line) < 64 + 2 || line[64] != ' ' || (line[65] != ' ' && line[65] != '*')) {
+			return -1;
+		}
+		line[64] = 0;
+		name = line + 66;
+	}
+	if (strlen(hex) != 64 || hex_to_bytes(hex, 64, job->expected, &len) != 1 || len != 32) {
+		return -1;
+	}
+	if (escaped && name_unescape(name) != 1) {
+		return -1;
+	}
+	if (!*name) {
+		return -1;
+	}
+	*pname = name;
+	return 1;
+}
+
+static void print_usage(FILE *out)
+{
+	fprintf(out, "usage: echo -n \"abc\" | %s\n", prog);
+	fprintf(out, "       %s [options] [file ...]\n", prog);
+	fprintf(out, "       %s -check [options] [checksum_file ...]\n", prog);
+	fprintf(out, "\n");
+	fprintf(out, "Output lines are in the sha256sum format, \"digest  file\".\n");
+	fprintf(out, "\n");
+	fprintf(out, "Options:\n");
+	fprintf(out, "  -c, -check	read digests from the checksum files and check them\n");
+	fprintf(out, "  -list		the arguments are files listing one file name per line\n");
+	fprintf(out, "  -jobs num	number of files hashed concurrently, default is the number of cpus\n");
+	fprintf(out, "  -quiet		in check mode, do not print OK for each verified file\n");
+	fprintf(out, "  -tree		tree mode SM3, hash leaf_size chunks in parallel\n");
+	fprintf(out, "  -leaf_size num	tree mode leaf size in bytes, default %d\n", SM3_TREE_DEFAULT_LEAF_SIZE);
+	fprintf(out, "  -threads num	tree mode hashing threads, default is the number of cpus,\n");
+	fprintf(out, "		shared by the files hashed concurrently\n");
+	fprintf(out, "\n");
+	fprintf(out, "The tree mode output is tagged with the leaf size, as\n");
+	fprintf(out, "  SM3-TREE-<leaf_size> (file) = digest\n");
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 1;
+	int check = 0;
+	int list = 0;
+	int quiet = 0;
+	int tree = 0;
+	size_t leaf_size = SM3_TREE_DEFAULT_LEAF_SIZE;
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	long num_workers = -1;
+	long tree_threads = -1;
+	char *stdin_args[] = { "-" };
+	QUEUE queue;
+	SOURCE src;
+	pthread_t *workers = NULL;
+	int started = 0;
+	uint8_t *buf = NULL;
+	size_t buflen = 0;
+	size_t num_failed = 0, num_unread = 0, num_bad_lines = 0;
+	size_t num_checked = 0;
+	int eof = 0;
 	int i;
 
-	if (argc > 1) {
-		fprintf(stderr, "usage: echo -n \"abc\" | %s\n", prog);
-		fprintf(stderr, "       %s < path/to/file\n", prog);
+	prog = argv[0];
+	memset(&queue, 0, sizeof(queue));
+	memset(&src, 0, sizeof(src));
+
+	argc--;
+	argv++;
+	while (argc >= 1) {
+		if (!strcmp(*argv, "-help") || !strcmp(*argv, "--help")) {
+			print_usage(stdout);
+			return 0;
+		} else if (!strcmp(*argv, "-c") || !strcmp(*argv, "-check") || !strcmp(*argv, "--check")) {
+			check = 1;
+		} else if (!strcmp(*argv, "-list")) {
+			list = 1;
+		} else if (!strcmp(*argv, "-quiet") || !strcmp(*argv, "--quiet")) {
+			quiet = 1;
+		} else if (!strcmp(*argv, "-jobs")) {
+			if (--argc < 1) goto bad;
+			num_workers = atoi(*(++argv));
+		} else if (!strcmp(*argv, "-tree")) {
+			tree = 1;
+		} else if (!strcmp(*argv, "-leaf_size")) {
+			if (--argc < 1) goto bad;
+			leaf_size = strtoul(*(++argv), NULL, 0);
+			if (leaf_size < SM3_BLOCK_SIZE) {
+				fprintf(stderr, "%s: invalid leaf size\n", prog);
+				return 1;
+			}
+		} else if (!strcmp(*argv, "-threads")) {
+			if (--argc < 1) goto bad;
+			tree_threads = atoi(*(++argv));
+		} else if (!strcmp(*argv, "--")) {
+			argc--;
+			argv++;
+			break;
+		} else if (**argv == '-' && (*argv)[1]) {
+			goto bad;
+		} else {
+			break;
+		}
+		argc--;
+		argv++;
+	}
+
+	if (num_cpus < 1) {
+		num_cpus = 1;
+	}
+	if (num_workers < 1) {
+		num_workers = num_cpus;
+	}
+	// a single input gets all the cpus, concurrent files share them
+	if (tree_threads < 1) {
+		long num_inputs = (check || list || argc > num_workers) ? num_workers : argc;
+		if (num_inputs < 1) {
+			num_inputs = 1;
+		}
+		tree_threads = num_cpus / num_inputs > 1 ? num_cpus / num_inputs : 1;
+	}
+
+	// a digest of stdin keeps the plain output of earlier versions
+	if (!argc && !check && !list) {
+		uint8_t dgst[32];
+		if (hash_file("-", tree ? leaf_size : 0, (int)tree_threads, &buf, &buflen, dgst) != 1) {
+			fprintf(stderr, "%s: read error on stdin\n", prog);
+			free(buf);
+			return 1;
+		}
+		if (tree) {
+			printf("SM3-TREE-%zu (-) = ", leaf_size);
+		}
+		for (i = 0; i < sizeof(dgst); i++) {
+			printf("%02x", dgst[i]);
+		}
+		printf("\n");
+		free(buf);
 		return 0;
 	}
 
-	sm3_init(&ctx);
-	while ((len = fread(buf, 1, sizeof(buf), stdin)) > 0) {
-		sm3_update(&ctx, buf, len);
+	src.check = check;
+	src.list = list;
+	src.args = argc ? argv : stdin_args;
+	src.argc = argc ? argc : 1;
+
+	queue.num_jobs = (size_t)num_workers * JOBS_PER_WORKER;
+	queue.tree_threads = (int)tree_threads;
+	if (!(queue.jobs = calloc(queue.num_jobs, sizeof(JOB)))
+		|| !(workers = calloc(num_workers, sizeof(pthread_t)))) {
+		fprintf(stderr, "%s: malloc failure\n", prog);
+		goto end;
+	}
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.work_cond, NULL);
+	pthread_cond_init(&queue.done_cond, NULL);
+
+	// with a single job the files are hashed by the main thread
+	if (num_workers > 1) {
+		for (started = 0; started < num_workers; started++) {
+			if (pthread_create(&workers[started], NULL, worker_thread, &queue) != 0) {
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&queue.lock);
+	for (;;) {
+		JOB *job = &queue.jobs[queue.head % queue.num_jobs];
+
+		if (queue.head < queue.tail && job->state == JOB_DONE) {
+			pthread_mutex_unlock(&queue.lock);
+
+			if (job->error) {
+				fprintf(stderr, "%s: %s: %s\n", prog, job->path, strerror(job->error));
+				if (check) {
+					num_unread++;
+					print_escape(job->path);
+					print_name(job->path);
+					printf(": FAILED open or read\n");
+				} else {
+					num_failed++;
+				}
+			} else if (check) {
+				if (memcmp(job->dgst, job->expected, 32) != 0) {
+					num_failed++;
+					print_escape(job->path);
+					print_name(job->path);
+					printf(": FAILED\n");
+				} else if (!quiet) {
+					print_escape(job->path);
+					print_name(job->path);
+					printf(": OK\n");
+				}
+			} else {
+				print_escape(job->path);
+				if (job->leaf_size) {
+					printf("SM3-TREE-%zu (", job->leaf_size);
+					print_name(job->path);
+					printf(") = ");
+				}
+				for (i = 0; i < 32; i++) {
+					printf("%02x", job->dgst[i]);
+				}
+				if (!job->leaf_size) {
+					printf("  ");
+					print_name(job->path);
+				}
+				printf("\n");
+			}
+			free(job->path);
+			job->path = NULL;
+
+			pthread_mutex_lock(&queue.lock);
+			job->state = JOB_EMPTY;
+			queue.head++;
+			continue;
+		}
+
+		job = &queue.jobs[queue.tail % queue.num_jobs];
+		if (!eof && job->state == JOB_EMPTY) {
+			char *name;
+
+			pthread_mutex_unlock(&queue.lock);
+			if (!(name = source_next(&src))) {
+				eof = 1;
+			} else if (check) {
+				if (parse_check_line(name, job, &name) != 1) {
+					if (*src.line) {
+						num_bad_lines++;
+					}
+					name = NULL;
+				} else {
+					num_checked++;
+				}
+			} else {
+				job->leaf_size = tree ? leaf_size : 0;
+				if (list && !*name) {
+					name = NULL;
+				}
+			}
+			if (name && !(job->path = strdup(name))) {
+				fprintf(stderr, "%s: malloc failure\n", prog);
+				eof = 1;
+				num_failed++;
+				name = NULL;
+			}
+			pthread_mutex_lock(&queue.lock);
+			if (name) {
+				job->state = JOB_PENDING;
+				queue.tail++;
+				pthread_cond_signal(&queue.work_cond);
+			}
+			continue;
+		}
+
+		if (queue.head == queue.tail && eof) {
+			break;
+		}
+		if (!started && queue.next < queue.tail) {
+			job = &queue.jobs[queue.next++ % queue.num_jobs];
+			pthread_mutex_unlock(&queue.lock);
+			job_run(&queue, job, &buf, &buflen);
+			pthread_mutex_lock(&queue.lock);
+			job->state = JOB_DONE;
+			continue;
+		}
+		pthread_cond_wait(&queue.done_cond, &queue.lock);
 	}
-	sm3_finish(&ctx, dgst);
+	queue.stop = 1;
+	pthread_cond_broadcast(&queue.work_cond);
+	pthread_mutex_unlock(&queue.lock);
 
-	for (i = 0; i < sizeof(dgst); i++) {
-		printf("%02x", dgst[i]);
+	if (num_bad_lines && num_checked) {
+		fprintf(stderr, "%s: WARNING: %zu line%s improperly formatted\n", prog,
+			num_bad_lines, num_bad_lines == 1 ? " is" : "s are");
+	}
+	if (num_unread) {
+		fprintf(stderr, "%s: WARNING: %zu listed file%s could not be read\n", prog,
+			num_unread, num_unread == 1 ? "" : "s");
+	}
+	if (check && num_failed) {
+		fprintf(stderr, "%s: WARNING: %zu computed checksum%s did NOT match\n", prog,
+			num_failed, num_failed == 1 ? "" : "s");
+	}
+	ret = (num_failed || num_unread || src.num_unopened) ? 1 : 0;
+	if (check && !num_checked && !src.num_unopened) {
+		fprintf(stderr, "%s: no properly formatted checksum lines found\n", prog);
+		ret = 1;
+	}
+	goto end;
+
+bad:
+	fprintf(stderr, "%s: illegal option '%s'\n", prog, *argv);
+	print_usage(stderr);
+	return 1;
+end:
+	for (i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	if (queue.jobs && workers) {
+		pthread_cond_destroy(&queue.work_cond);
+		pthread_cond_destroy(&queue.done_cond);
+		pthread_mutex_destroy(&queue.lock);
+	}
+	if (queue.jobs) {
+		size_t j;
+		for (j = 0; j < queue.num_jobs; j++) {
+			free(queue.jobs[j].path);
+		}
+		free(queue.jobs);
 	}
-	printf("\n");
-	return 0;
+	free(workers);
+	free(src.line);
+	free(buf);
+	return ret;
 }
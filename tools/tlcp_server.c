@@ -48,7 +48,6 @@ int main(int argc , char *argv[])
 	SM2_KEY signkey;
 	SM2_KEY enckey;
 
-	uint8_t verify_buf[4096];
 
 
 	TLS_CONNECT conn;
@@ -122,7 +121,7 @@ int main(int argc , char *argv[])
 
 	memset(&conn, 0, sizeof(conn));
 	if (tlcp_accept(&conn, port, certfp, &signkey, &enckey,
-		certfp, verify_buf, 4096) != 1) {
+		certfp) != 1) {
 		error_print();
 		return -1;
 	}
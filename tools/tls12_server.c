@@ -42,7 +42,6 @@ int main(int argc , char *argv[])
 	FILE *signkeyfp = NULL;
 	SM2_KEY signkey;
 
-	uint8_t verify_buf[4096];
 
 
 	TLS_CONNECT conn;
@@ -103,7 +102,7 @@ int main(int argc , char *argv[])
 
 	memset(&conn, 0, sizeof(conn));
 	if (tls12_accept(&conn, port, certfp, &signkey,
-		certfp, verify_buf, 4096) != 1) {
+		certfp) != 1) {
 		error_print();
 		return -1;
 	}